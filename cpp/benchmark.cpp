@@ -0,0 +1,325 @@
+#include "core/global.h"
+#include "core/config_parser.h"
+#include "core/timer.h"
+#include "dataio/sgf.h"
+#include "search/asyncbot.h"
+#include "program/setup.h"
+#include "main.h"
+
+using namespace std;
+
+#define TCLAP_NAMESTARTSTRING "-" //Use single dashes for all flags
+#include <tclap/CmdLine.h>
+
+namespace {
+  struct BenchmarkPosition {
+    Board board;
+    BoardHistory hist;
+    Player pla;
+  };
+
+  struct BenchmarkResult {
+    int nnCacheSizePowerOfTwo;
+    int nnMaxBatchSize;
+    int numNNServerThreadsPerModel;
+    int numSearchThreads;
+    double visitsPerSecond;
+    double rowsPerSecond;
+    double avgBatchSize;
+    double p50MoveSeconds;
+    double p99MoveSeconds;
+  };
+}
+
+static vector<int> parseIntList(const string& s, const string& argName, int min, int max) {
+  vector<int> ret;
+  vector<string> pieces = Global::split(s,',');
+  for(size_t i = 0; i<pieces.size(); i++) {
+    string piece = Global::trim(pieces[i]);
+    if(piece.size() <= 0)
+      continue;
+    int x;
+    if(!Global::tryStringToInt(piece,x) || x < min || x > max)
+      throw StringError("Invalid value for " + argName + ": " + piece);
+    ret.push_back(x);
+  }
+  if(ret.size() <= 0)
+    throw StringError("No values for " + argName);
+  return ret;
+}
+
+static double percentile(vector<double> xs, double p) {
+  assert(xs.size() > 0);
+  std::sort(xs.begin(), xs.end());
+  size_t idx = (size_t)std::ceil(p * xs.size());
+  if(idx > 0)
+    idx -= 1;
+  return xs[std::min(idx, xs.size()-1)];
+}
+
+int MainCmds::benchmark(int argc, const char* const* argv) {
+  Board::initHash();
+  ScoreValue::initTables();
+  Rand seedRand;
+
+  string configFile;
+  string modelFile;
+  vector<string> sgfFiles;
+  string logFile;
+  int positionsPerSgf;
+  int64_t maxVisits;
+  string searchThreadsStr;
+  string batchSizesStr;
+  string serverThreadsStr;
+  string cacheSizesStr;
+  double maxP99MoveSeconds;
+  try {
+    TCLAP::CmdLine cmd(
+      "Time searches over a grid of numSearchThreads, nnMaxBatchSize, numNNServerThreadsPerModel and nnCacheSizePowerOfTwo, "
+      "to find good values for them on this machine", ' ', Version::getKataGoVersionForHelp(),true
+    );
+    TCLAP::ValueArg<string> configFileArg("","config","Config file to use (see configs/gtp_example.cfg)",true,string(),"FILE");
+    TCLAP::ValueArg<string> modelFileArg("","model","Neural net model file to use, not needed if the config uses nnSyntheticNumDevices, nnReplayFile or nnServerSocket",false,string(),"FILE");
+    TCLAP::MultiArg<string> sgfFileArg("","sgf","Sgf file to take positions from, can be given multiple times",true,"FILE");
+    TCLAP::ValueArg<string> logFileArg("","log-file","Log file to output to",false,string(),"FILE");
+    TCLAP::ValueArg<int> positionsPerSgfArg("","positions-per-sgf","Number of positions spread through each sgf to search (default 5)",false,5,"N");
+    TCLAP::ValueArg<int64_t> visitsArg("v","visits","Visits to search each position for (default 800)",false,800,"VISITS");
+    TCLAP::ValueArg<string> searchThreadsArg("t","threads","Comma-separated numSearchThreads to try (default 1,2,4,8,16,32)",false,"1,2,4,8,16,32","N,N,...");
+    TCLAP::ValueArg<string> batchSizesArg("","batch-sizes","Comma-separated nnMaxBatchSize to try (default as in the config)",false,string(),"N,N,...");
+    TCLAP::ValueArg<string> serverThreadsArg("","server-threads","Comma-separated numNNServerThreadsPerModel to try (default as in the config)",false,string(),"N,N,...");
+    TCLAP::ValueArg<string> cacheSizesArg("","cache-sizes","Comma-separated nnCacheSizePowerOfTwo to try (default as in the config)",false,string(),"N,N,...");
+    TCLAP::ValueArg<double> maxP99Arg("","max-p99-move-seconds","Only recommend settings whose p99 time per move is at most this",false,-1.0,"SECONDS");
+    cmd.add(configFileArg);
+    cmd.add(modelFileArg);
+    cmd.add(sgfFileArg);
+    cmd.add(logFileArg);
+    cmd.add(positionsPerSgfArg);
+    cmd.add(visitsArg);
+    cmd.add(searchThreadsArg);
+    cmd.add(batchSizesArg);
+    cmd.add(serverThreadsArg);
+    cmd.add(cacheSizesArg);
+    cmd.add(maxP99Arg);
+    cmd.parse(argc,argv);
+    configFile = configFileArg.getValue();
+    modelFile = modelFileArg.getValue();
+    sgfFiles = sgfFileArg.getValue();
+    logFile = logFileArg.getValue();
+    positionsPerSgf = positionsPerSgfArg.getValue();
+    maxVisits = visitsArg.getValue();
+    searchThreadsStr = searchThreadsArg.getValue();
+    batchSizesStr = batchSizesArg.getValue();
+    serverThreadsStr = serverThreadsArg.getValue();
+    cacheSizesStr = cacheSizesArg.getValue();
+    maxP99MoveSeconds = maxP99Arg.getValue();
+
+    if(positionsPerSgf <= 0) {
+      cerr << "Error: -positions-per-sgf must be positive" << endl;
+      return 1;
+    }
+    if(maxVisits <= 0) {
+      cerr << "Error: -visits must be positive" << endl;
+      return 1;
+    }
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+
+  ConfigParser cfg(configFile);
+  if(modelFile == string() && !cfg.contains("nnSyntheticNumDevices") && !cfg.contains("nnReplayFile") && !cfg.contains("nnServerSocket"))
+    throw StringError("-model is needed unless the config sets nnSyntheticNumDevices, nnReplayFile or nnServerSocket");
+
+  vector<int> searchThreadss = parseIntList(searchThreadsStr, "-threads", 1, 1024);
+  vector<int> batchSizes = parseIntList(batchSizesStr.size() > 0 ? batchSizesStr : cfg.getString("nnMaxBatchSize"), "nnMaxBatchSize", 1, 65536);
+  vector<int> serverThreadss = parseIntList(serverThreadsStr.size() > 0 ? serverThreadsStr : cfg.getString("numNNServerThreadsPerModel"), "numNNServerThreadsPerModel", 1, 1024);
+  vector<int> cacheSizes = parseIntList(cacheSizesStr.size() > 0 ? cacheSizesStr : cfg.getString("nnCacheSizePowerOfTwo"), "nnCacheSizePowerOfTwo", -1, 48);
+  int maxSearchThreads = *std::max_element(searchThreadss.begin(), searchThreadss.end());
+
+  Logger logger;
+  if(logFile != string())
+    logger.addFile(logFile);
+  logger.setLogToStdout(false);
+  logger.write("Benchmark starting...");
+  logger.write(string("Git revision: ") + Version::getGitRevision());
+
+  SearchParams params;
+  {
+    vector<SearchParams> paramss = Setup::loadParams(cfg);
+    if(paramss.size() != 1)
+      throw StringError("Can only specify exactly one bot for benchmarking");
+    params = paramss[0];
+  }
+  params.maxVisits = maxVisits;
+  params.maxPlayouts = maxVisits;
+  params.maxTime = 1e20;
+
+  string searchRandSeed;
+  if(cfg.contains("searchRandSeed"))
+    searchRandSeed = cfg.getString("searchRandSeed");
+  else
+    searchRandSeed = Global::uint64ToString(seedRand.nextUInt64());
+
+  //Load positions------------------------------------------------------------
+
+  Rules defaultRules = Rules::getTrompTaylorish();
+  vector<BenchmarkPosition> positions;
+  int maxXSize = 0;
+  int maxYSize = 0;
+  for(size_t i = 0; i<sgfFiles.size(); i++) {
+    CompactSgf* sgf = CompactSgf::loadFile(sgfFiles[i]);
+    Rules rules = sgf->getRulesFromSgf(defaultRules);
+    int numMoves = (int)sgf->moves.size();
+    //Spread positions evenly through the game, skipping the very start, where the cache makes searches unrealistically fast
+    for(int j = 0; j<positionsPerSgf; j++) {
+      int turnNumber = (int)((int64_t)numMoves * (j+1) / (positionsPerSgf+1));
+      BenchmarkPosition position;
+      sgf->setupBoardAndHist(rules, position.board, position.pla, position.hist, turnNumber);
+      maxXSize = std::max(maxXSize, position.board.x_size);
+      maxYSize = std::max(maxYSize, position.board.y_size);
+      positions.push_back(position);
+    }
+    delete sgf;
+  }
+  logger.write("Loaded " + Global::uint64ToString(positions.size()) + " positions from " + Global::uint64ToString(sgfFiles.size()) + " sgfs");
+
+  Setup::initializeSession(cfg);
+
+  //Run the grid------------------------------------------------------------
+
+  cout << "Searching " << positions.size() << " positions for " << maxVisits << " visits each, with each of "
+       << (cacheSizes.size() * batchSizes.size() * serverThreadss.size() * searchThreadss.size()) << " settings" << endl;
+  cout << endl;
+  cout << "cacheSize batchSize serverThreads searchThreads   visits/s     rows/s  avgBatch  p50move(s)  p99move(s)" << endl;
+
+  vector<BenchmarkResult> results;
+  bool warnedUnusedKeys = false;
+  for(int cacheSize: cacheSizes) {
+    for(int batchSize: batchSizes) {
+      for(int serverThreads: serverThreadss) {
+        cfg.overrideKey("nnCacheSizePowerOfTwo", Global::intToString(cacheSize));
+        cfg.overrideKey("nnMaxBatchSize", Global::intToString(batchSize));
+        cfg.overrideKey("numNNServerThreadsPerModel", Global::intToString(serverThreads));
+
+        NNEvaluator* nnEval;
+        {
+          int maxConcurrentEvals = maxSearchThreads * 2 + 16; // * 2 + 16 just to give plenty of headroom
+          vector<NNEvaluator*> nnEvals =
+            Setup::initializeNNEvaluators(
+              {modelFile},{modelFile},cfg,logger,seedRand,maxConcurrentEvals,
+              false,false,maxXSize,maxYSize,-1
+            );
+          assert(nnEvals.size() == 1);
+          nnEval = nnEvals[0];
+        }
+        if(!warnedUnusedKeys) {
+          cfg.warnUnusedKeys(cerr,&logger);
+          warnedUnusedKeys = true;
+        }
+
+        for(int searchThreads: searchThreadss) {
+          SearchParams threadParams = params;
+          threadParams.numThreads = searchThreads;
+          AsyncBot* bot = new AsyncBot(threadParams, nnEval, &logger, searchRandSeed);
+
+          //Warm up, so that the first timed search doesn't pay for lazy initialization in the backend
+          nnEval->clearCache();
+          bot->setPosition(positions[0].pla,positions[0].board,positions[0].hist);
+          bot->genMoveSynchronous(positions[0].pla,TimeControls());
+
+          //Start each run cold, so that runs are comparable regardless of the order they're in
+          nnEval->clearCache();
+          nnEval->clearStats();
+          vector<double> moveSeconds;
+          int64_t totalVisits = 0;
+          double totalSeconds = 0.0;
+          for(size_t i = 0; i<positions.size(); i++) {
+            const BenchmarkPosition& position = positions[i];
+            bot->setPosition(position.pla,position.board,position.hist);
+            ClockTimer timer;
+            bot->genMoveSynchronous(position.pla,TimeControls());
+            double seconds = timer.getSeconds();
+            moveSeconds.push_back(seconds);
+            totalSeconds += seconds;
+            totalVisits += bot->getSearch()->numRootVisits();
+          }
+
+          BenchmarkResult result;
+          result.nnCacheSizePowerOfTwo = cacheSize;
+          result.nnMaxBatchSize = batchSize;
+          result.numNNServerThreadsPerModel = serverThreads;
+          result.numSearchThreads = searchThreads;
+          result.visitsPerSecond = totalVisits / std::max(totalSeconds, 1e-9);
+          result.rowsPerSecond = nnEval->numRowsProcessed() / std::max(totalSeconds, 1e-9);
+          result.avgBatchSize = nnEval->averageProcessedBatchSize();
+          result.p50MoveSeconds = percentile(moveSeconds, 0.50);
+          result.p99MoveSeconds = percentile(moveSeconds, 0.99);
+          results.push_back(result);
+
+          cout << Global::strprintf(
+            "%9d %9d %13d %13d %10.1f %10.1f %9.2f %11.3f %11.3f",
+            cacheSize, batchSize, serverThreads, searchThreads,
+            result.visitsPerSecond, result.rowsPerSecond, result.avgBatchSize, result.p50MoveSeconds, result.p99MoveSeconds
+          ) << endl;
+          logger.write(
+            "cacheSize " + Global::intToString(cacheSize) + " batchSize " + Global::intToString(batchSize) +
+            " serverThreads " + Global::intToString(serverThreads) + " searchThreads " + Global::intToString(searchThreads) +
+            " visits/s " + Global::doubleToString(result.visitsPerSecond) + " rows/s " + Global::doubleToString(result.rowsPerSecond) +
+            " avgBatch " + Global::doubleToString(result.avgBatchSize) + " p50 " + Global::doubleToString(result.p50MoveSeconds) +
+            " p99 " + Global::doubleToString(result.p99MoveSeconds)
+          );
+          delete bot;
+        }
+        delete nnEval;
+      }
+    }
+  }
+
+  //Recommend------------------------------------------------------------
+
+  //Each extra search thread makes search a little worse per visit, since threads can't see each others' results until
+  //they're in, so among settings within 5% of the fastest, prefer the fewest search threads, then the least memory.
+  double bestVisitsPerSecond = 0.0;
+  for(const BenchmarkResult& result: results) {
+    if(maxP99MoveSeconds > 0 && result.p99MoveSeconds > maxP99MoveSeconds)
+      continue;
+    bestVisitsPerSecond = std::max(bestVisitsPerSecond, result.visitsPerSecond);
+  }
+  const BenchmarkResult* recommended = NULL;
+  for(const BenchmarkResult& result: results) {
+    if(maxP99MoveSeconds > 0 && result.p99MoveSeconds > maxP99MoveSeconds)
+      continue;
+    if(result.visitsPerSecond < 0.95 * bestVisitsPerSecond)
+      continue;
+    if(recommended == NULL ||
+       result.numSearchThreads < recommended->numSearchThreads ||
+       (result.numSearchThreads == recommended->numSearchThreads &&
+        std::make_tuple(result.nnCacheSizePowerOfTwo, result.numNNServerThreadsPerModel, result.nnMaxBatchSize) <
+        std::make_tuple(recommended->nnCacheSizePowerOfTwo, recommended->numNNServerThreadsPerModel, recommended->nnMaxBatchSize)))
+      recommended = &result;
+  }
+
+  cout << endl;
+  if(recommended == NULL) {
+    cout << "No settings had a p99 time per move of at most " << maxP99MoveSeconds << " seconds" << endl;
+  }
+  else {
+    cout << "Recommended for this machine, " << Global::strprintf("%.1f", recommended->visitsPerSecond)
+         << " visits/s, the fastest being " << Global::strprintf("%.1f", bestVisitsPerSecond) << ":" << endl;
+    cout << "numSearchThreads = " << recommended->numSearchThreads << endl;
+    cout << "nnMaxBatchSize = " << recommended->nnMaxBatchSize << endl;
+    cout << "numNNServerThreadsPerModel = " << recommended->numNNServerThreadsPerModel << endl;
+    cout << "nnCacheSizePowerOfTwo = " << recommended->nnCacheSizePowerOfTwo << endl;
+    logger.write(
+      "Recommended numSearchThreads " + Global::intToString(recommended->numSearchThreads) +
+      " nnMaxBatchSize " + Global::intToString(recommended->nnMaxBatchSize) +
+      " numNNServerThreadsPerModel " + Global::intToString(recommended->numNNServerThreadsPerModel) +
+      " nnCacheSizePowerOfTwo " + Global::intToString(recommended->nnCacheSizePowerOfTwo)
+    );
+  }
+
+  NeuralNet::globalCleanup();
+  ScoreValue::freeTables();
+  return 0;
+}
@@ -0,0 +1,283 @@
+#include "../core/blockpool.h"
+
+#include "../core/test.h"
+
+using namespace std;
+
+//Pools that currently exist by id, so that threads exiting only return blocks to pools that are still alive.
+//Each pool also gets a serial number that is never reused, since ids and even addresses of pools are.
+static std::mutex livePoolsMutex;
+static BlockPool* livePools[BlockPool::MAX_NUM_POOLS];
+static std::atomic<uint64_t> nextPoolSerial(1);
+
+namespace {
+  //Free blocks that one thread holds onto for each pool, returned to the pools when the thread exits
+  struct ThreadCache {
+    //Serial of the pool that each entry belongs to, or 0 if none
+    uint64_t serials[BlockPool::MAX_NUM_POOLS];
+    void* heads[BlockPool::MAX_NUM_POOLS];
+    size_t counts[BlockPool::MAX_NUM_POOLS];
+    uint64_t numAllocs[BlockPool::MAX_NUM_POOLS];
+
+    ThreadCache() {
+      for(int i = 0; i<BlockPool::MAX_NUM_POOLS; i++)
+        reset(i,0);
+    }
+    ~ThreadCache() {
+      std::lock_guard<std::mutex> lock(livePoolsMutex);
+      for(int i = 0; i<BlockPool::MAX_NUM_POOLS; i++) {
+        if(serials[i] != 0 && livePools[i] != NULL && livePools[i]->getSerial() == serials[i])
+          livePools[i]->returnChain(heads[i], counts[i], numAllocs[i]);
+      }
+    }
+    ThreadCache(const ThreadCache&) = delete;
+    ThreadCache& operator=(const ThreadCache&) = delete;
+
+    //Anything cached for an older pool with the same id points into memory that pool already freed, so is dropped
+    void reset(int poolId, uint64_t serial) {
+      serials[poolId] = serial;
+      heads[poolId] = NULL;
+      counts[poolId] = 0;
+      numAllocs[poolId] = 0;
+    }
+  };
+}
+
+static thread_local ThreadCache threadCache;
+
+static int acquirePoolId(BlockPool* pool) {
+  std::lock_guard<std::mutex> lock(livePoolsMutex);
+  for(int i = 0; i<BlockPool::MAX_NUM_POOLS; i++) {
+    if(livePools[i] == NULL) {
+      livePools[i] = pool;
+      return i;
+    }
+  }
+  throw StringError("BlockPool: too many pools exist, at most " + Global::intToString(BlockPool::MAX_NUM_POOLS) + " are supported");
+}
+
+static inline void*& nextOf(void* block) {
+  return *static_cast<void**>(block);
+}
+
+BlockPool::BlockPool(size_t bBytes, size_t bPerBatch, size_t bPerSlab)
+  :blockBytes((std::max(bBytes,sizeof(void*)) + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT),
+   blocksPerBatch(bPerBatch),
+   batchesPerSlab(bPerSlab),
+   serial(nextPoolSerial.fetch_add(1)),
+   poolId(-1),
+   mutex(),
+   freeChains(),
+   slabs(),
+   numAllocs(0),
+   numSlabAllocs(0)
+{
+  if(blocksPerBatch <= 0 || batchesPerSlab <= 0)
+    throw StringError("BlockPool: blocksPerBatch and batchesPerSlab must be positive");
+  poolId = acquirePoolId(this);
+}
+
+BlockPool::~BlockPool() {
+  {
+    std::lock_guard<std::mutex> lock(livePoolsMutex);
+    livePools[poolId] = NULL;
+  }
+  for(size_t i = 0; i<slabs.size(); i++)
+    ::operator delete(slabs[i]);
+}
+
+size_t BlockPool::getBlockBytes() const {
+  return blockBytes;
+}
+uint64_t BlockPool::getSerial() const {
+  return serial;
+}
+
+void* BlockPool::alloc() {
+  ThreadCache& cache = threadCache;
+  if(cache.serials[poolId] != serial)
+    cache.reset(poolId,serial);
+  void*& head = cache.heads[poolId];
+  if(head == NULL) {
+    numAllocs.fetch_add(cache.numAllocs[poolId], std::memory_order_relaxed);
+    cache.numAllocs[poolId] = 0;
+    head = takeChain(cache.counts[poolId]);
+  }
+  void* block = head;
+  head = nextOf(block);
+  cache.counts[poolId] -= 1;
+  cache.numAllocs[poolId] += 1;
+  return block;
+}
+
+void BlockPool::free(void* block) {
+  if(block == NULL)
+    return;
+  ThreadCache& cache = threadCache;
+  if(cache.serials[poolId] != serial)
+    cache.reset(poolId,serial);
+  void*& head = cache.heads[poolId];
+  size_t& count = cache.counts[poolId];
+  nextOf(block) = head;
+  head = block;
+  count += 1;
+
+  //Threads that free more than they allocate, such as search threads freeing what server threads allocated,
+  //hand a batch back once they have two batches' worth, keeping one so that alternating allocs and frees
+  //don't bounce batches back and forth.
+  if(count >= 2 * blocksPerBatch) {
+    void* chainHead = head;
+    void* last = head;
+    for(size_t i = 1; i<blocksPerBatch; i++)
+      last = nextOf(last);
+    head = nextOf(last);
+    nextOf(last) = NULL;
+    count -= blocksPerBatch;
+    std::lock_guard<std::mutex> lock(mutex);
+    freeChains.push_back(std::make_pair(chainHead,blocksPerBatch));
+  }
+}
+
+void BlockPool::returnChain(void* head, size_t count, uint64_t threadNumAllocs) {
+  numAllocs.fetch_add(threadNumAllocs, std::memory_order_relaxed);
+  if(head == NULL)
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  freeChains.push_back(std::make_pair(head,count));
+}
+
+void* BlockPool::takeChain(size_t& count) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if(freeChains.size() <= 0) {
+    size_t numBlocks = blocksPerBatch * batchesPerSlab;
+    char* slab = static_cast<char*>(::operator new(numBlocks * blockBytes));
+    slabs.push_back(slab);
+    numSlabAllocs.fetch_add(1, std::memory_order_relaxed);
+    for(size_t b = 0; b<batchesPerSlab; b++) {
+      char* batchStart = slab + b * blocksPerBatch * blockBytes;
+      for(size_t i = 0; i<blocksPerBatch; i++)
+        nextOf(batchStart + i * blockBytes) = (i+1 < blocksPerBatch) ? batchStart + (i+1) * blockBytes : NULL;
+      freeChains.push_back(std::make_pair(static_cast<void*>(batchStart),blocksPerBatch));
+    }
+  }
+  std::pair<void*,size_t> chain = freeChains.back();
+  freeChains.pop_back();
+  count = chain.second;
+  return chain.first;
+}
+
+uint64_t BlockPool::getNumAllocs() const {
+  return numAllocs.load(std::memory_order_relaxed);
+}
+uint64_t BlockPool::getNumSlabAllocs() const {
+  return numSlabAllocs.load(std::memory_order_relaxed);
+}
+uint64_t BlockPool::getNumBytesReserved() const {
+  return getNumSlabAllocs() * blocksPerBatch * batchesPerSlab * blockBytes;
+}
+
+void BlockPool::runTests() {
+  cout << "Running block pool tests" << endl;
+
+  {
+    BlockPool pool(20, 4, 2);
+    testAssert(pool.getBlockBytes() == 32);
+    vector<void*> blocks;
+    for(int i = 0; i<20; i++) {
+      void* block = pool.alloc();
+      testAssert((size_t)block % BLOCK_ALIGNMENT == 0);
+      std::fill((char*)block, (char*)block + pool.getBlockBytes(), (char)i);
+      blocks.push_back(block);
+    }
+    for(int i = 0; i<20; i++) {
+      testAssert(((char*)blocks[i])[0] == (char)i && ((char*)blocks[i])[31] == (char)i);
+      for(int j = 0; j<i; j++)
+        testAssert(blocks[i] != blocks[j]);
+    }
+    //20 blocks at 8 per slab
+    testAssert(pool.getNumSlabAllocs() == 3);
+    for(int i = 0; i<20; i++)
+      pool.free(blocks[i]);
+    //Everything freed is reused before the pool asks for more memory
+    for(int i = 0; i<20; i++)
+      blocks[i] = pool.alloc();
+    testAssert(pool.getNumSlabAllocs() == 3);
+    for(int i = 0; i<20; i++)
+      pool.free(blocks[i]);
+  }
+
+  //Blocks allocated by some threads and freed by others, which must make their way back to be reused
+  {
+    BlockPool pool(sizeof(int64_t) * 4, 16, 4);
+    const int numThreads = 4;
+    const int numRounds = 200;
+    const int numPerRound = 50;
+    vector<vector<int64_t*>> handoffs(numThreads);
+    vector<std::mutex> handoffMutexes(numThreads);
+    vector<std::thread> threads;
+    for(int t = 0; t<numThreads; t++) {
+      threads.push_back(std::thread([&,t]() {
+        for(int round = 0; round<numRounds; round++) {
+          vector<int64_t*> mine;
+          for(int i = 0; i<numPerRound; i++) {
+            int64_t* block = (int64_t*)pool.alloc();
+            block[0] = t;
+            block[3] = round;
+            mine.push_back(block);
+          }
+          {
+            std::lock_guard<std::mutex> lock(handoffMutexes[(t+1) % numThreads]);
+            for(size_t i = 0; i<mine.size(); i++)
+              handoffs[(t+1) % numThreads].push_back(mine[i]);
+          }
+          vector<int64_t*> theirs;
+          {
+            std::lock_guard<std::mutex> lock(handoffMutexes[t]);
+            theirs.swap(handoffs[t]);
+          }
+          for(size_t i = 0; i<theirs.size(); i++) {
+            testAssert(theirs[i][0] == (t + numThreads - 1) % numThreads);
+            pool.free(theirs[i]);
+          }
+        }
+      }));
+    }
+    for(int t = 0; t<numThreads; t++)
+      threads[t].join();
+    for(int t = 0; t<numThreads; t++)
+      for(size_t i = 0; i<handoffs[t].size(); i++)
+        pool.free(handoffs[t][i]);
+    testAssert(pool.getNumAllocs() == (uint64_t)numThreads * numRounds * numPerRound);
+    //Blocks cached by the threads went back to the pool when they exited, so are there to be reused
+    uint64_t numSlabAllocs = pool.getNumSlabAllocs();
+    vector<void*> blocks;
+    for(int i = 0; i<numPerRound; i++)
+      blocks.push_back(pool.alloc());
+    for(int i = 0; i<numPerRound; i++)
+      pool.free(blocks[i]);
+    testAssert(pool.getNumSlabAllocs() == numSlabAllocs);
+  }
+
+  {
+    BlockPool pool(sizeof(vector<int>) + 64, 8, 2);
+    std::shared_ptr<vector<int>> p = std::allocate_shared<vector<int>>(BlockPoolAllocator<vector<int>>(&pool), 5, 7);
+    testAssert(p->size() == 5 && (*p)[4] == 7);
+    std::shared_ptr<vector<int>> q = p;
+    p = nullptr;
+    testAssert(q->size() == 5);
+    q = nullptr;
+    testAssert(pool.getNumSlabAllocs() == 1);
+  }
+
+  //Pools come and go, reusing ids, while this thread still has blocks of earlier ones cached
+  {
+    for(int i = 0; i<3 * MAX_NUM_POOLS; i++) {
+      BlockPool pool(64, 4, 1);
+      void* block = pool.alloc();
+      testAssert(pool.getNumSlabAllocs() == 1);
+      pool.free(block);
+      testAssert(pool.alloc() == block);
+      pool.free(block);
+    }
+  }
+}
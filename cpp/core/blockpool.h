@@ -0,0 +1,94 @@
+#ifndef CORE_BLOCKPOOL_H_
+#define CORE_BLOCKPOOL_H_
+
+#include "../core/global.h"
+#include "../core/multithread.h"
+
+//Allocator for blocks of one fixed size, for objects allocated and freed at high rates by many threads.
+//Each thread keeps its own list of free blocks, and only moves them to or from a shared list under a lock
+//in batches, so that most allocs and frees touch nothing shared. Blocks are carved out of large slabs, which
+//are held onto until the pool is destroyed, so the pool's memory is its peak usage plus what threads cache.
+//
+//All blocks must be freed before the pool is destroyed, so a pool whose blocks may still be in use at exit should be
+//allocated and never freed rather than be a static. Any thread may free a block allocated by another.
+class BlockPool {
+ public:
+  static const size_t BLOCK_ALIGNMENT = 16;
+  //Pools are numbered so threads can find their cached blocks for each, at most this many can exist at once
+  static const int MAX_NUM_POOLS = 16;
+
+  BlockPool(size_t blockBytes, size_t blocksPerBatch, size_t batchesPerSlab);
+  ~BlockPool();
+
+  BlockPool(const BlockPool&) = delete;
+  BlockPool& operator=(const BlockPool&) = delete;
+
+  size_t getBlockBytes() const;
+  //Unique over the life of the process, unlike pool ids and addresses
+  uint64_t getSerial() const;
+
+  void* alloc();
+  void free(void* block);
+
+  //Number of blocks handed out so far. Threads report their counts in batches, so this lags a little.
+  uint64_t getNumAllocs() const;
+  //Number of times the pool itself allocated memory, and how much in total
+  uint64_t getNumSlabAllocs() const;
+  uint64_t getNumBytesReserved() const;
+
+  //For internal use by the thread-local caches
+  void returnChain(void* head, size_t count, uint64_t numAllocs);
+
+  static void runTests();
+
+ private:
+  const size_t blockBytes;
+  const size_t blocksPerBatch;
+  const size_t batchesPerSlab;
+  const uint64_t serial;
+  int poolId;
+
+  std::mutex mutex;
+  //Chains of free blocks linked through their first bytes, with their lengths
+  std::vector<std::pair<void*,size_t>> freeChains;
+  std::vector<void*> slabs;
+
+  std::atomic<uint64_t> numAllocs;
+  std::atomic<uint64_t> numSlabAllocs;
+
+  void* takeChain(size_t& count);
+};
+
+//Standard allocator that serves single objects out of a BlockPool when they fit in its blocks, and
+//anything else from the global allocator. Mainly for std::allocate_shared, which rebinds it to allocate the
+//object and its reference counts together in one block.
+template<typename T>
+struct BlockPoolAllocator {
+  typedef T value_type;
+  BlockPool* pool;
+
+  explicit BlockPoolAllocator(BlockPool* p) : pool(p) {}
+  template<typename U>
+  BlockPoolAllocator(const BlockPoolAllocator<U>& other) : pool(other.pool) {}
+
+  inline bool fitsInBlock(size_t n) const {
+    return n == 1 && sizeof(T) <= pool->getBlockBytes() && alignof(T) <= BlockPool::BLOCK_ALIGNMENT;
+  }
+  inline T* allocate(size_t n) {
+    if(fitsInBlock(n))
+      return static_cast<T*>(pool->alloc());
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+  inline void deallocate(T* p, size_t n) {
+    if(fitsInBlock(n))
+      pool->free(p);
+    else
+      ::operator delete(p);
+  }
+};
+template<typename T, typename U>
+inline bool operator==(const BlockPoolAllocator<T>& a, const BlockPoolAllocator<U>& b) { return a.pool == b.pool; }
+template<typename T, typename U>
+inline bool operator!=(const BlockPoolAllocator<T>& a, const BlockPoolAllocator<U>& b) { return a.pool != b.pool; }
+
+#endif  // CORE_BLOCKPOOL_H_
@@ -74,6 +74,10 @@ bool ConfigParser::contains(const string& key) const {
   return keyValues.find(key) != keyValues.end();
 }
 
+void ConfigParser::overrideKey(const string& key, const string& value) {
+  keyValues[key] = value;
+}
+
 string ConfigParser::getString(const string& key) {
   auto iter = keyValues.find(key);
   if(iter == keyValues.end())
@@ -31,6 +31,9 @@ class ConfigParser {
 
   bool contains(const std::string& key) const;
 
+  //Sets key to value as if it were in the file, replacing any value there
+  void overrideKey(const std::string& key, const std::string& value);
+
   std::string getString(const std::string& key);
   bool getBool(const std::string& key);
   int getInt(const std::string& key);
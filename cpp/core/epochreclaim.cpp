@@ -0,0 +1,190 @@
+#include "../core/epochreclaim.h"
+
+#include "../core/test.h"
+
+using namespace std;
+
+//Every thread that uses any reclaimer gets an index into their slots, recycled when the thread exits.
+//Kept in plain arrays so that they are usable at any point during static initialization or destruction.
+static std::mutex threadIdxMutex;
+static int freeThreadIdxs[EpochReclaimer::MAX_NUM_THREADS];
+static int numFreeThreadIdxs = 0;
+//Every index ever handed out is below this, so reclaimers only need to look at that many slots
+static std::atomic<int> numThreadIdxsUsed(0);
+
+namespace {
+  struct ThreadIdx {
+    int idx;
+    ThreadIdx() {
+      std::lock_guard<std::mutex> lock(threadIdxMutex);
+      if(numFreeThreadIdxs > 0)
+        idx = freeThreadIdxs[--numFreeThreadIdxs];
+      else {
+        idx = numThreadIdxsUsed.load();
+        if(idx >= EpochReclaimer::MAX_NUM_THREADS)
+          throw StringError("EpochReclaimer: more than " + Global::intToString(EpochReclaimer::MAX_NUM_THREADS) + " threads");
+        numThreadIdxsUsed.store(idx+1);
+      }
+    }
+    ~ThreadIdx() {
+      std::lock_guard<std::mutex> lock(threadIdxMutex);
+      freeThreadIdxs[numFreeThreadIdxs++] = idx;
+    }
+    ThreadIdx(const ThreadIdx&) = delete;
+    ThreadIdx& operator=(const ThreadIdx&) = delete;
+  };
+}
+
+static thread_local ThreadIdx threadIdx;
+
+//How many objects to retire between attempts at freeing them
+static const size_t RECLAIM_INTERVAL = 64;
+
+EpochReclaimer::EpochReclaimer()
+  :globalEpoch(1),
+   threadSlots(NULL),
+   retiredMutex(),
+   retired()
+{
+  threadSlots = new ThreadSlot[MAX_NUM_THREADS];
+  for(int i = 0; i<MAX_NUM_THREADS; i++)
+    threadSlots[i].epoch.store(0, std::memory_order_relaxed);
+}
+
+EpochReclaimer::~EpochReclaimer() {
+  for(size_t i = 0; i<retired.size(); i++)
+    retired[i].deleter(retired[i].p);
+  delete[] threadSlots;
+}
+
+EpochReclaimer::Guard::Guard(EpochReclaimer& reclaimer)
+  :slot(reclaimer.threadSlots[threadIdx.idx].epoch)
+{
+  //Announce the epoch, and make sure it's still current afterward. Otherwise a writer may have already checked
+  //our slot and advanced past it, and could free things we're about to read.
+  uint64_t epoch = reclaimer.globalEpoch.load();
+  while(true) {
+    slot.store(epoch);
+    uint64_t newEpoch = reclaimer.globalEpoch.load();
+    if(newEpoch == epoch)
+      break;
+    epoch = newEpoch;
+  }
+}
+EpochReclaimer::Guard::~Guard() {
+  slot.store(0, std::memory_order_release);
+}
+
+bool EpochReclaimer::tryAdvanceUnsynchronized() {
+  uint64_t epoch = globalEpoch.load();
+  int numSlots = numThreadIdxsUsed.load();
+  for(int i = 0; i<numSlots; i++) {
+    uint64_t slotEpoch = threadSlots[i].epoch.load();
+    if(slotEpoch != 0 && slotEpoch != epoch)
+      return false;
+  }
+  globalEpoch.store(epoch+1);
+  return true;
+}
+
+void EpochReclaimer::retire(void* p, void (*deleter)(void*)) {
+  vector<Retired> toFree;
+  {
+    std::lock_guard<std::mutex> lock(retiredMutex);
+    Retired r;
+    r.p = p;
+    r.deleter = deleter;
+    r.epoch = globalEpoch.load();
+    retired.push_back(r);
+    if(retired.size() % RECLAIM_INTERVAL != 0)
+      return;
+
+    //Anything retired two epochs ago can no longer be held by any reader, since every reader that was in a Guard
+    //back then had to leave it for the epoch to advance twice.
+    tryAdvanceUnsynchronized();
+    uint64_t safeEpoch = globalEpoch.load();
+    size_t numSafe = 0;
+    while(numSafe < retired.size() && retired[numSafe].epoch + 2 <= safeEpoch)
+      numSafe++;
+    toFree.assign(retired.begin(), retired.begin() + numSafe);
+    retired.erase(retired.begin(), retired.begin() + numSafe);
+  }
+  //Free outside of the lock
+  for(size_t i = 0; i<toFree.size(); i++)
+    toFree[i].deleter(toFree[i].p);
+}
+
+size_t EpochReclaimer::getNumPending() {
+  std::lock_guard<std::mutex> lock(retiredMutex);
+  return retired.size();
+}
+
+void EpochReclaimer::runTests() {
+  cout << "Running epoch reclaimer tests" << endl;
+
+  struct Canary {
+    std::atomic<int64_t> value;
+  };
+  static std::atomic<int64_t> numFreed;
+  numFreed.store(0);
+  auto freeCanary = [](void* p) {
+    Canary* c = static_cast<Canary*>(p);
+    //Poison it first so that readers who could still see it would notice
+    c->value.store(-1);
+    delete c;
+    numFreed.fetch_add(1);
+  };
+
+  {
+    EpochReclaimer reclaimer;
+    const int numSlots = 4;
+    std::atomic<Canary*> slots[numSlots];
+    for(int i = 0; i<numSlots; i++)
+      slots[i].store(new Canary{{0}});
+
+    std::atomic<bool> stop(false);
+    std::atomic<int64_t> numReads(0);
+    vector<std::thread> readers;
+    for(int t = 0; t<3; t++) {
+      readers.push_back(std::thread([&,t]() {
+        int64_t n = 0;
+        while(!stop.load()) {
+          EpochReclaimer::Guard guard(reclaimer);
+          Canary* c = slots[(n + t) % numSlots].load(std::memory_order_acquire);
+          int64_t v0 = c->value.load();
+          std::this_thread::yield();
+          int64_t v1 = c->value.load();
+          testAssert(v0 >= 0 && v1 == v0);
+          n++;
+        }
+        numReads.fetch_add(n);
+      }));
+    }
+
+    const int64_t numWrites = 20000;
+    for(int64_t i = 1; i<=numWrites; i++) {
+      Canary* c = new Canary{{i}};
+      Canary* old = slots[i % numSlots].exchange(c, std::memory_order_acq_rel);
+      reclaimer.retire(old, freeCanary);
+      if(i % 1000 == 0)
+        std::this_thread::yield();
+    }
+    stop.store(true);
+    for(size_t t = 0; t<readers.size(); t++)
+      readers[t].join();
+    testAssert(numReads.load() > 0);
+
+    //Once readers are out, further retires free everything from before
+    for(int64_t i = 0; i<(int64_t)RECLAIM_INTERVAL * 3; i++) {
+      Canary* old = slots[0].exchange(new Canary{{i}});
+      reclaimer.retire(old, freeCanary);
+    }
+    testAssert(reclaimer.getNumPending() < RECLAIM_INTERVAL * 3);
+    testAssert(numFreed.load() > numWrites - (int64_t)RECLAIM_INTERVAL * 3);
+
+    for(int i = 0; i<numSlots; i++)
+      reclaimer.retire(slots[i].load(), freeCanary);
+  }
+  //The destructor frees whatever was left
+  testAssert(numFreed.load() == 20000 + (int64_t)RECLAIM_INTERVAL * 3 + 4);
+}
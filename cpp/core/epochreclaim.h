@@ -0,0 +1,69 @@
+#ifndef CORE_EPOCHRECLAIM_H_
+#define CORE_EPOCHRECLAIM_H_
+
+#include "../core/global.h"
+#include "../core/multithread.h"
+
+//Epoch-based reclamation, for data structures whose readers follow pointers without taking any lock.
+//
+//Readers wrap each access in a Guard. Writers that unlink an object from the structure hand it to retire instead
+//of freeing it, and it is only freed once every reader that was inside a Guard at the time has left it. Readers
+//only ever write to their own thread's slot, so they don't contend with each other or with writers.
+//
+//Guards for the same reclaimer must not be nested within one thread.
+class EpochReclaimer {
+ public:
+  //At most this many threads can use reclaimers at once, across the whole process
+  static const int MAX_NUM_THREADS = 8192;
+
+  EpochReclaimer();
+  //Frees everything still retired. No thread may be inside a Guard.
+  ~EpochReclaimer();
+
+  EpochReclaimer(const EpochReclaimer&) = delete;
+  EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+  class Guard {
+    std::atomic<uint64_t>& slot;
+   public:
+    explicit Guard(EpochReclaimer& reclaimer);
+    ~Guard();
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+  };
+
+  //Free p with deleter once no reader can still be using it. Thread-safe.
+  void retire(void* p, void (*deleter)(void*));
+  template<typename T>
+  void retireObject(T* p) {
+    retire(p, [](void* q) { delete static_cast<T*>(q); });
+  }
+
+  //Number of retired objects not yet freed
+  size_t getNumPending();
+
+  static void runTests();
+
+ private:
+  struct Retired {
+    void* p;
+    void (*deleter)(void*);
+    uint64_t epoch;
+  };
+  //Padded so that threads don't write to the same cache line
+  struct ThreadSlot {
+    //Epoch that the thread entered its current Guard at, or 0 if not in one
+    std::atomic<uint64_t> epoch;
+    char padding[64 - sizeof(uint64_t)];
+  };
+
+  std::atomic<uint64_t> globalEpoch;
+  ThreadSlot* threadSlots;
+
+  std::mutex retiredMutex;
+  std::vector<Retired> retired;
+
+  bool tryAdvanceUnsynchronized();
+};
+
+#endif  // CORE_EPOCHRECLAIM_H_
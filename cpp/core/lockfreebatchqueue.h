@@ -0,0 +1,380 @@
+#ifndef CORE_LOCKFREEBATCHQUEUE_H_
+#define CORE_LOCKFREEBATCHQUEUE_H_
+
+#include <chrono>
+
+#include "../core/global.h"
+#include "../core/multithread.h"
+
+//Multi-producer multi-consumer queue where producers push single elements and consumers pop batches of them.
+//
+//Pushing is lock-free: a producer claims a position in a ring with a fetch-add on the tail, writes its element into
+//that slot, and then publishes it by advancing the slot's sequence number. Consumers take the longest run of published
+//slots starting at the head and hand the slots back by advancing their sequence numbers by a full lap. The only time a
+//producer takes a lock is to wake consumers that are sleeping until the element it published arrives.
+//Consumers coordinate among themselves with a mutex, which is uncontended in practice since there are only ever a few
+//of them and they spend most of their time processing batches rather than popping them.
+//
+//Optionally consumers also wait adaptively for short batches to fill. When fewer than minFill elements are ready,
+//a consumer waits for more to arrive, but never past maxWait after the oldest of them was pushed, and only if at the
+//recently observed rate of pushes enough of them are expected to show up in time.
+//
+//Consumers that serve several queues can also take batches without blocking, and be interrupted while waiting on one
+//queue when something arrives in another.
+template<typename T>
+class LockFreeBatchQueue
+{
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    T elt;
+    std::chrono::steady_clock::time_point arrivalTime;
+  };
+  static const size_t CACHE_LINE_BYTES = 64;
+  //Keep producers claiming neighboring positions mostly off each other's cache lines
+  struct PaddedSlot {
+    Slot slot;
+    char padding[CACHE_LINE_BYTES - sizeof(Slot) % CACHE_LINE_BYTES];
+  };
+
+  //Weight of each new arrival in the running average of the interval between pushes
+  static constexpr double ARRIVAL_INTERVAL_EWMA_WEIGHT = 0.1;
+
+  const uint64_t capacity;
+  const uint64_t capacityMask;
+  const size_t minFill;
+  const std::chrono::steady_clock::duration maxWait;
+  PaddedSlot* slots;
+
+  char padding0[CACHE_LINE_BYTES];
+  //Next position for producers to claim
+  std::atomic<uint64_t> tail;
+  char padding1[CACHE_LINE_BYTES];
+  //A producer that publishes the element at a position >= wakeTarget - 1 must wake the consumers
+  std::atomic<uint64_t> wakeTarget;
+  char padding2[CACHE_LINE_BYTES];
+
+  //Everything below is only accessed by consumers holding consumerMutex, except the stats
+  std::mutex consumerMutex;
+  std::condition_variable consumerCondVar;
+  uint64_t head;
+  bool isKilled;
+  //Only modified while holding consumerMutex, but read without it
+  std::atomic<uint64_t> numInterrupts;
+  double arrivalIntervalEwma; //Seconds
+  std::chrono::steady_clock::time_point lastArrivalTime;
+
+  std::atomic<uint64_t> numFillWaits;
+  std::atomic<uint64_t> numFillTimeouts;
+  std::atomic<uint64_t> numFillWaitsSkipped;
+  std::atomic<uint64_t> fillWaitNanos;
+
+ public:
+  //minCapacity is rounded up to a power of two. Producers spin if ever more than that many elements are outstanding.
+  //minFill <= 1 or maxWaitMs <= 0 disables adaptive waiting for batches to fill.
+  inline LockFreeBatchQueue(size_t minCapacity, size_t minFillRows, double maxWaitMs)
+    :capacity(roundUpToPowerOfTwo(minCapacity)),
+     capacityMask(roundUpToPowerOfTwo(minCapacity)-1),
+     minFill(maxWaitMs > 0 ? minFillRows : 1),
+     maxWait(
+       std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double,std::milli>(maxWaitMs))
+     ),
+     slots(NULL),
+     tail(0),
+     wakeTarget(UINT64_MAX),
+     consumerMutex(),
+     consumerCondVar(),
+     head(0),
+     isKilled(false),
+     numInterrupts(0),
+     arrivalIntervalEwma(0.0),
+     lastArrivalTime(),
+     numFillWaits(0),
+     numFillTimeouts(0),
+     numFillWaitsSkipped(0),
+     fillWaitNanos(0)
+  {
+    slots = new PaddedSlot[capacity];
+    for(uint64_t i = 0; i<capacity; i++)
+      slots[i].slot.seq.store(i, std::memory_order_relaxed);
+  }
+  inline ~LockFreeBatchQueue()
+  {
+    delete[] slots;
+  }
+
+  LockFreeBatchQueue(const LockFreeBatchQueue&) = delete;
+  LockFreeBatchQueue& operator=(const LockFreeBatchQueue&) = delete;
+
+  inline size_t getMinFill() const
+  {
+    return minFill;
+  }
+  inline size_t getCapacity() const
+  {
+    return (size_t)capacity;
+  }
+  //Index in [0,capacity) of the slot that the element at a position occupies
+  inline size_t getSlotIdx(uint64_t pos) const
+  {
+    return (size_t)(pos & capacityMask);
+  }
+
+  inline void push(const T& elt)
+  {
+    publish(claim(), elt);
+  }
+
+  //Pushing in two steps, for producers that want to write data of their own into storage indexed by getSlotIdx
+  //before the element becomes visible to consumers. Every claimed position must be published, and consumers can't
+  //get past it until it is.
+  inline uint64_t claim()
+  {
+    uint64_t pos = tail.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots[pos & capacityMask].slot;
+    //Only if more than capacity elements are outstanding do we have to wait for a consumer to free up this slot
+    while(slot.seq.load(std::memory_order_acquire) != pos)
+      std::this_thread::yield();
+    return pos;
+  }
+  inline void publish(uint64_t pos, const T& elt)
+  {
+    Slot& slot = slots[pos & capacityMask].slot;
+    slot.elt = elt;
+    if(minFill > 1)
+      slot.arrivalTime = std::chrono::steady_clock::now();
+    slot.seq.store(pos+1, std::memory_order_release);
+
+    //Pairs with the fence in waitPopBatch, so that either the consumer going to sleep sees what we just published,
+    //or we see the wakeTarget that it registered.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(pos + 1 >= wakeTarget.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(consumerMutex);
+      //Every sleeping consumer wakes and registers again, so the target can be reset
+      wakeTarget.store(UINT64_MAX, std::memory_order_relaxed);
+      consumerCondVar.notify_all();
+    }
+  }
+
+  //Blocks until elements are ready (and, if adaptive, until the batch fills or that's not worth waiting for),
+  //then pops up to maxCount of them into buf. Returns the number popped, which is zero only if the queue was killed.
+  inline size_t waitPopBatch(T* buf, size_t maxCount)
+  {
+    uint64_t firstPos;
+    return waitTakeBatchImpl(buf, maxCount, true, NULL, firstPos);
+  }
+
+  //Like waitPopBatch, except that the slots of the returned elements stay reserved until release is called,
+  //so that storage indexed by their slots can still be read. Batches never wrap around the end of the ring,
+  //so the slots are the consecutive getSlotIdx(firstPos), ..., getSlotIdx(firstPos)+n-1.
+  inline size_t waitTakeBatch(T* buf, size_t maxCount, uint64_t& firstPos)
+  {
+    return waitTakeBatchImpl(buf, maxCount, false, NULL, firstPos);
+  }
+  //Like waitTakeBatch, but also returns zero once interruptWaits has been called since getNumInterrupts returned
+  //interruptsSeen, or immediately if it already has.
+  inline size_t waitTakeBatchInterruptible(T* buf, size_t maxCount, uint64_t interruptsSeen, uint64_t& firstPos)
+  {
+    return waitTakeBatchImpl(buf, maxCount, false, &interruptsSeen, firstPos);
+  }
+  //Like waitTakeBatch, but never waits, taking only the elements that are ready right now, possibly none
+  inline size_t tryTakeBatch(T* buf, size_t maxCount, uint64_t& firstPos)
+  {
+    std::lock_guard<std::mutex> lock(consumerMutex);
+    firstPos = head;
+    if(isKilled)
+      return 0;
+    maxCount = std::min(maxCount, (size_t)(capacity - (head & capacityMask)));
+    size_t numReady = countReadyUnsynchronized(maxCount);
+    popReadyUnsynchronized(buf, numReady, false);
+    return numReady;
+  }
+  //How many elements tryTakeBatch would take right now
+  inline size_t countReady(size_t maxCount)
+  {
+    std::lock_guard<std::mutex> lock(consumerMutex);
+    if(isKilled)
+      return 0;
+    maxCount = std::min(maxCount, (size_t)(capacity - (head & capacityMask)));
+    return countReadyUnsynchronized(maxCount);
+  }
+  inline void release(uint64_t firstPos, size_t count)
+  {
+    for(size_t i = 0; i<count; i++)
+      slotAt(firstPos + i).seq.store(firstPos + i + capacity, std::memory_order_release);
+  }
+
+  inline uint64_t getNumInterrupts() const
+  {
+    return numInterrupts.load(std::memory_order_acquire);
+  }
+  //Wake consumers in waitTakeBatchInterruptible, for when there's something for them to do elsewhere
+  inline void interruptWaits()
+  {
+    std::lock_guard<std::mutex> lock(consumerMutex);
+    numInterrupts.fetch_add(1, std::memory_order_release);
+    consumerCondVar.notify_all();
+  }
+
+  //Wake all consumers and make waitPopBatch and waitTakeBatch return zero until unkilled
+  inline void setKilled(bool b)
+  {
+    std::lock_guard<std::mutex> lock(consumerMutex);
+    isKilled = b;
+    consumerCondVar.notify_all();
+  }
+
+  //Number of batches where consumers waited for more elements, and how many of those ran out of time
+  inline uint64_t getNumFillWaits() const { return numFillWaits.load(std::memory_order_relaxed); }
+  inline uint64_t getNumFillTimeouts() const { return numFillTimeouts.load(std::memory_order_relaxed); }
+  //Number of times a short batch was popped immediately because elements weren't arriving fast enough to fill it in time
+  inline uint64_t getNumFillWaitsSkipped() const { return numFillWaitsSkipped.load(std::memory_order_relaxed); }
+  inline double getAverageFillWaitMs() const
+  {
+    uint64_t numWaits = getNumFillWaits();
+    if(numWaits <= 0)
+      return 0.0;
+    return (double)fillWaitNanos.load(std::memory_order_relaxed) / 1e6 / (double)numWaits;
+  }
+  inline void clearStats()
+  {
+    numFillWaits.store(0);
+    numFillTimeouts.store(0);
+    numFillWaitsSkipped.store(0);
+    fillWaitNanos.store(0);
+  }
+
+ private:
+  inline size_t waitTakeBatchImpl(T* buf, size_t maxCount, bool releaseNow, const uint64_t* interruptsSeen, uint64_t& firstPos)
+  {
+    std::unique_lock<std::mutex> lock(consumerMutex);
+    if(!releaseNow)
+      maxCount = std::min(maxCount, (size_t)(capacity - (head & capacityMask)));
+    const size_t fillTarget = std::min(minFill, maxCount);
+    bool waitedForFill = false;
+    std::chrono::steady_clock::time_point waitStartTime;
+    size_t numReady;
+    while(true) {
+      if(isKilled)
+        return 0;
+      if(interruptsSeen != NULL && numInterrupts.load(std::memory_order_relaxed) != *interruptsSeen)
+        return 0;
+      numReady = countReadyUnsynchronized(maxCount);
+      if(numReady >= maxCount)
+        break;
+
+      size_t numNeeded;
+      bool hasDeadline = false;
+      std::chrono::steady_clock::time_point deadline;
+      if(numReady <= 0)
+        numNeeded = 1;
+      else {
+        if(fillTarget <= 1 || numReady >= fillTarget)
+          break;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        deadline = slotAt(head).arrivalTime + maxWait;
+        if(now >= deadline) {
+          //Elements typically arrive in bursts as their consumers complete batches, which the average interval
+          //underestimates. So count running out of time as having missed an arrival, to back off from waiting when
+          //it isn't paying off.
+          if(waitedForFill) {
+            numFillTimeouts.fetch_add(1, std::memory_order_relaxed);
+            addArrivalIntervalUnsynchronized(std::chrono::duration<double>(maxWait).count());
+          }
+          break;
+        }
+        //The time since the latest arrival is a lower bound on the current interval, so that we react immediately
+        //if producers have stopped pushing, such as when they are all blocked waiting on the batches in flight.
+        double sinceLatestArrival = std::chrono::duration<double>(now - slotAt(head + numReady - 1).arrivalTime).count();
+        double arrivalInterval = std::max(arrivalIntervalEwma, sinceLatestArrival);
+        double expectedSecondsToFill = (fillTarget - numReady) * arrivalInterval;
+        if(expectedSecondsToFill > std::chrono::duration<double>(deadline - now).count()) {
+          numFillWaitsSkipped.fetch_add(1, std::memory_order_relaxed);
+          break;
+        }
+        if(!waitedForFill) {
+          waitedForFill = true;
+          waitStartTime = now;
+        }
+        numNeeded = fillTarget;
+        hasDeadline = true;
+      }
+
+      //Usually we want to be woken when the last element we need is published, but if that one was published
+      //ahead of some earlier ones, then instead when the first missing one is.
+      uint64_t target = isPublished(head + numNeeded - 1) ? head + numReady + 1 : head + numNeeded;
+      if(target < wakeTarget.load(std::memory_order_relaxed))
+        wakeTarget.store(target, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(isPublished(head + numReady) || isPublished(target - 1))
+        continue;
+
+      if(hasDeadline)
+        consumerCondVar.wait_until(lock, deadline);
+      else
+        consumerCondVar.wait(lock);
+    }
+
+    firstPos = head;
+    popReadyUnsynchronized(buf, numReady, releaseNow);
+
+    if(waitedForFill) {
+      numFillWaits.fetch_add(1, std::memory_order_relaxed);
+      fillWaitNanos.fetch_add(
+        (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - waitStartTime).count(),
+        std::memory_order_relaxed
+      );
+    }
+    return numReady;
+  }
+
+  static inline uint64_t roundUpToPowerOfTwo(size_t x)
+  {
+    uint64_t p = 1;
+    while(p < x)
+      p *= 2;
+    return p;
+  }
+
+  inline Slot& slotAt(uint64_t pos)
+  {
+    return slots[pos & capacityMask].slot;
+  }
+
+  inline bool isPublished(uint64_t pos)
+  {
+    return slotAt(pos).seq.load(std::memory_order_acquire) == pos+1;
+  }
+
+  inline size_t countReadyUnsynchronized(size_t maxCount)
+  {
+    size_t n = 0;
+    while(n < maxCount && isPublished(head + n))
+      n++;
+    return n;
+  }
+
+  inline void popReadyUnsynchronized(T* buf, size_t numReady, bool releaseNow)
+  {
+    for(size_t i = 0; i<numReady; i++) {
+      Slot& slot = slotAt(head + i);
+      buf[i] = slot.elt;
+      if(minFill > 1) {
+        double interval = std::chrono::duration<double>(
+          std::max(std::chrono::steady_clock::duration::zero(), std::min(slot.arrivalTime - lastArrivalTime, maxWait))
+        ).count();
+        addArrivalIntervalUnsynchronized(interval);
+        lastArrivalTime = std::max(lastArrivalTime, slot.arrivalTime);
+      }
+      if(releaseNow)
+        slot.seq.store(head + i + capacity, std::memory_order_release);
+    }
+    head += numReady;
+  }
+
+  inline void addArrivalIntervalUnsynchronized(double interval)
+  {
+    arrivalIntervalEwma += ARRIVAL_INTERVAL_EWMA_WEIGHT * (interval - arrivalIntervalEwma);
+  }
+};
+
+#endif  // CORE_LOCKFREEBATCHQUEUE_H_
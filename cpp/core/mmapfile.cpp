@@ -0,0 +1,423 @@
+#include "../core/mmapfile.h"
+
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+ #define _IS_WINDOWS
+#elif _WIN64
+ #define _IS_WINDOWS
+#elif __unix || __APPLE__
+  #define _IS_UNIX
+#else
+ #error Unknown OS!
+#endif
+
+#ifdef _IS_WINDOWS
+  #include <windows.h>
+#endif
+#ifdef _IS_UNIX
+  #include <cerrno>
+  #include <fcntl.h>
+  #include <sys/file.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+using namespace std;
+
+static void checkSharedMemoryName(const string& name) {
+  if(name.size() <= 0 || name.find('/') != string::npos || name.find('\\') != string::npos)
+    throw StringError("Invalid shared memory name, must be nonempty without slashes: " + name);
+}
+
+//WINDOWS IMPLMENTATIION-------------------------------------------------------------
+
+#ifdef _IS_WINDOWS
+
+MappedFile::MappedFile(const string& p)
+  :path(p),data(NULL),size(0),fileHandle(NULL),mappingHandle(NULL)
+{
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(file == INVALID_HANDLE_VALUE)
+    throw StringError("Could not open file: " + path);
+  LARGE_INTEGER fileSize;
+  if(!GetFileSizeEx(file, &fileSize)) {
+    CloseHandle(file);
+    throw StringError("Could not get size of file: " + path);
+  }
+  fileHandle = file;
+  size = (size_t)fileSize.QuadPart;
+  //Windows can't map an empty file, but there's nothing to map anyways
+  if(size == 0)
+    return;
+
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if(mapping == NULL) {
+    CloseHandle(file);
+    throw StringError("Could not map file: " + path);
+  }
+  mappingHandle = mapping;
+  data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if(data == NULL) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    throw StringError("Could not map file: " + path);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if(data != NULL)
+    UnmapViewOfFile(data);
+  if(mappingHandle != NULL)
+    CloseHandle((HANDLE)mappingHandle);
+  if(fileHandle != NULL)
+    CloseHandle((HANDLE)fileHandle);
+}
+
+SharedMappedFile::SharedMappedFile(const string& p, size_t sz, bool tryWritable)
+  :path(p),data(NULL),size(0),writable(false),fileHandle(NULL),mappingHandle(NULL)
+{
+  HANDLE file = INVALID_HANDLE_VALUE;
+  if(tryWritable) {
+    file = CreateFileA(
+      path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL
+    );
+    if(file == INVALID_HANDLE_VALUE)
+      throw StringError("Could not open file for writing: " + path);
+    //Lock a byte far past the end of any file rather than the contents, since locks on the contents would also
+    //block other processes from reading them
+    OVERLAPPED overlapped;
+    ZeroMemory(&overlapped, sizeof(overlapped));
+    overlapped.OffsetHigh = 0x7FFFFFFF;
+    if(LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped)) {
+      //Only size a new file, an existing one may be mapped by readers at its current size
+      LARGE_INTEGER curSize;
+      if(!GetFileSizeEx(file, &curSize)) {
+        CloseHandle(file);
+        throw StringError("Could not get size of file: " + path);
+      }
+      if(curSize.QuadPart == 0) {
+        LARGE_INTEGER newSize;
+        newSize.QuadPart = (LONGLONG)sz;
+        if(!SetFilePointerEx(file, newSize, NULL, FILE_BEGIN) || !SetEndOfFile(file)) {
+          CloseHandle(file);
+          throw StringError("Could not resize file: " + path);
+        }
+      }
+      writable = true;
+    }
+    else {
+      CloseHandle(file);
+      file = INVALID_HANDLE_VALUE;
+    }
+  }
+  if(!writable) {
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+      throw StringError("Could not open file: " + path);
+  }
+
+  LARGE_INTEGER fileSize;
+  if(!GetFileSizeEx(file, &fileSize)) {
+    CloseHandle(file);
+    throw StringError("Could not get size of file: " + path);
+  }
+  fileHandle = file;
+  size = (size_t)fileSize.QuadPart;
+  if(size == 0)
+    return;
+
+  HANDLE mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+  if(mapping == NULL) {
+    CloseHandle(file);
+    throw StringError("Could not map file: " + path);
+  }
+  mappingHandle = mapping;
+  data = (char*)MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+  if(data == NULL) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    throw StringError("Could not map file: " + path);
+  }
+}
+
+SharedMappedFile::~SharedMappedFile() {
+  if(data != NULL)
+    UnmapViewOfFile(data);
+  if(mappingHandle != NULL)
+    CloseHandle((HANDLE)mappingHandle);
+  //Closing the file also releases the lock
+  if(fileHandle != NULL)
+    CloseHandle((HANDLE)fileHandle);
+}
+
+void SharedMappedFile::flush() {
+  if(data != NULL && writable) {
+    FlushViewOfFile(data, 0);
+    FlushFileBuffers((HANDLE)fileHandle);
+  }
+}
+
+void SharedMappedFile::resize(size_t newSize) {
+  if(!writable)
+    throw StringError("Could not resize file opened read-only: " + path);
+  //Windows can't resize a file while it's mapped
+  if(data != NULL)
+    UnmapViewOfFile(data);
+  data = NULL;
+  if(mappingHandle != NULL)
+    CloseHandle((HANDLE)mappingHandle);
+  mappingHandle = NULL;
+  size = 0;
+
+  HANDLE file = (HANDLE)fileHandle;
+  LARGE_INTEGER newSize64;
+  newSize64.QuadPart = (LONGLONG)newSize;
+  if(!SetFilePointerEx(file, newSize64, NULL, FILE_BEGIN) || !SetEndOfFile(file))
+    throw StringError("Could not resize file: " + path);
+  if(newSize == 0)
+    return;
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, 0, NULL);
+  if(mapping == NULL)
+    throw StringError("Could not map file: " + path);
+  mappingHandle = mapping;
+  data = (char*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+  if(data == NULL)
+    throw StringError("Could not map file: " + path);
+  size = newSize;
+}
+
+SharedMemory::SharedMemory(const string& n, size_t sz, bool mustExist)
+  :name(n),data(NULL),size(sz),mappingHandle(NULL)
+{
+  checkSharedMemoryName(name);
+  //Backed by the paging file. Windows doesn't tell us the size of an existing mapping, only of the pages that a view
+  //of it spans, so mapping too little is caught but mapping a little too much is not.
+  HANDLE mapping;
+  if(mustExist)
+    mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, ("Local\\" + name).c_str());
+  else {
+    uint64_t size64 = (uint64_t)size;
+    mapping = CreateFileMappingA(
+      INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(size64 >> 32), (DWORD)(size64 & 0xFFFFFFFFULL), ("Local\\" + name).c_str()
+    );
+  }
+  if(mapping == NULL)
+    throw StringError(string(mustExist ? "Could not open shared memory: " : "Could not create shared memory: ") + name);
+  mappingHandle = mapping;
+  data = (char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  if(data == NULL) {
+    CloseHandle(mapping);
+    mappingHandle = NULL;
+    throw StringError("Could not map shared memory, or it is smaller than expected: " + name);
+  }
+}
+
+SharedMemory::~SharedMemory() {
+  if(data != NULL)
+    UnmapViewOfFile(data);
+  if(mappingHandle != NULL)
+    CloseHandle((HANDLE)mappingHandle);
+}
+
+bool SharedMemory::remove(const string& name) {
+  //Goes away by itself once every process closes it
+  (void)name;
+  return false;
+}
+
+#endif
+
+//UNIX IMPLEMENTATION------------------------------------------------------------------
+
+#ifdef _IS_UNIX
+
+MappedFile::MappedFile(const string& p)
+  :path(p),data(NULL),size(0),fileHandle(NULL),mappingHandle(NULL)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw StringError("Could not open file: " + path);
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    close(fd);
+    throw StringError("Could not get size of file: " + path);
+  }
+  size = (size_t)st.st_size;
+  //mmap of length 0 is an error, but there's nothing to map anyways
+  if(size == 0) {
+    close(fd);
+    return;
+  }
+
+  void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  //The mapping holds its own reference to the file
+  close(fd);
+  if(mapped == MAP_FAILED)
+    throw StringError("Could not map file: " + path);
+  data = (const char*)mapped;
+}
+
+MappedFile::~MappedFile() {
+  if(data != NULL)
+    munmap(const_cast<char*>(data), size);
+}
+
+SharedMappedFile::SharedMappedFile(const string& p, size_t sz, bool tryWritable)
+  :path(p),data(NULL),size(0),writable(false),fileHandle(NULL),mappingHandle(NULL)
+{
+  int fd = -1;
+  if(tryWritable) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+      throw StringError("Could not open file for writing: " + path);
+    if(flock(fd, LOCK_EX | LOCK_NB) == 0) {
+      //Only size a new file, an existing one may be mapped by readers at its current size
+      struct stat st;
+      if(fstat(fd, &st) != 0) {
+        close(fd);
+        throw StringError("Could not get size of file: " + path);
+      }
+      if(st.st_size == 0 && ftruncate(fd, (off_t)sz) != 0) {
+        close(fd);
+        throw StringError("Could not resize file: " + path);
+      }
+      writable = true;
+    }
+    else {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if(!writable) {
+    fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+      throw StringError("Could not open file: " + path);
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    close(fd);
+    throw StringError("Could not get size of file: " + path);
+  }
+  size = (size_t)st.st_size;
+  if(size > 0) {
+    void* mapped = mmap(NULL, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    if(mapped == MAP_FAILED) {
+      close(fd);
+      throw StringError("Could not map file: " + path);
+    }
+    data = (char*)mapped;
+  }
+
+  //The lock lives as long as the descriptor, so keep it open while writable
+  if(writable)
+    fileHandle = new int(fd);
+  else
+    close(fd);
+}
+
+SharedMappedFile::~SharedMappedFile() {
+  if(data != NULL)
+    munmap(data, size);
+  if(fileHandle != NULL) {
+    int* fd = (int*)fileHandle;
+    close(*fd);
+    delete fd;
+  }
+}
+
+void SharedMappedFile::flush() {
+  if(data != NULL && writable)
+    msync(data, size, MS_SYNC);
+}
+
+void SharedMappedFile::resize(size_t newSize) {
+  if(!writable)
+    throw StringError("Could not resize file opened read-only: " + path);
+  if(data != NULL)
+    munmap(data, size);
+  data = NULL;
+  size = 0;
+
+  int fd = *((int*)fileHandle);
+  if(ftruncate(fd, (off_t)newSize) != 0)
+    throw StringError("Could not resize file: " + path);
+  if(newSize == 0)
+    return;
+  void* mapped = mmap(NULL, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(mapped == MAP_FAILED)
+    throw StringError("Could not map file: " + path);
+  data = (char*)mapped;
+  size = newSize;
+}
+
+SharedMemory::SharedMemory(const string& n, size_t sz, bool mustExist)
+  :name(n),data(NULL),size(sz),mappingHandle(NULL)
+{
+  checkSharedMemoryName(name);
+  //Only the process that actually creates the region sizes it, everyone else waits for that to happen, so that no
+  //two processes can race to resize a region that one of them has already mapped.
+  bool created = false;
+  int fd = -1;
+  if(!mustExist) {
+    fd = shm_open(("/" + name).c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd >= 0)
+      created = true;
+    else if(errno != EEXIST)
+      throw StringError("Could not create shared memory: " + name);
+  }
+  if(!created) {
+    fd = shm_open(("/" + name).c_str(), O_RDWR, 0600);
+    if(fd < 0)
+      throw StringError(string(mustExist ? "Could not open shared memory: " : "Could not create shared memory: ") + name);
+  }
+
+  if(created) {
+    if(ftruncate(fd, (off_t)size) != 0) {
+      close(fd);
+      remove(name);
+      throw StringError("Could not resize shared memory: " + name);
+    }
+  }
+  else {
+    struct stat st;
+    const int maxWaitMs = 5000;
+    for(int waitedMs = 0; ; waitedMs++) {
+      if(fstat(fd, &st) != 0) {
+        close(fd);
+        throw StringError("Could not get size of shared memory: " + name);
+      }
+      if(st.st_size != 0 || waitedMs >= maxWaitMs)
+        break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if((size_t)st.st_size != size) {
+      close(fd);
+      throw StringError(
+        "Shared memory " + name + " already exists with size " + Global::int64ToString((int64_t)st.st_size) +
+        " rather than " + Global::uint64ToString((uint64_t)size)
+      );
+    }
+  }
+
+  void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(mapped == MAP_FAILED)
+    throw StringError("Could not map shared memory: " + name);
+  data = (char*)mapped;
+}
+
+SharedMemory::~SharedMemory() {
+  if(data != NULL)
+    munmap(data, size);
+}
+
+bool SharedMemory::remove(const string& name) {
+  checkSharedMemoryName(name);
+  return shm_unlink(("/" + name).c_str()) == 0;
+}
+
+#endif
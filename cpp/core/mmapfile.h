@@ -0,0 +1,81 @@
+#ifndef CORE_MMAPFILE_H_
+#define CORE_MMAPFILE_H_
+
+#include "../core/global.h"
+
+//Read-only memory mapping of an entire file. The mapping stays valid for the lifetime of this object.
+struct MappedFile {
+  std::string path;
+  const char* data;
+  size_t size;
+
+  //Throws StringError if the file can't be opened or mapped
+  MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile() = delete;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+ private:
+  //Platform-specific handles kept alive alongside the mapping, if any
+  void* fileHandle;
+  void* mappingHandle;
+};
+
+//Memory mapping of an entire file shared with other processes, so that writes through it persist in the file
+//and are seen by every other process mapping it.
+//The file is mapped at whatever size it has. If tryWritable, the file is created with size bytes if it doesn't exist
+//or is empty, and this process holds an exclusive lock on it for the lifetime of this object. If another process
+//(or another SharedMappedFile in this one) already holds that lock, or if not tryWritable, it is mapped read-only.
+struct SharedMappedFile {
+  std::string path;
+  char* data;
+  size_t size;
+  bool writable;
+
+  //Throws StringError if the file can't be opened or mapped
+  SharedMappedFile(const std::string& path, size_t size, bool tryWritable);
+  ~SharedMappedFile();
+
+  SharedMappedFile() = delete;
+  SharedMappedFile(const SharedMappedFile&) = delete;
+  SharedMappedFile& operator=(const SharedMappedFile&) = delete;
+
+  //Write out modified pages to the file, blocking until done
+  void flush();
+  //Resize the file and map it again, invalidating data. Only for writable files, and other processes mapping it
+  //must not touch anything past the new size. Throws StringError on failure.
+  void resize(size_t newSize);
+
+ private:
+  void* fileHandle;
+  void* mappingHandle;
+};
+
+//Named region of memory shared between processes on the same machine, not backed by any ordinary file.
+//Whichever process opens it first creates it zero-filled with the given size, and it lasts until removed or the
+//machine restarts (on Windows, until no process has it open anymore). On Unix it shows up under /dev/shm.
+struct SharedMemory {
+  std::string name;
+  char* data;
+  size_t size;
+
+  //Throws StringError if it can't be created or mapped, or if it already exists with a different size.
+  //If mustExist, only opens a region that another process already created, rather than creating it.
+  SharedMemory(const std::string& name, size_t size, bool mustExist);
+  ~SharedMemory();
+
+  SharedMemory() = delete;
+  SharedMemory(const SharedMemory&) = delete;
+  SharedMemory& operator=(const SharedMemory&) = delete;
+
+  //Remove the named region, so that the next process to open it creates it afresh. Processes that have it open
+  //keep using the old one. Returns false if there was no such region.
+  static bool remove(const std::string& name);
+
+ private:
+  void* mappingHandle;
+};
+
+#endif  // CORE_MMAPFILE_H_
@@ -329,9 +329,8 @@ int MainCmds::evalsgf(int argc, const char* const* argv) {
 
   sout << "Time taken: " << timer.getSeconds() << "\n";
   sout << "Root visits: " << search->numRootVisits() << "\n";
-  sout << "NN rows: " << nnEval->numRowsProcessed() << endl;
-  sout << "NN batches: " << nnEval->numBatchesProcessed() << endl;
-  sout << "NN avg batch size: " << nnEval->averageProcessedBatchSize() << endl;
+  for(const string& line: nnEval->getStatsLines())
+    sout << line << endl;
   sout << "PV: ";
   search->printPV(sout, search->rootNode, 25);
   sout << "\n";
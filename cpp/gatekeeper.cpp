@@ -283,6 +283,9 @@ int MainCmds::gatekeeper(int argc, const char* const* argv) {
 
   Setup::initializeSession(cfg);
 
+  //If enabled, the candidate and accepted nets share one set of server threads
+  NNServerGroup* nnServerGroup = Setup::initializeNNServerGroup(cfg,logger);
+
   //Done loading!
   //------------------------------------------------------------------------------------
   logger.write("Loaded all config stuff, watching for new neural nets in " + testModelsDir);
@@ -316,7 +319,7 @@ int MainCmds::gatekeeper(int argc, const char* const* argv) {
   };
 
   auto loadLatestNeuralNet =
-    [&testModelsDir,&rejectedModelsDir,&acceptedModelsDir,&sgfOutputDir,&logger,&cfg,numGameThreads]() -> NetAndStuff* {
+    [&testModelsDir,&rejectedModelsDir,&acceptedModelsDir,&sgfOutputDir,&logger,&cfg,numGameThreads,nnServerGroup]() -> NetAndStuff* {
     Rand rand;
 
     string testModelName;
@@ -357,7 +360,8 @@ int MainCmds::gatekeeper(int argc, const char* const* argv) {
     {
       vector<NNEvaluator*> nnEvals =
         Setup::initializeNNEvaluators(
-          {testModelName},{testModelFile},cfg,logger,rand,maxConcurrentEvals,debugSkipNeuralNetDefaultTest,false,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,-1
+          {testModelName},{testModelFile},cfg,logger,rand,maxConcurrentEvals,debugSkipNeuralNetDefaultTest,false,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,-1,
+          nnServerGroup
         );
       assert(nnEvals.size() == 1);
       logger.write("Loaded candidate neural net " + testModelName + " from: " + testModelFile);
@@ -370,7 +374,8 @@ int MainCmds::gatekeeper(int argc, const char* const* argv) {
     {
       vector<NNEvaluator*> nnEvals =
         Setup::initializeNNEvaluators(
-          {acceptedModelName},{acceptedModelFile},cfg,logger,rand,maxConcurrentEvals,debugSkipNeuralNetDefaultAccepted,false,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,-1
+          {acceptedModelName},{acceptedModelFile},cfg,logger,rand,maxConcurrentEvals,debugSkipNeuralNetDefaultAccepted,false,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,-1,
+          nnServerGroup
         );
       assert(nnEvals.size() == 1);
       logger.write("Loaded accepted neural net " + acceptedModelName + " from: " + acceptedModelFile);
@@ -537,6 +542,7 @@ int MainCmds::gatekeeper(int argc, const char* const* argv) {
   }
 
   //Delete and clean up everything else
+  delete nnServerGroup;
   NeuralNet::globalCleanup();
   delete gameRunner;
   ScoreValue::freeTables();
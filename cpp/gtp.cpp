@@ -159,9 +159,9 @@ static void printGenmoveLog(ostream& out, const AsyncBot* bot, const NNEvaluator
   out << bot->getRootHist().rules << "\n";
   out << "Time taken: " << timeTaken << "\n";
   out << "Root visits: " << search->numRootVisits() << "\n";
-  out << "NN rows: " << nnEval->numRowsProcessed() << endl;
-  out << "NN batches: " << nnEval->numBatchesProcessed() << endl;
-  out << "NN avg batch size: " << nnEval->averageProcessedBatchSize() << endl;
+  for(const string& line: nnEval->getStatsLines())
+    out << line << endl;
+  out << NNOutputPool::getStatsString() << endl;
   out << "PV: ";
   search->printPV(out, search->rootNode, 25);
   out << "\n";
@@ -17,6 +17,9 @@ static void printHelp(int argc, const char* argv[]) {
 gtp : Runs GTP engine that can be plugged into any standard Go GUI for play/analysis.
 match : Run self-play match games based on a config, more efficient than gtp due to batching.
 evalsgf : Utility/debug tool, analyze a single position of a game from an SGF file.
+nnserver : Run a neural net for gtp, match or selfplay processes on this machine to share, batching across all of them.
+benchmark : Time searches with various numbers of threads, batch sizes and cache sizes, and recommend settings.
+convertmodel : Convert a neural net model file to the binary format, which loads much faster.
 version : Print version and exit.
 
 ---Selfplay training subcommands---------
@@ -28,6 +31,8 @@ gatekeeper : Poll directory for new nets and match them against the latest net s
 
 runtests : Test important board algorithms and datastructures
 runnnlayertests : Test a few subcomponents of the current neural net backend
+runbatchqueuebench : Benchmark the neural net request queue against the old mutex-based one under contention
+profilenn : Time each residual block and head of a neural net in the current backend
 
 runnnontinyboardtest : Run neural net on a tiny board and dump result to stdout
 
@@ -65,12 +70,20 @@ int main(int argc, const char* argv[]) {
     return MainCmds::match(argc-1,&argv[1]);
   else if(cmdArg == "matchauto")
     return MainCmds::matchauto(argc-1,&argv[1]);
+  else if(cmdArg == "nnserver")
+    return MainCmds::nnserver(argc-1,&argv[1]);
+  else if(cmdArg == "benchmark")
+    return MainCmds::benchmark(argc-1,&argv[1]);
   else if(cmdArg == "selfplay")
     return MainCmds::selfplay(argc-1,&argv[1]);
   else if(cmdArg == "runtests")
     return MainCmds::runtests(argc-1,&argv[1]);
   else if(cmdArg == "runnnlayertests")
     return MainCmds::runnnlayertests(argc-1,&argv[1]);
+  else if(cmdArg == "runbatchqueuebench")
+    return MainCmds::runbatchqueuebench(argc-1,&argv[1]);
+  else if(cmdArg == "profilenn")
+    return MainCmds::profilenn(argc-1,&argv[1]);
   else if(cmdArg == "runnnontinyboardtest")
     return MainCmds::runnnontinyboardtest(argc-1,&argv[1]);
   else if(cmdArg == "runoutputtests")
@@ -85,6 +98,8 @@ int main(int argc, const char* argv[]) {
     return MainCmds::lzcost(argc-1,&argv[1]);
   else if(cmdArg == "demoplay")
     return MainCmds::demoplay(argc-1,&argv[1]);
+  else if(cmdArg == "convertmodel")
+    return MainCmds::convertmodel(argc-1,&argv[1]);
   else if(cmdArg == "sandbox")
     return MainCmds::sandbox();
   else if(cmdArg == "version") {
@@ -6,9 +6,13 @@ namespace MainCmds {
   int gtp(int argc, const char* const* argv);
   int match(int argc, const char* const* argv);
   int matchauto(int argc, const char* const* argv);
+  int nnserver(int argc, const char* const* argv);
+  int benchmark(int argc, const char* const* argv);
+  int profilenn(int argc, const char* const* argv);
   int selfplay(int argc, const char* const* argv);
   int runtests(int argc, const char* const* argv);
   int runnnlayertests(int argc, const char* const* argv);
+  int runbatchqueuebench(int argc, const char* const* argv);
   int runnnontinyboardtest(int argc, const char* const* argv);
   int runoutputtests(int argc, const char* const* argv);
   int runsearchtests(int argc, const char* const* argv);
@@ -17,6 +21,7 @@ namespace MainCmds {
 
   int lzcost(int argc, const char* const* argv);
   int demoplay(int argc, const char* const* argv);
+  int convertmodel(int argc, const char* const* argv);
 
   int sandbox();
 }
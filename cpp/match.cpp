@@ -235,12 +235,11 @@ int MainCmds::match(int argc, const char* const* argv) {
   for(int i = 0; i<nnEvals.size(); i++) {
     if(nnEvals[i] != NULL) {
       logger.write(nnEvals[i]->getModelFileName());
-      logger.write("NN rows: " + Global::int64ToString(nnEvals[i]->numRowsProcessed()));
-      logger.write("NN batches: " + Global::int64ToString(nnEvals[i]->numBatchesProcessed()));
-      logger.write("NN avg batch size: " + Global::doubleToString(nnEvals[i]->averageProcessedBatchSize()));
+      nnEvals[i]->logStats(logger, "");
       delete nnEvals[i];
     }
   }
+  logger.write(NNOutputPool::getStatsString());
   NeuralNet::globalCleanup();
   ScoreValue::freeTables();
 
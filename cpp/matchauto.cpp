@@ -67,6 +67,8 @@ namespace {
     ConfigParser* cfg;
     Rand seedRand;
     int maxConcurrentEvals;
+    //If not NULL, all the nets share these server threads
+    NNServerGroup* nnServerGroup;
 
     map<string, NetAndStuff*> loadedNets;
 
@@ -75,11 +77,13 @@ namespace {
   public:
     NetManager(
       ConfigParser* c,
-      int maxConcurrentEvs
+      int maxConcurrentEvs,
+      NNServerGroup* serverGroup
     )
       :cfg(c),
        seedRand(),
        maxConcurrentEvals(maxConcurrentEvs),
+       nnServerGroup(serverGroup),
        loadedNets()
     {
     }
@@ -89,6 +93,7 @@ namespace {
       for(; iter != loadedNets.end(); ++iter) {
         delete iter->second;
       }
+      delete nnServerGroup;
     }
 
     void preregisterGames(const string& nnModelFile, Logger& logger, int n) {
@@ -98,7 +103,10 @@ namespace {
       NetAndStuff* netAndStuff;
       if(iter == loadedNets.end()) {
         vector<NNEvaluator*> nnEvals =
-          Setup::initializeNNEvaluators({nnModelFile},{nnModelFile},*cfg,logger,seedRand,maxConcurrentEvals,false,false,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,-1);
+          Setup::initializeNNEvaluators(
+            {nnModelFile},{nnModelFile},*cfg,logger,seedRand,maxConcurrentEvals,false,false,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,-1,
+            nnServerGroup
+          );
         assert(nnEvals.size() == 1);
         netAndStuff = new NetAndStuff(nnEvals[0]);
         loadedNets[nnModelFile] = netAndStuff;
@@ -475,7 +483,7 @@ int MainCmds::matchauto(int argc, const char* const* argv) {
   //Initialize neural net inference engine globals, and set up model manager
   Setup::initializeSession(cfg);
 
-  NetManager* manager = new NetManager(&cfg,maxConcurrentEvals);
+  NetManager* manager = new NetManager(&cfg,maxConcurrentEvals,Setup::initializeNNServerGroup(cfg,logger));
 
   //Initialize object for randomly pairing bots
   AutoMatchPairer * autoMatchPairer = new AutoMatchPairer(cfg,resultsDir,numBots,botNames,nnModelFilesByBot,paramss);
@@ -558,3 +558,43 @@ int MainCmds::demoplay(int argc, const char* const* argv) {
   return 0;
 
 }
+
+int MainCmds::convertmodel(int argc, const char* const* argv) {
+  string inputFile;
+  string outputFile;
+  bool fp16;
+  try {
+    TCLAP::CmdLine cmd("Convert a neural net model to the binary format, which loads much faster", ' ', Version::getKataGoVersion(),true);
+    TCLAP::ValueArg<string> inputFileArg("","input-model","Model file to convert, text (maybe gzipped) or binary",true,string(),"FILE");
+    TCLAP::ValueArg<string> outputFileArg("","output-model","Binary model file to write",true,string(),"FILE");
+    TCLAP::SwitchArg fp16Arg("","fp16","Store weights as fp16, halving the file size at some loss of precision");
+    cmd.add(inputFileArg);
+    cmd.add(outputFileArg);
+    cmd.add(fp16Arg);
+    cmd.parse(argc,argv);
+    inputFile = inputFileArg.getValue();
+    outputFile = outputFileArg.getValue();
+    fp16 = fp16Arg.getValue();
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+
+  ClockTimer timer;
+  ModelDesc desc;
+  ModelDesc::loadFromFileMaybeGZipped(inputFile,desc);
+  double inputLoadTime = timer.getSeconds();
+  cout << "Loaded " << inputFile << " (" << desc.name << ", version " << desc.version << ") in " << inputLoadTime << " seconds" << endl;
+
+  desc.saveToBinaryFile(outputFile,fp16);
+  cout << "Wrote " << outputFile << (fp16 ? " with fp16 weights" : " with fp32 weights") << endl;
+
+  //Reload what we wrote so that any problem shows up now rather than when the model is first used
+  timer.reset();
+  ModelDesc reloaded;
+  ModelDesc::loadFromFileMaybeGZipped(outputFile,reloaded);
+  double outputLoadTime = timer.getSeconds();
+  cout << "Reloaded " << outputFile << " in " << outputLoadTime << " seconds" << endl;
+  return 0;
+}
@@ -0,0 +1,2668 @@
+#ifdef USE_CPU_BACKEND
+
+#include "../core/rand.h"
+#include "../neuralnet/cpukernels.h"
+#include "../neuralnet/modelversion.h"
+#include "../neuralnet/nninterface.h"
+#include "../neuralnet/nninputs.h"
+#include "../neuralnet/desc.h"
+#include "../neuralnet/nntunecache.h"
+
+#include <chrono>
+#include <mutex>
+
+using namespace std;
+
+//Pure-CPU implementation of the neural net interface, computing directly from the ModelDesc weights.
+//All internal activations are kept in NHWC layout, so that every convolution becomes a sum of small
+//matrix multiplies, one per filter tap, over contiguous rows of pixels.
+//The matrix multiplies and batch norms run on the kernels in cpukernels.h, picked at runtime for the machine's
+//instruction set, with weights prepacked into the panel layout those kernels expect.
+//FP16 is not supported. There is an optional int8 mode for the convolutions in the residual blocks, whose weights
+//are quantized per output channel and whose activation scales are calibrated on first use, see calibrateInt8.
+//Each fp32 convolution can run as direct, winograd or im2col, and which is fastest depends on the shape, the batch
+//size and the machine, so createComputeHandle can benchmark them and remember the winners, see autotuneConvs.
+
+void NeuralNet::globalInitialize() {
+  // Empty for cpu
+}
+
+void NeuralNet::globalCleanup() {
+  // Empty for cpu
+}
+
+//---------------------------------------------------------------------------------
+
+static void transposeNCHWToNHWC(const float* in, float* out, int nSize, int cSize, int xySize) {
+  for(int n = 0; n<nSize; n++) {
+    const float* inN = in + (size_t)n * cSize * xySize;
+    float* outN = out + (size_t)n * cSize * xySize;
+    for(int c = 0; c<cSize; c++)
+      for(int xy = 0; xy<xySize; xy++)
+        outN[xy * cSize + c] = inN[c * xySize + xy];
+  }
+}
+
+static void transposeNHWCToNCHW(const float* in, float* out, int nSize, int cSize, int xySize) {
+  for(int n = 0; n<nSize; n++) {
+    const float* inN = in + (size_t)n * cSize * xySize;
+    float* outN = out + (size_t)n * cSize * xySize;
+    for(int xy = 0; xy<xySize; xy++)
+      for(int c = 0; c<cSize; c++)
+        outN[c * xySize + xy] = inN[xy * cSize + c];
+  }
+}
+
+//Adds a per-(batch,channel) bias to every position of an NHWC buffer
+static void addNCBiasInplaceNHWC(float* buf, const float* biases, int nSize, int xySize, int cSize) {
+  for(int n = 0; n<nSize; n++) {
+    const float* bias = biases + (size_t)n * cSize;
+    for(int xy = 0; xy<xySize; xy++) {
+      float* row = buf + ((size_t)n * xySize + xy) * cSize;
+      for(int c = 0; c<cSize; c++)
+        row[c] += bias[c];
+    }
+  }
+}
+
+//Same formulas as customCudaPoolRowsGPoolNHWC - outputs mean, scaled mean, and max for each channel
+static void poolRowsGPoolNHWC(const float* in, float* out, int nSize, int xySize, int cSize, const float* maskSum) {
+  vector<float> sums(cSize);
+  vector<float> maxes(cSize);
+  for(int n = 0; n<nSize; n++) {
+    std::fill(sums.begin(),sums.end(),0.0f);
+    std::fill(maxes.begin(),maxes.end(),0.0f);
+    for(int xy = 0; xy<xySize; xy++) {
+      const float* row = in + ((size_t)n * xySize + xy) * cSize;
+      for(int c = 0; c<cSize; c++) {
+        sums[c] += row[c];
+        maxes[c] = std::max(maxes[c],row[c]);
+      }
+    }
+    float div = maskSum[n];
+    float sqrtdiv = sqrt(div);
+    float* outN = out + (size_t)n * cSize * 3;
+    for(int c = 0; c<cSize; c++) {
+      float mean = sums[c] / div;
+      outN[c] = mean;
+      outN[c + cSize] = mean * (sqrtdiv - 14.0f) * 0.1f;
+      outN[c + cSize*2] = maxes[c];
+    }
+  }
+}
+
+//Same formulas as customCudaValueHeadPoolNHWC
+static void valueHeadPoolNHWC(const float* in, float* out, int nSize, int xySize, int cSize, const float* maskSum) {
+  vector<float> sums(cSize);
+  for(int n = 0; n<nSize; n++) {
+    std::fill(sums.begin(),sums.end(),0.0f);
+    for(int xy = 0; xy<xySize; xy++) {
+      const float* row = in + ((size_t)n * xySize + xy) * cSize;
+      for(int c = 0; c<cSize; c++)
+        sums[c] += row[c];
+    }
+    float div = maskSum[n];
+    float sqrtdiv = sqrt(div);
+    float* outN = out + (size_t)n * cSize * 3;
+    for(int c = 0; c<cSize; c++) {
+      float mean = sums[c] / div;
+      outN[c] = mean;
+      outN[c + cSize] = mean * (sqrtdiv - 14.0f) * 0.1f;
+      outN[c + cSize*2] = mean * ((sqrtdiv - 14.0f) * (sqrtdiv - 14.0f) * 0.01f - 0.1f);
+    }
+  }
+}
+
+//Forward: mirror (y then x) and then transpose if square. Inverse: transpose if square and then mirror.
+//Matches the semantics of applySymmetriesNHWC in the cuda backend.
+static void applySymmetriesNHWC(
+  const bool* symmetriesBuffer, bool inverse, int batchSize, int cSize, int xSize, int ySize,
+  float* inputBuf, float* inputScratchBuf
+) {
+  bool mirrorY = symmetriesBuffer[0];
+  bool mirrorX = symmetriesBuffer[1];
+  bool transpose = symmetriesBuffer[2] && xSize == ySize;
+  if(!mirrorY && !mirrorX && !transpose)
+    return;
+
+  size_t bufSize = (size_t)batchSize * ySize * xSize * cSize;
+  std::copy(inputBuf, inputBuf + bufSize, inputScratchBuf);
+
+  for(int n = 0; n<batchSize; n++) {
+    const float* src = inputScratchBuf + (size_t)n * ySize * xSize * cSize;
+    float* dst = inputBuf + (size_t)n * ySize * xSize * cSize;
+    for(int y = 0; y<ySize; y++) {
+      for(int x = 0; x<xSize; x++) {
+        int sy;
+        int sx;
+        if(!inverse) {
+          int ty = transpose ? x : y;
+          int tx = transpose ? y : x;
+          sy = mirrorY ? ySize-1-ty : ty;
+          sx = mirrorX ? xSize-1-tx : tx;
+        }
+        else {
+          int my = mirrorY ? ySize-1-y : y;
+          int mx = mirrorX ? xSize-1-x : x;
+          sy = transpose ? mx : my;
+          sx = transpose ? my : mx;
+        }
+        const float* s = src + ((size_t)sy * xSize + sx) * cSize;
+        std::copy(s, s + cSize, dst + ((size_t)y * xSize + x) * cSize);
+      }
+    }
+  }
+}
+
+static void fillMaskSumBuf(const float* maskBuf, float* maskSumBuf, int batchSize, int xSize, int ySize) {
+  for(int n = 0; n<batchSize; n++) {
+    float sum = 0.0f;
+    const float* mask = maskBuf + (size_t)n * xSize * ySize;
+    for(int xy = 0; xy<xSize*ySize; xy++)
+      sum += mask[xy];
+    maskSumBuf[n] = sum;
+  }
+}
+
+//---------------------------------------------------------------------------------
+
+//Winograd F(4x4,3x3) transform matrices, see Lavin & Gray, "Fast Algorithms for Convolutional Neural Networks".
+//A 6x6 input tile d and a 3x3 filter g produce a 4x4 output tile Y = AT * [(G g GT) .* (BT d B)] * A.
+static const int WINOGRAD_TILE = 6;
+static const int WINOGRAD_OUT = 4;
+static const int WINOGRAD_NUM_ELTS = WINOGRAD_TILE * WINOGRAD_TILE;
+
+static const double winogradG[6][3] = {
+  { 1.0/4.0,       0.0,      0.0},
+  {-1.0/6.0, -1.0/6.0, -1.0/6.0},
+  {-1.0/6.0,  1.0/6.0, -1.0/6.0},
+  {1.0/24.0, 1.0/12.0,  1.0/6.0},
+  {1.0/24.0,-1.0/12.0,  1.0/6.0},
+  {     0.0,       0.0,      1.0},
+};
+static const float winogradBT[6][6] = {
+  {4.0f,  0.0f, -5.0f,  0.0f, 1.0f, 0.0f},
+  {0.0f, -4.0f, -4.0f,  1.0f, 1.0f, 0.0f},
+  {0.0f,  4.0f, -4.0f, -1.0f, 1.0f, 0.0f},
+  {0.0f, -2.0f, -1.0f,  2.0f, 1.0f, 0.0f},
+  {0.0f,  2.0f, -1.0f, -2.0f, 1.0f, 0.0f},
+  {0.0f,  4.0f,  0.0f, -5.0f, 0.0f, 1.0f},
+};
+static const float winogradAT[4][6] = {
+  {1.0f, 1.0f,  1.0f, 1.0f,  1.0f, 0.0f},
+  {0.0f, 1.0f, -1.0f, 2.0f, -2.0f, 0.0f},
+  {0.0f, 1.0f,  1.0f, 4.0f,  4.0f, 0.0f},
+  {0.0f, 1.0f, -1.0f, 8.0f, -8.0f, 1.0f},
+};
+
+struct ConvLayer;
+
+//The ways a ConvLayer can compute in fp32
+static const int CONV_ALGORITHM_DIRECT = 0;
+static const int CONV_ALGORITHM_WINOGRAD = 1;
+static const int CONV_ALGORITHM_IM2COL = 2;
+static const int NUM_CONV_ALGORITHMS = 3;
+static const char* const convAlgorithmNames[NUM_CONV_ALGORITHMS] = {"direct", "winograd", "im2col"};
+
+//The fp32 algorithm of conv layers by batch size, as picked by autotuning. Layers not in it use their default.
+struct ConvTuning {
+  map<const ConvLayer*,vector<int>> algorithmByBatchSize;
+};
+
+//Running maximum of the absolute value of the input of every conv layer that it gets passed to, for picking
+//int8 activation scales.
+struct Int8Calibration {
+  map<const ConvLayer*,float> maxAbsInputs;
+
+  Int8Calibration() {}
+  Int8Calibration(const Int8Calibration&) = delete;
+  Int8Calibration& operator=(const Int8Calibration&) = delete;
+
+  void record(const ConvLayer* layer, const float* buf, size_t n) {
+    float maxAbs = 0.0f;
+    for(size_t i = 0; i<n; i++)
+      maxAbs = std::max(maxAbs, std::fabs(buf[i]));
+    float& recorded = maxAbsInputs[layer];
+    recorded = std::max(recorded, maxAbs);
+  }
+};
+
+//What a conv layer needs from the handle running it, besides its input and output.
+struct ConvContext {
+  float* workspaceBuf;
+  size_t workspaceFloats;
+  //Use the int8 path, for layers that have been calibrated
+  bool useINT8;
+  //If not null, record the input of every layer applied
+  Int8Calibration* calibration;
+  //If not null, the fp32 algorithms to use instead of the defaults
+  const ConvTuning* tuning;
+
+  ConvContext(float* wBuf, size_t wFloats, bool int8, Int8Calibration* calib, const ConvTuning* tun)
+    :workspaceBuf(wBuf),workspaceFloats(wFloats),useINT8(int8),calibration(calib),tuning(tun)
+  {}
+};
+
+struct ConvLayer {
+  string name;
+  int convYSize;
+  int convXSize;
+  int inChannels;
+  int outChannels;
+  int dilationY;
+  int dilationX;
+  int paddingY;
+  int paddingX;
+
+  //Winograd is only for undilated 3x3 convolutions, and is their default, with direct for everything else
+  bool canUseWinograd;
+  int defaultAlgorithm;
+  //The filters of each algorithm are only built once something is going to run it, see prepareAlgorithm
+  bool prepared[NUM_CONV_ALGORITHMS];
+  //Weights are read from here when preparing an algorithm, so it must outlive this layer
+  const ConvLayerDesc* desc;
+
+  //Direct path: one packed ic x oc matrix per filter tap, indexed by y * convXSize + x
+  vector<CpuKernels::PackedMatrix> filters;
+  //Winograd path: G g GT for every ic,oc, as 36 packed ic x oc matrices, one per element of the transformed tile
+  vector<CpuKernels::PackedMatrix> winogradFilters;
+  //Im2col path: all taps stacked into one (taps * ic) x oc matrix, for one gemm per batch element
+  CpuKernels::PackedMatrix im2colFilter;
+
+  //Int8 path: all taps stacked into one (taps * ic) x oc matrix in im2col order, quantized symmetrically with
+  //one scale per output channel. Only built by prepareInt8, for models that some handle runs in int8 mode.
+  CpuKernels::PackedMatrixInt8 int8Filter;
+  vector<float> int8FilterScales;
+  //Zero until setInt8InputScale is called, and then int8ColScales is the scale of each output column of the gemm
+  float int8InputScale;
+  vector<float> int8ColScales;
+
+  ConvLayer() = delete;
+  ConvLayer(const ConvLayer&) = delete;
+  ConvLayer& operator=(const ConvLayer&) = delete;
+
+  ConvLayer(const ConvLayerDesc* d) {
+    desc = d;
+    name = desc->name;
+    convYSize = desc->convYSize;
+    convXSize = desc->convXSize;
+    inChannels = desc->inChannels;
+    outChannels = desc->outChannels;
+    dilationY = desc->dilationY;
+    dilationX = desc->dilationX;
+    paddingX = (convXSize / 2) * dilationX;
+    paddingY = (convYSize / 2) * dilationY;
+
+    assert(convXSize % 2 == 1);
+    assert(convYSize % 2 == 1);
+    assert(desc->weights.size() == (size_t)convYSize * convXSize * inChannels * outChannels);
+
+    canUseWinograd = convYSize == 3 && convXSize == 3 && dilationY == 1 && dilationX == 1;
+    defaultAlgorithm = canUseWinograd ? CONV_ALGORITHM_WINOGRAD : CONV_ALGORITHM_DIRECT;
+    std::fill(prepared, prepared + NUM_CONV_ALGORITHMS, false);
+    prepareAlgorithm(defaultAlgorithm);
+    int8InputScale = 0.0f;
+  }
+
+  bool supportsAlgorithm(int algorithm) const {
+    if(algorithm == CONV_ALGORITHM_WINOGRAD)
+      return canUseWinograd;
+    //For 1x1 convolutions, im2col would be the direct path with an extra copy
+    if(algorithm == CONV_ALGORITHM_IM2COL)
+      return !(convYSize == 1 && convXSize == 1);
+    return algorithm == CONV_ALGORITHM_DIRECT;
+  }
+
+  //Builds the filters for algorithm, if not already built. Not threadsafe with other calls to this on the same layer,
+  //but is with apply by handles that don't use algorithm yet.
+  void prepareAlgorithm(int algorithm) {
+    assert(supportsAlgorithm(algorithm));
+    if(prepared[algorithm])
+      return;
+
+    if(algorithm == CONV_ALGORITHM_WINOGRAD) {
+      vector<float> winogradFilter((size_t)WINOGRAD_NUM_ELTS * inChannels * outChannels);
+      for(int oc = 0; oc<outChannels; oc++) {
+        for(int ic = 0; ic<inChannels; ic++) {
+          const float* g = desc->weights.data() + ((size_t)oc * inChannels + ic) * 9;
+          //tmp = G g, then U = tmp GT
+          double tmp[6][3];
+          for(int i = 0; i<6; i++)
+            for(int j = 0; j<3; j++)
+              tmp[i][j] = winogradG[i][0] * g[0*3+j] + winogradG[i][1] * g[1*3+j] + winogradG[i][2] * g[2*3+j];
+          for(int i = 0; i<6; i++) {
+            for(int j = 0; j<6; j++) {
+              double u = tmp[i][0] * winogradG[j][0] + tmp[i][1] * winogradG[j][1] + tmp[i][2] * winogradG[j][2];
+              winogradFilter[(((size_t)i * WINOGRAD_TILE + j) * inChannels + ic) * outChannels + oc] = (float)u;
+            }
+          }
+        }
+      }
+      for(int e = 0; e<WINOGRAD_NUM_ELTS; e++)
+        winogradFilters.emplace_back(winogradFilter.data() + (size_t)e * inChannels * outChannels, inChannels, outChannels, outChannels);
+    }
+    else {
+      //Reorder from oc,ic,y,x into y,x,ic,oc first, so that each filter tap is a contiguous ic x oc matrix,
+      //and all of them together are the im2col matrix
+      vector<float> filter(desc->weights.size());
+      for(int oc = 0; oc<outChannels; oc++) {
+        for(int ic = 0; ic<inChannels; ic++) {
+          for(int y = 0; y<convYSize; y++) {
+            for(int x = 0; x<convXSize; x++) {
+              size_t srcIdx = (((size_t)oc * inChannels + ic) * convYSize + y) * convXSize + x;
+              size_t dstIdx = (((size_t)y * convXSize + x) * inChannels + ic) * outChannels + oc;
+              filter[dstIdx] = desc->weights[srcIdx];
+            }
+          }
+        }
+      }
+      if(algorithm == CONV_ALGORITHM_IM2COL)
+        im2colFilter = CpuKernels::PackedMatrix(filter.data(), convYSize * convXSize * inChannels, outChannels, outChannels);
+      else {
+        for(int tap = 0; tap<convYSize * convXSize; tap++)
+          filters.emplace_back(filter.data() + (size_t)tap * inChannels * outChannels, inChannels, outChannels, outChannels);
+      }
+    }
+    prepared[algorithm] = true;
+  }
+
+  //Frees the filters of every fp32 algorithm, for layers that only handles in int8 mode still use.
+  //Not threadsafe with prepareAlgorithm, or with apply by handles that run this layer in fp32.
+  void releaseFP32Filters() {
+    filters = vector<CpuKernels::PackedMatrix>();
+    winogradFilters = vector<CpuKernels::PackedMatrix>();
+    im2colFilter = CpuKernels::PackedMatrix();
+    std::fill(prepared, prepared + NUM_CONV_ALGORITHMS, false);
+  }
+
+  //Builds the int8 filter, if not already built. Not threadsafe with the int8 path of apply.
+  void prepareInt8() {
+    if(int8FilterScales.size() > 0)
+      return;
+    const int numTaps = convYSize * convXSize;
+    vector<int8_t> quantized((size_t)numTaps * inChannels * outChannels);
+    int8FilterScales.resize(outChannels);
+    for(int oc = 0; oc<outChannels; oc++) {
+      const float* w = desc->weights.data() + (size_t)oc * inChannels * numTaps;
+      float maxAbs = 0.0f;
+      for(int i = 0; i<inChannels * numTaps; i++)
+        maxAbs = std::max(maxAbs, std::fabs(w[i]));
+      const float scale = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+      int8FilterScales[oc] = scale;
+      for(int ic = 0; ic<inChannels; ic++) {
+        for(int tap = 0; tap<numTaps; tap++)
+          quantized[((size_t)tap * inChannels + ic) * outChannels + oc] = (int8_t)std::lround(w[ic * numTaps + tap] / scale);
+      }
+    }
+    int8Filter = CpuKernels::PackedMatrixInt8(quantized.data(), numTaps * inChannels, outChannels, outChannels);
+  }
+
+  //Inputs are quantized symmetrically so that maxAbsInput maps to 127. Requires prepareInt8. Not threadsafe with apply.
+  void setInt8InputScale(float maxAbsInput) {
+    assert(int8FilterScales.size() > 0);
+    int8InputScale = maxAbsInput > 0.0f ? maxAbsInput / 127.0f : 1.0f;
+    int8ColScales.assign(int8Filter.colSums.size(), 0.0f);
+    for(int oc = 0; oc<outChannels; oc++)
+      int8ColScales[oc] = int8InputScale * int8FilterScales[oc];
+  }
+
+  //1x1 convolutions can run the gemm directly on the quantized input if its rows are already whole groups
+  bool int8NeedsIm2col() const {
+    return !(convYSize == 1 && convXSize == 1 && inChannels % CpuKernels::INT8_K_GROUP == 0);
+  }
+  //Same as int8Filter.paddedRows, but known before prepareInt8
+  int getInt8PaddedRows() const {
+    int numRows = convYSize * convXSize * inChannels;
+    return (numRows + CpuKernels::INT8_K_GROUP - 1) / CpuKernels::INT8_K_GROUP * CpuKernels::INT8_K_GROUP;
+  }
+
+  size_t requiredWorkspaceFloats(int batchSize, int xSize, int ySize) const {
+    size_t numPositions = (size_t)batchSize * ySize * xSize;
+    size_t int8Bytes = numPositions * inChannels;
+    if(int8NeedsIm2col())
+      int8Bytes += numPositions * getInt8PaddedRows();
+    size_t floats = (int8Bytes + sizeof(float) - 1) / sizeof(float);
+    //Enough for any algorithm, since tuning may pick a different one than for another handle of the same model
+    if(supportsAlgorithm(CONV_ALGORITHM_IM2COL))
+      floats = std::max(floats, (size_t)ySize * xSize * convYSize * convXSize * inChannels);
+    if(canUseWinograd) {
+      size_t numTiles = (size_t)batchSize * ((ySize + WINOGRAD_OUT - 1) / WINOGRAD_OUT) * ((xSize + WINOGRAD_OUT - 1) / WINOGRAD_OUT);
+      size_t maxChannels = std::max(inChannels, outChannels);
+      floats = std::max(floats, WINOGRAD_NUM_ELTS * (numTiles * inChannels + numTiles * outChannels + 2 * maxChannels));
+    }
+    return floats;
+  }
+
+  void apply(
+    int batchSize,
+    int xSize,
+    int ySize,
+    bool accumulate,
+    const float* inputBuf,
+    float* outputBuf,
+    const ConvContext& ctx
+  ) const {
+    if(ctx.calibration != NULL)
+      ctx.calibration->record(this, inputBuf, (size_t)batchSize * ySize * xSize * inChannels);
+    if(ctx.useINT8 && int8InputScale > 0.0f) {
+      applyInt8(batchSize,xSize,ySize,accumulate,inputBuf,outputBuf,ctx.workspaceBuf,ctx.workspaceFloats);
+      return;
+    }
+    int algorithm = defaultAlgorithm;
+    if(ctx.tuning != NULL) {
+      auto iter = ctx.tuning->algorithmByBatchSize.find(this);
+      if(iter != ctx.tuning->algorithmByBatchSize.end())
+        algorithm = iter->second[batchSize];
+    }
+    applyFP32(algorithm,batchSize,xSize,ySize,accumulate,inputBuf,outputBuf,ctx.workspaceBuf,ctx.workspaceFloats);
+  }
+
+  void applyFP32(
+    int algorithm,
+    int batchSize,
+    int xSize,
+    int ySize,
+    bool accumulate,
+    const float* inputBuf,
+    float* outputBuf,
+    float* workspaceBuf,
+    size_t workspaceFloats
+  ) const {
+    assert(prepared[algorithm]);
+    if(algorithm == CONV_ALGORITHM_WINOGRAD)
+      applyWinograd(batchSize,xSize,ySize,accumulate,inputBuf,outputBuf,workspaceBuf,workspaceFloats);
+    else if(algorithm == CONV_ALGORITHM_IM2COL)
+      applyIm2col(batchSize,xSize,ySize,accumulate,inputBuf,outputBuf,workspaceBuf,workspaceFloats);
+    else
+      applyDirect(batchSize,xSize,ySize,accumulate,inputBuf,outputBuf);
+  }
+
+  //One small gemm per filter tap and row of the board, each over the run of positions whose input is on the board
+  void applyDirect(
+    int batchSize,
+    int xSize,
+    int ySize,
+    bool accumulate,
+    const float* inputBuf,
+    float* outputBuf
+  ) const {
+    if(!accumulate)
+      std::fill(outputBuf, outputBuf + (size_t)batchSize * ySize * xSize * outChannels, 0.0f);
+
+    //1x1 convolutions are just one big matrix multiply over all positions
+    if(convYSize == 1 && convXSize == 1) {
+      CpuKernels::sgemmAccumulate(batchSize * ySize * xSize, inputBuf, inChannels, filters[0], outputBuf, outChannels);
+      return;
+    }
+
+    for(int n = 0; n<batchSize; n++) {
+      for(int y = 0; y<ySize; y++) {
+        for(int dy = 0; dy<convYSize; dy++) {
+          int iy = y + dy * dilationY - paddingY;
+          if(iy < 0 || iy >= ySize)
+            continue;
+          for(int dx = 0; dx<convXSize; dx++) {
+            int xOffset = dx * dilationX - paddingX;
+            int x0 = std::max(0, -xOffset);
+            int x1 = std::min(xSize, xSize - xOffset);
+            if(x1 <= x0)
+              continue;
+            const float* a = inputBuf + (((size_t)n * ySize + iy) * xSize + (x0 + xOffset)) * inChannels;
+            float* c = outputBuf + (((size_t)n * ySize + y) * xSize + x0) * outChannels;
+            CpuKernels::sgemmAccumulate(x1 - x0, a, inChannels, filters[dy * convXSize + dx], c, outChannels);
+          }
+        }
+      }
+    }
+  }
+
+  //Gathers every position's receptive field into one row of an im2col matrix, with zeros for out-of-board taps,
+  //and does one gemm for each batch element. Fewer and larger gemms than the direct path, for the cost of the copy.
+  void applyIm2col(
+    int batchSize,
+    int xSize,
+    int ySize,
+    bool accumulate,
+    const float* inputBuf,
+    float* outputBuf,
+    float* workspaceBuf,
+    size_t workspaceFloats
+  ) const {
+    (void)workspaceFloats;
+    assert(workspaceFloats >= requiredWorkspaceFloats(batchSize,xSize,ySize));
+
+    const size_t xySize = (size_t)ySize * xSize;
+    const int lda = convYSize * convXSize * inChannels;
+    if(!accumulate)
+      std::fill(outputBuf, outputBuf + batchSize * xySize * outChannels, 0.0f);
+    for(int n = 0; n<batchSize; n++) {
+      const float* in = inputBuf + n * xySize * inChannels;
+      for(int y = 0; y<ySize; y++) {
+        for(int x = 0; x<xSize; x++) {
+          float* row = workspaceBuf + ((size_t)y * xSize + x) * lda;
+          for(int dy = 0; dy<convYSize; dy++) {
+            int iy = y + dy * dilationY - paddingY;
+            for(int dx = 0; dx<convXSize; dx++) {
+              int ix = x + dx * dilationX - paddingX;
+              float* dst = row + (size_t)(dy * convXSize + dx) * inChannels;
+              if(iy < 0 || iy >= ySize || ix < 0 || ix >= xSize)
+                std::fill(dst, dst + inChannels, 0.0f);
+              else {
+                const float* src = in + ((size_t)iy * xSize + ix) * inChannels;
+                std::copy(src, src + inChannels, dst);
+              }
+            }
+          }
+        }
+      }
+      CpuKernels::sgemmAccumulate((int)xySize, workspaceBuf, lda, im2colFilter, outputBuf + n * xySize * outChannels, outChannels);
+    }
+  }
+
+  //Quantizes the input, gathers every position's receptive field into one row of an im2col matrix, with out-of-board
+  //taps as the zero point, and then does one int8 gemm for the whole batch.
+  void applyInt8(
+    int batchSize,
+    int xSize,
+    int ySize,
+    bool accumulate,
+    const float* inputBuf,
+    float* outputBuf,
+    float* workspaceBuf,
+    size_t workspaceFloats
+  ) const {
+    (void)workspaceFloats;
+    assert(workspaceFloats >= requiredWorkspaceFloats(batchSize,xSize,ySize));
+
+    const size_t numPositions = (size_t)batchSize * ySize * xSize;
+    uint8_t* quantizedIn = (uint8_t*)workspaceBuf;
+    CpuKernels::quantizeU8(numPositions * inChannels, inputBuf, 1.0f / int8InputScale, quantizedIn);
+
+    const uint8_t* a = quantizedIn;
+    int lda = inChannels;
+    if(int8NeedsIm2col()) {
+      uint8_t* cols = quantizedIn + numPositions * inChannels;
+      const int numTaps = convYSize * convXSize;
+      lda = int8Filter.paddedRows;
+      for(int n = 0; n<batchSize; n++) {
+        for(int y = 0; y<ySize; y++) {
+          for(int x = 0; x<xSize; x++) {
+            uint8_t* row = cols + (((size_t)n * ySize + y) * xSize + x) * lda;
+            for(int dy = 0; dy<convYSize; dy++) {
+              int iy = y + dy * dilationY - paddingY;
+              for(int dx = 0; dx<convXSize; dx++) {
+                int ix = x + dx * dilationX - paddingX;
+                uint8_t* dst = row + (size_t)(dy * convXSize + dx) * inChannels;
+                if(iy < 0 || iy >= ySize || ix < 0 || ix >= xSize)
+                  std::fill(dst, dst + inChannels, (uint8_t)CpuKernels::INT8_ZERO_POINT);
+                else {
+                  const uint8_t* src = quantizedIn + (((size_t)n * ySize + iy) * xSize + ix) * inChannels;
+                  std::copy(src, src + inChannels, dst);
+                }
+              }
+            }
+            std::fill(row + (size_t)numTaps * inChannels, row + lda, (uint8_t)CpuKernels::INT8_ZERO_POINT);
+          }
+        }
+      }
+      a = cols;
+    }
+
+    if(!accumulate)
+      std::fill(outputBuf, outputBuf + numPositions * outChannels, 0.0f);
+    CpuKernels::gemmU8S8Accumulate((int)numPositions, a, lda, int8Filter, int8ColScales.data(), outputBuf, outChannels);
+  }
+
+  //The board is covered by 4x4 output tiles, each reading a 6x6 input tile that overhangs the tile by one on each side,
+  //with zero padding beyond the board edge. Tiles overhanging the far edge of the board are cropped on output.
+  void applyWinograd(
+    int batchSize,
+    int xSize,
+    int ySize,
+    bool accumulate,
+    const float* inputBuf,
+    float* outputBuf,
+    float* workspaceBuf,
+    size_t workspaceFloats
+  ) const {
+    (void)workspaceFloats;
+    assert(workspaceFloats >= requiredWorkspaceFloats(batchSize,xSize,ySize));
+
+    const int tilesY = (ySize + WINOGRAD_OUT - 1) / WINOGRAD_OUT;
+    const int tilesX = (xSize + WINOGRAD_OUT - 1) / WINOGRAD_OUT;
+    const int numTiles = batchSize * tilesY * tilesX;
+    const int maxChannels = std::max(inChannels, outChannels);
+
+    //transformedIn is 36 matrices of numTiles x ic, transformedOut is 36 matrices of numTiles x oc
+    float* transformedIn = workspaceBuf;
+    float* transformedOut = transformedIn + (size_t)WINOGRAD_NUM_ELTS * numTiles * inChannels;
+    float* tile = transformedOut + (size_t)WINOGRAD_NUM_ELTS * numTiles * outChannels;
+    float* tmp = tile + (size_t)WINOGRAD_NUM_ELTS * maxChannels;
+
+    //Input transform, V = BT d B for each channel
+    for(int n = 0; n<batchSize; n++) {
+      for(int ty = 0; ty<tilesY; ty++) {
+        for(int tx = 0; tx<tilesX; tx++) {
+          const int tileIdx = (n * tilesY + ty) * tilesX + tx;
+          for(int i = 0; i<WINOGRAD_TILE; i++) {
+            int y = ty * WINOGRAD_OUT - 1 + i;
+            for(int j = 0; j<WINOGRAD_TILE; j++) {
+              int x = tx * WINOGRAD_OUT - 1 + j;
+              float* d = tile + (size_t)(i * WINOGRAD_TILE + j) * inChannels;
+              if(y < 0 || y >= ySize || x < 0 || x >= xSize)
+                std::fill(d, d + inChannels, 0.0f);
+              else {
+                const float* src = inputBuf + (((size_t)n * ySize + y) * xSize + x) * inChannels;
+                std::copy(src, src + inChannels, d);
+              }
+            }
+          }
+          //tmp = BT d
+          for(int i = 0; i<WINOGRAD_TILE; i++) {
+            for(int j = 0; j<WINOGRAD_TILE; j++) {
+              float* t = tmp + (size_t)(i * WINOGRAD_TILE + j) * inChannels;
+              std::fill(t, t + inChannels, 0.0f);
+              for(int k = 0; k<WINOGRAD_TILE; k++) {
+                const float coeff = winogradBT[i][k];
+                if(coeff == 0.0f)
+                  continue;
+                const float* d = tile + (size_t)(k * WINOGRAD_TILE + j) * inChannels;
+                for(int c = 0; c<inChannels; c++)
+                  t[c] += coeff * d[c];
+              }
+            }
+          }
+          //V = tmp B
+          for(int i = 0; i<WINOGRAD_TILE; i++) {
+            for(int j = 0; j<WINOGRAD_TILE; j++) {
+              float* v = transformedIn + ((size_t)(i * WINOGRAD_TILE + j) * numTiles + tileIdx) * inChannels;
+              std::fill(v, v + inChannels, 0.0f);
+              for(int k = 0; k<WINOGRAD_TILE; k++) {
+                const float coeff = winogradBT[j][k];
+                if(coeff == 0.0f)
+                  continue;
+                const float* t = tmp + (size_t)(i * WINOGRAD_TILE + k) * inChannels;
+                for(int c = 0; c<inChannels; c++)
+                  v[c] += coeff * t[c];
+              }
+            }
+          }
+        }
+      }
+    }
+
+    //Elementwise product in the transformed domain, summed over input channels, is one matrix multiply per tile element
+    std::fill(transformedOut, transformedOut + (size_t)WINOGRAD_NUM_ELTS * numTiles * outChannels, 0.0f);
+    for(int e = 0; e<WINOGRAD_NUM_ELTS; e++) {
+      CpuKernels::sgemmAccumulate(
+        numTiles,
+        transformedIn + (size_t)e * numTiles * inChannels, inChannels,
+        winogradFilters[e],
+        transformedOut + (size_t)e * numTiles * outChannels, outChannels
+      );
+    }
+
+    //Output transform, Y = AT M A for each channel
+    for(int n = 0; n<batchSize; n++) {
+      for(int ty = 0; ty<tilesY; ty++) {
+        for(int tx = 0; tx<tilesX; tx++) {
+          const int tileIdx = (n * tilesY + ty) * tilesX + tx;
+          //tmp = AT M, a 4x6 matrix of channel vectors
+          for(int i = 0; i<WINOGRAD_OUT; i++) {
+            for(int j = 0; j<WINOGRAD_TILE; j++) {
+              float* t = tmp + (size_t)(i * WINOGRAD_TILE + j) * outChannels;
+              std::fill(t, t + outChannels, 0.0f);
+              for(int k = 0; k<WINOGRAD_TILE; k++) {
+                const float coeff = winogradAT[i][k];
+                if(coeff == 0.0f)
+                  continue;
+                const float* m = transformedOut + ((size_t)(k * WINOGRAD_TILE + j) * numTiles + tileIdx) * outChannels;
+                for(int c = 0; c<outChannels; c++)
+                  t[c] += coeff * m[c];
+              }
+            }
+          }
+          //Y = tmp A, written straight to the output with cropping
+          for(int i = 0; i<WINOGRAD_OUT; i++) {
+            int y = ty * WINOGRAD_OUT + i;
+            if(y >= ySize)
+              break;
+            for(int j = 0; j<WINOGRAD_OUT; j++) {
+              int x = tx * WINOGRAD_OUT + j;
+              if(x >= xSize)
+                break;
+              float* out = outputBuf + (((size_t)n * ySize + y) * xSize + x) * outChannels;
+              if(!accumulate)
+                std::fill(out, out + outChannels, 0.0f);
+              for(int k = 0; k<WINOGRAD_TILE; k++) {
+                const float coeff = winogradAT[j][k];
+                if(coeff == 0.0f)
+                  continue;
+                const float* t = tmp + (size_t)(i * WINOGRAD_TILE + k) * outChannels;
+                for(int c = 0; c<outChannels; c++)
+                  out[c] += coeff * t[c];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+};
+
+//---------------------------------------------------------------------------------
+
+struct BatchNormLayer {
+  string name;
+  int numChannels;
+  float epsilon;
+
+  vector<float> mergedScale;
+  vector<float> mergedBias;
+
+  BatchNormLayer() = delete;
+  BatchNormLayer(const BatchNormLayer&) = delete;
+  BatchNormLayer& operator=(const BatchNormLayer&) = delete;
+
+  BatchNormLayer(const BatchNormLayerDesc* desc) {
+    name = desc->name;
+    numChannels = desc->numChannels;
+    epsilon = desc->epsilon;
+
+    assert(desc->mean.size() == numChannels);
+    assert(desc->variance.size() == numChannels);
+    assert(desc->scale.size() == numChannels);
+    assert(desc->bias.size() == numChannels);
+
+    mergedScale.resize(numChannels);
+    mergedBias.resize(numChannels);
+    for(int i = 0; i<numChannels; i++) {
+      mergedScale[i] = desc->scale[i] / sqrt(desc->variance[i] + epsilon);
+      mergedBias[i] = desc->bias[i] - mergedScale[i] * desc->mean[i];
+    }
+  }
+
+  void apply(
+    int batchSize,
+    int xSize,
+    int ySize,
+    bool applyRelu,
+    const float* inputBuf,
+    const float* maskBuf, //ok to be null
+    float* outputBuf
+  ) const {
+    size_t numPositions = (size_t)batchSize * ySize * xSize;
+    CpuKernels::scaleBiasMaskRelu(
+      numPositions, numChannels, inputBuf, mergedScale.data(), mergedBias.data(), maskBuf, applyRelu, outputBuf
+    );
+  }
+
+};
+
+//---------------------------------------------------------------------------------
+
+struct MatMulLayer {
+  string name;
+  int inChannels;
+  int outChannels;
+  CpuKernels::PackedMatrix weights;
+
+  MatMulLayer() = delete;
+  MatMulLayer(const MatMulLayer&) = delete;
+  MatMulLayer& operator=(const MatMulLayer&) = delete;
+
+  MatMulLayer(const MatMulLayerDesc* desc) {
+    name = desc->name;
+    inChannels = desc->inChannels;
+    outChannels = desc->outChannels;
+    assert(desc->weights.size() == (size_t)inChannels * outChannels);
+    weights = CpuKernels::PackedMatrix(desc->weights.data(), inChannels, outChannels, outChannels);
+  }
+
+  void apply(int batchSize, const float* inputBuf, float* outputBuf) const {
+    std::fill(outputBuf, outputBuf + (size_t)batchSize * outChannels, 0.0f);
+    CpuKernels::sgemmAccumulate(batchSize, inputBuf, inChannels, weights, outputBuf, outChannels);
+  }
+
+};
+
+//---------------------------------------------------------------------------------
+
+struct MatBiasLayer {
+  string name;
+  int numChannels;
+  vector<float> weights;
+
+  MatBiasLayer() = delete;
+  MatBiasLayer(const MatBiasLayer&) = delete;
+  MatBiasLayer& operator=(const MatBiasLayer&) = delete;
+
+  MatBiasLayer(const MatBiasLayerDesc* desc) {
+    name = desc->name;
+    numChannels = desc->numChannels;
+    assert(desc->weights.size() == numChannels);
+    weights = desc->weights;
+  }
+
+  void apply(int batchSize, bool applyRelu, float* buf) const {
+    for(int n = 0; n<batchSize; n++) {
+      float* row = buf + (size_t)n * numChannels;
+      for(int c = 0; c<numChannels; c++) {
+        float x = row[c] + weights[c];
+        row[c] = applyRelu ? std::max(x, 0.0f) : x;
+      }
+    }
+  }
+
+};
+
+//---------------------------------------------------------------------------------
+
+struct ResidualBlock {
+  string name;
+  BatchNormLayer preBN;
+  ConvLayer regularConv;
+  BatchNormLayer midBN;
+  ConvLayer finalConv;
+
+  ResidualBlock() = delete;
+  ResidualBlock(const ResidualBlock&) = delete;
+  ResidualBlock& operator=(const ResidualBlock&) = delete;
+
+  ResidualBlock(const ResidualBlockDesc* desc)
+    :name(desc->name),
+     preBN(&desc->preBN),
+     regularConv(&desc->regularConv),
+     midBN(&desc->midBN),
+     finalConv(&desc->finalConv)
+  {}
+
+  size_t requiredWorkspaceFloats(int batchSize, int xSize, int ySize) const {
+    size_t floats = 0;
+    floats = std::max(floats, regularConv.requiredWorkspaceFloats(batchSize,xSize,ySize));
+    floats = std::max(floats, finalConv.requiredWorkspaceFloats(batchSize,xSize,ySize));
+    return floats;
+  }
+
+  void apply(
+    int batchSize,
+    int xSize,
+    int ySize,
+    float* trunkBuf,
+    float* trunkScratchBuf,
+    float* midInBuf,
+    float* midScratchBuf,
+    const float* maskBuf,
+    const ConvContext& ctx
+  ) const {
+    bool applyBNRelu = true;
+    preBN.apply(batchSize,xSize,ySize,applyBNRelu,trunkBuf,maskBuf,trunkScratchBuf);
+    regularConv.apply(batchSize,xSize,ySize,false,trunkScratchBuf,midInBuf,ctx);
+    midBN.apply(batchSize,xSize,ySize,applyBNRelu,midInBuf,maskBuf,midScratchBuf);
+    finalConv.apply(batchSize,xSize,ySize,true,midScratchBuf,trunkBuf,ctx);
+  }
+
+};
+
+//---------------------------------------------------------------------------------
+
+struct DilatedResidualBlock {
+  string name;
+  BatchNormLayer preBN;
+  ConvLayer regularConv;
+  ConvLayer dilatedConv;
+  BatchNormLayer midBN;
+  ConvLayer finalConv;
+
+  int regularChannels;
+  int dilatedChannels;
+
+  DilatedResidualBlock() = delete;
+  DilatedResidualBlock(const DilatedResidualBlock&) = delete;
+  DilatedResidualBlock& operator=(const DilatedResidualBlock&) = delete;
+
+  DilatedResidualBlock(const DilatedResidualBlockDesc* desc)
+    :name(desc->name),
+     preBN(&desc->preBN),
+     regularConv(&desc->regularConv),
+     dilatedConv(&desc->dilatedConv),
+     midBN(&desc->midBN),
+     finalConv(&desc->finalConv),
+     regularChannels(desc->regularConv.outChannels),
+     dilatedChannels(desc->dilatedConv.outChannels)
+  {}
+
+  size_t requiredWorkspaceFloats(int batchSize, int xSize, int ySize) const {
+    size_t floats = 0;
+    floats = std::max(floats, regularConv.requiredWorkspaceFloats(batchSize,xSize,ySize));
+    floats = std::max(floats, dilatedConv.requiredWorkspaceFloats(batchSize,xSize,ySize));
+    floats = std::max(floats, finalConv.requiredWorkspaceFloats(batchSize,xSize,ySize));
+    return floats;
+  }
+
+  void apply(
+    int batchSize,
+    int xSize,
+    int ySize,
+    float* trunkBuf,
+    float* trunkScratchBuf,
+    float* regularOutBuf,
+    float* dilatedOutBuf,
+    float* midInBuf,
+    float* midScratchBuf,
+    const float* maskBuf,
+    const ConvContext& ctx
+  ) const {
+    bool applyBNRelu = true;
+    preBN.apply(batchSize,xSize,ySize,applyBNRelu,trunkBuf,maskBuf,trunkScratchBuf);
+    regularConv.apply(batchSize,xSize,ySize,false,trunkScratchBuf,regularOutBuf,ctx);
+    dilatedConv.apply(batchSize,xSize,ySize,false,trunkScratchBuf,dilatedOutBuf,ctx);
+
+    size_t numPositions = (size_t)batchSize * ySize * xSize;
+    int midChannels = regularChannels + dilatedChannels;
+    for(size_t pos = 0; pos<numPositions; pos++) {
+      std::copy(regularOutBuf + pos * regularChannels, regularOutBuf + (pos+1) * regularChannels, midInBuf + pos * midChannels);
+      std::copy(dilatedOutBuf + pos * dilatedChannels, dilatedOutBuf + (pos+1) * dilatedChannels, midInBuf + pos * midChannels + regularChannels);
+    }
+
+    midBN.apply(batchSize,xSize,ySize,applyBNRelu,midInBuf,maskBuf,midScratchBuf);
+    finalConv.apply(batchSize,xSize,ySize,true,midScratchBuf,trunkBuf,ctx);
+  }
+
+};
+
+//---------------------------------------------------------------------------------
+
+struct GlobalPoolingResidualBlock {
+  string name;
+  BatchNormLayer preBN;
+  ConvLayer regularConv;
+  ConvLayer gpoolConv;
+  BatchNormLayer gpoolBN;
+  MatMulLayer gpoolToBiasMul;
+  BatchNormLayer midBN;
+  ConvLayer finalConv;
+
+  int regularChannels;
+  int gpoolChannels;
+
+  GlobalPoolingResidualBlock() = delete;
+  GlobalPoolingResidualBlock(const GlobalPoolingResidualBlock&) = delete;
+  GlobalPoolingResidualBlock& operator=(const GlobalPoolingResidualBlock&) = delete;
+
+  GlobalPoolingResidualBlock(const GlobalPoolingResidualBlockDesc* desc)
+    :name(desc->name),
+     preBN(&desc->preBN),
+     regularConv(&desc->regularConv),
+     gpoolConv(&desc->gpoolConv),
+     gpoolBN(&desc->gpoolBN),
+     gpoolToBiasMul(&desc->gpoolToBiasMul),
+     midBN(&desc->midBN),
+     finalConv(&desc->finalConv),
+     regularChannels(desc->regularConv.outChannels),
+     gpoolChannels(desc->gpoolConv.outChannels)
+  {}
+
+  size_t requiredWorkspaceFloats(int batchSize, int xSize, int ySize) const {
+    size_t floats = 0;
+    floats = std::max(floats, regularConv.requiredWorkspaceFloats(batchSize,xSize,ySize));
+    floats = std::max(floats, gpoolConv.requiredWorkspaceFloats(batchSize,xSize,ySize));
+    floats = std::max(floats, finalConv.requiredWorkspaceFloats(batchSize,xSize,ySize));
+    return floats;
+  }
+
+  void apply(
+    int batchSize,
+    int xSize,
+    int ySize,
+    float* trunkBuf,
+    float* trunkScratchBuf,
+    float* regularOutBuf,
+    float* gpoolOutBuf,
+    float* gpoolOutBuf2,
+    float* gpoolConcatBuf,
+    float* gpoolBiasBuf,
+    float* regularScratchBuf,
+    const float* maskBuf,
+    const float* maskSumBuf,
+    const ConvContext& ctx
+  ) const {
+    bool applyBNRelu = true;
+    preBN.apply(batchSize,xSize,ySize,applyBNRelu,trunkBuf,maskBuf,trunkScratchBuf);
+    regularConv.apply(batchSize,xSize,ySize,false,trunkScratchBuf,regularOutBuf,ctx);
+    gpoolConv.apply(batchSize,xSize,ySize,false,trunkScratchBuf,gpoolOutBuf,ctx);
+    gpoolBN.apply(batchSize,xSize,ySize,applyBNRelu,gpoolOutBuf,maskBuf,gpoolOutBuf2);
+
+    poolRowsGPoolNHWC(gpoolOutBuf2,gpoolConcatBuf,batchSize,xSize*ySize,gpoolChannels,maskSumBuf);
+    gpoolToBiasMul.apply(batchSize,gpoolConcatBuf,gpoolBiasBuf);
+    addNCBiasInplaceNHWC(regularOutBuf,gpoolBiasBuf,batchSize,xSize*ySize,regularChannels);
+
+    midBN.apply(batchSize,xSize,ySize,applyBNRelu,regularOutBuf,maskBuf,regularScratchBuf);
+    finalConv.apply(batchSize,xSize,ySize,true,regularScratchBuf,trunkBuf,ctx);
+  }
+
+};
+
+//------------------------------------------------------------------------------
+
+struct Buffers;
+
+//Attributes the time between consecutive laps to the layers of a profile, if profiling
+struct LayerTimer {
+  vector<NNLayerProfile>* profile;
+  int batchSize;
+  std::chrono::steady_clock::time_point lastTime;
+
+  LayerTimer(vector<NNLayerProfile>* p, int b)
+    :profile(p),batchSize(b),lastTime()
+  {
+    if(profile != NULL)
+      lastTime = std::chrono::steady_clock::now();
+  }
+
+  void lap(size_t layerIdx) {
+    if(profile == NULL)
+      return;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    assert(layerIdx < profile->size());
+    NNProfile::record((*profile)[layerIdx], batchSize, std::chrono::duration<double>(now - lastTime).count());
+    lastTime = now;
+  }
+};
+
+struct Trunk {
+  string name;
+  int version;
+  int numBlocks;
+  int trunkNumChannels;
+  int midNumChannels;
+  int regularNumChannels;
+  int dilatedNumChannels;
+  int gpoolNumChannels;
+
+  ConvLayer* initialConv;
+  MatMulLayer* initialMatMul;
+  vector<pair<int,void*>> blocks;
+  BatchNormLayer* trunkTipBN;
+
+  Trunk() = delete;
+  Trunk(const Trunk&) = delete;
+  Trunk& operator=(const Trunk&) = delete;
+
+  Trunk(const TrunkDesc* desc) {
+    name = desc->name;
+    version = desc->version;
+    numBlocks = desc->numBlocks;
+    trunkNumChannels = desc->trunkNumChannels;
+    midNumChannels = desc->midNumChannels;
+    regularNumChannels = desc->regularNumChannels;
+    dilatedNumChannels = desc->dilatedNumChannels;
+    gpoolNumChannels = desc->gpoolNumChannels;
+
+    initialConv = new ConvLayer(&desc->initialConv);
+    initialMatMul = new MatMulLayer(&desc->initialMatMul);
+    trunkTipBN = new BatchNormLayer(&desc->trunkTipBN);
+
+    assert(desc->blocks.size() == numBlocks);
+    for(int i = 0; i<numBlocks; i++) {
+      if(desc->blocks[i].first == ORDINARY_BLOCK_KIND) {
+        ResidualBlockDesc* blockDesc = (ResidualBlockDesc*)desc->blocks[i].second;
+        ResidualBlock* block = new ResidualBlock(blockDesc);
+        blocks.push_back(make_pair(ORDINARY_BLOCK_KIND,(void*)block));
+      }
+      else if(desc->blocks[i].first == DILATED_BLOCK_KIND) {
+        DilatedResidualBlockDesc* blockDesc = (DilatedResidualBlockDesc*)desc->blocks[i].second;
+        DilatedResidualBlock* block = new DilatedResidualBlock(blockDesc);
+        blocks.push_back(make_pair(DILATED_BLOCK_KIND,(void*)block));
+      }
+      else if(desc->blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+        GlobalPoolingResidualBlockDesc* blockDesc = (GlobalPoolingResidualBlockDesc*)desc->blocks[i].second;
+        GlobalPoolingResidualBlock* block = new GlobalPoolingResidualBlock(blockDesc);
+        blocks.push_back(make_pair(GLOBAL_POOLING_BLOCK_KIND,(void*)block));
+      }
+      else {
+        ASSERT_UNREACHABLE;
+      }
+    }
+  }
+
+  ~Trunk() {
+    for(int i = 0; i<blocks.size(); i++) {
+      if(blocks[i].first == ORDINARY_BLOCK_KIND) {
+        ResidualBlock* block = (ResidualBlock*)blocks[i].second;
+        delete block;
+      }
+      else if(blocks[i].first == DILATED_BLOCK_KIND) {
+        DilatedResidualBlock* block = (DilatedResidualBlock*)blocks[i].second;
+        delete block;
+      }
+      else if(blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+        GlobalPoolingResidualBlock* block = (GlobalPoolingResidualBlock*)blocks[i].second;
+        delete block;
+      }
+    }
+    delete initialConv;
+    delete initialMatMul;
+    delete trunkTipBN;
+  }
+
+  size_t requiredWorkspaceFloats(int batchSize, int xSize, int ySize) const {
+    size_t floats = initialConv->requiredWorkspaceFloats(batchSize,xSize,ySize);
+    for(int i = 0; i<blocks.size(); i++) {
+      if(blocks[i].first == ORDINARY_BLOCK_KIND) {
+        ResidualBlock* block = (ResidualBlock*)blocks[i].second;
+        floats = std::max(floats, block->requiredWorkspaceFloats(batchSize,xSize,ySize));
+      }
+      else if(blocks[i].first == DILATED_BLOCK_KIND) {
+        DilatedResidualBlock* block = (DilatedResidualBlock*)blocks[i].second;
+        floats = std::max(floats, block->requiredWorkspaceFloats(batchSize,xSize,ySize));
+      }
+      else if(blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+        GlobalPoolingResidualBlock* block = (GlobalPoolingResidualBlock*)blocks[i].second;
+        floats = std::max(floats, block->requiredWorkspaceFloats(batchSize,xSize,ySize));
+      }
+      else {
+        ASSERT_UNREACHABLE;
+      }
+    }
+    return floats;
+  }
+
+  //The convolutions that run in int8 in int8 mode. The initial conv and the heads always stay in fp32, they are
+  //a small part of the compute and the closest to the inputs and outputs.
+  vector<ConvLayer*> getInt8Convs() const {
+    vector<ConvLayer*> convs;
+    for(int i = 0; i<blocks.size(); i++) {
+      if(blocks[i].first == ORDINARY_BLOCK_KIND) {
+        ResidualBlock* block = (ResidualBlock*)blocks[i].second;
+        convs.push_back(&block->regularConv);
+        convs.push_back(&block->finalConv);
+      }
+      else if(blocks[i].first == DILATED_BLOCK_KIND) {
+        DilatedResidualBlock* block = (DilatedResidualBlock*)blocks[i].second;
+        convs.push_back(&block->regularConv);
+        convs.push_back(&block->dilatedConv);
+        convs.push_back(&block->finalConv);
+      }
+      else if(blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+        GlobalPoolingResidualBlock* block = (GlobalPoolingResidualBlock*)blocks[i].second;
+        convs.push_back(&block->regularConv);
+        convs.push_back(&block->gpoolConv);
+        convs.push_back(&block->finalConv);
+      }
+      else {
+        ASSERT_UNREACHABLE;
+      }
+    }
+    return convs;
+  }
+
+  //Laps layerTimer after the initial layers, each block and the tip, as layers 0 to numBlocks+1
+  void apply(int batchSize, int xSize, int ySize, const float* inputBuf, const float* inputGlobalBuf, const float* maskBuf, const float* maskSumBuf, Buffers& buffers, LayerTimer& layerTimer) const;
+
+};
+
+//------------------------------------------------------------------------------
+
+struct PolicyHead {
+  string name;
+  int version;
+  int p1Channels;
+  int g1Channels;
+  int p2Channels;
+
+  ConvLayer* p1Conv;
+  ConvLayer* g1Conv;
+  BatchNormLayer* g1BN;
+  MatMulLayer* gpoolToBiasMul;
+  BatchNormLayer* p1BN;
+  ConvLayer* p2Conv;
+  MatMulLayer* gpoolToPassMul;
+
+  PolicyHead() = delete;
+  PolicyHead(const PolicyHead&) = delete;
+  PolicyHead& operator=(const PolicyHead&) = delete;
+
+  PolicyHead(const PolicyHeadDesc* desc) {
+    name = desc->name;
+    version = desc->version;
+    p1Channels = desc->p1Conv.outChannels;
+    g1Channels = desc->g1Conv.outChannels;
+    p2Channels = desc->p2Conv.outChannels;
+
+    p1Conv = new ConvLayer(&desc->p1Conv);
+    g1Conv = new ConvLayer(&desc->g1Conv);
+    g1BN = new BatchNormLayer(&desc->g1BN);
+    gpoolToBiasMul = new MatMulLayer(&desc->gpoolToBiasMul);
+    p1BN = new BatchNormLayer(&desc->p1BN);
+    p2Conv = new ConvLayer(&desc->p2Conv);
+    gpoolToPassMul = new MatMulLayer(&desc->gpoolToPassMul);
+  }
+
+  ~PolicyHead() {
+    delete p1Conv;
+    delete g1Conv;
+    delete g1BN;
+    delete gpoolToBiasMul;
+    delete p1BN;
+    delete p2Conv;
+    delete gpoolToPassMul;
+  }
+
+  size_t requiredWorkspaceFloats(int batchSize, int xSize, int ySize) const {
+    size_t floats = 0;
+    floats = std::max(floats, p1Conv->requiredWorkspaceFloats(batchSize,xSize,ySize));
+    floats = std::max(floats, g1Conv->requiredWorkspaceFloats(batchSize,xSize,ySize));
+    floats = std::max(floats, p2Conv->requiredWorkspaceFloats(batchSize,xSize,ySize));
+    return floats;
+  }
+
+  void apply(int batchSize, int xSize, int ySize, const bool* symmetriesBuffer, const float* maskBuf, const float* maskSumBuf, Buffers& buffers, float* policyBuf) const;
+
+};
+
+//------------------------------------------------------------------------------
+
+struct ValueHead {
+  string name;
+  int version;
+  int v1Channels;
+  int v2Channels;
+  int valueChannels;
+  int scoreValueChannels;
+  int ownershipChannels;
+
+  ConvLayer* v1Conv;
+  BatchNormLayer* v1BN;
+  MatMulLayer* v2Mul;
+  MatBiasLayer* v2Bias;
+  MatMulLayer* v3Mul;
+  MatBiasLayer* v3Bias;
+  MatMulLayer* sv3Mul;
+  MatBiasLayer* sv3Bias;
+  ConvLayer* vOwnershipConv;
+
+  ValueHead() = delete;
+  ValueHead(const ValueHead&) = delete;
+  ValueHead& operator=(const ValueHead&) = delete;
+
+  ValueHead(const ValueHeadDesc* desc) {
+    name = desc->name;
+    version = desc->version;
+    v1Channels = desc->v1Conv.outChannels;
+    v2Channels = desc->v2Mul.outChannels;
+    valueChannels = desc->v3Mul.outChannels;
+    scoreValueChannels = desc->sv3Mul.outChannels;
+    ownershipChannels = desc->vOwnershipConv.outChannels;
+
+    v1Conv = new ConvLayer(&desc->v1Conv);
+    v1BN = new BatchNormLayer(&desc->v1BN);
+    v2Mul = new MatMulLayer(&desc->v2Mul);
+    v2Bias = new MatBiasLayer(&desc->v2Bias);
+    v3Mul = new MatMulLayer(&desc->v3Mul);
+    v3Bias = new MatBiasLayer(&desc->v3Bias);
+    sv3Mul = new MatMulLayer(&desc->sv3Mul);
+    sv3Bias = new MatBiasLayer(&desc->sv3Bias);
+    vOwnershipConv = new ConvLayer(&desc->vOwnershipConv);
+  }
+
+  ~ValueHead() {
+    delete v1Conv;
+    delete v1BN;
+    delete v2Mul;
+    delete v2Bias;
+    delete v3Mul;
+    delete v3Bias;
+    delete sv3Mul;
+    delete sv3Bias;
+    delete vOwnershipConv;
+  }
+
+  size_t requiredWorkspaceFloats(int batchSize, int xSize, int ySize) const {
+    size_t floats = 0;
+    floats = std::max(floats, v1Conv->requiredWorkspaceFloats(batchSize,xSize,ySize));
+    floats = std::max(floats, vOwnershipConv->requiredWorkspaceFloats(batchSize,xSize,ySize));
+    return floats;
+  }
+
+  void apply(
+    int batchSize, int xSize, int ySize, const bool* symmetriesBuffer, const float* maskBuf, const float* maskSumBuf, Buffers& buffers,
+    float* valueBuf, float* scoreValueBuf, float* ownershipBuf
+  ) const;
+
+};
+
+//------------------------------------------------------------------------------
+
+//The layers only hold weights and are never modified by apply, so they are built once here when the model
+//file is loaded and then shared by every handle using this model. The filters of each conv algorithm, and the
+//int8 filters, are only built once a handle needs them, see ConvLayer::prepareAlgorithm and calibrateInt8.
+struct LoadedModel {
+  ModelDesc modelDesc;
+  Trunk* trunk;
+  PolicyHead* policyHead;
+  ValueHead* valueHead;
+
+  //The int8 filters and activation scales of the layers are only built once, by the first handle that wants int8 mode
+  mutable std::mutex int8Mutex;
+  mutable bool int8Calibrated;
+  //Held while autotuning adds the filters of further algorithms to the layers
+  mutable std::mutex tuneMutex;
+  //Handles not in int8 mode, the only ones that need the fp32 filters of the layers that int8 mode runs in int8.
+  //Only accessed with both int8Mutex and tuneMutex held.
+  mutable int numFP32Handles;
+
+  LoadedModel(const string& fileName) {
+    ModelDesc::loadFromFileMaybeGZipped(fileName,modelDesc);
+    trunk = new Trunk(&modelDesc.trunk);
+    policyHead = new PolicyHead(&modelDesc.policyHead);
+    valueHead = new ValueHead(&modelDesc.valueHead);
+    int8Calibrated = false;
+    numFP32Handles = 0;
+  }
+
+  ~LoadedModel() {
+    delete valueHead;
+    delete policyHead;
+    delete trunk;
+  }
+
+  vector<ConvLayer*> getConvs() const {
+    vector<ConvLayer*> convs;
+    convs.push_back(trunk->initialConv);
+    vector<ConvLayer*> blockConvs = trunk->getInt8Convs();
+    convs.insert(convs.end(), blockConvs.begin(), blockConvs.end());
+    convs.push_back(policyHead->p1Conv);
+    convs.push_back(policyHead->g1Conv);
+    convs.push_back(policyHead->p2Conv);
+    convs.push_back(valueHead->v1Conv);
+    convs.push_back(valueHead->vOwnershipConv);
+    return convs;
+  }
+
+  //Once int8 mode is in use and no handle runs in fp32 anymore, frees the fp32 filters of the layers it runs in int8,
+  //since a model usually runs one way or the other. Must be called with int8Mutex and tuneMutex held.
+  void releaseUnusedFP32Filters() const {
+    if(!int8Calibrated || numFP32Handles > 0)
+      return;
+    vector<ConvLayer*> convs = trunk->getInt8Convs();
+    for(int i = 0; i<convs.size(); i++)
+      convs[i]->releaseFP32Filters();
+  }
+
+  LoadedModel() = delete;
+  LoadedModel(const LoadedModel&) = delete;
+  LoadedModel& operator=(const LoadedModel&) = delete;
+};
+
+//------------------------------------------------------------------------------
+
+struct Model {
+  string name;
+  int version;
+  int maxBatchSize;
+  int xSize;
+  int ySize;
+  int numInputChannels;
+  int numInputGlobalChannels;
+  int numValueChannels;
+  int numScoreValueChannels;
+  int numOwnershipChannels;
+  bool inputsUsingNHWC;
+
+  //Owned by the LoadedModel
+  const Trunk* trunk;
+  const PolicyHead* policyHead;
+  const ValueHead* valueHead;
+
+  Model() = delete;
+  Model(const Model&) = delete;
+  Model& operator=(const Model&) = delete;
+
+  Model(
+    const LoadedModel* loadedModel,
+    int maxBatchSz,
+    int nnXLen,
+    int nnYLen,
+    bool inputsUseNHWC
+  ) {
+    const ModelDesc* desc = &(loadedModel->modelDesc);
+    name = desc->name;
+    version = desc->version;
+    maxBatchSize = maxBatchSz;
+
+    xSize = nnXLen;
+    ySize = nnYLen;
+    if(nnXLen > NNPos::MAX_BOARD_LEN)
+      throw StringError(Global::strprintf("nnXLen (%d) is greater than NNPos::MAX_BOARD_LEN (%d)",
+        nnXLen, NNPos::MAX_BOARD_LEN
+      ));
+    if(nnYLen > NNPos::MAX_BOARD_LEN)
+      throw StringError(Global::strprintf("nnYLen (%d) is greater than NNPos::MAX_BOARD_LEN (%d)",
+        nnYLen, NNPos::MAX_BOARD_LEN
+      ));
+
+    numInputChannels = desc->numInputChannels;
+    numInputGlobalChannels = desc->numInputGlobalChannels;
+    numValueChannels = desc->numValueChannels;
+    numScoreValueChannels = desc->numScoreValueChannels;
+    numOwnershipChannels = desc->numOwnershipChannels;
+    inputsUsingNHWC = inputsUseNHWC;
+
+    int numFeatures = NNModelVersion::getNumSpatialFeatures(version);
+    if(numInputChannels != numFeatures)
+      throw StringError(Global::strprintf("Neural net numInputChannels (%d) was not the expected number based on version (%d)",
+        numInputChannels, numFeatures
+      ));
+    int numGlobalFeatures = NNModelVersion::getNumGlobalFeatures(version);
+    if(numInputGlobalChannels != numGlobalFeatures)
+      throw StringError(Global::strprintf("Neural net numInputGlobalChannels (%d) was not the expected number based on version (%d)",
+        numInputGlobalChannels, numGlobalFeatures
+      ));
+
+    trunk = loadedModel->trunk;
+    policyHead = loadedModel->policyHead;
+    valueHead = loadedModel->valueHead;
+  }
+
+  size_t requiredWorkspaceFloats(int batchSize) const {
+    size_t floats = 0;
+    floats = std::max(floats, trunk->requiredWorkspaceFloats(batchSize,xSize,ySize));
+    floats = std::max(floats, policyHead->requiredWorkspaceFloats(batchSize,xSize,ySize));
+    floats = std::max(floats, valueHead->requiredWorkspaceFloats(batchSize,xSize,ySize));
+    return floats;
+  }
+
+  void apply(
+    int batchSize,
+    bool requireExactNNLen,
+    const bool* symmetriesBuffer,
+    const float* userInputBuffer,
+    const float* userInputGlobalBuffer,
+    Buffers& buffers,
+    float* policyBuf,
+    float* valueBuf,
+    float* scoreValueBuf,
+    float* ownershipBuf,
+    vector<NNLayerProfile>* profile //NULL if not profiling
+  ) const;
+
+};
+
+//------------------------------------------------------------------------------
+
+//Scratch space for a single evaluation of a model, sized for the maximum batch size.
+//All spatial buffers are NHWC.
+struct Buffers {
+  vector<float> inputBuf;
+  vector<float> inputScratchBuf;
+  vector<float> maskBuf;
+  vector<float> maskSumBuf;
+
+  vector<float> trunkBuf;
+  vector<float> trunkScratchBuf;
+  vector<float> regularOutBuf;
+  vector<float> dilatedOutBuf;
+  vector<float> midInBuf;
+  vector<float> midScratchBuf;
+  vector<float> gpoolOutBuf;
+  vector<float> gpoolOutBuf2;
+  vector<float> gpoolConcatBuf;
+  vector<float> gpoolBiasBuf;
+  vector<float> regularScratchBuf;
+
+  vector<float> p1OutBuf;
+  vector<float> p1OutBuf2;
+  vector<float> g1OutBuf;
+  vector<float> g1OutBuf2;
+  vector<float> g1ConcatBuf;
+  vector<float> g1BiasBuf;
+  vector<float> p2OutBuf;
+  vector<float> p2ScratchBuf;
+  vector<float> g1PassBuf;
+
+  vector<float> v1OutBuf;
+  vector<float> v1OutBuf2;
+  vector<float> v1MeanBuf;
+  vector<float> v2OutBuf;
+  vector<float> ownershipScratchBuf;
+
+  vector<float> workspaceBuf;
+
+  //Int8 mode for the convolutions of the residual blocks, set by the owner
+  bool useINT8;
+  Int8Calibration* calibration;
+  //Autotuned fp32 algorithms, set by the owner
+  const ConvTuning* convTuning;
+
+  Buffers() = delete;
+  Buffers(const Buffers&) = delete;
+  Buffers& operator=(const Buffers&) = delete;
+
+  Buffers(const Model& m) {
+    size_t batchXYSize = (size_t)m.maxBatchSize * m.xSize * m.ySize;
+    const Trunk& t = *(m.trunk);
+    const PolicyHead& p = *(m.policyHead);
+    const ValueHead& v = *(m.valueHead);
+
+    inputBuf.resize(batchXYSize * m.numInputChannels);
+    inputScratchBuf.resize(batchXYSize * m.numInputChannels);
+    maskBuf.resize(batchXYSize);
+    maskSumBuf.resize(m.maxBatchSize);
+
+    trunkBuf.resize(batchXYSize * t.trunkNumChannels);
+    trunkScratchBuf.resize(batchXYSize * t.trunkNumChannels);
+    regularOutBuf.resize(batchXYSize * t.regularNumChannels);
+    dilatedOutBuf.resize(batchXYSize * t.dilatedNumChannels);
+    size_t midInChannels = std::max(t.midNumChannels, t.regularNumChannels + t.dilatedNumChannels);
+    midInBuf.resize(batchXYSize * midInChannels);
+    midScratchBuf.resize(batchXYSize * midInChannels);
+    gpoolOutBuf.resize(batchXYSize * t.gpoolNumChannels);
+    gpoolOutBuf2.resize(batchXYSize * t.gpoolNumChannels);
+    gpoolConcatBuf.resize((size_t)m.maxBatchSize * t.gpoolNumChannels * 3);
+    gpoolBiasBuf.resize((size_t)m.maxBatchSize * t.regularNumChannels);
+    regularScratchBuf.resize(batchXYSize * t.regularNumChannels);
+
+    p1OutBuf.resize(batchXYSize * p.p1Channels);
+    p1OutBuf2.resize(batchXYSize * p.p1Channels);
+    g1OutBuf.resize(batchXYSize * p.g1Channels);
+    g1OutBuf2.resize(batchXYSize * p.g1Channels);
+    g1ConcatBuf.resize((size_t)m.maxBatchSize * p.g1Channels * 3);
+    g1BiasBuf.resize((size_t)m.maxBatchSize * p.p1Channels);
+    p2OutBuf.resize(batchXYSize * p.p2Channels);
+    p2ScratchBuf.resize(batchXYSize * p.p2Channels);
+    g1PassBuf.resize(m.maxBatchSize);
+
+    v1OutBuf.resize(batchXYSize * v.v1Channels);
+    v1OutBuf2.resize(batchXYSize * v.v1Channels);
+    v1MeanBuf.resize((size_t)m.maxBatchSize * v.v1Channels * 3);
+    v2OutBuf.resize((size_t)m.maxBatchSize * v.v2Channels);
+    ownershipScratchBuf.resize(batchXYSize * v.ownershipChannels);
+
+    workspaceBuf.resize(m.requiredWorkspaceFloats(m.maxBatchSize));
+    useINT8 = false;
+    calibration = NULL;
+    convTuning = NULL;
+  }
+
+  ConvContext fp32ConvContext() {
+    return ConvContext(workspaceBuf.data(),workspaceBuf.size(),false,NULL,convTuning);
+  }
+  ConvContext blockConvContext() {
+    return ConvContext(workspaceBuf.data(),workspaceBuf.size(),useINT8,calibration,convTuning);
+  }
+
+};
+
+//------------------------------------------------------------------------------
+
+void Trunk::apply(
+  int batchSize, int xSize, int ySize, const float* inputBuf, const float* inputGlobalBuf, const float* maskBuf, const float* maskSumBuf, Buffers& buffers,
+  LayerTimer& layerTimer
+) const {
+  float* trunkBuf = buffers.trunkBuf.data();
+  float* trunkScratchBuf = buffers.trunkScratchBuf.data();
+
+  //Feed the conv into trunkScratchBuf, not trunkBuf
+  const ConvContext fp32Ctx = buffers.fp32ConvContext();
+  const ConvContext blockCtx = buffers.blockConvContext();
+
+  initialConv->apply(batchSize,xSize,ySize,false,inputBuf,trunkScratchBuf,fp32Ctx);
+  //Feed the matmul into trunkBuf, then accumulate it into trunkScratchBuf, broadcasting during the process
+  initialMatMul->apply(batchSize,inputGlobalBuf,trunkBuf);
+  addNCBiasInplaceNHWC(trunkScratchBuf,trunkBuf,batchSize,xSize*ySize,trunkNumChannels);
+  layerTimer.lap(0);
+
+  for(int i = 0; i<blocks.size(); i++) {
+    //Flip trunkBuf and trunkScratchBuf so that the result gets accumulated in trunkScratchBuf
+    if(blocks[i].first == ORDINARY_BLOCK_KIND) {
+      ResidualBlock* block = (ResidualBlock*)blocks[i].second;
+      block->apply(
+        batchSize,xSize,ySize,
+        trunkScratchBuf,
+        trunkBuf,
+        buffers.midInBuf.data(),
+        buffers.midScratchBuf.data(),
+        maskBuf,
+        blockCtx
+      );
+    }
+    else if(blocks[i].first == DILATED_BLOCK_KIND) {
+      DilatedResidualBlock* block = (DilatedResidualBlock*)blocks[i].second;
+      block->apply(
+        batchSize,xSize,ySize,
+        trunkScratchBuf,
+        trunkBuf,
+        buffers.regularOutBuf.data(),
+        buffers.dilatedOutBuf.data(),
+        buffers.midInBuf.data(),
+        buffers.midScratchBuf.data(),
+        maskBuf,
+        blockCtx
+      );
+    }
+    else if(blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+      GlobalPoolingResidualBlock* block = (GlobalPoolingResidualBlock*)blocks[i].second;
+      block->apply(
+        batchSize,xSize,ySize,
+        trunkScratchBuf,
+        trunkBuf,
+        buffers.regularOutBuf.data(),
+        buffers.gpoolOutBuf.data(),
+        buffers.gpoolOutBuf2.data(),
+        buffers.gpoolConcatBuf.data(),
+        buffers.gpoolBiasBuf.data(),
+        buffers.regularScratchBuf.data(),
+        maskBuf,
+        maskSumBuf,
+        blockCtx
+      );
+    }
+    else {
+      ASSERT_UNREACHABLE;
+    }
+    layerTimer.lap(1+i);
+  }
+
+  //And now with the final BN port it from trunkScratchBuf to trunkBuf.
+  bool applyBNRelu = true;
+  trunkTipBN->apply(batchSize,xSize,ySize,applyBNRelu,trunkScratchBuf,maskBuf,trunkBuf);
+  layerTimer.lap(1+blocks.size());
+}
+
+void PolicyHead::apply(
+  int batchSize, int xSize, int ySize, const bool* symmetriesBuffer, const float* maskBuf, const float* maskSumBuf, Buffers& buffers, float* policyBuf
+) const {
+  const float* trunkBuf = buffers.trunkBuf.data();
+  float* p1OutBuf = buffers.p1OutBuf.data();
+  float* p1OutBuf2 = buffers.p1OutBuf2.data();
+  float* g1OutBuf = buffers.g1OutBuf.data();
+  float* g1OutBuf2 = buffers.g1OutBuf2.data();
+  float* g1ConcatBuf = buffers.g1ConcatBuf.data();
+  float* g1BiasBuf = buffers.g1BiasBuf.data();
+  float* p2OutBuf = buffers.p2OutBuf.data();
+  float* g1PassBuf = buffers.g1PassBuf.data();
+  const ConvContext ctx = buffers.fp32ConvContext();
+
+  bool applyBNRelu = true;
+  p1Conv->apply(batchSize,xSize,ySize,false,trunkBuf,p1OutBuf,ctx);
+  g1Conv->apply(batchSize,xSize,ySize,false,trunkBuf,g1OutBuf,ctx);
+  g1BN->apply(batchSize,xSize,ySize,applyBNRelu,g1OutBuf,maskBuf,g1OutBuf2);
+
+  poolRowsGPoolNHWC(g1OutBuf2,g1ConcatBuf,batchSize,xSize*ySize,g1Channels,maskSumBuf);
+  gpoolToBiasMul->apply(batchSize,g1ConcatBuf,g1BiasBuf);
+  addNCBiasInplaceNHWC(p1OutBuf,g1BiasBuf,batchSize,xSize*ySize,p1Channels);
+
+  p1BN->apply(batchSize,xSize,ySize,applyBNRelu,p1OutBuf,maskBuf,p1OutBuf2);
+  p2Conv->apply(batchSize,xSize,ySize,false,p1OutBuf2,p2OutBuf,ctx);
+
+  bool inverse = true;
+  applySymmetriesNHWC(symmetriesBuffer, inverse, batchSize, p2Channels, xSize, ySize, p2OutBuf, buffers.p2ScratchBuf.data());
+
+  gpoolToPassMul->apply(batchSize,g1ConcatBuf,g1PassBuf);
+
+  assert(p2Channels == 1);
+  int policySize = xSize*ySize + 1;
+  for(int n = 0; n<batchSize; n++) {
+    std::copy(p2OutBuf + (size_t)n * xSize*ySize, p2OutBuf + (size_t)(n+1) * xSize*ySize, policyBuf + (size_t)n * policySize);
+    policyBuf[(size_t)n * policySize + xSize*ySize] = g1PassBuf[n];
+  }
+}
+
+void ValueHead::apply(
+  int batchSize, int xSize, int ySize, const bool* symmetriesBuffer, const float* maskBuf, const float* maskSumBuf, Buffers& buffers,
+  float* valueBuf, float* scoreValueBuf, float* ownershipBuf
+) const {
+  const float* trunkBuf = buffers.trunkBuf.data();
+  float* v1OutBuf = buffers.v1OutBuf.data();
+  float* v1OutBuf2 = buffers.v1OutBuf2.data();
+  float* v1MeanBuf = buffers.v1MeanBuf.data();
+  float* v2OutBuf = buffers.v2OutBuf.data();
+  const ConvContext ctx = buffers.fp32ConvContext();
+
+  bool applyBNRelu = true;
+  v1Conv->apply(batchSize,xSize,ySize,false,trunkBuf,v1OutBuf,ctx);
+  v1BN->apply(batchSize,xSize,ySize,applyBNRelu,v1OutBuf,maskBuf,v1OutBuf2);
+
+  valueHeadPoolNHWC(v1OutBuf2,v1MeanBuf,batchSize,xSize*ySize,v1Channels,maskSumBuf);
+
+  v2Mul->apply(batchSize,v1MeanBuf,v2OutBuf);
+  v2Bias->apply(batchSize,true,v2OutBuf);
+  v3Mul->apply(batchSize,v2OutBuf,valueBuf);
+  v3Bias->apply(batchSize,false,valueBuf);
+
+  sv3Mul->apply(batchSize,v2OutBuf,scoreValueBuf);
+  sv3Bias->apply(batchSize,false,scoreValueBuf);
+
+  vOwnershipConv->apply(batchSize,xSize,ySize,false,v1OutBuf2,ownershipBuf,ctx);
+  bool inverse = true;
+  applySymmetriesNHWC(symmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, ownershipBuf, buffers.ownershipScratchBuf.data());
+}
+
+void Model::apply(
+  int batchSize,
+  bool requireExactNNLen,
+  const bool* symmetriesBuffer,
+  const float* userInputBuffer,
+  const float* userInputGlobalBuffer,
+  Buffers& buffers,
+  float* policyBuf,
+  float* valueBuf,
+  float* scoreValueBuf,
+  float* ownershipBuf,
+  vector<NNLayerProfile>* profile
+) const {
+  LayerTimer layerTimer(profile,batchSize);
+  float* inputBuf = buffers.inputBuf.data();
+  float* maskBuf = buffers.maskBuf.data();
+  float* maskSumBuf = buffers.maskSumBuf.data();
+  int xySize = xSize * ySize;
+
+  if(inputsUsingNHWC)
+    std::copy(userInputBuffer, userInputBuffer + (size_t)batchSize * xySize * numInputChannels, inputBuf);
+  else
+    transposeNCHWToNHWC(userInputBuffer, inputBuf, batchSize, numInputChannels, xySize);
+
+  bool inverse = false;
+  applySymmetriesNHWC(symmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, inputBuf, buffers.inputScratchBuf.data());
+
+  for(size_t pos = 0; pos < (size_t)batchSize * xySize; pos++)
+    maskBuf[pos] = inputBuf[pos * numInputChannels];
+  fillMaskSumBuf(maskBuf, maskSumBuf, batchSize, xSize, ySize);
+
+  //Don't do any masking if we know the board is exactly the desired size
+  //The global pooling structures need maskSumBuf no matter what, for normalizing based on this and its sqrt.
+  const float* maskBufToUse = requireExactNNLen ? NULL : maskBuf;
+
+  trunk->apply(batchSize,xSize,ySize,inputBuf,userInputGlobalBuffer,maskBufToUse,maskSumBuf,buffers,layerTimer);
+  size_t numBlocks = trunk->blocks.size();
+  policyHead->apply(batchSize,xSize,ySize,symmetriesBuffer,maskBufToUse,maskSumBuf,buffers,policyBuf);
+  layerTimer.lap(numBlocks+2);
+  valueHead->apply(batchSize,xSize,ySize,symmetriesBuffer,maskBufToUse,maskSumBuf,buffers,valueBuf,scoreValueBuf,ownershipBuf);
+  layerTimer.lap(numBlocks+3);
+}
+
+//------------------------------------------------------------------------------
+
+LoadedModel* NeuralNet::loadModelFile(const string& file, int modelFileIdx) {
+  (void)modelFileIdx;
+  LoadedModel* loadedModel = new LoadedModel(file);
+  return loadedModel;
+}
+
+void NeuralNet::freeLoadedModel(LoadedModel* loadedModel) {
+  delete loadedModel;
+}
+
+int NeuralNet::getModelVersion(const LoadedModel* loadedModel) {
+  return loadedModel->modelDesc.version;
+}
+
+Rules NeuralNet::getSupportedRules(const LoadedModel* loadedModel, const Rules& desiredRules, bool& supported) {
+  return loadedModel->modelDesc.getSupportedRules(desiredRules, supported);
+}
+
+//------------------------------------------------------------------------------
+
+struct ComputeContext {
+  //Null if not autotuning
+  NNTuneCache* tuneCache;
+  //What the speed of the kernels depends on besides the layer shape and the batch and board size
+  string tuneKeyPrefix;
+
+  ComputeContext(const string& tuneFile, Logger* logger) {
+    tuneCache = tuneFile.size() > 0 ? new NNTuneCache(tuneFile,logger) : NULL;
+    tuneKeyPrefix = "cpu " + CpuKernels::getInstructionSetName(CpuKernels::getInstructionSet()) + " " + NNTuneCache::getCpuName();
+  }
+  ~ComputeContext() {
+    delete tuneCache;
+  }
+
+  ComputeContext() = delete;
+  ComputeContext(const ComputeContext&) = delete;
+  ComputeContext& operator=(const ComputeContext&) = delete;
+};
+
+ComputeContext* NeuralNet::createComputeContext(
+  const std::vector<int>& gpuIdxs,
+  Logger* logger,
+  const string& tuneFile
+) {
+  (void)gpuIdxs;
+  return new ComputeContext(tuneFile,logger);
+}
+
+void NeuralNet::freeComputeContext(ComputeContext* computeContext) {
+  delete computeContext;
+}
+
+//------------------------------------------------------------------------------
+
+//Fills NHWC inputs for numPositions positions reached by random play on an nnXLen x nnYLen board.
+//Random play looks nothing like real games, but it still covers a wide spread of stone counts, liberties and kos,
+//which is what the activation ranges depend on.
+static void fillRandomPlayInputs(
+  const ModelDesc& desc, int nnXLen, int nnYLen, int numPositions, Rand& rand, vector<float>& spatial, vector<float>& global
+) {
+  const int inputsVersion = NNModelVersion::getInputsVersion(desc.version);
+  const size_t spatialLen = (size_t)desc.numInputChannels * nnXLen * nnYLen;
+  const size_t globalLen = (size_t)desc.numInputGlobalChannels;
+  spatial.assign(spatialLen * numPositions, 0.0f);
+  global.assign(globalLen * numPositions, 0.0f);
+
+  const Rules rules = Rules::getTrompTaylorish();
+  const double drawEquivalentWinsForWhite = 0.5;
+  const bool useNHWC = true;
+  for(int i = 0; i<numPositions; i++) {
+    Board board(nnXLen,nnYLen);
+    Player pla = P_BLACK;
+    BoardHistory hist(board,pla,rules,0);
+    int numMoves = (int)rand.nextUInt(nnXLen * nnYLen);
+    for(int m = 0; m<numMoves && !hist.isGameFinished; m++) {
+      Loc loc = Board::PASS_LOC;
+      for(int attempt = 0; attempt<20; attempt++) {
+        Loc candidate = Location::getLoc(rand.nextUInt(nnXLen),rand.nextUInt(nnYLen),board.x_size);
+        if(hist.isLegal(board,candidate,pla)) {
+          loc = candidate;
+          break;
+        }
+      }
+      hist.makeBoardMoveAssumeLegal(board,loc,pla,NULL);
+      pla = getOpp(pla);
+    }
+
+    float* rowSpatial = spatial.data() + spatialLen * i;
+    float* rowGlobal = global.data() + globalLen * i;
+    static_assert(NNModelVersion::latestInputsVersionImplemented == 5, "");
+    if(inputsVersion == 3)
+      NNInputs::fillRowV3(board,hist,pla,drawEquivalentWinsForWhite,nnXLen,nnYLen,useNHWC,rowSpatial,rowGlobal);
+    else if(inputsVersion == 4)
+      NNInputs::fillRowV4(board,hist,pla,drawEquivalentWinsForWhite,nnXLen,nnYLen,useNHWC,rowSpatial,rowGlobal);
+    else if(inputsVersion == 5)
+      NNInputs::fillRowV5(board,hist,pla,drawEquivalentWinsForWhite,nnXLen,nnYLen,useNHWC,rowSpatial,rowGlobal);
+    else
+      ASSERT_UNREACHABLE;
+  }
+}
+
+static void softmaxInplace(float* buf, int n) {
+  float maxVal = buf[0];
+  for(int i = 1; i<n; i++)
+    maxVal = std::max(maxVal, buf[i]);
+  float sum = 0.0f;
+  for(int i = 0; i<n; i++) {
+    buf[i] = exp(buf[i] - maxVal);
+    sum += buf[i];
+  }
+  for(int i = 0; i<n; i++)
+    buf[i] /= sum;
+}
+
+//Sets the activation scale of every int8 layer to the largest input it sees in fp32 on one set of random-play positions,
+//then logs how far the int8 outputs are from fp32 on a second set.
+//Builds the int8 filters of those layers first.
+//Must be called with loadedModel->int8Mutex held and no handles of this model running in int8 mode yet.
+static void calibrateInt8(const LoadedModel* loadedModel, int nnXLen, int nnYLen, Logger* logger) {
+  const int batchSize = 8;
+  const int numCalibrationBatches = 4;
+  const int numTestBatches = 4;
+  const ModelDesc& desc = loadedModel->modelDesc;
+
+  Rand rand("cpuBackendInt8Calibration");
+  vector<float> spatial;
+  vector<float> global;
+  fillRandomPlayInputs(desc,nnXLen,nnYLen,batchSize * (numCalibrationBatches + numTestBatches),rand,spatial,global);
+  const size_t spatialLen = (size_t)desc.numInputChannels * nnXLen * nnYLen;
+  const size_t globalLen = (size_t)desc.numInputGlobalChannels;
+
+  const bool inputsUseNHWC = true;
+  const bool requireExactNNLen = true;
+  Model model(loadedModel,batchSize,nnXLen,nnYLen,inputsUseNHWC);
+  Buffers buffers(model);
+  bool symmetries[NNInputs::NUM_SYMMETRY_BOOLS];
+  std::fill(symmetries, symmetries + NNInputs::NUM_SYMMETRY_BOOLS, false);
+
+  const int policySize = NNPos::getPolicySize(nnXLen,nnYLen);
+  const int ownershipSize = nnXLen * nnYLen;
+  assert(model.numValueChannels == 3);
+  assert(model.numOwnershipChannels == 1);
+  vector<float> policy[2];
+  vector<float> value[2];
+  vector<float> scoreValue[2];
+  vector<float> ownership[2];
+  for(int i = 0; i<2; i++) {
+    policy[i].resize((size_t)batchSize * policySize);
+    value[i].resize((size_t)batchSize * model.numValueChannels);
+    scoreValue[i].resize((size_t)batchSize * model.numScoreValueChannels);
+    ownership[i].resize((size_t)batchSize * ownershipSize);
+  }
+  auto runBatch = [&](int batchIdx, int resultIdx) {
+    model.apply(
+      batchSize,requireExactNNLen,symmetries,
+      spatial.data() + spatialLen * batchSize * batchIdx,
+      global.data() + globalLen * batchSize * batchIdx,
+      buffers,
+      policy[resultIdx].data(),value[resultIdx].data(),scoreValue[resultIdx].data(),ownership[resultIdx].data(),
+      NULL
+    );
+  };
+
+  Int8Calibration calibration;
+  buffers.calibration = &calibration;
+  for(int b = 0; b<numCalibrationBatches; b++)
+    runBatch(b,0);
+  buffers.calibration = NULL;
+
+  vector<ConvLayer*> convs = loadedModel->trunk->getInt8Convs();
+  for(int i = 0; i<convs.size(); i++) {
+    convs[i]->prepareInt8();
+    convs[i]->setInt8InputScale(calibration.maxAbsInputs[convs[i]]);
+  }
+
+  int numTopMoveAgree = 0;
+  double maxPolicyProbErr = 0.0;
+  double maxWinLossErr = 0.0;
+  double maxOwnershipErr = 0.0;
+  for(int b = 0; b<numTestBatches; b++) {
+    buffers.useINT8 = false;
+    runBatch(numCalibrationBatches + b, 0);
+    buffers.useINT8 = true;
+    runBatch(numCalibrationBatches + b, 1);
+
+    for(int n = 0; n<batchSize; n++) {
+      float* policyFP32 = policy[0].data() + (size_t)n * policySize;
+      float* policyINT8 = policy[1].data() + (size_t)n * policySize;
+      softmaxInplace(policyFP32,policySize);
+      softmaxInplace(policyINT8,policySize);
+      if(std::max_element(policyFP32,policyFP32+policySize) - policyFP32 == std::max_element(policyINT8,policyINT8+policySize) - policyINT8)
+        numTopMoveAgree += 1;
+      for(int i = 0; i<policySize; i++)
+        maxPolicyProbErr = std::max(maxPolicyProbErr, (double)std::fabs(policyFP32[i] - policyINT8[i]));
+
+      float* valueFP32 = value[0].data() + (size_t)n * 3;
+      float* valueINT8 = value[1].data() + (size_t)n * 3;
+      softmaxInplace(valueFP32,3);
+      softmaxInplace(valueINT8,3);
+      maxWinLossErr = std::max(maxWinLossErr, (double)std::fabs((valueFP32[0] - valueFP32[1]) - (valueINT8[0] - valueINT8[1])));
+
+      for(int i = 0; i<ownershipSize; i++) {
+        size_t idx = (size_t)n * ownershipSize + i;
+        maxOwnershipErr = std::max(maxOwnershipErr, (double)std::fabs(tanh(ownership[0][idx]) - tanh(ownership[1][idx])));
+      }
+    }
+  }
+
+  if(logger != NULL) {
+    int numTestPositions = batchSize * numTestBatches;
+    logger->write(
+      "Cpu backend: Calibrated int8 mode on " + Global::intToString(batchSize * numCalibrationBatches) + " random-play positions" +
+      ", vs fp32 on " + Global::intToString(numTestPositions) + " others" +
+      ": top policy move agreement " + Global::intToString(numTopMoveAgree) + "/" + Global::intToString(numTestPositions) +
+      ", max policy prob error " + Global::doubleToString(maxPolicyProbErr) +
+      ", max winloss error " + Global::doubleToString(maxWinLossErr) +
+      ", max ownership error " + Global::doubleToString(maxOwnershipErr)
+    );
+  }
+}
+
+//------------------------------------------------------------------------------
+
+//Batch sizes are tuned at powers of two up to this, and each other batch size uses the result for the next smaller
+//tuned one. Larger batches behave much like this one, and are slow to benchmark.
+static const int MAX_TUNED_BATCH_SIZE = 8;
+
+//The fastest of the algorithms that layer supports, on a layer of the same shape with random weights and inputs
+static int benchmarkConvAlgorithms(const ConvLayer& layer, int batchSize, int xSize, int ySize, Rand& rand) {
+  ConvLayerDesc desc;
+  desc.name = layer.name + "/autotune";
+  desc.convYSize = layer.convYSize;
+  desc.convXSize = layer.convXSize;
+  desc.inChannels = layer.inChannels;
+  desc.outChannels = layer.outChannels;
+  desc.dilationY = layer.dilationY;
+  desc.dilationX = layer.dilationX;
+  desc.weights.resize((size_t)desc.convYSize * desc.convXSize * desc.inChannels * desc.outChannels);
+  for(size_t i = 0; i<desc.weights.size(); i++)
+    desc.weights[i] = (float)(rand.nextDouble() - 0.5);
+  ConvLayer candidate(&desc);
+
+  vector<float> input((size_t)batchSize * ySize * xSize * layer.inChannels);
+  for(size_t i = 0; i<input.size(); i++)
+    input[i] = (float)rand.nextDouble();
+  vector<float> output((size_t)batchSize * ySize * xSize * layer.outChannels);
+  vector<float> workspace(candidate.requiredWorkspaceFloats(batchSize,xSize,ySize));
+
+  //The fastest of a few runs, which discounts the first one warming up the caches
+  const int numRuns = 4;
+  int bestAlgorithm = candidate.defaultAlgorithm;
+  double bestSeconds = 1e30;
+  for(int algorithm = 0; algorithm<NUM_CONV_ALGORITHMS; algorithm++) {
+    if(!candidate.supportsAlgorithm(algorithm))
+      continue;
+    candidate.prepareAlgorithm(algorithm);
+    for(int i = 0; i<numRuns; i++) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      candidate.applyFP32(algorithm,batchSize,xSize,ySize,false,input.data(),output.data(),workspace.data(),workspace.size());
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if(seconds < bestSeconds) {
+        bestSeconds = seconds;
+        bestAlgorithm = algorithm;
+      }
+    }
+  }
+  return bestAlgorithm;
+}
+
+//Picks the fp32 algorithm of every conv layer of the model for every batch size, from the tuning cache, or by
+//benchmarking and adding to the cache for shapes not tuned before on this machine, and builds the filters needed.
+//Layers that will run in int8, and 1x1 layers, which only have the direct path, are left alone.
+static void autotuneConvs(
+  const LoadedModel* loadedModel, ComputeContext* context, int maxBatchSize, int nnXLen, int nnYLen, bool useINT8,
+  ConvTuning& tuning, Logger* logger
+) {
+  NNTuneCache* tuneCache = context->tuneCache;
+  vector<int> tunedBatchSizes;
+  for(int batchSize = 1; batchSize <= std::min(maxBatchSize,MAX_TUNED_BATCH_SIZE); batchSize *= 2)
+    tunedBatchSizes.push_back(batchSize);
+
+  vector<ConvLayer*> convs = loadedModel->getConvs();
+  std::set<ConvLayer*> int8Convs;
+  if(useINT8) {
+    vector<ConvLayer*> blockConvs = loadedModel->trunk->getInt8Convs();
+    int8Convs.insert(blockConvs.begin(), blockConvs.end());
+  }
+
+  Rand rand("cpuBackendAutotune");
+  int numBenchmarked = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(loadedModel->tuneMutex);
+  for(ConvLayer* conv: convs) {
+    if(int8Convs.find(conv) != int8Convs.end() || !conv->supportsAlgorithm(CONV_ALGORITHM_IM2COL))
+      continue;
+    vector<int>& algorithmByBatchSize = tuning.algorithmByBatchSize[conv];
+    algorithmByBatchSize.assign(maxBatchSize+1, conv->defaultAlgorithm);
+    for(int i = 0; i<tunedBatchSizes.size(); i++) {
+      int batchSize = tunedBatchSizes[i];
+      string key = context->tuneKeyPrefix + Global::strprintf(
+        " conv %dx%d dilation %dx%d channels %d %d batch %d board %dx%d",
+        conv->convYSize, conv->convXSize, conv->dilationY, conv->dilationX, conv->inChannels, conv->outChannels,
+        batchSize, nnXLen, nnYLen
+      );
+      string value;
+      int algorithm = -1;
+      if(tuneCache->get(key,value)) {
+        for(int a = 0; a<NUM_CONV_ALGORITHMS; a++) {
+          if(value == convAlgorithmNames[a] && conv->supportsAlgorithm(a))
+            algorithm = a;
+        }
+      }
+      if(algorithm < 0) {
+        algorithm = benchmarkConvAlgorithms(*conv,batchSize,nnXLen,nnYLen,rand);
+        tuneCache->set(key,convAlgorithmNames[algorithm]);
+        numBenchmarked += 1;
+      }
+      conv->prepareAlgorithm(algorithm);
+      int nextBatchSize = i+1 < tunedBatchSizes.size() ? tunedBatchSizes[i+1] : maxBatchSize+1;
+      std::fill(algorithmByBatchSize.begin() + batchSize, algorithmByBatchSize.begin() + nextBatchSize, algorithm);
+    }
+  }
+
+  if(logger != NULL) {
+    if(numBenchmarked > 0)
+      logger->write(
+        "Cpu backend: Autotuned " + Global::intToString(numBenchmarked) + " conv layer shapes and batch sizes in " +
+        Global::doubleToString(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()) +
+        " seconds, saved to " + tuneCache->getFile()
+      );
+    else
+      logger->write("Cpu backend: Using conv algorithms autotuned earlier, from " + tuneCache->getFile());
+  }
+}
+
+//------------------------------------------------------------------------------
+
+struct ComputeHandle {
+  const LoadedModel* loadedModel;
+  bool useINT8;
+  Model* model;
+  Buffers* buffers;
+  ConvTuning convTuning;
+  int nnXLen;
+  int nnYLen;
+  bool requireExactNNLen;
+  int policySize;
+  bool profilingEnabled;
+  vector<NNLayerProfile> profile;
+
+  ComputeHandle(
+    const LoadedModel* lModel,
+    int maxBatchSize,
+    int xLen,
+    int yLen,
+    bool rExactNNLen,
+    bool inputsUseNHWC,
+    bool int8,
+    const ConvTuning& tuning
+  ) {
+    loadedModel = lModel;
+    useINT8 = int8;
+    model = new Model(loadedModel, maxBatchSize, xLen, yLen, inputsUseNHWC);
+    buffers = new Buffers(*model);
+    buffers->useINT8 = useINT8;
+    convTuning = tuning;
+    buffers->convTuning = &convTuning;
+    nnXLen = xLen;
+    nnYLen = yLen;
+    requireExactNNLen = rExactNNLen;
+    policySize = NNPos::getPolicySize(nnXLen, nnYLen);
+    profilingEnabled = false;
+    profile = NNProfile::makeLayers(loadedModel->modelDesc, nnXLen, nnYLen);
+  }
+  ~ComputeHandle() {
+    delete buffers;
+    delete model;
+  }
+
+  ComputeHandle() = delete;
+  ComputeHandle(const ComputeHandle&) = delete;
+  ComputeHandle& operator=(const ComputeHandle&) = delete;
+};
+
+ComputeHandle* NeuralNet::createComputeHandle(
+  ComputeContext* context,
+  const LoadedModel* loadedModel,
+  Logger* logger,
+  int maxBatchSize,
+  int nnXLen,
+  int nnYLen,
+  bool requireExactNNLen,
+  bool inputsUseNHWC,
+  int gpuIdxForThisThread,
+  bool useFP16,
+  bool useINT8,
+  bool cudaUseNHWC
+) {
+  (void)gpuIdxForThisThread;
+  (void)cudaUseNHWC;
+
+  if(useFP16)
+    throw StringError("Cpu backend does not support useFP16=true");
+  if(logger != NULL) {
+    logger->write("Cpu backend: Model version " + Global::intToString(loadedModel->modelDesc.version));
+    logger->write("Cpu backend: Using " + CpuKernels::getInstructionSetName(CpuKernels::getInstructionSet()) + " kernels");
+    if(useINT8)
+      logger->write("Cpu backend: Using int8 mode with " + CpuKernels::getInstructionSetName(CpuKernels::getInt8InstructionSet()) + " kernels");
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(loadedModel->int8Mutex);
+    if(useINT8 && !loadedModel->int8Calibrated) {
+      calibrateInt8(loadedModel,nnXLen,nnYLen,logger);
+      loadedModel->int8Calibrated = true;
+    }
+    std::lock_guard<std::mutex> tuneLock(loadedModel->tuneMutex);
+    if(useINT8)
+      loadedModel->releaseUnusedFP32Filters();
+    else {
+      //Build again whatever an earlier int8 handle freed
+      loadedModel->numFP32Handles += 1;
+      vector<ConvLayer*> convs = loadedModel->trunk->getInt8Convs();
+      for(int i = 0; i<convs.size(); i++)
+        convs[i]->prepareAlgorithm(convs[i]->defaultAlgorithm);
+    }
+  }
+
+  ConvTuning tuning;
+  if(context != NULL && context->tuneCache != NULL)
+    autotuneConvs(loadedModel,context,maxBatchSize,nnXLen,nnYLen,useINT8,tuning,logger);
+
+  ComputeHandle* handle = new ComputeHandle(loadedModel,maxBatchSize,nnXLen,nnYLen,requireExactNNLen,inputsUseNHWC,useINT8,tuning);
+  return handle;
+}
+
+void NeuralNet::freeComputeHandle(ComputeHandle* handle) {
+  if(handle == NULL)
+    return;
+  const LoadedModel* loadedModel = handle->loadedModel;
+  bool useINT8 = handle->useINT8;
+  delete handle;
+  if(!useINT8) {
+    std::lock_guard<std::mutex> lock(loadedModel->int8Mutex);
+    std::lock_guard<std::mutex> tuneLock(loadedModel->tuneMutex);
+    loadedModel->numFP32Handles -= 1;
+    loadedModel->releaseUnusedFP32Filters();
+  }
+}
+
+//------------------------------------------------------------------------------
+
+struct InputBuffers {
+  int maxBatchSize;
+
+  size_t singleInputElts;
+  size_t singleInputGlobalElts;
+  size_t singlePolicyResultElts;
+  size_t singleValueResultElts;
+  size_t singleScoreValueResultElts;
+  size_t singleOwnershipResultElts;
+
+  float* userInputBuffer;
+  float* userInputGlobalBuffer;
+  bool* symmetriesBuffer;
+
+  //If not NULL, where getOutput actually reads the inputs from instead of the two buffers above
+  const float* externalInputBuffer;
+  const float* externalInputGlobalBuffer;
+
+  float* policyResults;
+  float* valueResults;
+  float* scoreValueResults;
+  float* ownershipResults;
+
+  InputBuffers(const LoadedModel* loadedModel, int maxBatchSz, int nnXLen, int nnYLen) {
+    const ModelDesc& m = loadedModel->modelDesc;
+
+    int xSize = nnXLen;
+    int ySize = nnYLen;
+
+    maxBatchSize = maxBatchSz;
+    singleInputElts = (size_t)m.numInputChannels * xSize * ySize;
+    singleInputGlobalElts = (size_t)m.numInputGlobalChannels;
+    singlePolicyResultElts = (size_t)(1 + xSize * ySize);
+    singleValueResultElts = (size_t)m.numValueChannels;
+    singleScoreValueResultElts = (size_t)m.numScoreValueChannels;
+    singleOwnershipResultElts = (size_t)m.numOwnershipChannels * xSize * ySize;
+
+    assert(NNModelVersion::getNumSpatialFeatures(m.version) == m.numInputChannels);
+    assert(NNModelVersion::getNumGlobalFeatures(m.version) == m.numInputGlobalChannels);
+
+    userInputBuffer = new float[singleInputElts * maxBatchSize];
+    userInputGlobalBuffer = new float[singleInputGlobalElts * maxBatchSize];
+    symmetriesBuffer = new bool[NNInputs::NUM_SYMMETRY_BOOLS];
+    externalInputBuffer = NULL;
+    externalInputGlobalBuffer = NULL;
+
+    policyResults = new float[singlePolicyResultElts * maxBatchSize];
+    valueResults = new float[singleValueResultElts * maxBatchSize];
+    scoreValueResults = new float[singleScoreValueResultElts * maxBatchSize];
+    ownershipResults = new float[singleOwnershipResultElts * maxBatchSize];
+  }
+
+  ~InputBuffers() {
+    delete[] userInputBuffer;
+    delete[] userInputGlobalBuffer;
+    delete[] symmetriesBuffer;
+    delete[] policyResults;
+    delete[] valueResults;
+    delete[] scoreValueResults;
+    delete[] ownershipResults;
+  }
+
+  InputBuffers() = delete;
+  InputBuffers(const InputBuffers&) = delete;
+  InputBuffers& operator=(const InputBuffers&) = delete;
+
+};
+
+InputBuffers* NeuralNet::createInputBuffers(const LoadedModel* loadedModel, int maxBatchSize, int nnXLen, int nnYLen) {
+  return new InputBuffers(loadedModel,maxBatchSize,nnXLen,nnYLen);
+}
+void NeuralNet::freeInputBuffers(InputBuffers* inputBuffers) {
+  delete inputBuffers;
+}
+
+float* NeuralNet::getBatchEltSpatialInplace(InputBuffers* inputBuffers, int nIdx) {
+  assert(nIdx < inputBuffers->maxBatchSize);
+  return inputBuffers->userInputBuffer + (inputBuffers->singleInputElts * nIdx);
+}
+
+float* NeuralNet::getBatchEltGlobalInplace(InputBuffers* inputBuffers, int nIdx) {
+  assert(nIdx < inputBuffers->maxBatchSize);
+  return inputBuffers->userInputGlobalBuffer + (inputBuffers->singleInputGlobalElts * nIdx);
+}
+
+int NeuralNet::getBatchEltSpatialLen(const InputBuffers* inputBuffers) {
+  return inputBuffers->singleInputElts;
+}
+int NeuralNet::getBatchEltGlobalLen(const InputBuffers* inputBuffers) {
+  return inputBuffers->singleInputGlobalElts;
+}
+
+bool* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers) {
+  return inputBuffers->symmetriesBuffer;
+}
+
+void NeuralNet::setBatchInputsExternal(InputBuffers* inputBuffers, const float* spatial, const float* global) {
+  assert((spatial == NULL) == (global == NULL));
+  inputBuffers->externalInputBuffer = spatial;
+  inputBuffers->externalInputGlobalBuffer = global;
+}
+
+//---------------------------------------------------------------------------------------
+
+void NeuralNet::getOutput(ComputeHandle* handle, InputBuffers* inputBuffers, int numBatchEltsFilled, vector<NNOutput*>& outputs) {
+  assert(numBatchEltsFilled <= inputBuffers->maxBatchSize);
+  assert(numBatchEltsFilled > 0);
+  int batchSize = numBatchEltsFilled;
+  int nnXLen = handle->nnXLen;
+  int nnYLen = handle->nnYLen;
+  int version = handle->model->version;
+
+  assert(inputBuffers->singlePolicyResultElts == handle->policySize);
+  assert(inputBuffers->singleOwnershipResultElts == nnXLen*nnYLen);
+
+  const float* inputBuf = inputBuffers->userInputBuffer;
+  const float* inputGlobalBuf = inputBuffers->userInputGlobalBuffer;
+  if(inputBuffers->externalInputBuffer != NULL) {
+    inputBuf = inputBuffers->externalInputBuffer;
+    inputGlobalBuf = inputBuffers->externalInputGlobalBuffer;
+  }
+
+  handle->model->apply(
+    batchSize,
+    handle->requireExactNNLen,
+    inputBuffers->symmetriesBuffer,
+    inputBuf,
+    inputGlobalBuf,
+    *(handle->buffers),
+    inputBuffers->policyResults,
+    inputBuffers->valueResults,
+    inputBuffers->scoreValueResults,
+    inputBuffers->ownershipResults,
+    handle->profilingEnabled ? &(handle->profile) : NULL
+  );
+
+  assert(outputs.size() == batchSize);
+
+  for(int row = 0; row < batchSize; row++) {
+    NNOutput* output = outputs[row];
+    assert(output->nnXLen == nnXLen);
+    assert(output->nnYLen == nnYLen);
+
+    float* policyProbs = output->policyProbs;
+
+    //These are not actually correct, the client does the postprocessing to turn them into
+    //policy probabilities and white game outcome probabilities
+    //Also we don't fill in the nnHash here either
+    std::copy(
+      inputBuffers->policyResults + row * handle->policySize,
+      inputBuffers->policyResults + (row+1) * handle->policySize,
+      policyProbs
+    );
+
+    int numValueChannels = handle->model->numValueChannels;
+    assert(numValueChannels == 3);
+    output->whiteWinProb = inputBuffers->valueResults[row * numValueChannels];
+    output->whiteLossProb = inputBuffers->valueResults[row * numValueChannels + 1];
+    output->whiteNoResultProb = inputBuffers->valueResults[row * numValueChannels + 2];
+
+    //As above, these are NOT actually from white's perspective, but rather the player to move.
+    //As usual the client does the postprocessing.
+    if(output->whiteOwnerMap != NULL) {
+      assert(handle->model->numOwnershipChannels == 1);
+      std::copy(
+        inputBuffers->ownershipResults + row * nnXLen * nnYLen,
+        inputBuffers->ownershipResults + (row+1) * nnXLen * nnYLen,
+        output->whiteOwnerMap
+      );
+    }
+
+    if(version >= 4) {
+      int numScoreValueChannels = handle->model->numScoreValueChannels;
+      assert(numScoreValueChannels == 2);
+      output->whiteScoreMean = inputBuffers->scoreValueResults[row * numScoreValueChannels];
+      output->whiteScoreMeanSq = inputBuffers->scoreValueResults[row * numScoreValueChannels + 1];
+    }
+    else if(version >= 3) {
+      int numScoreValueChannels = handle->model->numScoreValueChannels;
+      assert(numScoreValueChannels == 1);
+      output->whiteScoreMean = inputBuffers->scoreValueResults[row * numScoreValueChannels];
+      //Version 3 neural nets don't have any second moment output, implicitly already folding it in, so we just use the mean squared
+      output->whiteScoreMeanSq = output->whiteScoreMean * output->whiteScoreMean;
+    }
+    else {
+      ASSERT_UNREACHABLE;
+    }
+  }
+
+}
+
+bool NeuralNet::setProfilingEnabled(ComputeHandle* handle, bool enabled) {
+  if(enabled)
+    NNProfile::clear(handle->profile);
+  handle->profilingEnabled = enabled;
+  return true;
+}
+
+void NeuralNet::getProfile(const ComputeHandle* handle, vector<NNLayerProfile>& profile) {
+  profile = handle->profile;
+}
+
+//TESTING ----------------------------------------------------------------------------------
+
+//Copies a test buffer in the requested layout into an NHWC buffer
+static vector<float> testInputToNHWC(const vector<float>& buf, bool useNHWC, int batchSize, int cSize, int xySize) {
+  if(useNHWC)
+    return buf;
+  vector<float> ret(buf.size());
+  transposeNCHWToNHWC(buf.data(), ret.data(), batchSize, cSize, xySize);
+  return ret;
+}
+
+//Copies an NHWC buffer into a test buffer in the requested layout
+static void testOutputFromNHWC(const vector<float>& buf, bool useNHWC, int batchSize, int cSize, int xySize, vector<float>& outputBuffer) {
+  outputBuffer.resize(buf.size());
+  if(useNHWC)
+    std::copy(buf.begin(), buf.end(), outputBuffer.begin());
+  else
+    transposeNHWCToNCHW(buf.data(), outputBuffer.data(), batchSize, cSize, xySize);
+}
+
+bool NeuralNet::testEvaluateConv(
+  const ConvLayerDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const vector<float>& inputBuffer,
+  vector<float>& outputBuffer
+) {
+  if(useFP16)
+    return false;
+
+  int xySize = nnXLen * nnYLen;
+  size_t numInputFloats = (size_t)batchSize * xySize * desc->inChannels;
+  size_t numOutputFloats = (size_t)batchSize * xySize * desc->outChannels;
+  if(numInputFloats != inputBuffer.size())
+    throw StringError("testEvaluateConv: unexpected input buffer size");
+
+  ConvLayer convLayer(desc);
+  vector<float> input = testInputToNHWC(inputBuffer, useNHWC, batchSize, desc->inChannels, xySize);
+  vector<float> output(numOutputFloats);
+  vector<float> workspace(convLayer.requiredWorkspaceFloats(batchSize, nnXLen, nnYLen));
+  ConvContext ctx(workspace.data(), workspace.size(), false, NULL, NULL);
+  convLayer.apply(batchSize, nnXLen, nnYLen, false, input.data(), output.data(), ctx);
+
+  //Autotuning may pick any of the other algorithms instead, so they must all agree with the default
+  vector<float> otherOutput(numOutputFloats);
+  for(int algorithm = 0; algorithm<NUM_CONV_ALGORITHMS; algorithm++) {
+    if(algorithm == convLayer.defaultAlgorithm || !convLayer.supportsAlgorithm(algorithm))
+      continue;
+    convLayer.prepareAlgorithm(algorithm);
+    convLayer.applyFP32(algorithm, batchSize, nnXLen, nnYLen, false, input.data(), otherOutput.data(), workspace.data(), workspace.size());
+    for(size_t i = 0; i<numOutputFloats; i++) {
+      if(std::fabs(otherOutput[i] - output[i]) > 1e-4 * (1.0 + std::fabs(output[i])))
+        throw StringError(
+          "testEvaluateConv: " + string(convAlgorithmNames[algorithm]) + " gives " + Global::floatToString(otherOutput[i]) +
+          " but " + string(convAlgorithmNames[convLayer.defaultAlgorithm]) + " gives " + Global::floatToString(output[i])
+        );
+    }
+  }
+
+  //The int8 path must be within the rounding error of quantizing each input and weight, summed over every term
+  float maxAbsInput = 0.0f;
+  for(float v : input)
+    maxAbsInput = std::max(maxAbsInput, std::fabs(v));
+  convLayer.prepareInt8();
+  convLayer.setInt8InputScale(maxAbsInput);
+  ConvContext int8Ctx(workspace.data(), workspace.size(), true, NULL, NULL);
+  convLayer.apply(batchSize, nnXLen, nnYLen, false, input.data(), otherOutput.data(), int8Ctx);
+  const float inputScale = convLayer.int8InputScale;
+  for(int n = 0; n<batchSize; n++) {
+    for(int y = 0; y<nnYLen; y++) {
+      for(int x = 0; x<nnXLen; x++) {
+        for(int oc = 0; oc<desc->outChannels; oc++) {
+          const float weightScale = convLayer.int8FilterScales[oc];
+          double bound = 0.0;
+          for(int dy = 0; dy<desc->convYSize; dy++) {
+            int iy = y + (dy - desc->convYSize / 2) * desc->dilationY;
+            for(int dx = 0; dx<desc->convXSize; dx++) {
+              int ix = x + (dx - desc->convXSize / 2) * desc->dilationX;
+              if(iy < 0 || iy >= nnYLen || ix < 0 || ix >= nnXLen)
+                continue;
+              for(int ic = 0; ic<desc->inChannels; ic++) {
+                float v = input[(((size_t)n * nnYLen + iy) * nnXLen + ix) * desc->inChannels + ic];
+                float w = desc->weights[(((size_t)oc * desc->inChannels + ic) * desc->convYSize + dy) * desc->convXSize + dx];
+                bound += std::fabs(v) * weightScale * 0.5 + (std::fabs(w) + weightScale * 0.5) * inputScale * 0.5;
+              }
+            }
+          }
+          size_t i = (((size_t)n * nnYLen + y) * nnXLen + x) * desc->outChannels + oc;
+          if(std::fabs(otherOutput[i] - output[i]) > bound + 1e-4 * (1.0 + std::fabs(output[i])))
+            throw StringError(
+              "testEvaluateConv: int8 gives " + Global::floatToString(otherOutput[i]) + " but fp32 gives " +
+              Global::floatToString(output[i]) + ", more than the quantization error of " + Global::doubleToString(bound)
+            );
+        }
+      }
+    }
+  }
+
+  testOutputFromNHWC(output, useNHWC, batchSize, desc->outChannels, xySize, outputBuffer);
+  return true;
+}
+
+//Mask should be in 'NHW' format (no "C" channel).
+bool NeuralNet::testEvaluateBatchNorm(
+  const BatchNormLayerDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const vector<float>& inputBuffer,
+  const vector<float>& maskBuffer,
+  vector<float>& outputBuffer
+) {
+  if(useFP16)
+    return false;
+
+  int xySize = nnXLen * nnYLen;
+  size_t numInputFloats = (size_t)batchSize * xySize * desc->numChannels;
+  size_t numMaskFloats = (size_t)batchSize * xySize;
+  if(numInputFloats != inputBuffer.size())
+    throw StringError("testEvaluateBatchNorm: unexpected input buffer size");
+  if(numMaskFloats != maskBuffer.size())
+    throw StringError("testEvaluateBatchNorm: unexpected mask buffer size");
+
+  BatchNormLayer batchNormLayer(desc);
+  vector<float> input = testInputToNHWC(inputBuffer, useNHWC, batchSize, desc->numChannels, xySize);
+  vector<float> output(numInputFloats);
+  bool applyRelu = false;
+  batchNormLayer.apply(batchSize, nnXLen, nnYLen, applyRelu, input.data(), maskBuffer.data(), output.data());
+  testOutputFromNHWC(output, useNHWC, batchSize, desc->numChannels, xySize, outputBuffer);
+  return true;
+}
+
+bool NeuralNet::testEvaluateResidualBlock(
+  const ResidualBlockDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const vector<float>& inputBuffer,
+  const vector<float>& maskBuffer,
+  vector<float>& outputBuffer
+) {
+  if(useFP16)
+    return false;
+
+  int xySize = nnXLen * nnYLen;
+  size_t numTrunkFloats = (size_t)batchSize * xySize * desc->preBN.numChannels;
+  size_t numMaskFloats = (size_t)batchSize * xySize;
+  size_t numMidFloats = (size_t)batchSize * xySize * desc->finalConv.inChannels;
+  if(numTrunkFloats != inputBuffer.size())
+    throw StringError("testEvaluateResidualBlock: unexpected input buffer size");
+  if(numMaskFloats != maskBuffer.size())
+    throw StringError("testEvaluateResidualBlock: unexpected mask buffer size");
+
+  ResidualBlock residualBlock(desc);
+  vector<float> trunk = testInputToNHWC(inputBuffer, useNHWC, batchSize, desc->preBN.numChannels, xySize);
+  vector<float> trunkScratch(numTrunkFloats);
+  vector<float> midIn(numMidFloats);
+  vector<float> midScratch(numMidFloats);
+  vector<float> workspace(residualBlock.requiredWorkspaceFloats(batchSize, nnXLen, nnYLen));
+  ConvContext ctx(workspace.data(), workspace.size(), false, NULL, NULL);
+  residualBlock.apply(
+    batchSize, nnXLen, nnYLen,
+    trunk.data(), trunkScratch.data(), midIn.data(), midScratch.data(), maskBuffer.data(),
+    ctx
+  );
+  testOutputFromNHWC(trunk, useNHWC, batchSize, desc->preBN.numChannels, xySize, outputBuffer);
+  return true;
+}
+
+bool NeuralNet::testEvaluateGlobalPoolingResidualBlock(
+  const GlobalPoolingResidualBlockDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const vector<float>& inputBuffer,
+  const vector<float>& maskBuffer,
+  vector<float>& outputBuffer
+) {
+  if(useFP16)
+    return false;
+
+  int xySize = nnXLen * nnYLen;
+  size_t numTrunkFloats = (size_t)batchSize * xySize * desc->preBN.numChannels;
+  size_t numMaskFloats = (size_t)batchSize * xySize;
+  size_t numRegularOutFloats = (size_t)batchSize * xySize * desc->regularConv.outChannels;
+  size_t numGPoolOutFloats = (size_t)batchSize * xySize * desc->gpoolConv.outChannels;
+  size_t numGPoolConcatFloats = (size_t)batchSize * 3 * desc->gpoolConv.outChannels;
+  size_t numGPoolBiasFloats = (size_t)batchSize * desc->regularConv.outChannels;
+  if(numTrunkFloats != inputBuffer.size())
+    throw StringError("testEvaluateGlobalPoolingResidualBlock: unexpected input buffer size");
+  if(numMaskFloats != maskBuffer.size())
+    throw StringError("testEvaluateGlobalPoolingResidualBlock: unexpected mask buffer size");
+
+  GlobalPoolingResidualBlock residualBlock(desc);
+  vector<float> trunk = testInputToNHWC(inputBuffer, useNHWC, batchSize, desc->preBN.numChannels, xySize);
+  vector<float> trunkScratch(numTrunkFloats);
+  vector<float> regularOut(numRegularOutFloats);
+  vector<float> gpoolOut(numGPoolOutFloats);
+  vector<float> gpoolOut2(numGPoolOutFloats);
+  vector<float> gpoolConcat(numGPoolConcatFloats);
+  vector<float> gpoolBias(numGPoolBiasFloats);
+  vector<float> regularScratch(numRegularOutFloats);
+  vector<float> maskSum(batchSize);
+  fillMaskSumBuf(maskBuffer.data(), maskSum.data(), batchSize, nnXLen, nnYLen);
+  vector<float> workspace(residualBlock.requiredWorkspaceFloats(batchSize, nnXLen, nnYLen));
+  ConvContext ctx(workspace.data(), workspace.size(), false, NULL, NULL);
+
+  residualBlock.apply(
+    batchSize, nnXLen, nnYLen,
+    trunk.data(), trunkScratch.data(), regularOut.data(), gpoolOut.data(), gpoolOut2.data(),
+    gpoolConcat.data(), gpoolBias.data(), regularScratch.data(), maskBuffer.data(), maskSum.data(),
+    ctx
+  );
+  testOutputFromNHWC(trunk, useNHWC, batchSize, desc->preBN.numChannels, xySize, outputBuffer);
+  return true;
+}
+
+#endif  // USE_CPU_BACKEND
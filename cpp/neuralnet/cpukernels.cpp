@@ -0,0 +1,413 @@
+#include "../neuralnet/cpukernels.h"
+
+#include <cmath>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+CpuKernels::PackedMatrix::PackedMatrix()
+  :numRows(0),numCols(0),data()
+{}
+
+CpuKernels::PackedMatrix::PackedMatrix(const float* src, int k, int n, int ld)
+  :numRows(k),numCols(n),data()
+{
+  int numPanels = (n + PACK_NR - 1) / PACK_NR;
+  data.resize((size_t)numPanels * k * PACK_NR, 0.0f);
+  for(int panel = 0; panel<numPanels; panel++) {
+    int j0 = panel * PACK_NR;
+    int nr = std::min(PACK_NR, n - j0);
+    for(int p = 0; p<k; p++) {
+      const float* srcRow = src + (size_t)p * ld + j0;
+      float* dstRow = data.data() + ((size_t)panel * k + p) * PACK_NR;
+      for(int j = 0; j<nr; j++)
+        dstRow[j] = srcRow[j];
+    }
+  }
+}
+
+CpuKernels::PackedMatrixInt8::PackedMatrixInt8()
+  :numRows(0),numCols(0),paddedRows(0),data(),colSums()
+{}
+
+CpuKernels::PackedMatrixInt8::PackedMatrixInt8(const int8_t* src, int k, int n, int ld)
+  :numRows(k),numCols(n),paddedRows(),data(),colSums()
+{
+  paddedRows = (k + INT8_K_GROUP - 1) / INT8_K_GROUP * INT8_K_GROUP;
+  int numPanels = (n + PACK_NR - 1) / PACK_NR;
+  data.resize((size_t)numPanels * paddedRows * PACK_NR, 0);
+  colSums.resize((size_t)numPanels * PACK_NR, 0);
+  for(int panel = 0; panel<numPanels; panel++) {
+    int j0 = panel * PACK_NR;
+    int nr = std::min(PACK_NR, n - j0);
+    for(int p = 0; p<k; p++) {
+      int group = p / INT8_K_GROUP;
+      int idxInGroup = p % INT8_K_GROUP;
+      int8_t* dstGroup = data.data() + ((size_t)panel * paddedRows + (size_t)group * INT8_K_GROUP) * PACK_NR;
+      for(int j = 0; j<nr; j++) {
+        int8_t w = src[(size_t)p * ld + j0 + j];
+        dstGroup[j * INT8_K_GROUP + idxInGroup] = w;
+        colSums[j0 + j] += w;
+      }
+    }
+  }
+}
+
+//Generic ---------------------------------------------------------------------------------
+
+//Plain C++ that any compiler can at least partially vectorize for whatever baseline it targets.
+template<int MR>
+static void genericMicrokernel(int k, const float* a, int lda, const float* panel, float* c, int ldc, int nr) {
+  float acc[MR][CpuKernels::PACK_NR];
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++)
+    #pragma GCC unroll 16
+    for(int j = 0; j<CpuKernels::PACK_NR; j++)
+      acc[r][j] = 0.0f;
+
+  for(int p = 0; p<k; p++) {
+    const float* bRow = panel + (size_t)p * CpuKernels::PACK_NR;
+    #pragma GCC unroll 16
+    for(int r = 0; r<MR; r++) {
+      const float aVal = a[(size_t)r * lda + p];
+      #pragma GCC unroll 16
+      for(int j = 0; j<CpuKernels::PACK_NR; j++)
+        acc[r][j] += aVal * bRow[j];
+    }
+  }
+
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++)
+    for(int j = 0; j<nr; j++)
+      c[(size_t)r * ldc + j] += acc[r][j];
+}
+
+void CpuKernels::Generic::sgemmAccumulate(int m, int n, int k, const float* a, int lda, const float* packedB, float* c, int ldc) {
+  const int mr = 4;
+  for(int i0 = 0; i0<m; i0 += GEMM_ROW_BLOCK) {
+    int i1 = std::min(m, i0 + GEMM_ROW_BLOCK);
+    for(int j0 = 0; j0<n; j0 += PACK_NR) {
+      const float* panel = packedB + (size_t)(j0 / PACK_NR) * k * PACK_NR;
+      int nr = std::min(PACK_NR, n - j0);
+      int i = i0;
+      for(; i + mr <= i1; i += mr)
+        genericMicrokernel<4>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr);
+      switch(i1 - i) {
+      case 3: genericMicrokernel<3>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 2: genericMicrokernel<2>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 1: genericMicrokernel<1>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      default: break;
+      }
+    }
+  }
+}
+
+void CpuKernels::Generic::scaleBiasMaskRelu(
+  size_t numPositions, int numChannels,
+  const float* in, const float* scale, const float* bias, const float* mask, bool applyRelu, float* out
+) {
+  for(size_t pos = 0; pos<numPositions; pos++) {
+    const float* inRow = in + pos * numChannels;
+    float* outRow = out + pos * numChannels;
+    if(mask != NULL && mask[pos] == 0.0f) {
+      std::fill(outRow, outRow + numChannels, 0.0f);
+      continue;
+    }
+    float m = mask != NULL ? mask[pos] : 1.0f;
+    if(applyRelu) {
+      for(int c = 0; c<numChannels; c++)
+        outRow[c] = std::max(inRow[c] * scale[c] + bias[c], 0.0f) * m;
+    }
+    else {
+      for(int c = 0; c<numChannels; c++)
+        outRow[c] = (inRow[c] * scale[c] + bias[c]) * m;
+    }
+  }
+}
+
+void CpuKernels::Generic::quantizeU8(size_t n, const float* in, float invScale, uint8_t* out) {
+  for(size_t i = 0; i<n; i++) {
+    float x = std::min(std::max(in[i] * invScale, -127.0f), 127.0f);
+    out[i] = (uint8_t)((int)std::nearbyint(x) + INT8_ZERO_POINT);
+  }
+}
+
+template<int MR>
+static void genericInt8Microkernel(
+  int kPadded, const uint8_t* a, int lda, const int8_t* panel, const int32_t* colSums, const float* colScales,
+  float* c, int ldc, int nr
+) {
+  using namespace CpuKernels;
+  int32_t acc[MR][PACK_NR];
+  for(int r = 0; r<MR; r++)
+    for(int j = 0; j<PACK_NR; j++)
+      acc[r][j] = 0;
+
+  for(int g = 0; g<kPadded; g += INT8_K_GROUP) {
+    const int8_t* bGroup = panel + (size_t)g * PACK_NR;
+    for(int r = 0; r<MR; r++) {
+      const uint8_t* aGroup = a + (size_t)r * lda + g;
+      for(int j = 0; j<PACK_NR; j++) {
+        const int8_t* bCol = bGroup + j * INT8_K_GROUP;
+        for(int t = 0; t<INT8_K_GROUP; t++)
+          acc[r][j] += (int32_t)aGroup[t] * (int32_t)bCol[t];
+      }
+    }
+  }
+
+  for(int r = 0; r<MR; r++)
+    for(int j = 0; j<nr; j++)
+      c[(size_t)r * ldc + j] += (float)(acc[r][j] - INT8_ZERO_POINT * colSums[j]) * colScales[j];
+}
+
+void CpuKernels::Generic::gemmU8S8Accumulate(
+  int m, int n, int kPadded, const uint8_t* a, int lda, const int8_t* packedB, const int32_t* colSums, const float* colScales,
+  float* c, int ldc
+) {
+  const int mr = 4;
+  for(int i0 = 0; i0<m; i0 += GEMM_ROW_BLOCK) {
+    int i1 = std::min(m, i0 + GEMM_ROW_BLOCK);
+    for(int j0 = 0; j0<n; j0 += PACK_NR) {
+      const int8_t* panel = packedB + (size_t)(j0 / PACK_NR) * kPadded * PACK_NR;
+      int nr = std::min(PACK_NR, n - j0);
+      int i = i0;
+      for(; i + mr <= i1; i += mr)
+        genericInt8Microkernel<4>(kPadded, a + (size_t)i * lda, lda, panel, colSums + j0, colScales + j0, c + (size_t)i * ldc + j0, ldc, nr);
+      switch(i1 - i) {
+      case 3: genericInt8Microkernel<3>(kPadded, a + (size_t)i * lda, lda, panel, colSums + j0, colScales + j0, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 2: genericInt8Microkernel<2>(kPadded, a + (size_t)i * lda, lda, panel, colSums + j0, colScales + j0, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 1: genericInt8Microkernel<1>(kPadded, a + (size_t)i * lda, lda, panel, colSums + j0, colScales + j0, c + (size_t)i * ldc + j0, ldc, nr); break;
+      default: break;
+      }
+    }
+  }
+}
+
+//Neon ---------------------------------------------------------------------------------
+
+//Neon is part of the aarch64 baseline, so unlike the x86 kernels these need no special compile flags
+//and are always used on aarch64. The int8 kernels use the generic versions, since the dot product
+//instructions are not part of that baseline.
+#if defined(__aarch64__)
+
+//MR rows of 4 quad registers each, 24 accumulators out of the 32 vector registers.
+template<int MR>
+static void neonMicrokernel(int k, const float* a, int lda, const float* panel, float* c, int ldc, int nr) {
+  float32x4_t acc[MR][4];
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++)
+    #pragma GCC unroll 16
+    for(int q = 0; q<4; q++)
+      acc[r][q] = vdupq_n_f32(0.0f);
+
+  for(int p = 0; p<k; p++) {
+    const float* bRow = panel + (size_t)p * CpuKernels::PACK_NR;
+    const float32x4_t b0 = vld1q_f32(bRow);
+    const float32x4_t b1 = vld1q_f32(bRow + 4);
+    const float32x4_t b2 = vld1q_f32(bRow + 8);
+    const float32x4_t b3 = vld1q_f32(bRow + 12);
+    #pragma GCC unroll 16
+    for(int r = 0; r<MR; r++) {
+      const float aVal = a[(size_t)r * lda + p];
+      acc[r][0] = vfmaq_n_f32(acc[r][0], b0, aVal);
+      acc[r][1] = vfmaq_n_f32(acc[r][1], b1, aVal);
+      acc[r][2] = vfmaq_n_f32(acc[r][2], b2, aVal);
+      acc[r][3] = vfmaq_n_f32(acc[r][3], b3, aVal);
+    }
+  }
+
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++) {
+    float* cRow = c + (size_t)r * ldc;
+    if(nr == CpuKernels::PACK_NR) {
+      #pragma GCC unroll 16
+      for(int q = 0; q<4; q++)
+        vst1q_f32(cRow + 4*q, vaddq_f32(vld1q_f32(cRow + 4*q), acc[r][q]));
+    }
+    else {
+      float tmp[CpuKernels::PACK_NR];
+      #pragma GCC unroll 16
+      for(int q = 0; q<4; q++)
+        vst1q_f32(tmp + 4*q, acc[r][q]);
+      for(int j = 0; j<nr; j++)
+        cRow[j] += tmp[j];
+    }
+  }
+}
+
+void CpuKernels::Neon::sgemmAccumulate(int m, int n, int k, const float* a, int lda, const float* packedB, float* c, int ldc) {
+  const int mr = 6;
+  for(int i0 = 0; i0<m; i0 += GEMM_ROW_BLOCK) {
+    int i1 = std::min(m, i0 + GEMM_ROW_BLOCK);
+    for(int j0 = 0; j0<n; j0 += PACK_NR) {
+      const float* panel = packedB + (size_t)(j0 / PACK_NR) * k * PACK_NR;
+      int nr = std::min(PACK_NR, n - j0);
+      int i = i0;
+      for(; i + mr <= i1; i += mr)
+        neonMicrokernel<6>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr);
+      switch(i1 - i) {
+      case 5: neonMicrokernel<5>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 4: neonMicrokernel<4>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 3: neonMicrokernel<3>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 2: neonMicrokernel<2>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 1: neonMicrokernel<1>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      default: break;
+      }
+    }
+  }
+}
+
+void CpuKernels::Neon::scaleBiasMaskRelu(
+  size_t numPositions, int numChannels,
+  const float* in, const float* scale, const float* bias, const float* mask, bool applyRelu, float* out
+) {
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  for(size_t pos = 0; pos<numPositions; pos++) {
+    const float* inRow = in + pos * numChannels;
+    float* outRow = out + pos * numChannels;
+    float m = mask != NULL ? mask[pos] : 1.0f;
+    if(m == 0.0f) {
+      std::fill(outRow, outRow + numChannels, 0.0f);
+      continue;
+    }
+    int c = 0;
+    for(; c + 4 <= numChannels; c += 4) {
+      float32x4_t x = vfmaq_f32(vld1q_f32(bias + c), vld1q_f32(inRow + c), vld1q_f32(scale + c));
+      if(applyRelu)
+        x = vmaxq_f32(x, zero);
+      vst1q_f32(outRow + c, vmulq_n_f32(x, m));
+    }
+    for(; c<numChannels; c++) {
+      float x = inRow[c] * scale[c] + bias[c];
+      outRow[c] = (applyRelu ? std::max(x, 0.0f) : x) * m;
+    }
+  }
+}
+
+#endif
+
+//Dispatch ---------------------------------------------------------------------------------
+
+namespace {
+  struct KernelTable {
+    int isa;
+    void (*sgemmAccumulate)(int m, int n, int k, const float* a, int lda, const float* packedB, float* c, int ldc);
+    void (*scaleBiasMaskRelu)(
+      size_t numPositions, int numChannels,
+      const float* in, const float* scale, const float* bias, const float* mask, bool applyRelu, float* out
+    );
+    void (*quantizeU8)(size_t n, const float* in, float invScale, uint8_t* out);
+    int int8Isa;
+    void (*gemmU8S8Accumulate)(
+      int m, int n, int kPadded, const uint8_t* a, int lda, const int8_t* packedB, const int32_t* colSums, const float* colScales,
+      float* c, int ldc
+    );
+  };
+}
+
+//Picks the best kernels that the machine supports, among instruction sets no higher than maxIsa
+static KernelTable chooseKernels(int maxIsa) {
+  KernelTable table;
+  table.isa = CpuKernels::ISA_GENERIC;
+  table.sgemmAccumulate = &CpuKernels::Generic::sgemmAccumulate;
+  table.scaleBiasMaskRelu = &CpuKernels::Generic::scaleBiasMaskRelu;
+  table.quantizeU8 = &CpuKernels::Generic::quantizeU8;
+  table.int8Isa = CpuKernels::ISA_GENERIC;
+  table.gemmU8S8Accumulate = &CpuKernels::Generic::gemmU8S8Accumulate;
+
+#if defined(__x86_64__)
+  //Checks both the cpu and that the OS saves the corresponding register state
+  __builtin_cpu_init();
+  if(maxIsa >= CpuKernels::ISA_AVX2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    table.isa = CpuKernels::ISA_AVX2;
+    table.sgemmAccumulate = &CpuKernels::Avx2::sgemmAccumulate;
+    table.scaleBiasMaskRelu = &CpuKernels::Avx2::scaleBiasMaskRelu;
+    table.quantizeU8 = &CpuKernels::Avx2::quantizeU8;
+    table.int8Isa = CpuKernels::ISA_AVX2;
+    table.gemmU8S8Accumulate = &CpuKernels::Avx2::gemmU8S8Accumulate;
+  }
+  if(maxIsa >= CpuKernels::ISA_AVX512 && __builtin_cpu_supports("avx512f")) {
+    table.isa = CpuKernels::ISA_AVX512;
+    table.sgemmAccumulate = &CpuKernels::Avx512::sgemmAccumulate;
+    table.scaleBiasMaskRelu = &CpuKernels::Avx512::scaleBiasMaskRelu;
+    table.quantizeU8 = &CpuKernels::Avx512::quantizeU8;
+    if(maxIsa >= CpuKernels::ISA_AVX512_VNNI && __builtin_cpu_supports("avx512vnni")) {
+      table.int8Isa = CpuKernels::ISA_AVX512_VNNI;
+      table.gemmU8S8Accumulate = &CpuKernels::Avx512Vnni::gemmU8S8Accumulate;
+    }
+  }
+#elif defined(__aarch64__)
+  if(maxIsa >= CpuKernels::ISA_NEON) {
+    table.isa = CpuKernels::ISA_NEON;
+    table.sgemmAccumulate = &CpuKernels::Neon::sgemmAccumulate;
+    table.scaleBiasMaskRelu = &CpuKernels::Neon::scaleBiasMaskRelu;
+  }
+#endif
+  return table;
+}
+
+//Only changed by tests, the rest of the time this is fixed after the first call
+static KernelTable& getKernels() {
+  static KernelTable table = chooseKernels(CpuKernels::ISA_AVX512_VNNI);
+  return table;
+}
+
+int CpuKernels::getInstructionSet() {
+  return getKernels().isa;
+}
+
+int CpuKernels::getInt8InstructionSet() {
+  return getKernels().int8Isa;
+}
+
+vector<int> CpuKernels::getSupportedInstructionSets() {
+  vector<int> isas;
+  for(int isa = ISA_GENERIC; isa <= ISA_AVX512_VNNI; isa++) {
+    KernelTable table = chooseKernels(isa);
+    if(table.isa == isa || table.int8Isa == isa)
+      isas.push_back(isa);
+  }
+  return isas;
+}
+
+void CpuKernels::setMaxInstructionSetForTesting(int isa) {
+  getKernels() = chooseKernels(isa);
+}
+
+string CpuKernels::getInstructionSetName(int isa) {
+  switch(isa) {
+  case ISA_GENERIC: return "generic";
+  case ISA_NEON: return "NEON";
+  case ISA_AVX2: return "AVX2";
+  case ISA_AVX512: return "AVX-512";
+  case ISA_AVX512_VNNI: return "AVX-512 VNNI";
+  default: ASSERT_UNREACHABLE; return "";
+  }
+}
+
+void CpuKernels::sgemmAccumulate(int m, const float* a, int lda, const PackedMatrix& b, float* c, int ldc) {
+  if(m <= 0 || b.numCols <= 0)
+    return;
+  getKernels().sgemmAccumulate(m, b.numCols, b.numRows, a, lda, b.data.data(), c, ldc);
+}
+
+void CpuKernels::scaleBiasMaskRelu(
+  size_t numPositions, int numChannels,
+  const float* in, const float* scale, const float* bias, const float* mask, bool applyRelu, float* out
+) {
+  getKernels().scaleBiasMaskRelu(numPositions, numChannels, in, scale, bias, mask, applyRelu, out);
+}
+
+void CpuKernels::quantizeU8(size_t n, const float* in, float invScale, uint8_t* out) {
+  getKernels().quantizeU8(n, in, invScale, out);
+}
+
+void CpuKernels::gemmU8S8Accumulate(int m, const uint8_t* a, int lda, const PackedMatrixInt8& b, const float* colScales, float* c, int ldc) {
+  if(m <= 0 || b.numCols <= 0)
+    return;
+  assert(lda >= b.paddedRows);
+  getKernels().gemmU8S8Accumulate(m, b.numCols, b.paddedRows, a, lda, b.data.data(), b.colSums.data(), colScales, c, ldc);
+}
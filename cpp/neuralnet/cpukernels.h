@@ -0,0 +1,79 @@
+#ifndef NEURALNET_CPUKERNELS_H_
+#define NEURALNET_CPUKERNELS_H_
+
+#include "../core/global.h"
+#include "../neuralnet/cpukernelsimpl.h"
+
+//Low-level compute kernels for the cpu backend.
+//Each kernel is compiled separately for every instruction set we have an implementation for, and the best one
+//that the running machine supports is picked once at runtime, so that the binary does not depend on the -march
+//that it was built with.
+namespace CpuKernels {
+  static const int ISA_GENERIC = 0;
+  static const int ISA_NEON = 1;
+  static const int ISA_AVX2 = 2;
+  static const int ISA_AVX512 = 3;
+  static const int ISA_AVX512_VNNI = 4;
+
+  //The instruction set whose kernels are used by the dispatching functions below
+  int getInstructionSet();
+  //Same, but for gemmU8S8Accumulate, which can make use of more specific instructions
+  int getInt8InstructionSet();
+  std::string getInstructionSetName(int isa);
+
+  //For tests. The instruction sets that this machine has kernels for, in increasing order, where
+  //ISA_AVX512_VNNI only changes gemmU8S8Accumulate.
+  std::vector<int> getSupportedInstructionSets();
+  //For tests. Switches every kernel to the best instruction set no higher than isa. Not threadsafe with
+  //anything else using the kernels.
+  void setMaxInstructionSetForTesting(int isa);
+
+  //A k x n matrix stored as ceil(n / PACK_NR) column panels, each of which is k rows of PACK_NR contiguous floats,
+  //with the last panel zero-padded. Every microkernel streams exactly one panel at a time.
+  struct PackedMatrix {
+    int numRows;
+    int numCols;
+    std::vector<float> data;
+
+    PackedMatrix();
+    //Packs the row-major k x n matrix src with row stride ld
+    PackedMatrix(const float* src, int k, int n, int ld);
+  };
+
+  //A k x n int8 matrix, stored as ceil(n / PACK_NR) column panels. Each panel is paddedRows / INT8_K_GROUP
+  //groups, and each group is PACK_NR columns of INT8_K_GROUP consecutive rows, with all padding zero.
+  struct PackedMatrixInt8 {
+    int numRows;
+    int numCols;
+    int paddedRows;
+    std::vector<int8_t> data;
+    //Sum over all rows of each column, padded to whole panels, for removing INT8_ZERO_POINT from the products
+    std::vector<int32_t> colSums;
+
+    PackedMatrixInt8();
+    //Packs the row-major k x n matrix src with row stride ld
+    PackedMatrixInt8(const int8_t* src, int k, int n, int ld);
+  };
+
+  //Dispatching kernels ----------------------------------------------------------------
+
+  //C[i][j] += sum_p A[i][p] * B[p][j], for an m x k matrix A with row stride lda and C with row stride ldc.
+  void sgemmAccumulate(int m, const float* a, int lda, const PackedMatrix& b, float* c, int ldc);
+
+  //out[pos][c] = f(in[pos][c] * scale[c] + bias[c]) * mask[pos], over numPositions rows of numChannels,
+  //where f is relu if applyRelu and the identity otherwise. mask is ok to be null, meaning all 1.
+  //in and out may be the same buffer.
+  void scaleBiasMaskRelu(
+    size_t numPositions, int numChannels,
+    const float* in, const float* scale, const float* bias, const float* mask, bool applyRelu, float* out
+  );
+
+  //out[i] = clamp(round(in[i] * invScale), -127, 127) + INT8_ZERO_POINT
+  void quantizeU8(size_t n, const float* in, float invScale, uint8_t* out);
+
+  //C[i][j] += colScales[j] * sum_p (A[i][p] - INT8_ZERO_POINT) * B[p][j], for an m x b.paddedRows u8 matrix A
+  //with row stride lda. Columns of A past b.numRows may hold anything, since the matching rows of B are zero.
+  void gemmU8S8Accumulate(int m, const uint8_t* a, int lda, const PackedMatrixInt8& b, const float* colScales, float* c, int ldc);
+}
+
+#endif  // NEURALNET_CPUKERNELS_H_
@@ -0,0 +1,212 @@
+//AVX2+FMA kernels. This file is compiled with -mavx2 -mfma and its functions are only ever called
+//after the dispatcher in cpukernels.cpp has checked that the running cpu supports them.
+
+#include "../neuralnet/cpukernelsimpl.h"
+
+#if defined(__x86_64__)
+
+#if !defined(__AVX2__) || !defined(__FMA__)
+#error "cpukernels_avx2.cpp must be compiled with -mavx2 -mfma"
+#endif
+
+#include <immintrin.h>
+
+using namespace CpuKernels;
+
+//MR rows of two ymm registers each. With MR = 6 this is 12 accumulators, plus 2 for the row of B and 1 for
+//the broadcast of A, out of 16 registers.
+template<int MR>
+static inline void avx2Microkernel(int k, const float* a, int lda, const float* panel, float* c, int ldc, int nr) {
+  __m256 acc0[MR];
+  __m256 acc1[MR];
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++) {
+    acc0[r] = _mm256_setzero_ps();
+    acc1[r] = _mm256_setzero_ps();
+  }
+
+  for(int p = 0; p<k; p++) {
+    const __m256 b0 = _mm256_loadu_ps(panel + (size_t)p * PACK_NR);
+    const __m256 b1 = _mm256_loadu_ps(panel + (size_t)p * PACK_NR + 8);
+    #pragma GCC unroll 16
+    for(int r = 0; r<MR; r++) {
+      const __m256 aVal = _mm256_broadcast_ss(a + (size_t)r * lda + p);
+      acc0[r] = _mm256_fmadd_ps(aVal, b0, acc0[r]);
+      acc1[r] = _mm256_fmadd_ps(aVal, b1, acc1[r]);
+    }
+  }
+
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++) {
+    float* cRow = c + (size_t)r * ldc;
+    if(nr == PACK_NR) {
+      _mm256_storeu_ps(cRow, _mm256_add_ps(_mm256_loadu_ps(cRow), acc0[r]));
+      _mm256_storeu_ps(cRow + 8, _mm256_add_ps(_mm256_loadu_ps(cRow + 8), acc1[r]));
+    }
+    else {
+      float tmp[PACK_NR];
+      _mm256_storeu_ps(tmp, acc0[r]);
+      _mm256_storeu_ps(tmp + 8, acc1[r]);
+      for(int j = 0; j<nr; j++)
+        cRow[j] += tmp[j];
+    }
+  }
+}
+
+void CpuKernels::Avx2::sgemmAccumulate(int m, int n, int k, const float* a, int lda, const float* packedB, float* c, int ldc) {
+  const int mr = 6;
+  for(int i0 = 0; i0<m; i0 += GEMM_ROW_BLOCK) {
+    int i1 = m < i0 + GEMM_ROW_BLOCK ? m : i0 + GEMM_ROW_BLOCK;
+    for(int j0 = 0; j0<n; j0 += PACK_NR) {
+      const float* panel = packedB + (size_t)(j0 / PACK_NR) * k * PACK_NR;
+      int nr = n - j0 < PACK_NR ? n - j0 : PACK_NR;
+      int i = i0;
+      for(; i + mr <= i1; i += mr)
+        avx2Microkernel<6>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr);
+      switch(i1 - i) {
+      case 5: avx2Microkernel<5>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 4: avx2Microkernel<4>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 3: avx2Microkernel<3>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 2: avx2Microkernel<2>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 1: avx2Microkernel<1>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      default: break;
+      }
+    }
+  }
+}
+
+void CpuKernels::Avx2::scaleBiasMaskRelu(
+  size_t numPositions, int numChannels,
+  const float* in, const float* scale, const float* bias, const float* mask, bool applyRelu, float* out
+) {
+  const __m256 zero = _mm256_setzero_ps();
+  for(size_t pos = 0; pos<numPositions; pos++) {
+    const float* inRow = in + pos * numChannels;
+    float* outRow = out + pos * numChannels;
+    const float m = mask != NULL ? mask[pos] : 1.0f;
+    int c = 0;
+    if(m == 0.0f) {
+      for(; c + 8 <= numChannels; c += 8)
+        _mm256_storeu_ps(outRow + c, zero);
+      for(; c<numChannels; c++)
+        outRow[c] = 0.0f;
+      continue;
+    }
+    const __m256 mVec = _mm256_set1_ps(m);
+    for(; c + 8 <= numChannels; c += 8) {
+      __m256 x = _mm256_fmadd_ps(_mm256_loadu_ps(inRow + c), _mm256_loadu_ps(scale + c), _mm256_loadu_ps(bias + c));
+      if(applyRelu)
+        x = _mm256_max_ps(x, zero);
+      _mm256_storeu_ps(outRow + c, _mm256_mul_ps(x, mVec));
+    }
+    for(; c<numChannels; c++) {
+      float x = inRow[c] * scale[c] + bias[c];
+      if(applyRelu && x < 0.0f)
+        x = 0.0f;
+      outRow[c] = x * m;
+    }
+  }
+}
+
+void CpuKernels::Avx2::quantizeU8(size_t n, const float* in, float invScale, uint8_t* out) {
+  const __m256 invScaleVec = _mm256_set1_ps(invScale);
+  const __m256 lo = _mm256_set1_ps(-127.0f);
+  const __m256 hi = _mm256_set1_ps(127.0f);
+  const __m256i zeroPoint = _mm256_set1_epi32(INT8_ZERO_POINT);
+  //packs and packus interleave the 128-bit lanes, this puts the 32-bit groups back in order
+  const __m256i unshuffle = _mm256_setr_epi32(0,4,1,5,2,6,3,7);
+  size_t i = 0;
+  for(; i + 32 <= n; i += 32) {
+    __m256i q[4];
+    for(int v = 0; v<4; v++) {
+      __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8*v), invScaleVec), lo), hi);
+      q[v] = _mm256_add_epi32(_mm256_cvtps_epi32(x), zeroPoint);
+    }
+    __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(q[0], q[1]), _mm256_packs_epi32(q[2], q[3]));
+    _mm256_storeu_si256((__m256i*)(out + i), _mm256_permutevar8x32_epi32(packed, unshuffle));
+  }
+  for(; i<n; i++) {
+    float x = in[i] * invScale;
+    x = x < -127.0f ? -127.0f : x > 127.0f ? 127.0f : x;
+    out[i] = (uint8_t)(_mm_cvtss_si32(_mm_set_ss(x)) + INT8_ZERO_POINT);
+  }
+}
+
+//There is no u8 x s8 dot product without VNNI that doesn't saturate on our value ranges, so widen both to 16 bits and
+//use madd, which sums adjacent pairs. Each of the 4 accumulators per row then holds 4 columns x 2 partial sums,
+//which get combined at the end. MR = 2 uses 8 accumulators, 4 for the widened group of B and 1 for A.
+template<int MR>
+static inline void avx2Int8Microkernel(
+  int kPadded, const uint8_t* a, int lda, const int8_t* panel, const int32_t* colSums, const float* colScales,
+  float* c, int ldc, int nr
+) {
+  __m256i acc[MR][4];
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++) {
+    #pragma GCC unroll 4
+    for(int q = 0; q<4; q++)
+      acc[r][q] = _mm256_setzero_si256();
+  }
+
+  for(int g = 0; g<kPadded; g += INT8_K_GROUP) {
+    const int8_t* bGroup = panel + (size_t)g * PACK_NR;
+    __m256i b[4];
+    #pragma GCC unroll 4
+    for(int q = 0; q<4; q++)
+      b[q] = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(bGroup + 16*q)));
+    #pragma GCC unroll 16
+    for(int r = 0; r<MR; r++) {
+      int32_t aGroup;
+      __builtin_memcpy(&aGroup, a + (size_t)r * lda + g, sizeof(aGroup));
+      const __m256i aVec = _mm256_broadcastq_epi64(_mm_cvtepu8_epi16(_mm_cvtsi32_si128(aGroup)));
+      #pragma GCC unroll 4
+      for(int q = 0; q<4; q++)
+        acc[r][q] = _mm256_add_epi32(acc[r][q], _mm256_madd_epi16(aVec, b[q]));
+    }
+  }
+
+  const __m256i zeroPoint = _mm256_set1_epi32(INT8_ZERO_POINT);
+  const __m256i comp0 = _mm256_mullo_epi32(zeroPoint, _mm256_loadu_si256((const __m256i*)colSums));
+  const __m256i comp1 = _mm256_mullo_epi32(zeroPoint, _mm256_loadu_si256((const __m256i*)(colSums + 8)));
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++) {
+    //hadd leaves the columns as 0,1,4,5 | 2,3,6,7, the permute fixes the order
+    __m256i sum0 = _mm256_permute4x64_epi64(_mm256_hadd_epi32(acc[r][0], acc[r][1]), 0xD8);
+    __m256i sum1 = _mm256_permute4x64_epi64(_mm256_hadd_epi32(acc[r][2], acc[r][3]), 0xD8);
+    __m256 f0 = _mm256_cvtepi32_ps(_mm256_sub_epi32(sum0, comp0));
+    __m256 f1 = _mm256_cvtepi32_ps(_mm256_sub_epi32(sum1, comp1));
+    float* cRow = c + (size_t)r * ldc;
+    if(nr == PACK_NR) {
+      _mm256_storeu_ps(cRow, _mm256_fmadd_ps(f0, _mm256_loadu_ps(colScales), _mm256_loadu_ps(cRow)));
+      _mm256_storeu_ps(cRow + 8, _mm256_fmadd_ps(f1, _mm256_loadu_ps(colScales + 8), _mm256_loadu_ps(cRow + 8)));
+    }
+    else {
+      float tmp[PACK_NR];
+      _mm256_storeu_ps(tmp, f0);
+      _mm256_storeu_ps(tmp + 8, f1);
+      for(int j = 0; j<nr; j++)
+        cRow[j] += tmp[j] * colScales[j];
+    }
+  }
+}
+
+void CpuKernels::Avx2::gemmU8S8Accumulate(
+  int m, int n, int kPadded, const uint8_t* a, int lda, const int8_t* packedB, const int32_t* colSums, const float* colScales,
+  float* c, int ldc
+) {
+  const int mr = 2;
+  for(int i0 = 0; i0<m; i0 += GEMM_ROW_BLOCK) {
+    int i1 = m < i0 + GEMM_ROW_BLOCK ? m : i0 + GEMM_ROW_BLOCK;
+    for(int j0 = 0; j0<n; j0 += PACK_NR) {
+      const int8_t* panel = packedB + (size_t)(j0 / PACK_NR) * kPadded * PACK_NR;
+      int nr = n - j0 < PACK_NR ? n - j0 : PACK_NR;
+      int i = i0;
+      for(; i + mr <= i1; i += mr)
+        avx2Int8Microkernel<2>(kPadded, a + (size_t)i * lda, lda, panel, colSums + j0, colScales + j0, c + (size_t)i * ldc + j0, ldc, nr);
+      if(i < i1)
+        avx2Int8Microkernel<1>(kPadded, a + (size_t)i * lda, lda, panel, colSums + j0, colScales + j0, c + (size_t)i * ldc + j0, ldc, nr);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,133 @@
+//AVX-512 kernels. This file is compiled with -mavx512f and its functions are only ever called
+//after the dispatcher in cpukernels.cpp has checked that the running cpu supports them.
+
+#include "../neuralnet/cpukernelsimpl.h"
+
+#if defined(__x86_64__)
+
+#if !defined(__AVX512F__)
+#error "cpukernels_avx512.cpp must be compiled with -mavx512f"
+#endif
+
+//GCC warns about the deliberately uninitialized passthrough operand of the unmasked avx512 intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+using namespace CpuKernels;
+
+//A whole panel row is exactly one zmm register. MR rows gives MR independent accumulators, with MR = 12
+//being enough to cover the latency of two fma ports while leaving most of the 32 registers free.
+template<int MR>
+static inline void avx512Microkernel(int k, const float* a, int lda, const float* panel, float* c, int ldc, int nr) {
+  __m512 acc[MR];
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++)
+    acc[r] = _mm512_setzero_ps();
+
+  for(int p = 0; p<k; p++) {
+    const __m512 b = _mm512_loadu_ps(panel + (size_t)p * PACK_NR);
+    #pragma GCC unroll 16
+    for(int r = 0; r<MR; r++)
+      acc[r] = _mm512_fmadd_ps(_mm512_set1_ps(a[(size_t)r * lda + p]), b, acc[r]);
+  }
+
+  const __mmask16 colMask = (__mmask16)((1u << nr) - 1u);
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++) {
+    float* cRow = c + (size_t)r * ldc;
+    if(nr == PACK_NR)
+      _mm512_storeu_ps(cRow, _mm512_add_ps(_mm512_loadu_ps(cRow), acc[r]));
+    else
+      _mm512_mask_storeu_ps(cRow, colMask, _mm512_add_ps(_mm512_maskz_loadu_ps(colMask, cRow), acc[r]));
+  }
+}
+
+void CpuKernels::Avx512::sgemmAccumulate(int m, int n, int k, const float* a, int lda, const float* packedB, float* c, int ldc) {
+  const int mr = 12;
+  for(int i0 = 0; i0<m; i0 += GEMM_ROW_BLOCK) {
+    int i1 = m < i0 + GEMM_ROW_BLOCK ? m : i0 + GEMM_ROW_BLOCK;
+    for(int j0 = 0; j0<n; j0 += PACK_NR) {
+      const float* panel = packedB + (size_t)(j0 / PACK_NR) * k * PACK_NR;
+      int nr = n - j0 < PACK_NR ? n - j0 : PACK_NR;
+      int i = i0;
+      for(; i + mr <= i1; i += mr)
+        avx512Microkernel<12>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr);
+      //Remainder rows, at most one kernel call of each smaller size
+      if(i + 8 <= i1) {
+        avx512Microkernel<8>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr);
+        i += 8;
+      }
+      if(i + 4 <= i1) {
+        avx512Microkernel<4>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr);
+        i += 4;
+      }
+      switch(i1 - i) {
+      case 3: avx512Microkernel<3>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 2: avx512Microkernel<2>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      case 1: avx512Microkernel<1>(k, a + (size_t)i * lda, lda, panel, c + (size_t)i * ldc + j0, ldc, nr); break;
+      default: break;
+      }
+    }
+  }
+}
+
+void CpuKernels::Avx512::scaleBiasMaskRelu(
+  size_t numPositions, int numChannels,
+  const float* in, const float* scale, const float* bias, const float* mask, bool applyRelu, float* out
+) {
+  const __m512 zero = _mm512_setzero_ps();
+  const int numFull = numChannels / 16 * 16;
+  const __mmask16 tailMask = (__mmask16)((1u << (numChannels - numFull)) - 1u);
+  for(size_t pos = 0; pos<numPositions; pos++) {
+    const float* inRow = in + pos * numChannels;
+    float* outRow = out + pos * numChannels;
+    const float m = mask != NULL ? mask[pos] : 1.0f;
+    if(m == 0.0f) {
+      for(int c = 0; c<numFull; c += 16)
+        _mm512_storeu_ps(outRow + c, zero);
+      if(tailMask != 0)
+        _mm512_mask_storeu_ps(outRow + numFull, tailMask, zero);
+      continue;
+    }
+    const __m512 mVec = _mm512_set1_ps(m);
+    for(int c = 0; c<numFull; c += 16) {
+      __m512 x = _mm512_fmadd_ps(_mm512_loadu_ps(inRow + c), _mm512_loadu_ps(scale + c), _mm512_loadu_ps(bias + c));
+      if(applyRelu)
+        x = _mm512_max_ps(x, zero);
+      _mm512_storeu_ps(outRow + c, _mm512_mul_ps(x, mVec));
+    }
+    if(tailMask != 0) {
+      __m512 x = _mm512_fmadd_ps(
+        _mm512_maskz_loadu_ps(tailMask, inRow + numFull),
+        _mm512_maskz_loadu_ps(tailMask, scale + numFull),
+        _mm512_maskz_loadu_ps(tailMask, bias + numFull)
+      );
+      if(applyRelu)
+        x = _mm512_max_ps(x, zero);
+      _mm512_mask_storeu_ps(outRow + numFull, tailMask, _mm512_mul_ps(x, mVec));
+    }
+  }
+}
+
+void CpuKernels::Avx512::quantizeU8(size_t n, const float* in, float invScale, uint8_t* out) {
+  const __m512 invScaleVec = _mm512_set1_ps(invScale);
+  const __m512 lo = _mm512_set1_ps(-127.0f);
+  const __m512 hi = _mm512_set1_ps(127.0f);
+  const __m512i zeroPoint = _mm512_set1_epi32(INT8_ZERO_POINT);
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16) {
+    __m512 x = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(in + i), invScaleVec), lo), hi);
+    _mm_storeu_si128((__m128i*)(out + i), _mm512_cvtepi32_epi8(_mm512_add_epi32(_mm512_cvtps_epi32(x), zeroPoint)));
+  }
+  if(i < n) {
+    const __mmask16 tailMask = (__mmask16)((1u << (n - i)) - 1u);
+    __m512 x = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_maskz_loadu_ps(tailMask, in + i), invScaleVec), lo), hi);
+    _mm512_mask_cvtepi32_storeu_epi8(out + i, tailMask, _mm512_add_epi32(_mm512_cvtps_epi32(x), zeroPoint));
+  }
+}
+
+#endif
@@ -0,0 +1,93 @@
+//AVX-512 VNNI kernels. This file is compiled with -mavx512f -mavx512vnni and its functions are only ever called
+//after the dispatcher in cpukernels.cpp has checked that the running cpu supports them.
+
+#include "../neuralnet/cpukernelsimpl.h"
+
+#if defined(__x86_64__)
+
+#if !defined(__AVX512F__) || !defined(__AVX512VNNI__)
+#error "cpukernels_avx512vnni.cpp must be compiled with -mavx512f -mavx512vnni"
+#endif
+
+//GCC warns about the deliberately uninitialized passthrough operand of the unmasked avx512 intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+using namespace CpuKernels;
+
+//Each int32 lane of a zmm register is one column of the panel, and a single vpdpbusd accumulates a whole
+//group of INT8_K_GROUP rows into all of them, so this is the same shape as the fp32 kernel with 4x the work per instruction.
+template<int MR>
+static inline void vnniMicrokernel(
+  int kPadded, const uint8_t* a, int lda, const int8_t* panel, const int32_t* colSums, const float* colScales,
+  float* c, int ldc, int nr
+) {
+  __m512i acc[MR];
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++)
+    acc[r] = _mm512_setzero_si512();
+
+  for(int g = 0; g<kPadded; g += INT8_K_GROUP) {
+    const __m512i b = _mm512_loadu_si512((const void*)(panel + (size_t)g * PACK_NR));
+    #pragma GCC unroll 16
+    for(int r = 0; r<MR; r++) {
+      int32_t aGroup;
+      __builtin_memcpy(&aGroup, a + (size_t)r * lda + g, sizeof(aGroup));
+      acc[r] = _mm512_dpbusd_epi32(acc[r], _mm512_set1_epi32(aGroup), b);
+    }
+  }
+
+  const __mmask16 colMask = (__mmask16)((1u << nr) - 1u);
+  const __m512i comp = _mm512_mullo_epi32(_mm512_set1_epi32(INT8_ZERO_POINT), _mm512_loadu_si512((const void*)colSums));
+  const __m512 scale = _mm512_maskz_loadu_ps(colMask, colScales);
+  #pragma GCC unroll 16
+  for(int r = 0; r<MR; r++) {
+    float* cRow = c + (size_t)r * ldc;
+    __m512 f = _mm512_cvtepi32_ps(_mm512_sub_epi32(acc[r], comp));
+    if(nr == PACK_NR)
+      _mm512_storeu_ps(cRow, _mm512_fmadd_ps(f, scale, _mm512_loadu_ps(cRow)));
+    else
+      _mm512_mask_storeu_ps(cRow, colMask, _mm512_fmadd_ps(f, scale, _mm512_maskz_loadu_ps(colMask, cRow)));
+  }
+}
+
+void CpuKernels::Avx512Vnni::gemmU8S8Accumulate(
+  int m, int n, int kPadded, const uint8_t* a, int lda, const int8_t* packedB, const int32_t* colSums, const float* colScales,
+  float* c, int ldc
+) {
+  const int mr = 12;
+  for(int i0 = 0; i0<m; i0 += GEMM_ROW_BLOCK) {
+    int i1 = m < i0 + GEMM_ROW_BLOCK ? m : i0 + GEMM_ROW_BLOCK;
+    for(int j0 = 0; j0<n; j0 += PACK_NR) {
+      const int8_t* panel = packedB + (size_t)(j0 / PACK_NR) * kPadded * PACK_NR;
+      const int32_t* panelColSums = colSums + j0;
+      const float* panelColScales = colScales + j0;
+      float* cPanel = c + j0;
+      int nr = n - j0 < PACK_NR ? n - j0 : PACK_NR;
+      int i = i0;
+      for(; i + mr <= i1; i += mr)
+        vnniMicrokernel<12>(kPadded, a + (size_t)i * lda, lda, panel, panelColSums, panelColScales, cPanel + (size_t)i * ldc, ldc, nr);
+      //Remainder rows, at most one kernel call of each smaller size
+      if(i + 8 <= i1) {
+        vnniMicrokernel<8>(kPadded, a + (size_t)i * lda, lda, panel, panelColSums, panelColScales, cPanel + (size_t)i * ldc, ldc, nr);
+        i += 8;
+      }
+      if(i + 4 <= i1) {
+        vnniMicrokernel<4>(kPadded, a + (size_t)i * lda, lda, panel, panelColSums, panelColScales, cPanel + (size_t)i * ldc, ldc, nr);
+        i += 4;
+      }
+      switch(i1 - i) {
+      case 3: vnniMicrokernel<3>(kPadded, a + (size_t)i * lda, lda, panel, panelColSums, panelColScales, cPanel + (size_t)i * ldc, ldc, nr); break;
+      case 2: vnniMicrokernel<2>(kPadded, a + (size_t)i * lda, lda, panel, panelColSums, panelColScales, cPanel + (size_t)i * ldc, ldc, nr); break;
+      case 1: vnniMicrokernel<1>(kPadded, a + (size_t)i * lda, lda, panel, panelColSums, panelColScales, cPanel + (size_t)i * ldc, ldc, nr); break;
+      default: break;
+      }
+    }
+  }
+}
+
+#endif
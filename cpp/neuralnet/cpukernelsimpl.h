@@ -0,0 +1,78 @@
+#ifndef NEURALNET_CPUKERNELSIMPL_H_
+#define NEURALNET_CPUKERNELSIMPL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+//Declarations shared between the dispatcher in cpukernels.cpp and the per-instruction-set translation units.
+//This deliberately includes nothing beyond <cstddef>/<cstdint> and takes only raw pointers, since the per-instruction-set
+//files are compiled with extra -m flags and must not instantiate any inline library code that the linker
+//could then end up sharing with code that runs on machines without those instructions.
+namespace CpuKernels {
+  //Width of the column panels that matrices are packed into. This is the same for every instruction set,
+  //so that packed weights stay valid regardless of which kernels end up being dispatched to.
+  static const int PACK_NR = 16;
+  //Rows of A are processed in blocks of this many at a time, with every panel of B swept across one block
+  //before moving on to the next, so that the block of A stays in cache.
+  static const int GEMM_ROW_BLOCK = 240;
+
+  //Int8 matrices are packed with groups of this many consecutive rows interleaved within each column,
+  //matching the 4-way u8 x s8 dot product instructions.
+  static const int INT8_K_GROUP = 4;
+  //Activations are quantized to signed values in [-127,127] and then offset by this much to be stored as u8.
+  static const int INT8_ZERO_POINT = 128;
+
+  //Per-instruction-set implementations, use the dispatching functions in cpukernels.h instead.
+
+  namespace Generic {
+    void sgemmAccumulate(int m, int n, int k, const float* a, int lda, const float* packedB, float* c, int ldc);
+    void scaleBiasMaskRelu(
+      size_t numPositions, int numChannels,
+      const float* in, const float* scale, const float* bias, const float* mask, bool applyRelu, float* out
+    );
+    void quantizeU8(size_t n, const float* in, float invScale, uint8_t* out);
+    void gemmU8S8Accumulate(
+      int m, int n, int kPadded, const uint8_t* a, int lda, const int8_t* packedB, const int32_t* colSums, const float* colScales,
+      float* c, int ldc
+    );
+  }
+#if defined(__aarch64__)
+  namespace Neon {
+    void sgemmAccumulate(int m, int n, int k, const float* a, int lda, const float* packedB, float* c, int ldc);
+    void scaleBiasMaskRelu(
+      size_t numPositions, int numChannels,
+      const float* in, const float* scale, const float* bias, const float* mask, bool applyRelu, float* out
+    );
+  }
+#endif
+#if defined(__x86_64__)
+  namespace Avx2 {
+    void sgemmAccumulate(int m, int n, int k, const float* a, int lda, const float* packedB, float* c, int ldc);
+    void scaleBiasMaskRelu(
+      size_t numPositions, int numChannels,
+      const float* in, const float* scale, const float* bias, const float* mask, bool applyRelu, float* out
+    );
+    void quantizeU8(size_t n, const float* in, float invScale, uint8_t* out);
+    void gemmU8S8Accumulate(
+      int m, int n, int kPadded, const uint8_t* a, int lda, const int8_t* packedB, const int32_t* colSums, const float* colScales,
+      float* c, int ldc
+    );
+  }
+  namespace Avx512 {
+    void sgemmAccumulate(int m, int n, int k, const float* a, int lda, const float* packedB, float* c, int ldc);
+    void scaleBiasMaskRelu(
+      size_t numPositions, int numChannels,
+      const float* in, const float* scale, const float* bias, const float* mask, bool applyRelu, float* out
+    );
+    void quantizeU8(size_t n, const float* in, float invScale, uint8_t* out);
+  }
+  namespace Avx512Vnni {
+    void gemmU8S8Accumulate(
+      int m, int n, int kPadded, const uint8_t* a, int lda, const int8_t* packedB, const int32_t* colSums, const float* colScales,
+      float* c, int ldc
+    );
+  }
+#endif
+}
+
+#endif  // NEURALNET_CPUKERNELSIMPL_H_
@@ -970,6 +970,26 @@ struct GlobalPoolingResidualBlock {
 
 //------------------------------------------------------------------------------
 
+//Records an event after each layer of one apply, if profiling, so that the layers can be timed once the batch is done
+//without waiting for each one in between
+struct LayerTimer {
+  const vector<cudaEvent_t>* events; //NULL if not profiling, else one more than the number of layers
+
+  LayerTimer(const vector<cudaEvent_t>* e)
+    :events(e)
+  {
+    if(events != NULL)
+      CUDA_ERR("LayerTimer",cudaEventRecord((*events)[0],0));
+  }
+
+  void lap(size_t layerIdx) {
+    if(events == NULL)
+      return;
+    assert(layerIdx+1 < events->size());
+    CUDA_ERR("LayerTimer",cudaEventRecord((*events)[layerIdx+1],0));
+  }
+};
+
 struct Trunk {
   string name;
   int version;
@@ -1266,7 +1286,8 @@ struct Trunk {
     const void* zeroBuf,
     const void* oneBuf,
     void* workspaceBuf,
-    size_t workspaceBytes
+    size_t workspaceBytes,
+    LayerTimer& layerTimer //Lapped after the initial layers, each block and the tip, as layers 0 to numBlocks+1
   ) const {
 
     const cudnnTensorDescriptor_t& trunkDescriptor = trunkDescriptors[batchSize-1];
@@ -1296,6 +1317,7 @@ struct Trunk {
         customCudaAddNCBiasInplaceNHWC((half*)trunkScratchBuf,(const half*)trunkBuf,batchSize,xSize*ySize,trunkNumChannels);
     }
     CUDA_ERR(name.c_str(),cudaPeekAtLastError());
+    layerTimer.lap(0);
 
     for(int i = 0; i<blocks.size(); i++) {
       if(blocks[i].first == ORDINARY_BLOCK_KIND) {
@@ -1361,12 +1383,13 @@ struct Trunk {
       else {
         ASSERT_UNREACHABLE;
       }
-
+      layerTimer.lap(1+i);
     }
 
     //And now with the final BN port it from trunkScratchBuf to trunkBuf.
     bool applyBNRelu = true;
     trunkTipBN->apply(cudaHandles,batchSize,applyBNRelu,trunkScratchBuf,maskBuf,trunkBuf);
+    layerTimer.lap(1+blocks.size());
   }
 
 };
@@ -2169,8 +2192,11 @@ struct Model {
     const void* oneBuf,
 
     void* workspaceBuf,
-    size_t workspaceBytes
+    size_t workspaceBytes,
+
+    const vector<cudaEvent_t>* profileEvents //NULL if not profiling
   ) const {
+    LayerTimer layerTimer(profileEvents);
     const cudnnTensorDescriptor_t& inputDescriptor = inputDescriptors[batchSize-1];
     const cudnnTensorDescriptor_t& trunkDescriptor = trunk->trunkDescriptors[batchSize-1];
 
@@ -2237,8 +2263,10 @@ struct Model {
       zeroBuf,
       oneBuf,
       workspaceBuf,
-      workspaceBytes
+      workspaceBytes,
+      layerTimer
     );
+    size_t numBlocks = trunk->blocks.size();
     policyHead->apply(
       cudaHandles,
       trunkDescriptor,
@@ -2260,6 +2288,7 @@ struct Model {
       workspaceBuf,
       workspaceBytes
     );
+    layerTimer.lap(numBlocks+2);
     valueHead->apply(
       cudaHandles,
       trunkDescriptor,
@@ -2279,6 +2308,7 @@ struct Model {
       workspaceBuf,
       workspaceBytes
     );
+    layerTimer.lap(numBlocks+3);
   }
 
 };
@@ -2511,13 +2541,16 @@ struct Buffers {
 
 //------------------------------------------------------------------------------
 
-//Cuda implementation doesn't need this
+//Cuda implementation doesn't need this, and leaves picking convolution algorithms to cudnn's heuristics rather than
+//autotuning them
 ComputeContext* NeuralNet::createComputeContext(
   const std::vector<int>& gpuIdxs,
-  Logger* logger
+  Logger* logger,
+  const string& tuneFile
 ) {
   (void)gpuIdxs;
   (void)logger;
+  (void)tuneFile;
   return NULL;
 }
 
@@ -2537,6 +2570,9 @@ struct ComputeHandle {
   int nnYLen;
   bool requireExactNNLen;
   int policySize;
+  bool profilingEnabled;
+  vector<NNLayerProfile> profile;
+  vector<cudaEvent_t> profileEvents;
 
   ComputeHandle(
     const LoadedModel* loadedModel,
@@ -2560,10 +2596,18 @@ struct ComputeHandle {
     requireExactNNLen = rExactNNLen;
     policySize = NNPos::getPolicySize(nnXLen, nnYLen);
 
+    profilingEnabled = false;
+    profile = NNProfile::makeLayers(loadedModel->modelDesc, nnXLen, nnYLen);
+    profileEvents.resize(profile.size()+1);
+    for(size_t i = 0; i<profileEvents.size(); i++)
+      CUDA_ERR("ComputeHandle", cudaEventCreate(&profileEvents[i]));
+
     //Synchronize after creating buffers and copying all the weights, just in case
     CUDA_ERR("ComputeHandle", cudaDeviceSynchronize());
   }
   ~ComputeHandle() {
+    for(size_t i = 0; i<profileEvents.size(); i++)
+      cudaEventDestroy(profileEvents[i]);
     delete buffers;
     delete model;
     delete cudaHandles;
@@ -2585,10 +2629,14 @@ ComputeHandle* NeuralNet::createComputeHandle(
   bool inputsUseNHWC,
   int gpuIdxForThisThread,
   bool useFP16,
+  bool useINT8,
   bool cudaUseNHWC
 ) {
   (void)context;
 
+  if(useINT8)
+    throw StringError("CUDA backend does not support useINT8=true");
+
   CUDA_ERR("createComputeHandle",cudaSetDevice(gpuIdxForThisThread));
 
   cudaDeviceProp prop;
@@ -2642,6 +2690,10 @@ struct InputBuffers {
   float* userInputGlobalBuffer; //Host pointer
   bool* symmetriesBuffer; //Host pointer
 
+  //If not NULL, host pointers that getOutput actually copies the inputs from instead of the two buffers above
+  const float* externalInputBuffer;
+  const float* externalInputGlobalBuffer;
+
   float* policyResults; //Host pointer
   float* valueResults; //Host pointer
   float* scoreValueResults; //Host pointer
@@ -2680,6 +2732,8 @@ struct InputBuffers {
     userInputBuffer = new float[(size_t)m.numInputChannels * maxBatchSize * xSize * ySize];
     userInputGlobalBuffer = new float[(size_t)m.numInputGlobalChannels * maxBatchSize];
     symmetriesBuffer = new bool[NNInputs::NUM_SYMMETRY_BOOLS];
+    externalInputBuffer = NULL;
+    externalInputGlobalBuffer = NULL;
 
     policyResults = new float[(size_t)maxBatchSize * (1 + xSize * ySize)];
     valueResults = new float[(size_t)maxBatchSize * m.numValueChannels];
@@ -2732,6 +2786,12 @@ bool* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers) {
   return inputBuffers->symmetriesBuffer;
 }
 
+void NeuralNet::setBatchInputsExternal(InputBuffers* inputBuffers, const float* spatial, const float* global) {
+  assert((spatial == NULL) == (global == NULL));
+  inputBuffers->externalInputBuffer = spatial;
+  inputBuffers->externalInputGlobalBuffer = global;
+}
+
 
 //---------------------------------------------------------------------------------------
 
@@ -2745,6 +2805,13 @@ void NeuralNet::getOutput(ComputeHandle* gpuHandle, InputBuffers* inputBuffers,
   int version = gpuHandle->model->version;
   Buffers* buffers = gpuHandle->buffers;
 
+  const float* userInputBuffer = inputBuffers->userInputBuffer;
+  const float* userInputGlobalBuffer = inputBuffers->userInputGlobalBuffer;
+  if(inputBuffers->externalInputBuffer != NULL) {
+    userInputBuffer = inputBuffers->externalInputBuffer;
+    userInputGlobalBuffer = inputBuffers->externalInputGlobalBuffer;
+  }
+
   if(!gpuHandle->usingFP16) {
     assert(inputBuffers->userInputBufferBytes == buffers->inputBufBytes);
     assert(inputBuffers->userInputGlobalBufferBytes == buffers->inputGlobalBufBytes);
@@ -2759,8 +2826,8 @@ void NeuralNet::getOutput(ComputeHandle* gpuHandle, InputBuffers* inputBuffers,
     assert(inputBuffers->singleOwnershipResultElts == nnXLen*nnYLen);
     assert(inputBuffers->singleOwnershipResultBytes == nnXLen*nnYLen * sizeof(float));
 
-    CUDA_ERR("getOutput",cudaMemcpy(buffers->inputBuf, inputBuffers->userInputBuffer, inputBuffers->singleInputBytes*batchSize, cudaMemcpyHostToDevice));
-    CUDA_ERR("getOutput",cudaMemcpy(buffers->inputGlobalBuf, inputBuffers->userInputGlobalBuffer, inputBuffers->singleInputGlobalBytes*batchSize, cudaMemcpyHostToDevice));
+    CUDA_ERR("getOutput",cudaMemcpy(buffers->inputBuf, userInputBuffer, inputBuffers->singleInputBytes*batchSize, cudaMemcpyHostToDevice));
+    CUDA_ERR("getOutput",cudaMemcpy(buffers->inputGlobalBuf, userInputGlobalBuffer, inputBuffers->singleInputGlobalBytes*batchSize, cudaMemcpyHostToDevice));
   }
   else {
     assert(inputBuffers->userInputBufferBytes == buffers->inputBufBytesFloat);
@@ -2778,8 +2845,8 @@ void NeuralNet::getOutput(ComputeHandle* gpuHandle, InputBuffers* inputBuffers,
     assert(inputBuffers->singleOwnershipResultElts == nnXLen*nnYLen);
     assert(inputBuffers->singleOwnershipResultBytes == nnXLen*nnYLen * sizeof(float));
 
-    CUDA_ERR("getOutput",cudaMemcpy(buffers->inputBufFloat, inputBuffers->userInputBuffer, inputBuffers->singleInputBytes*batchSize, cudaMemcpyHostToDevice));
-    CUDA_ERR("getOutput",cudaMemcpy(buffers->inputGlobalBufFloat, inputBuffers->userInputGlobalBuffer, inputBuffers->singleInputGlobalBytes*batchSize, cudaMemcpyHostToDevice));
+    CUDA_ERR("getOutput",cudaMemcpy(buffers->inputBufFloat, userInputBuffer, inputBuffers->singleInputBytes*batchSize, cudaMemcpyHostToDevice));
+    CUDA_ERR("getOutput",cudaMemcpy(buffers->inputGlobalBufFloat, userInputGlobalBuffer, inputBuffers->singleInputGlobalBytes*batchSize, cudaMemcpyHostToDevice));
 
     customCudaCopyToHalf((const float*)buffers->inputBufFloat,(half*)buffers->inputBuf,inputBuffers->singleInputElts*batchSize);
     CUDA_ERR("getOutput",cudaPeekAtLastError());
@@ -2836,7 +2903,9 @@ void NeuralNet::getOutput(ComputeHandle* gpuHandle, InputBuffers* inputBuffers,
     buffers->oneBuf,
 
     buffers->workspaceBuf,
-    buffers->workspaceBytes
+    buffers->workspaceBytes,
+
+    gpuHandle->profilingEnabled ? &(gpuHandle->profileEvents) : NULL
   );
 
   CUDA_ERR("getOutput",cudaMemcpy(inputBuffers->policyResults, buffers->policyBuf, inputBuffers->singlePolicyResultBytes*batchSize, cudaMemcpyDeviceToHost));
@@ -2844,6 +2913,15 @@ void NeuralNet::getOutput(ComputeHandle* gpuHandle, InputBuffers* inputBuffers,
   CUDA_ERR("getOutput",cudaMemcpy(inputBuffers->scoreValueResults, buffers->scoreValueBuf, inputBuffers->singleScoreValueResultBytes*batchSize, cudaMemcpyDeviceToHost));
   CUDA_ERR("getOutput",cudaMemcpy(inputBuffers->ownershipResults, buffers->ownershipBuf, inputBuffers->singleOwnershipResultBytes*batchSize, cudaMemcpyDeviceToHost));
 
+  //The copies above waited for the whole batch, so all the events are done
+  if(gpuHandle->profilingEnabled) {
+    for(size_t i = 0; i<gpuHandle->profile.size(); i++) {
+      float ms;
+      CUDA_ERR("getOutput",cudaEventElapsedTime(&ms, gpuHandle->profileEvents[i], gpuHandle->profileEvents[i+1]));
+      NNProfile::record(gpuHandle->profile[i], batchSize, ms / 1000.0);
+    }
+  }
+
   assert(outputs.size() == batchSize);
 
   for(int row = 0; row < batchSize; row++) {
@@ -2899,6 +2977,17 @@ void NeuralNet::getOutput(ComputeHandle* gpuHandle, InputBuffers* inputBuffers,
 
 }
 
+bool NeuralNet::setProfilingEnabled(ComputeHandle* gpuHandle, bool enabled) {
+  if(enabled)
+    NNProfile::clear(gpuHandle->profile);
+  gpuHandle->profilingEnabled = enabled;
+  return true;
+}
+
+void NeuralNet::getProfile(const ComputeHandle* gpuHandle, vector<NNLayerProfile>& profile) {
+  profile = gpuHandle->profile;
+}
+
 //TESTING ----------------------------------------------------------------------------------
 
 
@@ -1,10 +1,13 @@
 #include "../neuralnet/desc.h"
 
 #include <cmath>
+#include <cstring>
 #include <fstream>
+#include <sstream>
 #include <zstr/src/zstr.hpp>
 
 #include "../core/global.h"
+#include "../core/mmapfile.h"
 #include "../neuralnet/modelversion.h"
 #include "../neuralnet/nninterface.h"
 
@@ -17,6 +20,149 @@ static void checkWeightFinite(float f, const string& name) {
 #define CHECKFINITE(x, name) \
   { checkWeightFinite((x), name); }
 
+//BINARY MODEL FORMAT---------------------------------------------------------------
+//
+//A binary model file is laid out as:
+//  A fixed BINARY_PREAMBLE_BYTES preamble (see loadFromBinaryFile), followed by
+//  A header, which is exactly the same whitespace-separated token stream as the text format, except that each array of
+//  weights is replaced by a blob reference "<dtype> <offset>" where dtype is "f32" or "f16" and offset is the
+//  byte offset within the data section. Padding to BINARY_ALIGNMENT, followed by
+//  The data section, with every blob aligned to BINARY_ALIGNMENT and stored in the same order as the in-memory desc
+//  (so conv weights are oc,ic,y,x rather than the text order y,x,ic,oc).
+//
+//This way the topology is parsed and validated by the same constructors as the text format, and loading a weight
+//array is a single copy straight out of the memory-mapped file.
+
+static const char BINARY_MAGIC[8] = {'K','G','M','O','D','E','L','B'};
+static const uint32_t BINARY_FORMAT_VERSION = 1;
+static const uint32_t BINARY_ENDIAN_CHECK = 0x01020304;
+static const size_t BINARY_PREAMBLE_BYTES = 64;
+static const size_t BINARY_ALIGNMENT = 64;
+
+namespace {
+  struct BinaryWeightSource {
+    const char* data;
+    size_t size;
+  };
+}
+
+//Streams parsing a binary model header carry a pointer to the data section in this pword slot
+static int binaryWeightSourceIdx() {
+  static const int idx = ios_base::xalloc();
+  return idx;
+}
+
+static float halfToFloat(uint16_t h) {
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1F;
+  uint32_t mantissa = h & 0x3FF;
+  uint32_t bits;
+  if(exponent == 0x1F)
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  else if(exponent != 0)
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  else if(mantissa == 0)
+    bits = sign;
+  else {
+    //Subnormal half, renormalize
+    exponent = 113;
+    while((mantissa & 0x400) == 0) {
+      mantissa <<= 1;
+      exponent--;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+  }
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+//Round to nearest even. Returns false if the value is not finite or out of the range of a half.
+static bool floatToHalf(float f, uint16_t& h) {
+  uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+  int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+  uint32_t mantissa = bits & 0x7FFFFF;
+  if(!isfinite(f))
+    return false;
+  if(exponent >= 0x1F)
+    return false;
+  if(exponent <= 0) {
+    if(exponent < -10) {
+      h = sign;
+      return true;
+    }
+    mantissa |= 0x800000;
+    int shift = 14 - exponent;
+    uint32_t halfMantissa = mantissa >> shift;
+    uint32_t remainder = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if(remainder > halfway || (remainder == halfway && (halfMantissa & 1)))
+      halfMantissa++;
+    h = (uint16_t)(sign | halfMantissa);
+    return true;
+  }
+  uint32_t result = ((uint32_t)exponent << 10) | (mantissa >> 13);
+  uint32_t remainder = mantissa & 0x1FFF;
+  if(remainder > 0x1000 || (remainder == 0x1000 && (result & 1)))
+    result++;
+  //Rounding can carry all the way into the exponent, which is still correct unless it becomes infinity
+  if(result >= 0x7C00)
+    return false;
+  h = (uint16_t)(sign | result);
+  return true;
+}
+
+static void readBinaryWeights(istream& in, const BinaryWeightSource* source, float* dst, size_t numWeights, const string& name) {
+  string dtype;
+  uint64_t offset;
+  in >> dtype;
+  in >> offset;
+  if(in.fail())
+    throw StringError(name + ": failed to parse binary weight blob reference");
+  size_t eltSize;
+  if(dtype == "f32")
+    eltSize = 4;
+  else if(dtype == "f16")
+    eltSize = 2;
+  else
+    throw StringError(name + ": unknown binary weight dtype " + dtype);
+  if(offset % BINARY_ALIGNMENT != 0)
+    throw StringError(name + ": misaligned binary weight blob offset " + Global::uint64ToString(offset));
+  if(offset > source->size || numWeights > (source->size - offset) / eltSize)
+    throw StringError(name + ": binary weight blob extends past the end of the file");
+
+  const char* blob = source->data + offset;
+  if(eltSize == 4) {
+    std::memcpy(dst, blob, numWeights * sizeof(float));
+    for(size_t i = 0; i < numWeights; i++)
+      CHECKFINITE(dst[i], name);
+  } else {
+    const uint16_t* halfs = (const uint16_t*)blob;
+    for(size_t i = 0; i < numWeights; i++) {
+      float w = halfToFloat(halfs[i]);
+      CHECKFINITE(w, name);
+      dst[i] = w;
+    }
+  }
+}
+
+//Reads an array of weights that is in the same order in both the text and the in-memory format
+static void readWeights(istream& in, float* dst, size_t numWeights, const string& name) {
+  const BinaryWeightSource* source = (const BinaryWeightSource*)in.pword(binaryWeightSourceIdx());
+  if(source != NULL) {
+    readBinaryWeights(in, source, dst, numWeights, name);
+    return;
+  }
+  for(size_t i = 0; i < numWeights; i++) {
+    float w;
+    in >> w;
+    CHECKFINITE(w, name);
+    dst[i] = w;
+  }
+}
+
 ConvLayerDesc::ConvLayerDesc()
   : convYSize(0), convXSize(0), inChannels(0), outChannels(0), dilationY(1), dilationX(1) {}
 
@@ -50,14 +196,19 @@ ConvLayerDesc::ConvLayerDesc(istream& in) {
   int yStride = convXSize;
   int xStride = 1;
 
-  for(int y = 0; y < convYSize; y++) {
-    for(int x = 0; x < convXSize; x++) {
-      for(int ic = 0; ic < inChannels; ic++) {
-        for(int oc = 0; oc < outChannels; oc++) {
-          float w;
-          in >> w;
-          CHECKFINITE(w, name);
-          weights[oc * ocStride + ic * icStride + y * yStride + x * xStride] = w;
+  const BinaryWeightSource* source = (const BinaryWeightSource*)in.pword(binaryWeightSourceIdx());
+  if(source != NULL)
+    readBinaryWeights(in, source, weights.data(), weights.size(), name);
+  else {
+    for(int y = 0; y < convYSize; y++) {
+      for(int x = 0; x < convXSize; x++) {
+        for(int ic = 0; ic < inChannels; ic++) {
+          for(int oc = 0; oc < outChannels; oc++) {
+            float w;
+            in >> w;
+            CHECKFINITE(w, name);
+            weights[oc * ocStride + ic * icStride + y * yStride + x * xStride] = w;
+          }
         }
       }
     }
@@ -101,37 +252,20 @@ BatchNormLayerDesc::BatchNormLayerDesc(istream& in) {
   if(epsilon <= 0)
     throw StringError(name + ": epsilon (" + Global::floatToString(epsilon) + ") <= 0");
 
-  float w;
   mean.resize(numChannels);
-  for(int c = 0; c < numChannels; c++) {
-    in >> w;
-    CHECKFINITE(w, name);
-    mean[c] = w;
-  }
+  readWeights(in, mean.data(), numChannels, name);
   variance.resize(numChannels);
-  for(int c = 0; c < numChannels; c++) {
-    in >> w;
-    CHECKFINITE(w, name);
-    variance[c] = w;
-  }
+  readWeights(in, variance.data(), numChannels, name);
   scale.resize(numChannels);
-  for(int c = 0; c < numChannels; c++) {
-    if(hasScale)
-      in >> w;
-    else
-      w = 1.0;
-    CHECKFINITE(w, name);
-    scale[c] = w;
-  }
+  if(hasScale)
+    readWeights(in, scale.data(), numChannels, name);
+  else
+    std::fill(scale.begin(), scale.end(), 1.0f);
   bias.resize(numChannels);
-  for(int c = 0; c < numChannels; c++) {
-    if(hasBias)
-      in >> w;
-    else
-      w = 1.0;
-    CHECKFINITE(w, name);
-    bias[c] = w;
-  }
+  if(hasBias)
+    readWeights(in, bias.data(), numChannels, name);
+  else
+    std::fill(bias.begin(), bias.end(), 1.0f);
 
   if(in.fail())
     throw StringError(
@@ -190,17 +324,7 @@ MatMulLayerDesc::MatMulLayerDesc(istream& in) {
   // Cublas order used is also ic,oc since we transpose
   int numWeights = inChannels * outChannels;
   weights.resize(numWeights);
-  int icStride = outChannels;
-  int ocStride = 1;
-
-  for(int ic = 0; ic < inChannels; ic++) {
-    for(int oc = 0; oc < outChannels; oc++) {
-      float w;
-      in >> w;
-      CHECKFINITE(w, name);
-      weights[oc * ocStride + ic * icStride] = w;
-    }
-  }
+  readWeights(in, weights.data(), weights.size(), name);
   if(in.fail())
     throw StringError(name + ": matmullayer failed to parse expected number of matmul weights");
 }
@@ -231,13 +355,7 @@ MatBiasLayerDesc::MatBiasLayerDesc(istream& in) {
     throw StringError(name + ": number of channels must be positive");
 
   weights.resize(numChannels);
-
-  for(int c = 0; c < numChannels; c++) {
-    float w;
-    in >> w;
-    CHECKFINITE(w, name);
-    weights[c] = w;
-  }
+  readWeights(in, weights.data(), weights.size(), name);
   if(in.fail())
     throw StringError(name + ": matbiaslayer failed to parse expected number of matbias weights");
 }
@@ -1013,25 +1131,289 @@ ModelDesc& ModelDesc::operator=(ModelDesc&& other) {
   return *this;
 }
 
+//-----------------------------------------------------------------------------
+
+namespace {
+  //Accumulates the header token stream and the data section of a binary model file.
+  //The write functions below must emit tokens in exactly the order the constructors above parse them.
+  struct BinaryModelWriter {
+    ostringstream header;
+    vector<char> data;
+    const bool weightsAsFP16;
+
+    BinaryModelWriter(bool fp16) : header(), data(), weightsAsFP16(fp16) {}
+    BinaryModelWriter(const BinaryModelWriter&) = delete;
+    BinaryModelWriter& operator=(const BinaryModelWriter&) = delete;
+
+    void writeName(const string& name) {
+      if(name.size() <= 0 || name.find_first_of(" \t\r\n\v\f") != string::npos)
+        throw StringError("Cannot write name \"" + name + "\" to a binary model file, names must be nonempty without whitespace");
+      header << name << "\n";
+    }
+
+    void writeWeights(const vector<float>& weights, size_t expectedSize, const string& name) {
+      if(weights.size() != expectedSize)
+        throw StringError(
+          name + Global::strprintf(": expected %d weights but found %d", (int)expectedSize, (int)weights.size()));
+      data.resize((data.size() + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT * BINARY_ALIGNMENT, 0);
+      size_t offset = data.size();
+      if(weightsAsFP16) {
+        data.resize(offset + weights.size() * sizeof(uint16_t));
+        for(size_t i = 0; i < weights.size(); i++) {
+          uint16_t h;
+          if(!floatToHalf(weights[i], h))
+            throw StringError(name + ": weight " + Global::floatToString(weights[i]) + " cannot be represented as fp16");
+          std::memcpy(data.data() + offset + i * sizeof(uint16_t), &h, sizeof(uint16_t));
+        }
+        header << "f16 " << offset << "\n";
+      } else {
+        data.resize(offset + weights.size() * sizeof(float));
+        std::memcpy(data.data() + offset, weights.data(), weights.size() * sizeof(float));
+        header << "f32 " << offset << "\n";
+      }
+    }
+  };
+}
+
+static void writeBinary(BinaryModelWriter& w, const ConvLayerDesc& desc) {
+  w.writeName(desc.name);
+  w.header << desc.convYSize << " " << desc.convXSize << " " << desc.inChannels << " " << desc.outChannels << " "
+           << desc.dilationY << " " << desc.dilationX << "\n";
+  w.writeWeights(
+    desc.weights, (size_t)desc.convYSize * desc.convXSize * desc.inChannels * desc.outChannels, desc.name);
+}
+
+static void writeBinary(BinaryModelWriter& w, const BatchNormLayerDesc& desc) {
+  w.writeName(desc.name);
+  w.header << desc.numChannels << " " << Global::strprintf("%.9g", desc.epsilon) << " " << (int)desc.hasScale << " "
+           << (int)desc.hasBias << "\n";
+  w.writeWeights(desc.mean, desc.numChannels, desc.name);
+  w.writeWeights(desc.variance, desc.numChannels, desc.name);
+  if(desc.hasScale)
+    w.writeWeights(desc.scale, desc.numChannels, desc.name);
+  if(desc.hasBias)
+    w.writeWeights(desc.bias, desc.numChannels, desc.name);
+}
+
+static void writeBinary(BinaryModelWriter& w, const ActivationLayerDesc& desc) {
+  w.writeName(desc.name);
+}
+
+static void writeBinary(BinaryModelWriter& w, const MatMulLayerDesc& desc) {
+  w.writeName(desc.name);
+  w.header << desc.inChannels << " " << desc.outChannels << "\n";
+  w.writeWeights(desc.weights, (size_t)desc.inChannels * desc.outChannels, desc.name);
+}
+
+static void writeBinary(BinaryModelWriter& w, const MatBiasLayerDesc& desc) {
+  w.writeName(desc.name);
+  w.header << desc.numChannels << "\n";
+  w.writeWeights(desc.weights, desc.numChannels, desc.name);
+}
+
+static void writeBinary(BinaryModelWriter& w, const ResidualBlockDesc& desc) {
+  w.writeName(desc.name);
+  writeBinary(w, desc.preBN);
+  writeBinary(w, desc.preActivation);
+  writeBinary(w, desc.regularConv);
+  writeBinary(w, desc.midBN);
+  writeBinary(w, desc.midActivation);
+  writeBinary(w, desc.finalConv);
+}
+
+static void writeBinary(BinaryModelWriter& w, const DilatedResidualBlockDesc& desc) {
+  w.writeName(desc.name);
+  writeBinary(w, desc.preBN);
+  writeBinary(w, desc.preActivation);
+  writeBinary(w, desc.regularConv);
+  writeBinary(w, desc.dilatedConv);
+  writeBinary(w, desc.midBN);
+  writeBinary(w, desc.midActivation);
+  writeBinary(w, desc.finalConv);
+}
+
+static void writeBinary(BinaryModelWriter& w, const GlobalPoolingResidualBlockDesc& desc) {
+  w.writeName(desc.name);
+  writeBinary(w, desc.preBN);
+  writeBinary(w, desc.preActivation);
+  writeBinary(w, desc.regularConv);
+  writeBinary(w, desc.gpoolConv);
+  writeBinary(w, desc.gpoolBN);
+  writeBinary(w, desc.gpoolActivation);
+  writeBinary(w, desc.gpoolToBiasMul);
+  writeBinary(w, desc.midBN);
+  writeBinary(w, desc.midActivation);
+  writeBinary(w, desc.finalConv);
+}
+
+static void writeBinary(BinaryModelWriter& w, const TrunkDesc& desc) {
+  w.writeName(desc.name);
+  w.header << desc.numBlocks << " " << desc.trunkNumChannels << " " << desc.midNumChannels << " "
+           << desc.regularNumChannels << " " << desc.dilatedNumChannels << " " << desc.gpoolNumChannels << "\n";
+  writeBinary(w, desc.initialConv);
+  if(desc.version >= 3)
+    writeBinary(w, desc.initialMatMul);
+  for(int i = 0; i < desc.blocks.size(); i++) {
+    if(desc.blocks[i].first == ORDINARY_BLOCK_KIND) {
+      w.header << "ordinary_block\n";
+      writeBinary(w, *((const ResidualBlockDesc*)desc.blocks[i].second));
+    } else if(desc.blocks[i].first == DILATED_BLOCK_KIND) {
+      w.header << "dilated_block\n";
+      writeBinary(w, *((const DilatedResidualBlockDesc*)desc.blocks[i].second));
+    } else if(desc.blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+      w.header << "gpool_block\n";
+      writeBinary(w, *((const GlobalPoolingResidualBlockDesc*)desc.blocks[i].second));
+    } else
+      ASSERT_UNREACHABLE;
+  }
+  writeBinary(w, desc.trunkTipBN);
+  writeBinary(w, desc.trunkTipActivation);
+}
+
+static void writeBinary(BinaryModelWriter& w, const PolicyHeadDesc& desc) {
+  w.writeName(desc.name);
+  writeBinary(w, desc.p1Conv);
+  writeBinary(w, desc.g1Conv);
+  writeBinary(w, desc.g1BN);
+  writeBinary(w, desc.g1Activation);
+  writeBinary(w, desc.gpoolToBiasMul);
+  writeBinary(w, desc.p1BN);
+  writeBinary(w, desc.p1Activation);
+  writeBinary(w, desc.p2Conv);
+  writeBinary(w, desc.gpoolToPassMul);
+}
+
+static void writeBinary(BinaryModelWriter& w, const ValueHeadDesc& desc) {
+  w.writeName(desc.name);
+  writeBinary(w, desc.v1Conv);
+  writeBinary(w, desc.v1BN);
+  writeBinary(w, desc.v1Activation);
+  writeBinary(w, desc.v2Mul);
+  writeBinary(w, desc.v2Bias);
+  writeBinary(w, desc.v2Activation);
+  writeBinary(w, desc.v3Mul);
+  writeBinary(w, desc.v3Bias);
+  if(desc.version >= 3) {
+    writeBinary(w, desc.sv3Mul);
+    writeBinary(w, desc.sv3Bias);
+    writeBinary(w, desc.vOwnershipConv);
+  }
+}
+
+static void writeBinary(BinaryModelWriter& w, const ModelDesc& desc) {
+  w.writeName(desc.name);
+  w.header << desc.version << "\n";
+  if(desc.version < 3)
+    w.header << desc.xSizePreV3 << " " << desc.ySizePreV3 << "\n";
+  w.header << desc.numInputChannels << "\n";
+  if(desc.version >= 3)
+    w.header << desc.numInputGlobalChannels << "\n";
+  writeBinary(w, desc.trunk);
+  writeBinary(w, desc.policyHead);
+  writeBinary(w, desc.valueHead);
+}
+
+//Preamble layout, all in native byte order, which the endian check verifies on load:
+//  [0,8) magic, [8,12) format version, [12,16) endian check,
+//  [16,24) header bytes, [24,32) data section offset, [32,40) data section bytes, rest zero.
+void ModelDesc::saveToBinaryFile(const string& fileName, bool weightsAsFP16) const {
+  BinaryModelWriter writer(weightsAsFP16);
+  writeBinary(writer, *this);
+
+  const string header = writer.header.str();
+  const uint64_t headerBytes = header.size();
+  const uint64_t dataOffset = (BINARY_PREAMBLE_BYTES + headerBytes + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT * BINARY_ALIGNMENT;
+  const uint64_t dataBytes = writer.data.size();
+
+  char preamble[BINARY_PREAMBLE_BYTES];
+  std::memset(preamble, 0, BINARY_PREAMBLE_BYTES);
+  std::memcpy(preamble, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+  std::memcpy(preamble + 8, &BINARY_FORMAT_VERSION, sizeof(uint32_t));
+  std::memcpy(preamble + 12, &BINARY_ENDIAN_CHECK, sizeof(uint32_t));
+  std::memcpy(preamble + 16, &headerBytes, sizeof(uint64_t));
+  std::memcpy(preamble + 24, &dataOffset, sizeof(uint64_t));
+  std::memcpy(preamble + 32, &dataBytes, sizeof(uint64_t));
+
+  ofstream out(fileName, ios::out | ios::binary | ios::trunc);
+  if(!out.good())
+    throw StringError("Could not open file for writing: " + fileName);
+  out.write(preamble, BINARY_PREAMBLE_BYTES);
+  out.write(header.data(), header.size());
+  vector<char> padding(dataOffset - BINARY_PREAMBLE_BYTES - headerBytes, 0);
+  out.write(padding.data(), padding.size());
+  out.write(writer.data.data(), writer.data.size());
+  out.close();
+  if(out.fail())
+    throw StringError("Error writing binary model file: " + fileName);
+}
+
+static void loadFromBinaryFile(const string& fileName, ModelDesc& descBuf) {
+  MappedFile file(fileName);
+  if(file.size < BINARY_PREAMBLE_BYTES)
+    throw StringError("File is too short to be a binary model");
+
+  uint32_t formatVersion;
+  uint32_t endianCheck;
+  uint64_t headerBytes;
+  uint64_t dataOffset;
+  uint64_t dataBytes;
+  std::memcpy(&formatVersion, file.data + 8, sizeof(uint32_t));
+  std::memcpy(&endianCheck, file.data + 12, sizeof(uint32_t));
+  std::memcpy(&headerBytes, file.data + 16, sizeof(uint64_t));
+  std::memcpy(&dataOffset, file.data + 24, sizeof(uint64_t));
+  std::memcpy(&dataBytes, file.data + 32, sizeof(uint64_t));
+
+  if(std::memcmp(file.data, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0)
+    throw StringError("File is not a binary model");
+  if(endianCheck != BINARY_ENDIAN_CHECK)
+    throw StringError("Binary model was written on a machine with a different byte order");
+  if(formatVersion != BINARY_FORMAT_VERSION)
+    throw StringError("Unsupported binary model format version " + Global::uint64ToString(formatVersion));
+  if(
+    headerBytes > file.size - BINARY_PREAMBLE_BYTES || dataOffset < BINARY_PREAMBLE_BYTES + headerBytes ||
+    dataOffset % BINARY_ALIGNMENT != 0 || dataOffset > file.size || dataBytes != file.size - dataOffset)
+    throw StringError("Binary model has inconsistent section sizes, file is truncated or corrupt");
+
+  istringstream in(string(file.data + BINARY_PREAMBLE_BYTES, headerBytes));
+  BinaryWeightSource source;
+  source.data = file.data + dataOffset;
+  source.size = dataBytes;
+  in.pword(binaryWeightSourceIdx()) = (void*)&source;
+
+  descBuf = ModelDesc(in);
+
+  string extra;
+  in >> extra;
+  if(!in.fail())
+    throw StringError("Binary model header has unexpected trailing data: " + extra);
+}
+
 void ModelDesc::loadFromFileMaybeGZipped(const string& fileName, ModelDesc& descBuf) {
   try {
     //zstr has a bad property of simply aborting the program if the file doesn't exist
     //So we try to catch this common error by explicitly testing first if the file exists by trying to open it normally
     //to turn it into a regular C++ exception.
+    bool isBinary;
     {
-      ifstream testIn(fileName);
+      ifstream testIn(fileName, ios::in | ios::binary);
       if(!testIn.good())
         throw StringError("File does not exist or could not be opened: " + fileName);
+      char magic[sizeof(BINARY_MAGIC)];
+      testIn.read(magic, sizeof(magic));
+      isBinary = testIn.gcount() == sizeof(magic) && std::memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0;
+    }
+    if(isBinary)
+      loadFromBinaryFile(fileName, descBuf);
+    else {
+      zstr::ifstream in(fileName);
+      descBuf = std::move(ModelDesc(in));
     }
-    zstr::ifstream in(fileName);
-    descBuf = std::move(ModelDesc(in));
   }
   catch(const StringError& e) {
     throw StringError("Error parsing model file " + fileName + ": " + e.what());
   }
 }
 
-
 Rules ModelDesc::getSupportedRules(const Rules& desiredRules, bool& supported) const {
   static_assert(NNModelVersion::latestModelVersionImplemented == 6, "");
   Rules rules = desiredRules;
@@ -1,5 +1,6 @@
 /* Data descriptors shared between the backends. Supports I/O to simple text
-   format generated by the python training. */
+   format generated by the python training, and to a memory-mappable binary
+   format with the same layer topology that loads much faster. */
 
 #ifndef DESC_H
 #define DESC_H
@@ -264,7 +265,11 @@ struct ModelDesc {
   ModelDesc& operator=(ModelDesc&& other);
 
   //Loads a model from a file that may or may not be gzipped, storing it in descBuf
+  //Also accepts binary model files written by saveToBinaryFile, which are detected by their magic bytes.
   static void loadFromFileMaybeGZipped(const std::string& fileName, ModelDesc& descBuf);
+  //Writes this model in the binary format, which loads by memory-mapping instead of text parsing.
+  //If weightsAsFP16, weights are stored as fp16, throwing if any weight is out of range.
+  void saveToBinaryFile(const std::string& fileName, bool weightsAsFP16) const;
 
   //Return the "nearest" supported ruleset to desiredRules by this model.
   //Fills supported with true if desiredRules itself was exactly supported, false if some modifications had to be made.
@@ -15,10 +15,12 @@ void NeuralNet::globalCleanup() {
 
 ComputeContext* NeuralNet::createComputeContext(
   const std::vector<int>& gpuIdxs,
-  Logger* logger
+  Logger* logger,
+  const string& tuneFile
 ) {
   (void)gpuIdxs;
   (void)logger;
+  (void)tuneFile;
   throw StringError("Dummy neural net backend: NeuralNet::createComputeContext unimplemented");
 }
 void NeuralNet::freeComputeContext(ComputeContext* computeContext) {
@@ -60,6 +62,7 @@ ComputeHandle* NeuralNet::createComputeHandle(
   bool inputsUseNHWC,
   int gpuIdxForThisThread,
   bool useFP16,
+  bool useINT8,
   bool cudaUseNHWC
 ) {
   (void)context;
@@ -72,6 +75,7 @@ ComputeHandle* NeuralNet::createComputeHandle(
   (void)inputsUseNHWC;
   (void)gpuIdxForThisThread;
   (void)useFP16;
+  (void)useINT8;
   (void)cudaUseNHWC;
   throw StringError("Dummy neural net backend: NeuralNet::createLocalGpuHandle unimplemented");
 }
@@ -111,6 +115,13 @@ bool* NeuralNet::getSymmetriesInplace(InputBuffers* buffers) {
   throw StringError("Dummy neural net backend: NeuralNet::getSymmetriesInplace unimplemented");
 }
 
+void NeuralNet::setBatchInputsExternal(InputBuffers* buffers, const float* spatial, const float* global) {
+  (void)buffers;
+  (void)spatial;
+  (void)global;
+  throw StringError("Dummy neural net backend: NeuralNet::setBatchInputsExternal unimplemented");
+}
+
 int NeuralNet::getBatchEltSpatialLen(const InputBuffers* buffers) {
   (void)buffers;
   throw StringError("Dummy neural net backend: NeuralNet::getBatchEltSpatialLen unimplemented");
@@ -134,6 +145,17 @@ void NeuralNet::getOutput(
   throw StringError("Dummy neural net backend: NeuralNet::getOutput unimplemented");
 }
 
+bool NeuralNet::setProfilingEnabled(ComputeHandle* gpuHandle, bool enabled) {
+  (void)gpuHandle;
+  (void)enabled;
+  return false;
+}
+
+void NeuralNet::getProfile(const ComputeHandle* gpuHandle, vector<NNLayerProfile>& profile) {
+  (void)gpuHandle;
+  profile.clear();
+}
+
 
 
 bool NeuralNet::testEvaluateConv(
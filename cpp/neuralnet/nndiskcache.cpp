@@ -0,0 +1,307 @@
+#include "../neuralnet/nndiskcache.h"
+
+#include <cstring>
+
+using namespace std;
+
+//Bump this whenever the layout of the file or of CompactNNOutput serialization changes
+static const uint32_t DISK_CACHE_VERSION = 1;
+static const char DISK_CACHE_MAGIC[8] = {'K','G','N','N','D','C','A','C'};
+
+struct NNDiskCache::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t unused;
+  uint64_t fileBytes;
+  uint64_t numSlots;
+  //Where the next record goes
+  std::atomic<uint64_t> dataEnd;
+  std::atomic<uint64_t> numEntries;
+  char padding[16];
+};
+
+//Index entry, empty while offset is 0. The key is written before the offset and never changes once the offset is.
+struct NNDiskCache::Slot {
+  std::atomic<uint64_t> key0;
+  std::atomic<uint64_t> key1;
+  std::atomic<uint64_t> offset;
+};
+
+//Each record is key0, key1, the length of the serialized CompactNNOutput as a uint32 followed by 4 unused bytes,
+//a checksum of all of those, and then the serialized output itself, padded to a multiple of 8 bytes.
+static const uint64_t RECORD_HEADER_BYTES = 32;
+
+//Budget for the index, in bytes of file per slot. Entries for 19x19 are a few hundred bytes on average,
+//so the index fills up at around the same time as the records.
+static const uint64_t BYTES_PER_SLOT = 512;
+//Entries not found within this many slots of where they hash to are assumed absent
+static const uint64_t MAX_PROBES = 16;
+
+//Distinguishes entries with and without owner maps for the same position
+static const Hash128 OWNER_MAP_KEY_SALT = Hash128(0x5b7c2a9e4f1d3068ULL, 0xe1a4c67b92d0853fULL);
+
+static uint64_t computeNumSlots(uint64_t fileBytes) {
+  uint64_t numSlots = 1;
+  while(numSlots * 2 <= fileBytes / BYTES_PER_SLOT)
+    numSlots *= 2;
+  return numSlots;
+}
+
+static uint64_t computeDataStart(uint64_t numSlots, size_t headerBytes, size_t slotBytes) {
+  uint64_t dataStart = headerBytes + numSlots * slotBytes;
+  return (dataStart + 63) / 64 * 64;
+}
+
+static uint64_t checksumOf(Hash128 key, const uint8_t* buf, uint64_t numBytes) {
+  uint64_t h = Hash::murmurMix(key.hash0 ^ Hash::murmurMix(key.hash1 ^ numBytes));
+  uint64_t i = 0;
+  for(; i+8 <= numBytes; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, buf + i, 8);
+    h = Hash::murmurMix(h ^ word);
+  }
+  uint64_t word = 0;
+  std::memcpy(&word, buf + i, numBytes - i);
+  return Hash::murmurMix(h ^ word);
+}
+
+NNDiskCache::NNDiskCache(
+  const string& path,
+  int64_t maxBytes,
+  bool readOnly,
+  Hash128 salt,
+  int topK,
+  Logger* logger
+)
+  :file(NULL),
+   header(NULL),
+   slots(NULL),
+   numSlots(0),
+   slotMask(0),
+   dataStart(0),
+   valid(false),
+   keySalt(salt),
+   policyTopK(topK),
+   writeMutex(),
+   numLookups(0),
+   numHits(0),
+   numInserts(0),
+   numInsertsDropped(0)
+{
+  static_assert(sizeof(Header) == 64, "");
+  static_assert(sizeof(Slot) == 24, "");
+  if(maxBytes < MIN_BYTES)
+    throw StringError("NNDiskCache: size must be at least " + Global::int64ToString(MIN_BYTES) + " bytes");
+  if(policyTopK < 0)
+    throw StringError("NNDiskCache: policyTopK is negative: " + Global::intToString(policyTopK));
+
+  file = new SharedMappedFile(path, (size_t)maxBytes, !readOnly);
+  setLayout();
+
+  //Check that the file is one of ours and consistent with its own size
+  uint64_t fileBytes = file->size;
+  valid = fileBytes >= (uint64_t)MIN_BYTES;
+  if(valid) {
+    uint64_t dataEnd = header->dataEnd.load(std::memory_order_acquire);
+    valid =
+      std::memcmp(header->magic, DISK_CACHE_MAGIC, sizeof(DISK_CACHE_MAGIC)) == 0 &&
+      header->version == DISK_CACHE_VERSION &&
+      header->fileBytes == fileBytes &&
+      header->numSlots == numSlots &&
+      dataEnd >= dataStart && dataEnd <= fileBytes;
+  }
+
+  if(file->writable && !valid) {
+    //Only a file that isn't a valid cache is resized, nothing in it is worth keeping
+    if(fileBytes != (uint64_t)maxBytes) {
+      file->resize((size_t)maxBytes);
+      setLayout();
+      fileBytes = file->size;
+    }
+    //Start afresh, writing the magic last so that a partially initialized file is never taken as valid
+    std::memset(file->data, 0, dataStart);
+    header->version = DISK_CACHE_VERSION;
+    header->fileBytes = fileBytes;
+    header->numSlots = numSlots;
+    header->dataEnd.store(dataStart);
+    header->numEntries.store(0);
+    std::memcpy(header->magic, DISK_CACHE_MAGIC, sizeof(DISK_CACHE_MAGIC));
+    valid = true;
+    if(logger != NULL)
+      logger->write("Initialized NN disk cache " + path + " with " + Global::uint64ToString(fileBytes) + " bytes");
+  }
+  else if(valid) {
+    if(logger != NULL) {
+      logger->write(
+        string("Opened NN disk cache ") + path + (file->writable ? "" : " read-only") +
+        " with " + Global::uint64ToString(header->numEntries.load()) + " entries"
+      );
+      //Resizing would throw away every entry, and could crash readers still mapping the old size
+      if(file->writable && fileBytes != (uint64_t)maxBytes)
+        logger->write(
+          "NN disk cache " + path + " keeps its existing size of " + Global::uint64ToString(fileBytes) +
+          " bytes rather than " + Global::int64ToString(maxBytes) + ", delete it to change its size"
+        );
+    }
+  }
+  else {
+    if(logger != NULL)
+      logger->write("WARNING: NN disk cache " + path + " is not a valid cache file or is still being initialized, ignoring it");
+  }
+}
+
+void NNDiskCache::setLayout() {
+  uint64_t fileBytes = file->size;
+  header = (Header*)file->data;
+  if(fileBytes < (uint64_t)MIN_BYTES) {
+    slots = NULL;
+    numSlots = 0;
+    slotMask = 0;
+    dataStart = 0;
+    return;
+  }
+  numSlots = computeNumSlots(fileBytes);
+  slotMask = numSlots - 1;
+  dataStart = computeDataStart(numSlots, sizeof(Header), sizeof(Slot));
+  slots = (Slot*)(file->data + sizeof(Header));
+}
+
+NNDiskCache::~NNDiskCache() {
+  file->flush();
+  delete file;
+}
+
+bool NNDiskCache::isWritable() const {
+  return file->writable;
+}
+
+Hash128 NNDiskCache::getKey(Hash128 nnHash, bool hasOwnerMap) const {
+  Hash128 key = nnHash ^ keySalt;
+  if(hasOwnerMap)
+    key ^= OWNER_MAP_KEY_SALT;
+  return key;
+}
+
+bool NNDiskCache::getWithKey(Hash128 key, shared_ptr<NNOutput>& ret) const {
+  uint64_t fileBytes = file->size;
+  uint64_t start = key.hash0 & slotMask;
+  for(uint64_t i = 0; i<MAX_PROBES; i++) {
+    const Slot& slot = slots[(start + i) & slotMask];
+    uint64_t offset = slot.offset.load(std::memory_order_acquire);
+    if(offset == 0)
+      return false;
+    if(slot.key0.load(std::memory_order_relaxed) != key.hash0 || slot.key1.load(std::memory_order_relaxed) != key.hash1)
+      continue;
+
+    //Trust nothing in the record until it checks out, in case the file was cut off or corrupted
+    if(offset < dataStart || offset > fileBytes - RECORD_HEADER_BYTES)
+      return false;
+    const uint8_t* record = (const uint8_t*)file->data + offset;
+    Hash128 recordKey;
+    uint32_t numBytes;
+    uint64_t checksum;
+    std::memcpy(&recordKey.hash0, record, 8);
+    std::memcpy(&recordKey.hash1, record + 8, 8);
+    std::memcpy(&numBytes, record + 16, 4);
+    std::memcpy(&checksum, record + 24, 8);
+    if(recordKey != key || numBytes > fileBytes - offset - RECORD_HEADER_BYTES)
+      return false;
+    const uint8_t* payload = record + RECORD_HEADER_BYTES;
+    if(checksumOf(key, payload, numBytes) != checksum)
+      return false;
+    try {
+      ret = CompactNNOutput::deserialize(payload, numBytes)->decompress();
+    }
+    catch(const StringError&) {
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+bool NNDiskCache::get(Hash128 nnHash, bool includeOwnerMap, shared_ptr<NNOutput>& ret) {
+  numLookups.fetch_add(1, std::memory_order_relaxed);
+  ret = nullptr;
+  if(!valid)
+    return false;
+  //Prefer what was asked for, but a result with an owner map is as good as one without
+  bool found =
+    getWithKey(getKey(nnHash, includeOwnerMap), ret) ||
+    getWithKey(getKey(nnHash, !includeOwnerMap), ret);
+  if(!found)
+    return false;
+  ret->nnHash = nnHash;
+  numHits.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void NNDiskCache::set(const NNOutput& p, int boardXSize, int boardYSize) {
+  if(!valid || !file->writable)
+    return;
+  CompactNNOutput compact(p, boardXSize, boardYSize, policyTopK);
+  uint64_t numBytes = compact.getSerializedSize();
+  uint64_t recordBytes = RECORD_HEADER_BYTES + (numBytes + 7) / 8 * 8;
+  Hash128 key = getKey(p.nnHash, p.whiteOwnerMap != NULL);
+
+  std::lock_guard<std::mutex> lock(writeMutex);
+  Slot* slot = NULL;
+  uint64_t start = key.hash0 & slotMask;
+  for(uint64_t i = 0; i<MAX_PROBES; i++) {
+    Slot& s = slots[(start + i) & slotMask];
+    if(s.offset.load(std::memory_order_relaxed) == 0) {
+      slot = &s;
+      break;
+    }
+    //Already there
+    if(s.key0.load(std::memory_order_relaxed) == key.hash0 && s.key1.load(std::memory_order_relaxed) == key.hash1)
+      return;
+  }
+  uint64_t offset = header->dataEnd.load(std::memory_order_relaxed);
+  if(slot == NULL || offset + recordBytes > file->size) {
+    numInsertsDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  //Write the record, then claim its space, then publish it in the index
+  uint8_t* record = (uint8_t*)file->data + offset;
+  uint8_t* payload = record + RECORD_HEADER_BYTES;
+  uint32_t numBytes32 = (uint32_t)numBytes;
+  compact.serialize(payload);
+  uint64_t checksum = checksumOf(key, payload, numBytes);
+  std::memset(record, 0, RECORD_HEADER_BYTES);
+  std::memcpy(record, &key.hash0, 8);
+  std::memcpy(record + 8, &key.hash1, 8);
+  std::memcpy(record + 16, &numBytes32, 4);
+  std::memcpy(record + 24, &checksum, 8);
+  header->dataEnd.store(offset + recordBytes, std::memory_order_release);
+  slot->key0.store(key.hash0, std::memory_order_relaxed);
+  slot->key1.store(key.hash1, std::memory_order_relaxed);
+  slot->offset.store(offset, std::memory_order_release);
+  header->numEntries.fetch_add(1, std::memory_order_relaxed);
+  numInserts.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t NNDiskCache::getNumLookups() const {
+  return numLookups.load(std::memory_order_relaxed);
+}
+uint64_t NNDiskCache::getNumHits() const {
+  return numHits.load(std::memory_order_relaxed);
+}
+uint64_t NNDiskCache::getNumInserts() const {
+  return numInserts.load(std::memory_order_relaxed);
+}
+uint64_t NNDiskCache::getNumInsertsDropped() const {
+  return numInsertsDropped.load(std::memory_order_relaxed);
+}
+uint64_t NNDiskCache::getNumEntries() const {
+  if(!valid)
+    return 0;
+  return header->numEntries.load(std::memory_order_relaxed);
+}
+void NNDiskCache::clearStats() {
+  numLookups.store(0);
+  numHits.store(0);
+  numInserts.store(0);
+  numInsertsDropped.store(0);
+}
@@ -0,0 +1,90 @@
+#ifndef NEURALNET_NNDISKCACHE_H_
+#define NEURALNET_NNDISKCACHE_H_
+
+#include "../core/global.h"
+#include "../core/hash.h"
+#include "../core/logger.h"
+#include "../core/mmapfile.h"
+#include "../core/multithread.h"
+#include "../neuralnet/nninputs.h"
+
+//Persistent cache of neural net outputs in a memory-mapped file, so that evaluations are reused across runs.
+//Sits behind NNCacheTable: lookups that miss in memory try here before going to the neural net.
+//
+//The file has a fixed size, holding a header, an open-addressed index of entries keyed by hash, and then records
+//appended one after another, each a CompactNNOutput with a checksum. Once the file is full no further entries are
+//added. Records are written completely before being published in the index, and lookups check the checksum,
+//so a process dying partway through a write at worst leaves an entry that is never found.
+//
+//One process at a time can write to a file, others that open it only read from it, and all of them see entries
+//as soon as they are published.
+class NNDiskCache {
+ public:
+  //Entries are keyed by nnHash together with keySalt, which should identify everything else the output depends on,
+  //such as the model, so that files are never mixed up between them.
+  //maxBytes is the size of a new file. An existing valid file keeps its size, only one that isn't a valid cache is
+  //resized. If readOnly, or another process is already writing the file, it is only read.
+  //Entries are stored as CompactNNOutputs with the given policyTopK.
+  NNDiskCache(
+    const std::string& path,
+    int64_t maxBytes,
+    bool readOnly,
+    Hash128 keySalt,
+    int policyTopK,
+    Logger* logger
+  );
+  ~NNDiskCache();
+
+  NNDiskCache(const NNDiskCache& other) = delete;
+  NNDiskCache& operator=(const NNDiskCache& other) = delete;
+
+  bool isWritable() const;
+
+  //These are thread-safe. For get, ret will be set to nullptr upon a failure to find. A result with an owner map
+  //is returned if there is one, and otherwise if includeOwnerMap, then a result without one may still be returned.
+  //For set, the board size is that of the position that p is the output for. Does nothing if read-only.
+  bool get(Hash128 nnHash, bool includeOwnerMap, std::shared_ptr<NNOutput>& ret);
+  void set(const NNOutput& p, int boardXSize, int boardYSize);
+
+  //Stats since construction or the last clearStats
+  uint64_t getNumLookups() const;
+  uint64_t getNumHits() const;
+  uint64_t getNumInserts() const;
+  //Number of entries that couldn't be inserted because the file or the index around where they go was full
+  uint64_t getNumInsertsDropped() const;
+  //Entries in the file, including ones from previous runs and from other processes
+  uint64_t getNumEntries() const;
+  void clearStats();
+
+  static const int64_t MIN_BYTES = 1 << 20;
+
+ private:
+  struct Header;
+  struct Slot;
+
+  SharedMappedFile* file;
+  Header* header;
+  Slot* slots;
+  uint64_t numSlots;
+  uint64_t slotMask;
+  uint64_t dataStart;
+  bool valid;
+  Hash128 keySalt;
+  int policyTopK;
+
+  //Held by writers only, readers don't take any lock
+  std::mutex writeMutex;
+
+  std::atomic<uint64_t> numLookups;
+  std::atomic<uint64_t> numHits;
+  std::atomic<uint64_t> numInserts;
+  std::atomic<uint64_t> numInsertsDropped;
+
+  //Set header, slots and the index layout from the size of file
+  void setLayout();
+
+  Hash128 getKey(Hash128 nnHash, bool hasOwnerMap) const;
+  bool getWithKey(Hash128 key, std::shared_ptr<NNOutput>& ret) const;
+};
+
+#endif  // NEURALNET_NNDISKCACHE_H_
@@ -1,10 +1,119 @@
 #include "../neuralnet/nneval.h"
+
+#include <cstring>
+#include <sys/stat.h>
+
+#include "../core/mmapfile.h"
+#include "../core/sha2.h"
 #include "../neuralnet/modelversion.h"
+#include "../neuralnet/nnremote.h"
+#include "../neuralnet/nnsynthetic.h"
+#include "../neuralnet/nnservergroup.h"
 
 using namespace std;
 
 //-------------------------------------------------------------------------------------
 
+//Process-wide registry of loaded models, so that every NNEvaluator for the same model shares one LoadedModel
+//and its weights, and memory scales with the number of distinct models rather than the number of evaluators.
+//Keyed by path and content hash, so that a file that is replaced on disk is loaded afresh.
+//LoadedModel is only ever used through const pointers once loaded and backends lock any state they lazily initialize
+//inside it, so sharing it between evaluators is safe.
+namespace {
+  struct SharedLoadedModel {
+    LoadedModel* loadedModel;
+    int refCount;
+  };
+}
+
+static std::mutex sharedModelsMutex;
+static std::map<string,SharedLoadedModel> sharedModelsByKey;
+static std::map<const LoadedModel*,string> sharedModelKeys;
+//Hashing a large model file takes about as long as loading it, so each file is only hashed again once its size or
+//modification time changes
+static std::map<string,string> modelFileHashesByStamp;
+
+//SHA256 of the contents of the model file as hex, or empty if it couldn't be read
+static string getModelFileHash(const string& modelFileName) {
+  struct stat fileStat;
+  if(stat(modelFileName.c_str(), &fileStat) != 0)
+    return string();
+  string stamp =
+    modelFileName + " " + Global::int64ToString((int64_t)fileStat.st_size) + " " +
+    Global::int64ToString((int64_t)fileStat.st_mtime);
+  {
+    std::lock_guard<std::mutex> lock(sharedModelsMutex);
+    auto iter = modelFileHashesByStamp.find(stamp);
+    if(iter != modelFileHashesByStamp.end())
+      return iter->second;
+  }
+
+  string hashStr;
+  try {
+    MappedFile file(modelFileName);
+    char hash[65];
+    SHA2::get256((const uint8_t*)file.data, file.size, hash);
+    hashStr = string(hash);
+  }
+  catch(const StringError&) {
+    return string();
+  }
+  std::lock_guard<std::mutex> lock(sharedModelsMutex);
+  modelFileHashesByStamp[stamp] = hashStr;
+  return hashStr;
+}
+
+//Backends currently ignore modelFileIdx, so it is not part of the key and the first evaluator to load a model
+//determines the idx it was loaded with.
+static LoadedModel* acquireSharedLoadedModel(const string& modelFileName, const string& modelFileHash, int modelFileIdx, Logger* logger) {
+  //Let the backend report the error in the usual way
+  if(modelFileHash.size() <= 0)
+    return NeuralNet::loadModelFile(modelFileName, modelFileIdx);
+  string key = modelFileName + " " + modelFileHash;
+
+  //Holding the lock while loading also makes sure that evaluators being constructed concurrently
+  //for the same model don't both load it.
+  std::lock_guard<std::mutex> lock(sharedModelsMutex);
+  auto iter = sharedModelsByKey.find(key);
+  if(iter != sharedModelsByKey.end()) {
+    iter->second.refCount += 1;
+    if(logger != NULL)
+      logger->write(
+        "Sharing already loaded model " + modelFileName +
+        " (" + Global::intToString(iter->second.refCount) + " evaluators now use it)"
+      );
+    return iter->second.loadedModel;
+  }
+
+  LoadedModel* loadedModel = NeuralNet::loadModelFile(modelFileName, modelFileIdx);
+  SharedLoadedModel shared;
+  shared.loadedModel = loadedModel;
+  shared.refCount = 1;
+  sharedModelsByKey[key] = shared;
+  sharedModelKeys[loadedModel] = key;
+  return loadedModel;
+}
+
+static void releaseSharedLoadedModel(LoadedModel* loadedModel) {
+  {
+    std::lock_guard<std::mutex> lock(sharedModelsMutex);
+    auto keyIter = sharedModelKeys.find(loadedModel);
+    //Not in the registry if we couldn't hash the file, so this evaluator was the only owner
+    if(keyIter != sharedModelKeys.end()) {
+      auto iter = sharedModelsByKey.find(keyIter->second);
+      assert(iter != sharedModelsByKey.end());
+      iter->second.refCount -= 1;
+      if(iter->second.refCount > 0)
+        return;
+      sharedModelsByKey.erase(iter);
+      sharedModelKeys.erase(keyIter);
+    }
+  }
+  NeuralNet::freeLoadedModel(loadedModel);
+}
+
+//-------------------------------------------------------------------------------------
+
 NNResultBuf::NNResultBuf()
   : clientWaitingForResult(),
     resultMutex(),
@@ -12,26 +121,31 @@ NNResultBuf::NNResultBuf()
     includeOwnerMap(false),
     boardXSizeForServer(0),
     boardYSizeForServer(0),
-    rowSpatialSize(0),
-    rowGlobalSize(0),
-    rowSpatial(NULL),
-    rowGlobal(NULL),
+    searchDepth(0),
+    highPriority(false),
     result(nullptr),
-    errorLogLockout(false)
+    errorLogLockout(false),
+    completionQueue(NULL),
+    pendingBoard(NULL),
+    pendingHistory(NULL),
+    pendingPla(C_EMPTY),
+    pendingDrawEquivalentWinsForWhite(0.0),
+    pendingNNHash(),
+    pendingCacheSymmetry(0),
+    pendingIsCoalesced(false),
+    resultWithoutOwnerMap(nullptr),
+    inFlightEval(nullptr)
 {}
 
-NNResultBuf::~NNResultBuf() {
-  if(rowSpatial != NULL)
-    delete[] rowSpatial;
-  if(rowGlobal != NULL)
-    delete[] rowGlobal;
-}
+NNResultBuf::~NNResultBuf()
+{}
 
 //-------------------------------------------------------------------------------------
 
 NNServerBuf::NNServerBuf(const NNEvaluator& nnEval, const LoadedModel* model)
   :inputBuffers(NULL),
-   resultBufs(NULL)
+   resultBufs(NULL),
+   remoteConnection(NULL)
 {
   int maxNumRows = nnEval.getMaxBatchSize();
   if(model != NULL)
@@ -48,10 +162,33 @@ NNServerBuf::~NNServerBuf() {
   //Pointers inside here don't need to be deleted, they simply point to the clients waiting for results
   delete[] resultBufs;
   resultBufs = NULL;
+  delete remoteConnection;
+  remoteConnection = NULL;
 }
 
 //-------------------------------------------------------------------------------------
 
+NNEvaluator::Options::Options()
+  :minBatchFill(1),
+   maxBatchWaitMs(0.0),
+   compressCache(false),
+   cachePolicyTopK(0),
+   canonicalizeCacheSymmetry(false),
+   diskCacheFile(),
+   diskCacheMaxBytes((int64_t)1 << 30),
+   diskCacheReadOnly(false),
+   sharedCacheName(),
+   sharedCacheMaxBytes((int64_t)1 << 30),
+   nnServerSocket(),
+   syntheticNumDevices(0),
+   syntheticBatchLatencyMs(0.0),
+   syntheticRowLatencyMs(0.0),
+   recordFile(),
+   replayFile(),
+   replayMissPolicy(NNReplay::MISS_UNIFORM),
+   tuneFile()
+{}
+
 NNEvaluator::NNEvaluator(
   const string& mName,
   const string& mFileName,
@@ -68,7 +205,8 @@ NNEvaluator::NNEvaluator(
   int nnMutexPoolSizePowerofTwo,
   bool skipNeuralNet,
   bool alwaysOwnerMap,
-  float nnPolicyTemp
+  float nnPolicyTemp,
+  const Options& options
 )
   :modelName(mName),
    modelFileName(mFileName),
@@ -79,23 +217,35 @@ NNEvaluator::NNEvaluator(
    inputsUseNHWC(iUseNHWC),
    computeContext(NULL),
    loadedModel(NULL),
+   remoteClient(NULL),
+   syntheticBackend(NULL),
    nnCacheTable(NULL),
+   nnSharedCache(NULL),
+   nnDiskCache(NULL),
+   nnRecorder(NULL),
+   nnReplay(NULL),
+   replayMissPolicy(options.replayMissPolicy),
+   nnInFlightTable(NULL),
    debugSkipNeuralNet(skipNeuralNet),
    alwaysIncludeOwnerMap(alwaysOwnerMap),
    nnPolicyInvTemperature(1.0/nnPolicyTemp),
+   canonicalizeCacheSymmetry(options.canonicalizeCacheSymmetry),
    serverThreads(),
-   serverWaitingForBatchStart(),
-   bufferMutex(),
+   serverGroup(NULL),
    isKilled(false),
    maxNumRows(maxBatchSize),
-   numResultBufss(),
-   numResultBufssMask(),
    m_numRowsProcessed(0),
    m_numBatchesProcessed(0),
-   m_resultBufss(NULL),
-   m_currentResultBufsLen(0),
-   m_currentResultBufsIdx(0),
-   m_oldestResultBufsIdx(0)
+   m_numHighPriorityRowsProcessed(0),
+   minBatchFill(options.minBatchFill),
+   resultBufQueue(NULL),
+   rowSpatialLen(0),
+   rowGlobalLen(0),
+   inputRowsSpatial(NULL),
+   inputRowsGlobal(NULL),
+   highPriorityQueue(NULL),
+   highPriorityRowsSpatial(NULL),
+   highPriorityRowsGlobal(NULL)
 {
   if(nnXLen > NNPos::MAX_BOARD_LEN)
     throw StringError("Maximum supported nnEval board size is " + Global::intToString(NNPos::MAX_BOARD_LEN));
@@ -105,60 +255,168 @@ NNEvaluator::NNEvaluator(
     throw StringError("maxConcurrentEvals is negative: " + Global::intToString(maxConcurrentEvals));
   if(maxBatchSize <= 0)
     throw StringError("maxBatchSize is negative: " + Global::intToString(maxBatchSize));
-
-  //Add three, just to give a bit of extra headroom, and make it a power of two
-  numResultBufss = maxConcurrentEvals / maxBatchSize + 3;
-  {
-    int x = 1;
-    while (x < numResultBufss)
-      x *= 2;
-    numResultBufss = x;
-  }
-  numResultBufssMask = numResultBufss - 1;
+  if(options.maxBatchWaitMs < 0)
+    throw StringError("maxBatchWaitMs is negative: " + Global::doubleToString(options.maxBatchWaitMs));
+  if(options.cachePolicyTopK < 0)
+    throw StringError("cachePolicyTopK is negative: " + Global::intToString(options.cachePolicyTopK));
+
+  //No point waiting for more rows than fit in a batch, or without any time to wait
+  if(minBatchFill > maxBatchSize)
+    minBatchFill = maxBatchSize;
+  if(options.maxBatchWaitMs <= 0)
+    minBatchFill = 1;
+
+  //Every concurrent eval can have a row queued, plus a few batches of extra headroom
+  resultBufQueue = new LockFreeBatchQueue<NNResultBuf*>(
+    (size_t)maxConcurrentEvals + 3 * (size_t)maxBatchSize, (size_t)minBatchFill, options.maxBatchWaitMs
+  );
+  //Few evaluations are high priority at once, and they're served as soon as possible rather than waited for
+  highPriorityQueue = new LockFreeBatchQueue<NNResultBuf*>(
+    std::min((size_t)maxConcurrentEvals, 2 * (size_t)maxBatchSize), 1, 0.0
+  );
 
   if(nnCacheSizePowerOfTwo >= 0)
-    nnCacheTable = new NNCacheTable(nnCacheSizePowerOfTwo, nnMutexPoolSizePowerofTwo);
-
-  computeContext = NeuralNet::createComputeContext(gpuIdxs,logger);
+    nnCacheTable = new NNCacheTable(nnCacheSizePowerOfTwo, nnMutexPoolSizePowerofTwo, options.compressCache, options.cachePolicyTopK);
+
+  if(options.syntheticNumDevices > 0 && options.nnServerSocket.size() > 0)
+    throw StringError("Cannot use both a synthetic neural net and an nn server");
+  if(options.recordFile.size() > 0 && options.replayFile.size() > 0)
+    throw StringError("Cannot both record and replay neural net evaluations");
+
+  if(options.replayFile.size() > 0) {
+    nnReplay = new NNReplay(options.replayFile, logger);
+    if(nnReplay->getNNXLen() != nnXLen || nnReplay->getNNYLen() != nnYLen)
+      throw StringError(
+        "Nn recording " + options.replayFile + " is for nnXLen " + Global::intToString(nnReplay->getNNXLen()) +
+        " nnYLen " + Global::intToString(nnReplay->getNNYLen()) + " but this has " +
+        Global::intToString(nnXLen) + " " + Global::intToString(nnYLen)
+      );
+    if(nnReplay->getCanonicalizeSymmetry() != canonicalizeCacheSymmetry)
+      throw StringError("Nn recording " + options.replayFile + " must be replayed with the same nnCacheCanonicalizeSymmetry as recorded");
+    //Misses never reach the net, so there's no need to load it
+    if(replayMissPolicy != NNReplay::MISS_EVALUATE)
+      debugSkipNeuralNet = true;
+  }
 
-  if(!debugSkipNeuralNet) {
-    loadedModel = NeuralNet::loadModelFile(modelFileName, modelFileIdx);
+  string modelFileHash;
+  if(!debugSkipNeuralNet && options.syntheticNumDevices > 0) {
+    syntheticBackend = new NNSyntheticBackend(options.syntheticNumDevices, options.syntheticBatchLatencyMs, options.syntheticRowLatencyMs, nnXLen, nnYLen);
+    modelVersion = NNModelVersion::defaultModelVersion;
+    inputsVersion = NNModelVersion::getInputsVersion(modelVersion);
+  }
+  else if(!debugSkipNeuralNet && options.nnServerSocket.size() > 0) {
+    remoteClient = new NNRemoteClient(options.nnServerSocket, nnXLen, nnYLen, inputsUseNHWC, maxBatchSize, logger);
+    modelFileHash = remoteClient->getModelFileHash();
+    modelVersion = remoteClient->getModelVersion();
+    inputsVersion = NNModelVersion::getInputsVersion(modelVersion);
+  }
+  else if(!debugSkipNeuralNet) {
+    computeContext = NeuralNet::createComputeContext(gpuIdxs,logger,options.tuneFile);
+    modelFileHash = getModelFileHash(modelFileName);
+    loadedModel = acquireSharedLoadedModel(modelFileName, modelFileHash, modelFileIdx, logger);
     modelVersion = NeuralNet::getModelVersion(loadedModel);
     inputsVersion = NNModelVersion::getInputsVersion(modelVersion);
   }
   else {
+    computeContext = NeuralNet::createComputeContext(gpuIdxs,logger,string());
     modelVersion = NNModelVersion::defaultModelVersion;
     inputsVersion = NNModelVersion::getInputsVersion(modelVersion);
   }
 
-  m_resultBufss = new NNResultBuf**[numResultBufss];
-  for(int i = 0; i < numResultBufss; i++) {
-    m_resultBufss[i] = new NNResultBuf*[maxBatchSize];
-    for(int j = 0; j < maxBatchSize; j++)
-      m_resultBufss[i][j] = NULL;
+  if(nnReplay != NULL) {
+    //Hash positions as they were when recorded
+    if(debugSkipNeuralNet) {
+      modelVersion = nnReplay->getModelVersion();
+      inputsVersion = NNModelVersion::getInputsVersion(modelVersion);
+    }
+    else if(nnReplay->getModelVersion() != modelVersion)
+      throw StringError(
+        "Nn recording " + options.replayFile + " is for model version " + Global::intToString(nnReplay->getModelVersion()) +
+        " but the model has version " + Global::intToString(modelVersion)
+      );
+  }
+  if(options.recordFile.size() > 0)
+    nnRecorder = new NNRecorder(options.recordFile, modelVersion, nnXLen, nnYLen, canonicalizeCacheSymmetry, modelFileHash, logger);
+
+  if(options.diskCacheFile.size() > 0 || options.sharedCacheName.size() > 0) {
+    if(modelFileHash.size() < 32) {
+      if(logger != NULL)
+        logger->write("WARNING: Not using NN shared or disk cache since there is no model file to key it on");
+    }
+    else {
+      //Key entries on everything that the output depends on besides the position
+      Hash128 keySalt(
+        std::stoull(modelFileHash.substr(0,16), NULL, 16),
+        std::stoull(modelFileHash.substr(16,16), NULL, 16)
+      );
+      float invTemperature = nnPolicyInvTemperature;
+      uint32_t invTemperatureBits;
+      std::memcpy(&invTemperatureBits, &invTemperature, sizeof(uint32_t));
+      keySalt.hash0 ^= Hash::murmurMix(((uint64_t)nnXLen << 40) ^ ((uint64_t)nnYLen << 32) ^ invTemperatureBits);
+      //And on how entries are stored, since a lossy top-k policy must not be served to a run expecting a full one
+      keySalt.hash1 ^= Hash::murmurMix(((uint64_t)options.cachePolicyTopK << 1) ^ (canonicalizeCacheSymmetry ? 1 : 0));
+      if(options.sharedCacheName.size() > 0)
+        nnSharedCache = new NNSharedCache(options.sharedCacheName, options.sharedCacheMaxBytes, keySalt, options.cachePolicyTopK, logger);
+      struct stat diskCacheStat;
+      if(options.diskCacheFile.size() > 0 && options.diskCacheReadOnly && stat(options.diskCacheFile.c_str(), &diskCacheStat) != 0) {
+        if(logger != NULL)
+          logger->write("WARNING: Not using NN disk cache since it is read-only and " + options.diskCacheFile + " does not exist");
+      }
+      else if(options.diskCacheFile.size() > 0)
+        nnDiskCache = new NNDiskCache(options.diskCacheFile, options.diskCacheMaxBytes, options.diskCacheReadOnly, keySalt, options.cachePolicyTopK, logger);
+    }
+  }
+
+  if(nnCacheTable != NULL || nnSharedCache != NULL || nnDiskCache != NULL)
+    nnInFlightTable = new NNInFlightTable();
+
+  if(!debugSkipNeuralNet) {
+    rowSpatialLen = NNModelVersion::getNumSpatialFeatures(modelVersion) * nnXLen * nnYLen;
+    rowGlobalLen = NNModelVersion::getNumGlobalFeatures(modelVersion);
+    size_t numRows = resultBufQueue->getCapacity();
+    inputRowsSpatial = new float[numRows * rowSpatialLen];
+    inputRowsGlobal = new float[numRows * rowGlobalLen];
+    size_t numHighPriorityRows = highPriorityQueue->getCapacity();
+    highPriorityRowsSpatial = new float[numHighPriorityRows * rowSpatialLen];
+    highPriorityRowsGlobal = new float[numHighPriorityRows * rowGlobalLen];
   }
 }
 
 NNEvaluator::~NNEvaluator() {
   killServerThreads();
 
-  for(int i = 0; i < numResultBufss; i++) {
-    NNResultBuf** resultBufs = m_resultBufss[i];
-    //Pointers inside here don't need to be deleted, they simply point to the clients waiting for results
-    delete[] resultBufs;
-    m_resultBufss[i] = NULL;
-  }
-  delete[] m_resultBufss;
-  m_resultBufss = NULL;
+  //Pointers inside here don't need to be deleted, they simply point to the clients waiting for results
+  delete resultBufQueue;
+  resultBufQueue = NULL;
+  delete[] inputRowsSpatial;
+  inputRowsSpatial = NULL;
+  delete[] inputRowsGlobal;
+  inputRowsGlobal = NULL;
+  delete highPriorityQueue;
+  highPriorityQueue = NULL;
+  delete[] highPriorityRowsSpatial;
+  highPriorityRowsSpatial = NULL;
+  delete[] highPriorityRowsGlobal;
+  highPriorityRowsGlobal = NULL;
 
   if(loadedModel != NULL)
-    NeuralNet::freeLoadedModel(loadedModel);
+    releaseSharedLoadedModel(loadedModel);
   loadedModel = NULL;
 
-  NeuralNet::freeComputeContext(computeContext);
+  if(remoteClient == NULL && syntheticBackend == NULL)
+    NeuralNet::freeComputeContext(computeContext);
   computeContext = NULL;
+  delete remoteClient;
+  remoteClient = NULL;
+  delete syntheticBackend;
+  syntheticBackend = NULL;
 
   delete nnCacheTable;
+  delete nnSharedCache;
+  delete nnDiskCache;
+  delete nnRecorder;
+  delete nnReplay;
+  delete nnInFlightTable;
 }
 
 string NNEvaluator::getModelName() const {
@@ -167,6 +425,9 @@ string NNEvaluator::getModelName() const {
 string NNEvaluator::getModelFileName() const {
   return modelFileName;
 }
+bool NNEvaluator::usesNNServer() const {
+  return remoteClient != NULL;
+}
 int NNEvaluator::getMaxBatchSize() const {
   return maxNumRows;
 }
@@ -177,22 +438,184 @@ int NNEvaluator::getNNYLen() const {
   return nnYLen;
 }
 Rules NNEvaluator::getSupportedRules(const Rules& desiredRules, bool& supported) {
+  if(remoteClient != NULL || syntheticBackend != NULL) {
+    //Which rules a model supports depends only on its version
+    ModelDesc desc;
+    desc.version = modelVersion;
+    return desc.getSupportedRules(desiredRules, supported);
+  }
   return NeuralNet::getSupportedRules(loadedModel, desiredRules, supported);
 }
 
 uint64_t NNEvaluator::numRowsProcessed() const {
   return m_numRowsProcessed.load(std::memory_order_relaxed);
 }
+uint64_t NNEvaluator::numHighPriorityRowsProcessed() const {
+  return m_numHighPriorityRowsProcessed.load(std::memory_order_relaxed);
+}
 uint64_t NNEvaluator::numBatchesProcessed() const {
   return m_numBatchesProcessed.load(std::memory_order_relaxed);
 }
 double NNEvaluator::averageProcessedBatchSize() const {
-  return (double)numRowsProcessed() / (double)numBatchesProcessed();
+  uint64_t numBatches = numBatchesProcessed();
+  if(numBatches <= 0)
+    return 0.0;
+  return (double)numRowsProcessed() / (double)numBatches;
+}
+
+int NNEvaluator::getMinBatchFill() const {
+  return minBatchFill;
+}
+uint64_t NNEvaluator::numBatchFillWaits() const {
+  return resultBufQueue->getNumFillWaits();
+}
+uint64_t NNEvaluator::numBatchFillTimeouts() const {
+  return resultBufQueue->getNumFillTimeouts();
+}
+uint64_t NNEvaluator::numBatchFillWaitsSkipped() const {
+  return resultBufQueue->getNumFillWaitsSkipped();
+}
+double NNEvaluator::averageBatchFillWaitMs() const {
+  return resultBufQueue->getAverageFillWaitMs();
+}
+
+uint64_t NNEvaluator::numCacheLookups() const {
+  return nnCacheTable == NULL ? 0 : nnCacheTable->getNumLookups();
+}
+uint64_t NNEvaluator::numCacheHits() const {
+  return nnCacheTable == NULL ? 0 : nnCacheTable->getNumHits();
+}
+uint64_t NNEvaluator::numCacheInserts() const {
+  return nnCacheTable == NULL ? 0 : nnCacheTable->getNumInserts();
+}
+uint64_t NNEvaluator::numCacheEvictions() const {
+  return nnCacheTable == NULL ? 0 : nnCacheTable->getNumEvictions();
+}
+uint64_t NNEvaluator::numCacheWriteContentions() const {
+  return nnCacheTable == NULL ? 0 : nnCacheTable->getNumWriteContentions();
+}
+uint64_t NNEvaluator::numCoalescedEvals() const {
+  return nnInFlightTable == NULL ? 0 : nnInFlightTable->getNumCoalesced();
+}
+
+bool NNEvaluator::hasSharedCache() const {
+  return nnSharedCache != NULL;
+}
+uint64_t NNEvaluator::numSharedCacheLookups() const {
+  return nnSharedCache == NULL ? 0 : nnSharedCache->getNumLookups();
+}
+uint64_t NNEvaluator::numSharedCacheHits() const {
+  return nnSharedCache == NULL ? 0 : nnSharedCache->getNumHits();
+}
+uint64_t NNEvaluator::numSharedCacheInserts() const {
+  return nnSharedCache == NULL ? 0 : nnSharedCache->getNumInserts();
+}
+uint64_t NNEvaluator::numSharedCacheContentions() const {
+  return nnSharedCache == NULL ? 0 : nnSharedCache->getNumContentions();
+}
+
+bool NNEvaluator::hasDiskCache() const {
+  return nnDiskCache != NULL;
+}
+uint64_t NNEvaluator::numDiskCacheLookups() const {
+  return nnDiskCache == NULL ? 0 : nnDiskCache->getNumLookups();
+}
+uint64_t NNEvaluator::numDiskCacheHits() const {
+  return nnDiskCache == NULL ? 0 : nnDiskCache->getNumHits();
+}
+uint64_t NNEvaluator::numDiskCacheInserts() const {
+  return nnDiskCache == NULL ? 0 : nnDiskCache->getNumInserts();
+}
+uint64_t NNEvaluator::numDiskCacheInsertsDropped() const {
+  return nnDiskCache == NULL ? 0 : nnDiskCache->getNumInsertsDropped();
+}
+uint64_t NNEvaluator::numDiskCacheEntries() const {
+  return nnDiskCache == NULL ? 0 : nnDiskCache->getNumEntries();
+}
+
+bool NNEvaluator::isRecording() const {
+  return nnRecorder != NULL;
+}
+uint64_t NNEvaluator::numRecordedEvals() const {
+  return nnRecorder == NULL ? 0 : nnRecorder->getNumRecorded();
+}
+bool NNEvaluator::isReplaying() const {
+  return nnReplay != NULL;
+}
+uint64_t NNEvaluator::numReplayLookups() const {
+  return nnReplay == NULL ? 0 : nnReplay->getNumLookups();
+}
+uint64_t NNEvaluator::numReplayHits() const {
+  return nnReplay == NULL ? 0 : nnReplay->getNumHits();
+}
+
+vector<string> NNEvaluator::getStatsLines() const {
+  vector<string> lines;
+  lines.push_back("NN rows: " + Global::uint64ToString(numRowsProcessed()));
+  lines.push_back("NN high priority rows: " + Global::uint64ToString(numHighPriorityRowsProcessed()));
+  lines.push_back("NN batches: " + Global::uint64ToString(numBatchesProcessed()));
+  lines.push_back("NN avg batch size: " + Global::doubleToString(averageProcessedBatchSize()));
+  if(getMinBatchFill() > 1)
+    lines.push_back(
+      "NN batch fill waits: " + Global::uint64ToString(numBatchFillWaits()) +
+      " timeouts: " + Global::uint64ToString(numBatchFillTimeouts()) +
+      " skipped: " + Global::uint64ToString(numBatchFillWaitsSkipped()) +
+      " avg wait ms: " + Global::doubleToString(averageBatchFillWaitMs())
+    );
+  lines.push_back(
+    "NN cache lookups: " + Global::uint64ToString(numCacheLookups()) +
+    " hits: " + Global::uint64ToString(numCacheHits()) +
+    " inserts: " + Global::uint64ToString(numCacheInserts()) +
+    " evictions: " + Global::uint64ToString(numCacheEvictions()) +
+    " write contentions: " + Global::uint64ToString(numCacheWriteContentions()) +
+    " coalesced: " + Global::uint64ToString(numCoalescedEvals())
+  );
+  if(hasSharedCache())
+    lines.push_back(
+      "NN shared cache lookups: " + Global::uint64ToString(numSharedCacheLookups()) +
+      " hits: " + Global::uint64ToString(numSharedCacheHits()) +
+      " inserts: " + Global::uint64ToString(numSharedCacheInserts()) +
+      " contentions: " + Global::uint64ToString(numSharedCacheContentions())
+    );
+  if(hasDiskCache())
+    lines.push_back(
+      "NN disk cache lookups: " + Global::uint64ToString(numDiskCacheLookups()) +
+      " hits: " + Global::uint64ToString(numDiskCacheHits()) +
+      " inserts: " + Global::uint64ToString(numDiskCacheInserts()) +
+      " dropped: " + Global::uint64ToString(numDiskCacheInsertsDropped()) +
+      " entries: " + Global::uint64ToString(numDiskCacheEntries())
+    );
+  if(isReplaying())
+    lines.push_back(
+      "NN replay lookups: " + Global::uint64ToString(numReplayLookups()) +
+      " hits: " + Global::uint64ToString(numReplayHits())
+    );
+  if(isRecording())
+    lines.push_back("NN recorded evals: " + Global::uint64ToString(numRecordedEvals()));
+  return lines;
+}
+
+void NNEvaluator::logStats(Logger& logger, const string& prefix) const {
+  for(const string& line: getStatsLines())
+    logger.write(prefix + line);
 }
 
 void NNEvaluator::clearStats() {
   m_numRowsProcessed.store(0);
   m_numBatchesProcessed.store(0);
+  m_numHighPriorityRowsProcessed.store(0);
+  resultBufQueue->clearStats();
+  highPriorityQueue->clearStats();
+  if(nnCacheTable != NULL)
+    nnCacheTable->clearStats();
+  if(nnSharedCache != NULL)
+    nnSharedCache->clearStats();
+  if(nnDiskCache != NULL)
+    nnDiskCache->clearStats();
+  if(nnReplay != NULL)
+    nnReplay->clearStats();
+  if(nnInFlightTable != NULL)
+    nnInFlightTable->clearStats();
 }
 
 void NNEvaluator::clearCache() {
@@ -202,18 +625,19 @@ void NNEvaluator::clearCache() {
 
 static void serveEvals(
   int threadIdx, bool doRandomize, string randSeed, int defaultSymmetry, Logger* logger,
-  NNEvaluator* nnEval, const LoadedModel* loadedModel,
+  NNEvaluator* nnEval,
   int gpuIdxForThisThread,
   bool useFP16,
+  bool useINT8,
   bool cudaUseNHWC
 ) {
-  NNServerBuf* buf = new NNServerBuf(*nnEval,loadedModel);
+  NNServerBuf* buf = nnEval->createServerBuf();
   Rand rand(randSeed + ":NNEvalServerThread:" + Global::intToString(threadIdx));
 
   //Used to have a try catch around this but actually we're in big trouble if this raises an exception
   //and causes possibly the only nnEval thread to die, so actually go ahead and let the exception escape to
   //toplevel for easier debugging
-  nnEval->serve(*buf,rand,logger,doRandomize,defaultSymmetry,gpuIdxForThisThread,useFP16,cudaUseNHWC);
+  nnEval->serve(*buf,rand,logger,doRandomize,defaultSymmetry,gpuIdxForThisThread,useFP16,useINT8,cudaUseNHWC);
   delete buf;
 }
 
@@ -225,9 +649,10 @@ void NNEvaluator::spawnServerThreads(
   Logger& logger,
   vector<int> gpuIdxByServerThread,
   bool useFP16,
+  bool useINT8,
   bool cudaUseNHWC
 ) {
-  if(serverThreads.size() != 0)
+  if(serverThreads.size() != 0 || serverGroup != NULL)
     throw StringError("NNEvaluator::spawnServerThreads called when threads were already running!");
   if(gpuIdxByServerThread.size() != numThreads)
     throw StringError("gpuIdxByServerThread.size() != numThreads");
@@ -235,17 +660,37 @@ void NNEvaluator::spawnServerThreads(
   for(int i = 0; i<numThreads; i++) {
     int gpuIdxForThisThread = gpuIdxByServerThread[i];
     std::thread* thread = new std::thread(
-      &serveEvals,i,doRandomize,randSeed,defaultSymmetry,&logger,this,loadedModel,gpuIdxForThisThread,useFP16,cudaUseNHWC
+      &serveEvals,i,doRandomize,randSeed,defaultSymmetry,&logger,this,gpuIdxForThisThread,useFP16,useINT8,cudaUseNHWC
     );
     serverThreads.push_back(thread);
   }
 }
 
+void NNEvaluator::joinServerGroup(
+  NNServerGroup& group,
+  bool doRandomize,
+  string randSeed,
+  int defaultSymmetry,
+  bool useFP16,
+  bool useINT8,
+  bool cudaUseNHWC
+) {
+  if(serverThreads.size() != 0 || serverGroup != NULL)
+    throw StringError("NNEvaluator::joinServerGroup called when threads were already running!");
+  serverGroup = &group;
+  group.addEvaluator(this,doRandomize,randSeed,defaultSymmetry,useFP16,useINT8,cudaUseNHWC);
+}
+
 void NNEvaluator::killServerThreads() {
-  unique_lock<std::mutex> lock(bufferMutex);
+  if(serverGroup != NULL) {
+    //The group's threads are done with this once this returns
+    serverGroup->removeEvaluator(this);
+    serverGroup = NULL;
+  }
+
   isKilled = true;
-  lock.unlock();
-  serverWaitingForBatchStart.notify_all();
+  resultBufQueue->setKilled(true);
+  highPriorityQueue->setKilled(true);
 
   for(size_t i = 0; i<serverThreads.size(); i++)
     serverThreads[i]->join();
@@ -254,123 +699,205 @@ void NNEvaluator::killServerThreads() {
   serverThreads.clear();
 
   //Can unset now that threads are dead
+  resultBufQueue->setKilled(false);
+  highPriorityQueue->setKilled(false);
   isKilled = false;
 }
 
+//Hands a result to the client waiting for it, or to its completion queue if it's asynchronous.
+//The client may reuse resultBuf as soon as it has the result, so it mustn't be touched after this.
+static void deliverResult(NNResultBuf* resultBuf, shared_ptr<NNOutput>&& result) {
+  NNCompletionQueue* completionQueue = resultBuf->completionQueue;
+  if(completionQueue != NULL) {
+    assert(resultBuf->hasResult == false);
+    resultBuf->result = std::move(result);
+    resultBuf->hasResult = true;
+    completionQueue->forcePush(resultBuf);
+    return;
+  }
+  unique_lock<std::mutex> resultLock(resultBuf->resultMutex);
+  assert(resultBuf->hasResult == false);
+  resultBuf->result = std::move(result);
+  resultBuf->hasResult = true;
+  resultBuf->clientWaitingForResult.notify_all();
+  resultLock.unlock();
+}
+
+NNServerBuf* NNEvaluator::createServerBuf() const {
+  NNServerBuf* buf = new NNServerBuf(*this,loadedModel);
+  if(remoteClient != NULL)
+    buf->remoteConnection = remoteClient->connect();
+  return buf;
+}
+
+ComputeHandle* NNEvaluator::createServerComputeHandle(
+  Logger* logger, int gpuIdxForThisThread, bool useFP16, bool useINT8, bool cudaUseNHWC
+) {
+  if(loadedModel == NULL)
+    return NULL;
+  return NeuralNet::createComputeHandle(
+    computeContext,
+    loadedModel,
+    logger,
+    maxNumRows,
+    nnXLen,
+    nnYLen,
+    requireExactNNLen,
+    inputsUseNHWC,
+    gpuIdxForThisThread,
+    useFP16,
+    useINT8,
+    cudaUseNHWC
+  );
+}
+
 void NNEvaluator::serve(
   NNServerBuf& buf, Rand& rand, Logger* logger, bool doRandomize, int defaultSymmetry,
-  int gpuIdxForThisThread, bool useFP16, bool cudaUseNHWC
+  int gpuIdxForThisThread, bool useFP16, bool useINT8, bool cudaUseNHWC
 ) {
+  ComputeHandle* gpuHandle = createServerComputeHandle(logger,gpuIdxForThisThread,useFP16,useINT8,cudaUseNHWC);
 
-  ComputeHandle* gpuHandle = NULL;
-  if(loadedModel != NULL)
-    gpuHandle = NeuralNet::createComputeHandle(
-      computeContext,
-      loadedModel,
-      logger,
-      maxNumRows,
-      nnXLen,
-      nnYLen,
-      requireExactNNLen,
-      inputsUseNHWC,
-      gpuIdxForThisThread,
-      useFP16,
-      cudaUseNHWC
-    );
+  int numHighPriorityBatchesInARow = 0;
+  while(true) {
+    //Read before checking the high priority queue, so that anything published to it after that interrupts the wait
+    uint64_t interruptsSeen = resultBufQueue->getNumInterrupts();
+    LockFreeBatchQueue<NNResultBuf*>* queue = NULL;
+    uint64_t firstQueuePos;
+    int numRows = 0;
+    if(numHighPriorityBatchesInARow >= MAX_HIGH_PRIORITY_BATCHES_IN_A_ROW)
+      numRows = takeQueuedBatch(buf,false,queue,firstQueuePos);
+    if(numRows <= 0)
+      numRows = takeQueuedBatch(buf,true,queue,firstQueuePos);
+    if(numRows <= 0) {
+      queue = resultBufQueue;
+      numRows = (int)queue->waitTakeBatchInterruptible(buf.resultBufs,maxNumRows,interruptsSeen,firstQueuePos);
+    }
+    if(numRows <= 0) {
+      if(isKilled)
+        break;
+      continue;
+    }
 
-  vector<NNOutput*> outputBuf;
+    if(queue == highPriorityQueue)
+      numHighPriorityBatchesInARow++;
+    else
+      numHighPriorityBatchesInARow = 0;
 
-  unique_lock<std::mutex> lock(bufferMutex,std::defer_lock);
-  while(true) {
-    lock.lock();
-    while(m_currentResultBufsLen <= 0 && m_currentResultBufsIdx == m_oldestResultBufsIdx && !isKilled)
-      serverWaitingForBatchStart.wait(lock);
+    serveBatch(buf,gpuHandle,rand,doRandomize,defaultSymmetry,queue,firstQueuePos,numRows);
+  }
 
-    if(isKilled)
-      break;
+  NeuralNet::freeComputeHandle(gpuHandle);
+}
 
-    std::swap(m_resultBufss[m_oldestResultBufsIdx],buf.resultBufs);
+void NNEvaluator::countQueuedRows(int& numHighPriority, int& numNormal) {
+  numHighPriority = (int)highPriorityQueue->countReady(maxNumRows);
+  numNormal = (int)resultBufQueue->countReady(maxNumRows);
+}
 
-    int numRows;
-    //We grabbed everything in the latest buffer, so clients should move on to an entirely new buffer
-    if(m_currentResultBufsIdx == m_oldestResultBufsIdx) {
-      m_oldestResultBufsIdx = (m_oldestResultBufsIdx + 1) & numResultBufssMask;
-      m_currentResultBufsIdx = m_oldestResultBufsIdx;
-      numRows = m_currentResultBufsLen;
-      m_currentResultBufsLen = 0;
-    }
-    //We grabbed a buffer that clients have already entirely moved onward from.
-    else {
-      m_oldestResultBufsIdx = (m_oldestResultBufsIdx + 1) & numResultBufssMask;
-      numRows = maxNumRows;
-    }
+int NNEvaluator::takeQueuedBatch(
+  NNServerBuf& buf, bool highPriority, LockFreeBatchQueue<NNResultBuf*>*& queue, uint64_t& firstQueuePos
+) {
+  queue = highPriority ? highPriorityQueue : resultBufQueue;
+  return (int)queue->tryTakeBatch(buf.resultBufs,maxNumRows,firstQueuePos);
+}
 
-    lock.unlock();
+void NNEvaluator::serveBatch(
+  NNServerBuf& buf, ComputeHandle* gpuHandle, Rand& rand, bool doRandomize, int defaultSymmetry,
+  LockFreeBatchQueue<NNResultBuf*>* queue, uint64_t firstQueuePos, int numRows
+) {
+  bool isHighPriority = queue == highPriorityQueue;
+  if(isHighPriority)
+    m_numHighPriorityRowsProcessed.fetch_add(numRows, std::memory_order_relaxed);
 
-    if(debugSkipNeuralNet) {
-      for(int row = 0; row < numRows; row++) {
-        assert(buf.resultBufs[row] != NULL);
-        NNResultBuf* resultBuf = buf.resultBufs[row];
-        buf.resultBufs[row] = NULL;
+  if(debugSkipNeuralNet) {
+    queue->release(firstQueuePos,numRows);
+    for(int row = 0; row < numRows; row++) {
+      assert(buf.resultBufs[row] != NULL);
+      NNResultBuf* resultBuf = buf.resultBufs[row];
+      buf.resultBufs[row] = NULL;
 
-        int boardXSize = resultBuf->boardXSizeForServer;
-        int boardYSize = resultBuf->boardYSizeForServer;
+      int boardXSize = resultBuf->boardXSizeForServer;
+      int boardYSize = resultBuf->boardYSizeForServer;
 
-        unique_lock<std::mutex> resultLock(resultBuf->resultMutex);
-        assert(resultBuf->hasResult == false);
-        resultBuf->result = std::make_shared<NNOutput>();
+      shared_ptr<NNOutput> result = NNOutputPool::makeShared();
 
-        float* policyProbs = resultBuf->result->policyProbs;
-        for(int i = 0; i<NNPos::MAX_NN_POLICY_SIZE; i++)
-          policyProbs[i] = 0;
+      float* policyProbs = result->policyProbs;
+      for(int i = 0; i<NNPos::MAX_NN_POLICY_SIZE; i++)
+        policyProbs[i] = 0;
 
-        //At this point, these aren't probabilities, since this is before the postprocessing
-        //that happens for each result. These just need to be unnormalized log probabilities.
-        //Illegal move filtering happens later.
+      //At this point, these aren't probabilities, since this is before the postprocessing
+      //that happens for each result. These just need to be unnormalized log probabilities.
+      //Illegal move filtering happens later.
+      for(int y = 0; y<boardYSize; y++) {
+        for(int x = 0; x<boardXSize; x++) {
+          int pos = NNPos::xyToPos(x,y,nnXLen);
+          policyProbs[pos] = rand.nextGaussian();
+        }
+      }
+      policyProbs[NNPos::locToPos(Board::PASS_LOC,boardXSize,nnXLen,nnYLen)] = rand.nextGaussian();
+
+      result->nnXLen = nnXLen;
+      result->nnYLen = nnYLen;
+      if(resultBuf->includeOwnerMap) {
+        float* whiteOwnerMap = NNOutputPool::allocOwnerMap();
+        for(int i = 0; i<nnXLen*nnYLen; i++)
+          whiteOwnerMap[i] = 0.0;
         for(int y = 0; y<boardYSize; y++) {
           for(int x = 0; x<boardXSize; x++) {
             int pos = NNPos::xyToPos(x,y,nnXLen);
-            policyProbs[pos] = rand.nextGaussian();
-          }
-        }
-        policyProbs[NNPos::locToPos(Board::PASS_LOC,boardXSize,nnXLen,nnYLen)] = rand.nextGaussian();
-
-        resultBuf->result->nnXLen = nnXLen;
-        resultBuf->result->nnYLen = nnYLen;
-        if(resultBuf->includeOwnerMap) {
-          float* whiteOwnerMap = new float[nnXLen*nnYLen];
-          for(int i = 0; i<nnXLen*nnYLen; i++)
-            whiteOwnerMap[i] = 0.0;
-          for(int y = 0; y<boardYSize; y++) {
-            for(int x = 0; x<boardXSize; x++) {
-              int pos = NNPos::xyToPos(x,y,nnXLen);
-              whiteOwnerMap[pos] = rand.nextGaussian() * 0.20;
-            }
+            whiteOwnerMap[pos] = rand.nextGaussian() * 0.20;
           }
-          resultBuf->result->whiteOwnerMap = whiteOwnerMap;
-        }
-        else {
-          resultBuf->result->whiteOwnerMap = NULL;
         }
-
-        //These aren't really probabilities. Win/Loss/NoResult will get softmaxed later
-        double whiteWinProb = 0.0 + rand.nextGaussian() * 0.20;
-        double whiteLossProb = 0.0 + rand.nextGaussian() * 0.20;
-        double whiteScoreMean = 0.0 + rand.nextGaussian() * 0.20;
-        double whiteScoreMeanSq = 0.0 + rand.nextGaussian() * 0.20;
-        double whiteNoResultProb = 0.0 + rand.nextGaussian() * 0.20;
-        resultBuf->result->whiteWinProb = whiteWinProb;
-        resultBuf->result->whiteLossProb = whiteLossProb;
-        resultBuf->result->whiteNoResultProb = whiteNoResultProb;
-        resultBuf->result->whiteScoreMean = whiteScoreMean;
-        resultBuf->result->whiteScoreMeanSq = whiteScoreMeanSq;
-        resultBuf->hasResult = true;
-        resultBuf->clientWaitingForResult.notify_all();
-        resultLock.unlock();
+        result->whiteOwnerMap = whiteOwnerMap;
       }
-      continue;
+      else {
+        result->whiteOwnerMap = NULL;
+      }
+
+      //These aren't really probabilities. Win/Loss/NoResult will get softmaxed later
+      double whiteWinProb = 0.0 + rand.nextGaussian() * 0.20;
+      double whiteLossProb = 0.0 + rand.nextGaussian() * 0.20;
+      double whiteScoreMean = 0.0 + rand.nextGaussian() * 0.20;
+      double whiteScoreMeanSq = 0.0 + rand.nextGaussian() * 0.20;
+      double whiteNoResultProb = 0.0 + rand.nextGaussian() * 0.20;
+      result->whiteWinProb = whiteWinProb;
+      result->whiteLossProb = whiteLossProb;
+      result->whiteNoResultProb = whiteNoResultProb;
+      result->whiteScoreMean = whiteScoreMean;
+      result->whiteScoreMeanSq = whiteScoreMeanSq;
+      deliverResult(resultBuf, std::move(result));
     }
+    return;
+  }
 
+  vector<shared_ptr<NNOutput>>& outputs = buf.outputs;
+  vector<NNOutput*>& outputBuf = buf.outputBuf;
+  outputs.clear();
+  outputBuf.clear();
+  for(int row = 0; row<numRows; row++) {
+    shared_ptr<NNOutput> emptyOutput = NNOutputPool::makeShared();
+    assert(buf.resultBufs[row] != NULL);
+    emptyOutput->nnXLen = nnXLen;
+    emptyOutput->nnYLen = nnYLen;
+    if(buf.resultBufs[row]->includeOwnerMap)
+      emptyOutput->whiteOwnerMap = NNOutputPool::allocOwnerMap();
+    else
+      emptyOutput->whiteOwnerMap = NULL;
+    outputBuf.push_back(emptyOutput.get());
+    outputs.push_back(std::move(emptyOutput));
+  }
+
+  size_t firstSlotIdx = queue->getSlotIdx(firstQueuePos);
+  const float* rowsSpatial = (isHighPriority ? highPriorityRowsSpatial : inputRowsSpatial) + firstSlotIdx * rowSpatialLen;
+  const float* rowsGlobal = (isHighPriority ? highPriorityRowsGlobal : inputRowsGlobal) + firstSlotIdx * rowGlobalLen;
+  if(buf.remoteConnection != NULL) {
+    //The server picks the symmetry
+    buf.remoteConnection->getOutput(rowsSpatial, rowsGlobal, numRows, outputBuf);
+  }
+  else if(syntheticBackend != NULL) {
+    syntheticBackend->getOutput(rowsSpatial, rowSpatialLen, rowsGlobal, rowGlobalLen, numRows, outputBuf);
+  }
+  else {
     int symmetry = defaultSymmetry;
     if(doRandomize)
       symmetry = rand.nextUInt(NNInputs::NUM_SYMMETRY_COMBINATIONS);
@@ -379,73 +906,153 @@ void NNEvaluator::serve(
     symmetriesBuffer[1] = (symmetry & 0x2) != 0;
     symmetriesBuffer[2] = (symmetry & 0x4) != 0;
 
-    outputBuf.clear();
-    for(int row = 0; row<numRows; row++) {
-      NNOutput* emptyOutput = new NNOutput();
-      assert(buf.resultBufs[row] != NULL);
-      emptyOutput->nnXLen = nnXLen;
-      emptyOutput->nnYLen = nnYLen;
-      if(buf.resultBufs[row]->includeOwnerMap)
-        emptyOutput->whiteOwnerMap = new float[nnXLen*nnYLen];
-      else
-        emptyOutput->whiteOwnerMap = NULL;
-      outputBuf.push_back(emptyOutput);
-    }
-
-    int numSpatialFeatures = NNModelVersion::getNumSpatialFeatures(modelVersion);
-    int numGlobalFeatures = NNModelVersion::getNumGlobalFeatures(modelVersion);
-    int rowSpatialLen = numSpatialFeatures * nnXLen * nnYLen;
-    int rowGlobalLen = numGlobalFeatures;
     assert(rowSpatialLen == NeuralNet::getBatchEltSpatialLen(buf.inputBuffers));
     assert(rowGlobalLen == NeuralNet::getBatchEltGlobalLen(buf.inputBuffers));
+    NeuralNet::setBatchInputsExternal(buf.inputBuffers, rowsSpatial, rowsGlobal);
+    NeuralNet::getOutput(gpuHandle, buf.inputBuffers, numRows, outputBuf);
+  }
+  assert(outputBuf.size() == numRows);
+  //Done reading the rows, clients can claim their slots again
+  queue->release(firstQueuePos,numRows);
+
+  m_numRowsProcessed.fetch_add(numRows, std::memory_order_relaxed);
+  m_numBatchesProcessed.fetch_add(1, std::memory_order_relaxed);
+
+  for(int row = 0; row < numRows; row++) {
+    assert(buf.resultBufs[row] != NULL);
+    NNResultBuf* resultBuf = buf.resultBufs[row];
+    buf.resultBufs[row] = NULL;
+    deliverResult(resultBuf, std::move(outputs[row]));
+  }
+}
 
-    for(int row = 0; row<numRows; row++) {
-      float* rowSpatialInput = NeuralNet::getBatchEltSpatialInplace(buf.inputBuffers,row);
-      float* rowGlobalInput = NeuralNet::getBatchEltGlobalInplace(buf.inputBuffers,row);
-
-      const float* rowSpatial = buf.resultBufs[row]->rowSpatial;
-      const float* rowGlobal = buf.resultBufs[row]->rowGlobal;
-      std::copy(rowSpatial,rowSpatial+rowSpatialLen,rowSpatialInput);
-      std::copy(rowGlobal,rowGlobal+rowGlobalLen,rowGlobalInput);
+namespace {
+  //Makes sure that an evaluation in flight is finished even if evaluating it throws, so nobody waits on it forever
+  struct InFlightEvalFinisher {
+    NNInFlightTable* table;
+    shared_ptr<NNInFlightTable::Eval> eval;
+
+    InFlightEvalFinisher(NNInFlightTable* t, shared_ptr<NNInFlightTable::Eval>&& e)
+      :table(t),eval(std::move(e))
+    {}
+    ~InFlightEvalFinisher() {
+      if(eval != nullptr)
+        table->finish(eval,nullptr);
     }
+  };
+}
 
-    NeuralNet::getOutput(gpuHandle, buf.inputBuffers, numRows, outputBuf);
-    assert(outputBuf.size() == numRows);
+void NNEvaluator::evaluate(
+  Board& board,
+  const BoardHistory& history,
+  Player nextPlayer,
+  double drawEquivalentWinsForWhite,
+  NNResultBuf& buf,
+  Logger* logger,
+  bool skipCache,
+  bool includeOwnerMap
+) {
+  if(startEvaluate(board, history, nextPlayer, drawEquivalentWinsForWhite, buf, NULL, skipCache, includeOwnerMap))
+    return;
 
-    m_numRowsProcessed.fetch_add(numRows, std::memory_order_relaxed);
-    m_numBatchesProcessed.fetch_add(1, std::memory_order_relaxed);
+  unique_lock<std::mutex> resultLock(buf.resultMutex);
+  while(!buf.hasResult)
+    buf.clientWaitingForResult.wait(resultLock);
+  resultLock.unlock();
 
-    for(int row = 0; row < numRows; row++) {
-      assert(buf.resultBufs[row] != NULL);
-      NNResultBuf* resultBuf = buf.resultBufs[row];
-      buf.resultBufs[row] = NULL;
+  finishEvaluate(buf, logger);
+}
 
-      unique_lock<std::mutex> resultLock(resultBuf->resultMutex);
-      assert(resultBuf->hasResult == false);
-      resultBuf->result = std::shared_ptr<NNOutput>(outputBuf[row]);
-      resultBuf->hasResult = true;
-      resultBuf->clientWaitingForResult.notify_all();
-      resultLock.unlock();
-    }
+bool NNEvaluator::evaluateAsync(
+  Board& board,
+  const BoardHistory& history,
+  Player nextPlayer,
+  double drawEquivalentWinsForWhite,
+  NNResultBuf& buf,
+  NNCompletionQueue& completionQueue,
+  bool skipCache,
+  bool includeOwnerMap
+) {
+  return startEvaluate(board, history, nextPlayer, drawEquivalentWinsForWhite, buf, &completionQueue, skipCache, includeOwnerMap);
+}
 
-    continue;
+bool NNEvaluator::finishAsync(NNResultBuf& buf, Logger* logger) {
+  assert(buf.hasResult);
+  if(!buf.pendingIsCoalesced) {
+    finishEvaluate(buf, logger);
+    return true;
+  }
+  //The evaluation we were waiting on failed, so queue it again ourselves, without blocking the caller
+  if(buf.result == nullptr) {
+    return startEvaluate(
+      *buf.pendingBoard, *buf.pendingHistory, buf.pendingPla, buf.pendingDrawEquivalentWinsForWhite, buf,
+      buf.completionQueue, true, buf.includeOwnerMap
+    );
+  }
+  if(buf.pendingCacheSymmetry != 0) {
+    shared_ptr<NNOutput> transformed = NNOutputPool::makeShared();
+    transformed->whiteOwnerMap = NULL;
+    NNSymmetry::transformOutput(
+      *(buf.result), *transformed, buf.pendingBoard->x_size, buf.pendingBoard->y_size, buf.pendingCacheSymmetry, true
+    );
+    buf.result = std::move(transformed);
   }
+  return true;
+}
 
-  NeuralNet::freeComputeHandle(gpuHandle);
+//Postprocessed output for a position knowing nothing about it, for replay misses
+static shared_ptr<NNOutput> makeUniformOutput(
+  const Board& board, const BoardHistory& history, Player nextPlayer, int nnXLen, int nnYLen, bool includeOwnerMap
+) {
+  shared_ptr<NNOutput> result = NNOutputPool::makeShared();
+  result->nnXLen = nnXLen;
+  result->nnYLen = nnYLen;
+  int policySize = NNPos::getPolicySize(nnXLen,nnYLen);
+  int legalCount = 0;
+  for(int i = 0; i<policySize; i++) {
+    Loc loc = NNPos::posToLoc(i,board.x_size,board.y_size,nnXLen,nnYLen);
+    bool isLegal = history.isLegal(board,loc,nextPlayer);
+    result->policyProbs[i] = isLegal ? 1.0f : -1.0f;
+    if(isLegal)
+      legalCount++;
+  }
+  assert(legalCount > 0);
+  for(int i = 0; i<policySize; i++) {
+    if(result->policyProbs[i] > 0.0f)
+      result->policyProbs[i] = 1.0f / legalCount;
+  }
+  for(int i = policySize; i<NNPos::MAX_NN_POLICY_SIZE; i++)
+    result->policyProbs[i] = -1.0f;
+  result->whiteWinProb = 0.5f;
+  result->whiteLossProb = 0.5f;
+  result->whiteNoResultProb = 0.0f;
+  result->whiteScoreMean = 0.0f;
+  result->whiteScoreMeanSq = 0.0f;
+  if(includeOwnerMap) {
+    result->whiteOwnerMap = NNOutputPool::allocOwnerMap();
+    std::fill(result->whiteOwnerMap, result->whiteOwnerMap + nnXLen * nnYLen, 0.0f);
+  }
+  else
+    result->whiteOwnerMap = NULL;
+  return result;
 }
 
-void NNEvaluator::evaluate(
+bool NNEvaluator::startEvaluate(
   Board& board,
   const BoardHistory& history,
   Player nextPlayer,
   double drawEquivalentWinsForWhite,
   NNResultBuf& buf,
-  Logger* logger,
+  NNCompletionQueue* completionQueue,
   bool skipCache,
   bool includeOwnerMap
 ) {
   assert(!isKilled);
   buf.hasResult = false;
+  buf.completionQueue = completionQueue;
+  buf.pendingIsCoalesced = false;
+  buf.resultWithoutOwnerMap = nullptr;
+  assert(buf.inFlightEval == nullptr);
 
   if(board.x_size > nnXLen || board.y_size > nnYLen)
     throw StringError("NNEvaluator was configured with nnXLen = " + Global::intToString(nnXLen) +
@@ -469,86 +1076,161 @@ void NNEvaluator::evaluate(
   else
     ASSERT_UNREACHABLE;
 
+  //Share cache entries between positions that are rotations or reflections of each other, by keying them on the
+  //canonical orientation of the position and storing results in that orientation.
+  int cacheSymmetry = 0;
+  if(canonicalizeCacheSymmetry &&
+     (nnCacheTable != NULL || nnSharedCache != NULL || nnDiskCache != NULL || nnRecorder != NULL || nnReplay != NULL))
+    nnHash = NNSymmetry::getCanonicalHash(nnHash, board, history, cacheSymmetry);
+
   includeOwnerMap |= alwaysIncludeOwnerMap;
 
-  bool hadResultWithoutOwnerMap = false;
-  shared_ptr<NNOutput> resultWithoutOwnerMap;
-  if(nnCacheTable != NULL && !skipCache && nnCacheTable->get(nnHash,buf.result)) {
+  //Everything needed later to finish the evaluation
+  buf.pendingBoard = &board;
+  buf.pendingHistory = &history;
+  buf.pendingPla = nextPlayer;
+  buf.pendingDrawEquivalentWinsForWhite = drawEquivalentWinsForWhite;
+  buf.pendingNNHash = nnHash;
+  buf.pendingCacheSymmetry = cacheSymmetry;
+  buf.includeOwnerMap = includeOwnerMap;
+
+  bool foundInCache = false;
+  //Replayed evaluations stand in for the net, so they're used even when skipping the cache
+  if(nnReplay != NULL) {
+    if(nnReplay->get(nnHash,buf.result)) {
+      if(includeOwnerMap && buf.result->whiteOwnerMap == NULL && replayMissPolicy != NNReplay::MISS_EVALUATE) {
+        if(replayMissPolicy == NNReplay::MISS_FAIL)
+          throw StringError("Nn recording has no ownership for position " + Global::uint64ToHexString(nnHash.hash1) + Global::uint64ToHexString(nnHash.hash0));
+        float* whiteOwnerMap = NNOutputPool::allocOwnerMap();
+        std::fill(whiteOwnerMap, whiteOwnerMap + nnXLen * nnYLen, 0.0f);
+        buf.result->whiteOwnerMap = whiteOwnerMap;
+      }
+      foundInCache = true;
+    }
+    else if(replayMissPolicy == NNReplay::MISS_FAIL)
+      throw StringError("Nn recording has no evaluation for position " + Global::uint64ToHexString(nnHash.hash1) + Global::uint64ToHexString(nnHash.hash0));
+    else if(replayMissPolicy == NNReplay::MISS_UNIFORM) {
+      buf.result = makeUniformOutput(board, history, nextPlayer, nnXLen, nnYLen, includeOwnerMap);
+      buf.hasResult = true;
+      return true;
+    }
+  }
+  if(!skipCache && !foundInCache) {
+    //Fill in the faster tiers with whatever is found in the slower ones
+    if(nnCacheTable != NULL && nnCacheTable->get(nnHash,buf.result))
+      foundInCache = true;
+    else if(nnSharedCache != NULL && nnSharedCache->get(nnHash,buf.result)) {
+      foundInCache = true;
+      if(nnCacheTable != NULL)
+        nnCacheTable->set(buf.result, board.x_size, board.y_size, buf.searchDepth);
+      //From an evaluation earlier than this run, or by another process
+      if(nnRecorder != NULL)
+        nnRecorder->record(*(buf.result), board.x_size, board.y_size);
+    }
+    else if(nnDiskCache != NULL && nnDiskCache->get(nnHash,includeOwnerMap,buf.result)) {
+      foundInCache = true;
+      if(nnCacheTable != NULL)
+        nnCacheTable->set(buf.result, board.x_size, board.y_size, buf.searchDepth);
+      if(nnSharedCache != NULL)
+        nnSharedCache->set(*(buf.result), board.x_size, board.y_size);
+      if(nnRecorder != NULL)
+        nnRecorder->record(*(buf.result), board.x_size, board.y_size);
+    }
+  }
+
+  //If another thread is already evaluating this position, wait for its result instead of queueing it again
+  InFlightEvalFinisher inFlightEvalFinisher(nnInFlightTable, nullptr);
+  if(!skipCache && nnInFlightTable != NULL && (!foundInCache || (includeOwnerMap && buf.result->whiteOwnerMap == NULL))) {
+    bool isOwner;
+    bool isAsync = completionQueue != NULL;
+    shared_ptr<NNInFlightTable::Eval> inFlightEval = nnInFlightTable->join(nnHash, includeOwnerMap, isAsync, isOwner);
+    if(isOwner)
+      inFlightEvalFinisher.eval = std::move(inFlightEval);
+    else if(isAsync) {
+      //We'll be pushed onto our completion queue when it's done, unless it already is
+      buf.pendingIsCoalesced = true;
+      if(nnInFlightTable->addAsyncWaiter(*inFlightEval, &buf))
+        return false;
+      buf.pendingIsCoalesced = false;
+      shared_ptr<NNOutput> coalescedResult = nnInFlightTable->wait(*inFlightEval);
+      if(coalescedResult != nullptr) {
+        buf.result = std::move(coalescedResult);
+        foundInCache = true;
+      }
+    }
+    else {
+      shared_ptr<NNOutput> coalescedResult = nnInFlightTable->wait(*inFlightEval);
+      //If it failed, just try evaluating it ourselves
+      if(coalescedResult != nullptr) {
+        buf.result = std::move(coalescedResult);
+        foundInCache = true;
+      }
+    }
+  }
+
+  if(foundInCache) {
+    if(cacheSymmetry != 0) {
+      shared_ptr<NNOutput> transformed = NNOutputPool::makeShared();
+      transformed->whiteOwnerMap = NULL;
+      NNSymmetry::transformOutput(*(buf.result), *transformed, board.x_size, board.y_size, cacheSymmetry, true);
+      buf.result = std::move(transformed);
+    }
     if(!(includeOwnerMap && buf.result->whiteOwnerMap == NULL))
     {
       buf.hasResult = true;
-      return;
+      return true;
     }
     else {
-      hadResultWithoutOwnerMap = true;
-      resultWithoutOwnerMap = std::move(buf.result);
+      buf.resultWithoutOwnerMap = std::move(buf.result);
       buf.result = nullptr;
     }
   }
-  buf.includeOwnerMap = includeOwnerMap;
 
   buf.boardXSizeForServer = board.x_size;
   buf.boardYSizeForServer = board.y_size;
 
+  //Claim our place in the queue first, so we can write our inputs straight into the row for it
+  LockFreeBatchQueue<NNResultBuf*>* queue = buf.highPriority ? highPriorityQueue : resultBufQueue;
+  uint64_t queuePos = queue->claim();
   if(!debugSkipNeuralNet) {
-    int rowSpatialLen = NNModelVersion::getNumSpatialFeatures(modelVersion) * nnXLen * nnYLen;
-    if(buf.rowSpatial == NULL) {
-      buf.rowSpatial = new float[rowSpatialLen];
-      buf.rowSpatialSize = rowSpatialLen;
-    }
-    else {
-      if(buf.rowSpatialSize != rowSpatialLen)
-        throw StringError("Cannot reuse an nnResultBuf with different dimensions or model version");
-    }
-    int rowGlobalLen = NNModelVersion::getNumGlobalFeatures(modelVersion);
-    if(buf.rowGlobal == NULL) {
-      buf.rowGlobal = new float[rowGlobalLen];
-      buf.rowGlobalSize = rowGlobalLen;
-    }
-    else {
-      if(buf.rowGlobalSize != rowGlobalLen)
-        throw StringError("Cannot reuse an nnResultBuf with different dimensions or model version");
-    }
+    size_t slotIdx = queue->getSlotIdx(queuePos);
+    float* rowSpatial = (buf.highPriority ? highPriorityRowsSpatial : inputRowsSpatial) + slotIdx * rowSpatialLen;
+    float* rowGlobal = (buf.highPriority ? highPriorityRowsGlobal : inputRowsGlobal) + slotIdx * rowGlobalLen;
 
     static_assert(NNModelVersion::latestInputsVersionImplemented == 5, "");
     if(inputsVersion == 3) {
-      NNInputs::fillRowV3(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, buf.rowSpatial, buf.rowGlobal);
+      NNInputs::fillRowV3(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, rowSpatial, rowGlobal);
     }
     else if(inputsVersion == 4) {
-      NNInputs::fillRowV4(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, buf.rowSpatial, buf.rowGlobal);
+      NNInputs::fillRowV4(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, rowSpatial, rowGlobal);
     }
     else if(inputsVersion == 5) {
-      NNInputs::fillRowV5(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, buf.rowSpatial, buf.rowGlobal);
+      NNInputs::fillRowV5(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, rowSpatial, rowGlobal);
     }
     else
       ASSERT_UNREACHABLE;
   }
 
-  unique_lock<std::mutex> lock(bufferMutex);
-
-  m_resultBufss[m_currentResultBufsIdx][m_currentResultBufsLen] = &buf;
-  m_currentResultBufsLen += 1;
-  if(m_currentResultBufsLen == 1 && m_currentResultBufsIdx == m_oldestResultBufsIdx)
-    serverWaitingForBatchStart.notify_one();
-
-  bool overlooped = false;
-  if(m_currentResultBufsLen >= maxNumRows) {
-    m_currentResultBufsLen = 0;
-    m_currentResultBufsIdx = (m_currentResultBufsIdx + 1) & numResultBufssMask;
-    overlooped = m_currentResultBufsIdx == m_oldestResultBufsIdx;
-  }
-  lock.unlock();
-
-  //This should only fire if we have more than maxConcurrentEvals evaluating, such that they wrap the
-  //circular buffer.
-  assert(!overlooped);
-  (void)overlooped; //Avoid unused variable when asserts disabled
-
-  unique_lock<std::mutex> resultLock(buf.resultMutex);
-  while(!buf.hasResult)
-    buf.clientWaitingForResult.wait(resultLock);
-  resultLock.unlock();
+  //From here the evaluation is finished in finishEvaluate
+  buf.inFlightEval = std::move(inFlightEvalFinisher.eval);
+  queue->publish(queuePos,&buf);
+  //Wake a server thread that may be waiting on the normal queue, or for any evaluator in the group
+  if(serverGroup != NULL)
+    serverGroup->notifyArrival();
+  else if(buf.highPriority)
+    resultBufQueue->interruptWaits();
+  return false;
+}
 
+void NNEvaluator::finishEvaluate(NNResultBuf& buf, Logger* logger) {
+  const Board& board = *buf.pendingBoard;
+  const BoardHistory& history = *buf.pendingHistory;
+  Player nextPlayer = buf.pendingPla;
+  Hash128 nnHash = buf.pendingNNHash;
+  int cacheSymmetry = buf.pendingCacheSymmetry;
+  bool hadResultWithoutOwnerMap = buf.resultWithoutOwnerMap != nullptr;
+  shared_ptr<NNOutput> resultWithoutOwnerMap = std::move(buf.resultWithoutOwnerMap);
+  InFlightEvalFinisher inFlightEvalFinisher(nnInFlightTable, std::move(buf.inFlightEval));
   //Perform postprocessing on the result - turn the nn output into probabilities
   //As a hack though, if the only thing we were missing was the ownermap, just grab the old policy and values
   //and use those. This avoids recomputing in a randomly different orientation when we just need the ownermap
@@ -778,21 +1460,65 @@ void NNEvaluator::evaluate(
 
   //And record the nnHash in the result and put it into the table
   buf.result->nnHash = nnHash;
-  if(nnCacheTable != NULL)
-    nnCacheTable->set(buf.result);
+  if(nnCacheTable != NULL || nnSharedCache != NULL || nnDiskCache != NULL || nnRecorder != NULL) {
+    shared_ptr<NNOutput> toCache = buf.result;
+    if(cacheSymmetry != 0) {
+      toCache = NNOutputPool::makeShared();
+      toCache->whiteOwnerMap = NULL;
+      NNSymmetry::transformOutput(*(buf.result), *toCache, board.x_size, board.y_size, cacheSymmetry, false);
+    }
+    if(nnCacheTable != NULL)
+      nnCacheTable->set(toCache, board.x_size, board.y_size, buf.searchDepth);
+    if(nnSharedCache != NULL)
+      nnSharedCache->set(*toCache, board.x_size, board.y_size);
+    if(nnDiskCache != NULL)
+      nnDiskCache->set(*toCache, board.x_size, board.y_size);
+    if(nnRecorder != NULL)
+      nnRecorder->record(*toCache, board.x_size, board.y_size);
+    if(inFlightEvalFinisher.eval != nullptr) {
+      nnInFlightTable->finish(inFlightEvalFinisher.eval, toCache);
+      inFlightEvalFinisher.eval = nullptr;
+    }
+  }
 
 }
 
 //Uncomment this to lower the effective hash size down to one where we get true collisions
 //#define SIMULATE_TRUE_HASH_COLLISIONS
 
-NNCacheTable::Entry::Entry()
-  :ptr(nullptr)
-{}
-NNCacheTable::Entry::~Entry()
-{}
+static inline bool cacheHashMatches(Hash128 a, Hash128 b) {
+#if defined(SIMULATE_TRUE_HASH_COLLISIONS)
+  return ((a.hash0 ^ b.hash0) & 0xFFF) == 0;
+#else
+  return a == b;
+#endif
+}
+static inline uint32_t cacheTagOf(Hash128 nnHash) {
+#if defined(SIMULATE_TRUE_HASH_COLLISIONS)
+  (void)nnHash;
+  return 0;
+#else
+  return (uint32_t)(nnHash.hash1 >> 32);
+#endif
+}
 
-NNCacheTable::NNCacheTable(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo) {
+//Hits saturate here, so that lookups of hot entries soon stop writing to their set
+static const uint8_t CACHE_MAX_HITS = 15;
+//When choosing a victim, entries closer to the root count as having up to this many extra hits (this many at the
+//root, one fewer per move below it), so they stay cached longer
+static const int CACHE_MAX_DEPTH_BONUS = 4;
+
+NNCacheTable::NNCacheTable(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo, bool comp, int topK)
+  :sets(NULL),
+   numSets(0),
+   setMask(0),
+   mutexPool(NULL),
+   mutexPoolMask(0),
+   compress(comp),
+   policyTopK(topK),
+   counterStripes(NULL),
+   reclaimer()
+{
   if(sizePowerOfTwo < 0 || sizePowerOfTwo > 63)
     throw StringError("NNCacheTable: Invalid sizePowerOfTwo: " + Global::intToString(sizePowerOfTwo));
   if(mutexPoolSizePowerOfTwo < 0 || mutexPoolSizePowerOfTwo > 31)
@@ -801,73 +1527,270 @@ NNCacheTable::NNCacheTable(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo) {
   sizePowerOfTwo = sizePowerOfTwo > 12 ? 12 : sizePowerOfTwo;
 #endif
 
-  tableSize = ((uint64_t)1) << sizePowerOfTwo;
-  tableMask = tableSize-1;
-  entries = new Entry[tableSize];
+  uint64_t tableSize = ((uint64_t)1) << sizePowerOfTwo;
+  numSets = std::max((uint64_t)1, tableSize / NUM_WAYS);
+  setMask = numSets-1;
+  sets = new Set[numSets];
+  for(uint64_t i = 0; i<numSets; i++) {
+    for(int w = 0; w<NUM_WAYS; w++) {
+      sets[i].tags[w].store(0, std::memory_order_relaxed);
+      sets[i].entries[w].store(NULL, std::memory_order_relaxed);
+      sets[i].hits[w].store(0, std::memory_order_relaxed);
+      sets[i].depths[w] = 0;
+      sets[i].insertTimes[w] = 0;
+    }
+    sets[i].numInserts = 0;
+  }
   uint32_t mutexPoolSize = ((uint32_t)1) << mutexPoolSizePowerOfTwo;
   mutexPoolMask = mutexPoolSize-1;
   mutexPool = new MutexPool(mutexPoolSize);
+  counterStripes = new Counters[NUM_COUNTER_STRIPES];
+  clearStats();
 }
 NNCacheTable::~NNCacheTable() {
-  delete[] entries;
+  for(uint64_t i = 0; i<numSets; i++) {
+    for(int w = 0; w<NUM_WAYS; w++)
+      delete sets[i].entries[w].load(std::memory_order_relaxed);
+  }
+  delete[] sets;
   delete mutexPool;
+  delete[] counterStripes;
 }
 
 bool NNCacheTable::get(Hash128 nnHash, shared_ptr<NNOutput>& ret) {
-  //Free ret BEFORE locking, to avoid any expensive operations while locked.
+  //Free ret BEFORE looking up, to avoid any expensive operations while in the middle of it.
   if(ret != nullptr)
     ret.reset();
 
-  uint64_t idx = nnHash.hash0 & tableMask;
-  uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
-  Entry& entry = entries[idx];
-  std::mutex& mutex = mutexPool->getMutex(mutexIdx);
+  uint64_t setIdx = nnHash.hash0 & setMask;
+  Set& set = sets[setIdx];
+  Counters& counters = counterStripes[setIdx % NUM_COUNTER_STRIPES];
+  counters.numLookups.fetch_add(1, std::memory_order_relaxed);
+  uint32_t tag = cacheTagOf(nnHash);
 
-  std::lock_guard<std::mutex> lock(mutex);
+  EpochReclaimer::Guard guard(reclaimer);
+  for(int w = 0; w<NUM_WAYS; w++) {
+    if(set.tags[w].load(std::memory_order_relaxed) != tag)
+      continue;
+    Entry* entry = set.entries[w].load(std::memory_order_acquire);
+    if(entry == NULL || !cacheHashMatches(entry->nnHash, nnHash))
+      continue;
 
-  bool found = false;
-#if defined(SIMULATE_TRUE_HASH_COLLISIONS)
-  if(entry.ptr != nullptr && ((entry.ptr->nnHash.hash0 ^ nnHash.hash0) & 0xFFF) == 0) {
-    ret = entry.ptr;
-    found = true;
-  }
-#else
-  if(entry.ptr != nullptr && entry.ptr->nnHash == nnHash) {
-    ret = entry.ptr;
-    found = true;
+    uint8_t hits = set.hits[w].load(std::memory_order_relaxed);
+    if(hits < CACHE_MAX_HITS)
+      set.hits[w].store(hits+1, std::memory_order_relaxed);
+    counters.numHits.fetch_add(1, std::memory_order_relaxed);
+    if(compress)
+      ret = entry->compact->decompress();
+    else
+      ret = entry->ptr;
+    return true;
   }
-#endif
-  return found;
+  return false;
 }
 
-void NNCacheTable::set(const shared_ptr<NNOutput>& p) {
-  //Immediately copy p right now, before locking, to avoid any expensive operations while locked.
-  shared_ptr<NNOutput> buf(p);
+void NNCacheTable::set(const shared_ptr<NNOutput>& p, int boardXSize, int boardYSize, int searchDepth) {
+  //Build the entry right now, before locking, to avoid any expensive operations while locked.
+  Entry* newEntry = new Entry();
+  newEntry->nnHash = p->nnHash;
+  if(compress)
+    newEntry->compact = std::unique_ptr<CompactNNOutput>(new CompactNNOutput(*p, boardXSize, boardYSize, policyTopK));
+  else
+    newEntry->ptr = p;
 
-  uint64_t idx = p->nnHash.hash0 & tableMask;
-  uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
-  Entry& entry = entries[idx];
-  std::mutex& mutex = mutexPool->getMutex(mutexIdx);
+  uint64_t setIdx = p->nnHash.hash0 & setMask;
+  Set& set = sets[setIdx];
+  Counters& counters = counterStripes[setIdx % NUM_COUNTER_STRIPES];
+  std::mutex& mutex = mutexPool->getMutex((uint32_t)setIdx & mutexPoolMask);
 
+  Entry* oldEntry;
   {
-    std::lock_guard<std::mutex> lock(mutex);
-    //Perform a swap, to avoid any expensive free under the mutex.
-    entry.ptr.swap(buf);
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if(!lock.owns_lock()) {
+      counters.numWriteContentions.fetch_add(1, std::memory_order_relaxed);
+      lock.lock();
+    }
+
+    //Replace the entry for the same position if there is one, such as when adding an owner map, keeping its hits.
+    //Else fill an empty way, else evict the entry least worth keeping.
+    int way = -1;
+    for(int w = 0; w<NUM_WAYS && way < 0; w++) {
+      Entry* entry = set.entries[w].load(std::memory_order_relaxed);
+      if(entry != NULL && entry->nnHash == p->nnHash)
+        way = w;
+    }
+    if(way < 0) {
+      for(int w = 0; w<NUM_WAYS && way < 0; w++) {
+        if(set.entries[w].load(std::memory_order_relaxed) == NULL)
+          way = w;
+      }
+      if(way < 0) {
+        //Among equally worth keeping, the oldest
+        int bestRetention = 0;
+        int bestAge = 0;
+        for(int w = 0; w<NUM_WAYS; w++) {
+          int retention = set.hits[w].load(std::memory_order_relaxed) + std::max(0, CACHE_MAX_DEPTH_BONUS - set.depths[w]);
+          int age = (uint8_t)(set.numInserts - set.insertTimes[w]);
+          if(way < 0 || retention < bestRetention || (retention == bestRetention && age > bestAge)) {
+            way = w;
+            bestRetention = retention;
+            bestAge = age;
+          }
+        }
+        //Age the survivors, so that entries that were hot long ago don't stay forever
+        for(int w = 0; w<NUM_WAYS; w++)
+          set.hits[w].store(set.hits[w].load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+        counters.numEvictions.fetch_add(1, std::memory_order_relaxed);
+      }
+      set.hits[way].store(0, std::memory_order_relaxed);
+      set.insertTimes[way] = set.numInserts;
+      set.numInserts += 1;
+    }
+    set.depths[way] = (uint8_t)std::min(std::max(searchDepth,0),255);
+    oldEntry = set.entries[way].exchange(newEntry, std::memory_order_acq_rel);
+    set.tags[way].store(cacheTagOf(p->nnHash), std::memory_order_relaxed);
+    counters.numInserts.fetch_add(1, std::memory_order_relaxed);
   }
 
-  //No longer locked, allow buf to fall out of scope now, will free whatever used to be present in the table.
+  //Lookups may still be reading the old entry, so it's freed later
+  if(oldEntry != NULL)
+    reclaimer.retireObject(oldEntry);
 }
 
 void NNCacheTable::clear() {
-  shared_ptr<NNOutput> buf;
-  for(size_t idx = 0; idx<tableSize; idx++) {
-    Entry& entry = entries[idx];
-    uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
-    std::mutex& mutex = mutexPool->getMutex(mutexIdx);
+  for(uint64_t setIdx = 0; setIdx<numSets; setIdx++) {
+    Set& set = sets[setIdx];
+    std::mutex& mutex = mutexPool->getMutex((uint32_t)setIdx & mutexPoolMask);
+    Entry* oldEntries[NUM_WAYS];
     {
       std::lock_guard<std::mutex> lock(mutex);
-      entry.ptr.swap(buf);
+      for(int w = 0; w<NUM_WAYS; w++) {
+        oldEntries[w] = set.entries[w].exchange(NULL, std::memory_order_acq_rel);
+        set.hits[w].store(0, std::memory_order_relaxed);
+      }
+    }
+    for(int w = 0; w<NUM_WAYS; w++) {
+      if(oldEntries[w] != NULL)
+        reclaimer.retireObject(oldEntries[w]);
     }
-    buf.reset();
   }
 }
+
+uint64_t NNCacheTable::getNumLookups() const {
+  uint64_t n = 0;
+  for(int i = 0; i<NUM_COUNTER_STRIPES; i++)
+    n += counterStripes[i].numLookups.load(std::memory_order_relaxed);
+  return n;
+}
+uint64_t NNCacheTable::getNumHits() const {
+  uint64_t n = 0;
+  for(int i = 0; i<NUM_COUNTER_STRIPES; i++)
+    n += counterStripes[i].numHits.load(std::memory_order_relaxed);
+  return n;
+}
+uint64_t NNCacheTable::getNumInserts() const {
+  uint64_t n = 0;
+  for(int i = 0; i<NUM_COUNTER_STRIPES; i++)
+    n += counterStripes[i].numInserts.load(std::memory_order_relaxed);
+  return n;
+}
+uint64_t NNCacheTable::getNumEvictions() const {
+  uint64_t n = 0;
+  for(int i = 0; i<NUM_COUNTER_STRIPES; i++)
+    n += counterStripes[i].numEvictions.load(std::memory_order_relaxed);
+  return n;
+}
+uint64_t NNCacheTable::getNumWriteContentions() const {
+  uint64_t n = 0;
+  for(int i = 0; i<NUM_COUNTER_STRIPES; i++)
+    n += counterStripes[i].numWriteContentions.load(std::memory_order_relaxed);
+  return n;
+}
+void NNCacheTable::clearStats() {
+  for(int i = 0; i<NUM_COUNTER_STRIPES; i++) {
+    counterStripes[i].numLookups.store(0);
+    counterStripes[i].numHits.store(0);
+    counterStripes[i].numInserts.store(0);
+    counterStripes[i].numEvictions.store(0);
+    counterStripes[i].numWriteContentions.store(0);
+  }
+}
+
+//-------------------------------------------------------------------------------------
+
+NNInFlightTable::NNInFlightTable()
+  :shards(NULL),
+   numCoalesced(0)
+{
+  shards = new Shard[NUM_SHARDS];
+}
+NNInFlightTable::~NNInFlightTable() {
+  delete[] shards;
+}
+
+shared_ptr<NNInFlightTable::Eval> NNInFlightTable::join(Hash128 nnHash, bool includeOwnerMap, bool isAsync, bool& isOwner) {
+  Shard& shard = shards[nnHash.hash0 % NUM_SHARDS];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto iter = shard.evals.find(nnHash);
+  if(iter != shard.evals.end() && (iter->second->includeOwnerMap || !includeOwnerMap) && (isAsync || !iter->second->isAsync)) {
+    isOwner = false;
+    numCoalesced.fetch_add(1, std::memory_order_relaxed);
+    return iter->second;
+  }
+
+  shared_ptr<Eval> eval = make_shared<Eval>();
+  eval->nnHash = nnHash;
+  eval->includeOwnerMap = includeOwnerMap;
+  eval->isAsync = isAsync;
+  eval->done = false;
+  //If there's already one in flight that we can't wait on, leave it be and simply don't share ours
+  if(iter == shard.evals.end())
+    shard.evals[nnHash] = eval;
+  isOwner = true;
+  return eval;
+}
+
+shared_ptr<NNOutput> NNInFlightTable::wait(Eval& eval) {
+  std::unique_lock<std::mutex> lock(eval.mutex);
+  while(!eval.done)
+    eval.resultReady.wait(lock);
+  return eval.result;
+}
+
+bool NNInFlightTable::addAsyncWaiter(Eval& eval, NNResultBuf* buf) {
+  std::lock_guard<std::mutex> lock(eval.mutex);
+  if(eval.done)
+    return false;
+  eval.asyncWaiters.push_back(buf);
+  return true;
+}
+
+void NNInFlightTable::finish(const shared_ptr<Eval>& eval, const shared_ptr<NNOutput>& result) {
+  {
+    Shard& shard = shards[eval->nnHash.hash0 % NUM_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto iter = shard.evals.find(eval->nnHash);
+    if(iter != shard.evals.end() && iter->second == eval)
+      shard.evals.erase(iter);
+  }
+  vector<NNResultBuf*> asyncWaiters;
+  {
+    std::lock_guard<std::mutex> lock(eval->mutex);
+    eval->result = result;
+    eval->done = true;
+    eval->resultReady.notify_all();
+    asyncWaiters.swap(eval->asyncWaiters);
+  }
+  for(NNResultBuf* buf: asyncWaiters) {
+    buf->result = result;
+    buf->hasResult = true;
+    buf->completionQueue->forcePush(buf);
+  }
+}
+
+uint64_t NNInFlightTable::getNumCoalesced() const {
+  return numCoalesced.load(std::memory_order_relaxed);
+}
+void NNInFlightTable::clearStats() {
+  numCoalesced.store(0);
+}
@@ -4,40 +4,162 @@
 #include <memory>
 
 #include "../core/global.h"
+#include "../core/epochreclaim.h"
+#include "../core/lockfreebatchqueue.h"
 #include "../core/logger.h"
 #include "../core/multithread.h"
+#include "../core/threadsafequeue.h"
 #include "../game/board.h"
 #include "../game/boardhistory.h"
+#include "../neuralnet/nndiskcache.h"
 #include "../neuralnet/nninputs.h"
 #include "../neuralnet/nninterface.h"
+#include "../neuralnet/nnrecording.h"
+#include "../neuralnet/nnsharedcache.h"
 #include "../search/mutexpool.h"
 
 class NNEvaluator;
-
+class NNServerGroup;
+class NNRemoteClient;
+class NNRemoteConnection;
+class NNSyntheticBackend;
+struct NNResultBuf;
+
+//Where NNEvaluator::evaluateAsync delivers each NNResultBuf once its result is back
+typedef ThreadSafeQueue<NNResultBuf*> NNCompletionQueue;
+
+//Cache of neural net outputs by nnHash, as a set-associative table.
+//Lookups take no locks: they scan the ways of one set, and entries replaced while a lookup might still be reading
+//them are only freed once it is done, via epoch-based reclamation. Inserts lock a mutex for the set from a pool.
+//When a set is full, the entry replaced is the one least worth keeping, judging by how often it was hit recently
+//and how near the search root it was evaluated.
 class NNCacheTable {
+ public:
+  static const int NUM_WAYS = 4;
+
+ private:
   struct Entry {
+    Hash128 nnHash;
     std::shared_ptr<NNOutput> ptr;
-    Entry();
-    ~Entry();
+    //Used instead of ptr if the table is compressed
+    std::unique_ptr<CompactNNOutput> compact;
+  };
+  //Sized to a cache line, so that a lookup usually touches only one besides that of the entry it finds
+  struct Set {
+    //Bits of nnHash.hash1 of each entry, so most mismatching ways can be skipped without following their pointers.
+    //Only a hint, lookups still check the full hash of the entry.
+    std::atomic<uint32_t> tags[NUM_WAYS];
+    std::atomic<Entry*> entries[NUM_WAYS];
+    //Recent hits, approximate since lookups bump them without synchronizing with each other
+    std::atomic<uint8_t> hits[NUM_WAYS];
+    //Only accessed while holding the set's mutex.
+    //Inserts into the set so far, mod 256, and the value of that when each entry was inserted.
+    uint8_t depths[NUM_WAYS];
+    uint8_t insertTimes[NUM_WAYS];
+    uint8_t numInserts;
+    char padding[64 - (NUM_WAYS * (sizeof(uint32_t) + sizeof(Entry*) + 3) + 1) % 64];
+  };
+  //Counters are spread over several cache lines by set, so that threads don't all contend on them
+  static const int NUM_COUNTER_STRIPES = 16;
+  struct Counters {
+    std::atomic<uint64_t> numLookups;
+    std::atomic<uint64_t> numHits;
+    std::atomic<uint64_t> numInserts;
+    std::atomic<uint64_t> numEvictions;
+    std::atomic<uint64_t> numWriteContentions;
+    char padding[64 - 5 * sizeof(uint64_t)];
   };
 
-  Entry* entries;
+  Set* sets;
+  uint64_t numSets;
+  uint64_t setMask;
   MutexPool* mutexPool;
-  uint64_t tableSize;
-  uint64_t tableMask;
   uint32_t mutexPoolMask;
+  bool compress;
+  int policyTopK;
+  Counters* counterStripes;
+  EpochReclaimer reclaimer;
 
  public:
-  NNCacheTable(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo);
+  //Holds 2^sizePowerOfTwo entries in total.
+  //If compress, entries are stored as CompactNNOutputs with the given policyTopK, which take several times
+  //less memory, at the cost of decompressing them on every hit and some loss of precision.
+  NNCacheTable(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo, bool compress, int policyTopK);
   ~NNCacheTable();
 
   NNCacheTable(const NNCacheTable& other) = delete;
   NNCacheTable& operator=(const NNCacheTable& other) = delete;
 
   //These are thread-safe. For get, ret will be set to nullptr upon a failure to find.
+  //For set, the board size is that of the position that p is the output for, and searchDepth is how far below
+  //the root of a search it is, or 0 if unknown.
   bool get(Hash128 nnHash, std::shared_ptr<NNOutput>& ret);
-  void set(const std::shared_ptr<NNOutput>& p);
+  void set(const std::shared_ptr<NNOutput>& p, int boardXSize, int boardYSize, int searchDepth);
   void clear();
+
+  //Stats since construction or the last clearStats
+  uint64_t getNumLookups() const;
+  uint64_t getNumHits() const;
+  uint64_t getNumInserts() const;
+  //Number of inserts that had to replace an entry for a different position
+  uint64_t getNumEvictions() const;
+  //Number of inserts that had to wait for another insert into the same set, or one sharing its mutex
+  uint64_t getNumWriteContentions() const;
+  void clearStats();
+};
+
+//Evaluations that have been queued for the neural net but whose results are not back yet, by nnHash.
+//Search threads often miss in the cache on the same position at nearly the same time, such as when they reach the
+//same transposition, and this lets all but the first of them wait for its result rather than queue another row.
+class NNInFlightTable {
+ public:
+  struct Eval {
+    Hash128 nnHash;
+    bool includeOwnerMap;
+    //Whether the owner is an asynchronous evaluation, which a thread waiting synchronously must not wait on, since
+    //it could be its own
+    bool isAsync;
+    std::mutex mutex;
+    std::condition_variable resultReady;
+    bool done;
+    //Once done, the result in the orientation that the cache stores the position in, or nullptr if evaluation failed
+    std::shared_ptr<NNOutput> result;
+    //Asynchronous evaluations waiting on this one, which are pushed onto their completion queues when it's done
+    std::vector<NNResultBuf*> asyncWaiters;
+  };
+
+ private:
+  static const int NUM_SHARDS = 64;
+  struct Shard {
+    std::mutex mutex;
+    std::map<Hash128,std::shared_ptr<Eval>> evals;
+  };
+  Shard* shards;
+  std::atomic<uint64_t> numCoalesced;
+
+ public:
+  NNInFlightTable();
+  ~NNInFlightTable();
+
+  NNInFlightTable(const NNInFlightTable& other) = delete;
+  NNInFlightTable& operator=(const NNInFlightTable& other) = delete;
+
+  //These are thread-safe.
+  //If nnHash is already being evaluated, with an owner map if includeOwnerMap, returns that evaluation and sets
+  //isOwner to false, and the caller should wait for it. Otherwise returns a new evaluation and sets isOwner to true,
+  //and the caller must finish it, even if it fails. isAsync is whether the caller is an asynchronous evaluation.
+  std::shared_ptr<Eval> join(Hash128 nnHash, bool includeOwnerMap, bool isAsync, bool& isOwner);
+  //Returns the result of an evaluation joined but not owned once it is done, or nullptr if it failed
+  std::shared_ptr<NNOutput> wait(Eval& eval);
+  //Instead of waiting, have buf pushed onto its completion queue with the result once the evaluation is done.
+  //Returns false without doing so if it is done already.
+  bool addAsyncWaiter(Eval& eval, NNResultBuf* buf);
+  //Removes an evaluation from the table and wakes everyone waiting on it. Pass nullptr if it failed.
+  void finish(const std::shared_ptr<Eval>& eval, const std::shared_ptr<NNOutput>& result);
+
+  //Number of joins that waited on an existing evaluation, since construction or the last clearStats
+  uint64_t getNumCoalesced() const;
+  void clearStats();
 };
 
 //Each thread should allocate and re-use one of these
@@ -48,13 +170,29 @@ struct NNResultBuf {
   bool includeOwnerMap;
   int boardXSizeForServer;
   int boardYSizeForServer;
-  int rowSpatialSize;
-  int rowGlobalSize;
-  float* rowSpatial;
-  float* rowGlobal;
+  //Set by the caller before evaluating, how far below the root of a search the position is, or 0 if unknown.
+  //Used by the cache to prefer keeping evaluations near the root.
+  int searchDepth;
+  //Set by the caller before evaluating, whether the result is needed urgently, such as for the root of a search,
+  //which nothing else in it can proceed without. Such evaluations are batched separately and served first.
+  bool highPriority;
   std::shared_ptr<NNOutput> result;
   bool errorLogLockout; //error flag to restrict log to 1 error to prevent spam
 
+  //Set by NNEvaluator, the state of an evaluation between when it is queued and when it is finished
+  NNCompletionQueue* completionQueue;
+  Board* pendingBoard;
+  const BoardHistory* pendingHistory;
+  Player pendingPla;
+  double pendingDrawEquivalentWinsForWhite;
+  Hash128 pendingNNHash;
+  int pendingCacheSymmetry;
+  //Whether the result will come from another evaluation of the same position, already postprocessed
+  bool pendingIsCoalesced;
+  std::shared_ptr<NNOutput> resultWithoutOwnerMap;
+  //The evaluation in flight this is the owner of, if any
+  std::shared_ptr<NNInFlightTable::Eval> inFlightEval;
+
   NNResultBuf();
   ~NNResultBuf();
   NNResultBuf(const NNResultBuf& other) = delete;
@@ -65,6 +203,10 @@ struct NNResultBuf {
 struct NNServerBuf {
   InputBuffers* inputBuffers;
   NNResultBuf** resultBufs;
+  std::vector<std::shared_ptr<NNOutput>> outputs;
+  std::vector<NNOutput*> outputBuf;
+  //If the evaluator uses an nn server, this thread's connection to it
+  NNRemoteConnection* remoteConnection;
 
   NNServerBuf(const NNEvaluator& nneval, const LoadedModel* model);
   ~NNServerBuf();
@@ -74,6 +216,40 @@ struct NNServerBuf {
 
 class NNEvaluator {
  public:
+  //Optional features of the evaluator, all off by default, see the nn* settings in configs/gtp_example.cfg
+  struct Options {
+    //Batch formation, see serve
+    int minBatchFill; //Wait for batches to have at least this many rows...
+    double maxBatchWaitMs; //...but for no longer than this
+
+    //Cache layout, see NNCacheTable
+    bool compressCache; //Store entries as CompactNNOutput
+    int cachePolicyTopK; //If compressing, keep only the top this many policy moves, or all if 0
+    bool canonicalizeCacheSymmetry; //Key the cache on the canonical symmetry of positions
+
+    //Caches beyond the process, keyed on the model file hash, see NNDiskCache and NNSharedCache
+    std::string diskCacheFile;
+    int64_t diskCacheMaxBytes;
+    bool diskCacheReadOnly;
+    std::string sharedCacheName;
+    int64_t sharedCacheMaxBytes;
+
+    //Where the net is run, if not by this process on the model file
+    std::string nnServerSocket; //By the nn server at this socket, see NNRemoteClient
+    int syntheticNumDevices; //By a simulated net if > 0, see NNSyntheticBackend
+    double syntheticBatchLatencyMs;
+    double syntheticRowLatencyMs;
+
+    //See NNRecorder and NNReplay
+    std::string recordFile;
+    std::string replayFile;
+    int replayMissPolicy;
+
+    std::string tuneFile; //See NeuralNet::createComputeContext
+
+    Options();
+  };
+
   NNEvaluator(
     const std::string& modelName,
     const std::string& modelFileName,
@@ -90,12 +266,15 @@ class NNEvaluator {
     int nnMutexPoolSizePowerofTwo,
     bool debugSkipNeuralNet,
     bool alwaysIncludeOwnerMap,
-    float nnPolicyTemperature
+    float nnPolicyTemperature,
+    const Options& options
   );
   ~NNEvaluator();
 
   std::string getModelName() const;
   std::string getModelFileName() const;
+  //Whether the net is run by an nn server in another process, see NNRemoteClient, rather than by this process
+  bool usesNNServer() const;
   int getMaxBatchSize() const;
   int getNNXLen() const;
   int getNNYLen() const;
@@ -104,7 +283,7 @@ class NNEvaluator {
   //Fills supported with true if desiredRules itself was exactly supported, false if some modifications had to be made.
   Rules getSupportedRules(const Rules& desiredRules, bool& supported);
 
-  //Clear all entires cached in the table
+  //Clear all entires cached in the table. Entries in the disk cache, if any, are kept.
   void clearCache();
 
   //Queue a position for the next neural net batch evaluation and wait for it. Upon evaluation, result
@@ -122,6 +301,27 @@ class NNEvaluator {
     bool includeOwnerMap
   );
 
+  //Like evaluate, but queues the position and returns without waiting for the result, so that one thread can have
+  //many evaluations in flight at once, each with its own NNResultBuf.
+  //Returns true if the result is already in buf, such as from the cache. Otherwise once it's back, buf is pushed onto
+  //completionQueue, and the caller must call finishAsync on it to fill in buf.result.
+  //board and history must stay alive and unchanged until then. Evaluations in flight this way count against
+  //maxConcurrentEvals like any other.
+  //finishAsync returns false if instead the position had to be queued again, because the evaluation it was waiting on
+  //failed, in which case buf will be pushed onto completionQueue again later just the same.
+  //These functions are threadsafe.
+  bool evaluateAsync(
+    Board& board,
+    const BoardHistory& history,
+    Player nextPlayer,
+    double drawEquivalentWinsForWhite,
+    NNResultBuf& buf,
+    NNCompletionQueue& completionQueue,
+    bool skipCache,
+    bool includeOwnerMap
+  );
+  bool finishAsync(NNResultBuf& buf, Logger* logger);
+
   //Actually spawn threads and return the results.
   //If doRandomize, uses randSeed as a seed, further randomized per-thread
   //If not doRandomize, uses defaultSymmetry for all nn evaluations.
@@ -134,6 +334,7 @@ class NNEvaluator {
     Logger& logger,
     std::vector<int> gpuIdxByServerThread,
     bool useFP16,
+    bool useINT8,
     bool cudaUseNHWC
   );
 
@@ -141,10 +342,70 @@ class NNEvaluator {
   //should have calls to it and spawnServerThreads singlethreaded.
   void killServerThreads();
 
+  //Instead of spawning server threads of its own, have those of group serve this evaluator, alongside the other
+  //evaluators in it. The arguments are as for spawnServerThreads, but the gpus are the group's.
+  //killServerThreads leaves the group again.
+  void joinServerGroup(
+    NNServerGroup& group,
+    bool doRandomize,
+    std::string randSeed,
+    int defaultSymmetry,
+    bool useFP16,
+    bool useINT8,
+    bool cudaUseNHWC
+  );
+
   //Some stats
   uint64_t numRowsProcessed() const;
   uint64_t numBatchesProcessed() const;
   double averageProcessedBatchSize() const;
+  //Number of rows that were evaluated in high priority batches, see NNResultBuf::highPriority
+  uint64_t numHighPriorityRowsProcessed() const;
+
+  //Stats for adaptive batching, see minBatchFill below. All zero if it's disabled.
+  int getMinBatchFill() const;
+  //Number of batches where the server waited for more rows, and how many of those ran out of latency budget
+  uint64_t numBatchFillWaits() const;
+  uint64_t numBatchFillTimeouts() const;
+  //Number of times a short batch was started immediately because rows weren't arriving fast enough to fill it in time
+  uint64_t numBatchFillWaitsSkipped() const;
+  double averageBatchFillWaitMs() const;
+
+  //Stats for the NN cache, see NNCacheTable. All zero if there's no cache.
+  uint64_t numCacheLookups() const;
+  uint64_t numCacheHits() const;
+  uint64_t numCacheInserts() const;
+  uint64_t numCacheEvictions() const;
+  uint64_t numCacheWriteContentions() const;
+  //Number of evaluations that waited for the result of an identical one already queued, see NNInFlightTable
+  uint64_t numCoalescedEvals() const;
+
+  //Stats for the NN shared memory cache, see NNSharedCache. All zero if there's no shared cache.
+  bool hasSharedCache() const;
+  uint64_t numSharedCacheLookups() const;
+  uint64_t numSharedCacheHits() const;
+  uint64_t numSharedCacheInserts() const;
+  uint64_t numSharedCacheContentions() const;
+
+  //Stats for the NN disk cache, see NNDiskCache. All zero if there's no disk cache.
+  bool hasDiskCache() const;
+  uint64_t numDiskCacheLookups() const;
+  uint64_t numDiskCacheHits() const;
+  uint64_t numDiskCacheInserts() const;
+  uint64_t numDiskCacheInsertsDropped() const;
+  uint64_t numDiskCacheEntries() const;
+
+  //Stats for recording and replaying evaluations, see NNRecorder and NNReplay. All zero if not doing so.
+  bool isRecording() const;
+  uint64_t numRecordedEvals() const;
+  bool isReplaying() const;
+  uint64_t numReplayLookups() const;
+  uint64_t numReplayHits() const;
+
+  //All of the stats above that apply to this evaluator, one line each
+  std::vector<std::string> getStatsLines() const;
+  //Writes getStatsLines to logger, each line prefixed by prefix
+  void logStats(Logger& logger, const std::string& prefix) const;
 
   void clearStats();
 
@@ -159,41 +420,97 @@ class NNEvaluator {
 
   ComputeContext* computeContext;
   LoadedModel* loadedModel;
+  //If set, there's no model or compute context here, and server threads send their batches to an nn server instead
+  NNRemoteClient* remoteClient;
+  //If set, there's no model or compute context either, and batches are run by this, see NNSyntheticBackend
+  NNSyntheticBackend* syntheticBackend;
   NNCacheTable* nnCacheTable;
+  //Tiers behind nnCacheTable, both optional: shared with other processes, and then persistent
+  NNSharedCache* nnSharedCache;
+  NNDiskCache* nnDiskCache;
+  //Optional, recording every evaluation, or else serving them from a recording, see NNRecorder and NNReplay
+  NNRecorder* nnRecorder;
+  NNReplay* nnReplay;
+  int replayMissPolicy;
+  //Present whenever there's some cache, since joining an evaluation in flight is just a cache hit that arrives late
+  NNInFlightTable* nnInFlightTable;
 
   bool debugSkipNeuralNet;
   bool alwaysIncludeOwnerMap;
   float nnPolicyInvTemperature;
+  //Whether positions are looked up in the cache under the least of their hashes under all symmetries
+  bool canonicalizeCacheSymmetry;
 
   int modelVersion;
   int inputsVersion;
 
   std::vector<std::thread*> serverThreads;
+  //The group whose threads serve this instead, if any
+  NNServerGroup* serverGroup;
 
-  std::condition_variable serverWaitingForBatchStart;
-  std::mutex bufferMutex;
-  bool isKilled;
+  std::atomic<bool> isKilled;
 
   int maxNumRows;
-  int numResultBufss;
-  int numResultBufssMask;
 
   std::atomic<uint64_t> m_numRowsProcessed;
   std::atomic<uint64_t> m_numBatchesProcessed;
-
-  //An array of NNResultBuf** of length numResultBufss, each NNResultBuf** is an array of NNResultBuf* of length maxNumRows.
-  //If a full resultBufs array fills up, client threads can move on to fill up more without waiting. Implemented basically
-  //as a circular buffer.
-  NNResultBuf*** m_resultBufss;
-  int m_currentResultBufsLen; //Number of rows used in in the latest (not yet full) resultBufss.
-  int m_currentResultBufsIdx; //Index of the current resultBufs being filled.
-  int m_oldestResultBufsIdx; //Index of the oldest resultBufs that still needs to be processed by a server thread
+  std::atomic<uint64_t> m_numHighPriorityRowsProcessed;
+
+  //Clients push their NNResultBuf into this without taking any lock, server threads pop batches of them.
+  //Also implements adaptive batching: when a server thread finds fewer than minBatchFill rows queued, it waits for
+  //more to arrive, but never past maxBatchWaitMs after the first of those rows was queued, and only if at the
+  //recently observed rate of arrivals enough rows are expected to show up in time. minBatchFill <= 1 disables this.
+  int minBatchFill;
+  LockFreeBatchQueue<NNResultBuf*>* resultBufQueue;
+
+  //Model inputs, one row per slot of resultBufQueue. Clients encode directly into the row of the slot they claimed,
+  //and since a batch occupies consecutive slots, server threads pass its rows to the backend without copying them.
+  int rowSpatialLen;
+  int rowGlobalLen;
+  float* inputRowsSpatial;
+  float* inputRowsGlobal;
+
+  //High priority evaluations have a queue and rows of their own, so that they never wait behind a backlog of others
+  //and batches stay contiguous. Server threads take from it before resultBufQueue, but after
+  //MAX_HIGH_PRIORITY_BATCHES_IN_A_ROW, take a normal one first if any is waiting, so that those are never starved.
+  LockFreeBatchQueue<NNResultBuf*>* highPriorityQueue;
+  float* highPriorityRowsSpatial;
+  float* highPriorityRowsGlobal;
+
+  //Evaluating is split into queueing the position, unless it's cached, and postprocessing the result once it's back.
+  //startEvaluate returns true if the result is already available.
+  bool startEvaluate(
+    Board& board,
+    const BoardHistory& history,
+    Player nextPlayer,
+    double drawEquivalentWinsForWhite,
+    NNResultBuf& buf,
+    NNCompletionQueue* completionQueue,
+    bool skipCache,
+    bool includeOwnerMap
+  );
+  void finishEvaluate(NNResultBuf& buf, Logger* logger);
 
  public:
-  //Helper, for internal use only
+  //Helpers, for internal use only
+  static const int MAX_HIGH_PRIORITY_BATCHES_IN_A_ROW = 4;
   void serve(
     NNServerBuf& buf, Rand& rand, Logger* logger, bool doRandomize, int defaultSymmetry,
-    int gpuIdxForThisThread, bool useFP16, bool cudaUseNHWC
+    int gpuIdxForThisThread, bool useFP16, bool useINT8, bool cudaUseNHWC
+  );
+  NNServerBuf* createServerBuf() const;
+  ComputeHandle* createServerComputeHandle(
+    Logger* logger, int gpuIdxForThisThread, bool useFP16, bool useINT8, bool cudaUseNHWC
+  );
+  //Rows ready to be taken right now from each queue, up to a batch
+  void countQueuedRows(int& numHighPriority, int& numNormal);
+  //Takes the rows ready right now from one of the queues without waiting, to be passed to serveBatch
+  int takeQueuedBatch(
+    NNServerBuf& buf, bool highPriority, LockFreeBatchQueue<NNResultBuf*>*& queue, uint64_t& firstQueuePos
+  );
+  void serveBatch(
+    NNServerBuf& buf, ComputeHandle* gpuHandle, Rand& rand, bool doRandomize, int defaultSymmetry,
+    LockFreeBatchQueue<NNResultBuf*>* queue, uint64_t firstQueuePos, int numRows
   );
 };
 
@@ -1,5 +1,9 @@
 #include "../neuralnet/nninputs.h"
 
+#include <cstring>
+
+#include "../core/blockpool.h"
+
 using namespace std;
 
 int NNPos::xyToPos(int x, int y, int nnXLen) {
@@ -215,7 +219,7 @@ NNOutput::NNOutput(const NNOutput& other) {
   nnXLen = other.nnXLen;
   nnYLen = other.nnYLen;
   if(other.whiteOwnerMap != NULL) {
-    whiteOwnerMap = new float[nnXLen * nnYLen];
+    whiteOwnerMap = NNOutputPool::allocOwnerMap();
     std::copy(other.whiteOwnerMap, other.whiteOwnerMap + nnXLen * nnYLen, whiteOwnerMap);
   }
   else
@@ -237,10 +241,10 @@ NNOutput& NNOutput::operator=(const NNOutput& other) {
   nnXLen = other.nnXLen;
   nnYLen = other.nnYLen;
   if(whiteOwnerMap != NULL) {
-    delete[] whiteOwnerMap;
+    NNOutputPool::freeOwnerMap(whiteOwnerMap);
   }
   if(other.whiteOwnerMap != NULL) {
-    whiteOwnerMap = new float[nnXLen * nnYLen];
+    whiteOwnerMap = NNOutputPool::allocOwnerMap();
     std::copy(other.whiteOwnerMap, other.whiteOwnerMap + nnXLen * nnYLen, whiteOwnerMap);
   }
   else
@@ -254,11 +258,468 @@ NNOutput& NNOutput::operator=(const NNOutput& other) {
 
 NNOutput::~NNOutput() {
   if(whiteOwnerMap != NULL) {
-    delete[] whiteOwnerMap;
+    NNOutputPool::freeOwnerMap(whiteOwnerMap);
     whiteOwnerMap = NULL;
   }
 }
 
+//The pools are never destroyed, since NNOutputs can outlive static destruction, such as when held by other statics
+//or by threads still running at exit.
+//Blocks hold an NNOutput along with the reference counts that std::allocate_shared puts next to it
+static BlockPool& getNNOutputBlockPool() {
+  static BlockPool* pool = new BlockPool(sizeof(NNOutput) + 64, 64, 16);
+  return *pool;
+}
+static BlockPool& getOwnerMapBlockPool() {
+  static BlockPool* pool = new BlockPool(sizeof(float) * NNPos::MAX_BOARD_AREA, 64, 16);
+  return *pool;
+}
+
+shared_ptr<NNOutput> NNOutputPool::makeShared() {
+  return std::allocate_shared<NNOutput>(BlockPoolAllocator<NNOutput>(&getNNOutputBlockPool()));
+}
+shared_ptr<NNOutput> NNOutputPool::makeShared(const NNOutput& other) {
+  return std::allocate_shared<NNOutput>(BlockPoolAllocator<NNOutput>(&getNNOutputBlockPool()), other);
+}
+
+float* NNOutputPool::allocOwnerMap() {
+  return static_cast<float*>(getOwnerMapBlockPool().alloc());
+}
+void NNOutputPool::freeOwnerMap(float* ownerMap) {
+  getOwnerMapBlockPool().free(ownerMap);
+}
+
+uint64_t NNOutputPool::getNumAllocs() {
+  return getNNOutputBlockPool().getNumAllocs() + getOwnerMapBlockPool().getNumAllocs();
+}
+uint64_t NNOutputPool::getNumHeapAllocs() {
+  return getNNOutputBlockPool().getNumSlabAllocs() + getOwnerMapBlockPool().getNumSlabAllocs();
+}
+uint64_t NNOutputPool::getNumBytesReserved() {
+  return getNNOutputBlockPool().getNumBytesReserved() + getOwnerMapBlockPool().getNumBytesReserved();
+}
+string NNOutputPool::getStatsString() {
+  return
+    "NN output pool allocs: " + Global::uint64ToString(getNumAllocs()) +
+    " heap allocs: " + Global::uint64ToString(getNumHeapAllocs()) +
+    " reserved MB: " + Global::doubleToString(getNumBytesReserved() / 1048576.0);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+
+//Compact outputs index the policy by board location rather than by pos, with pass last
+static inline int policyPosOfIdx(int idx, int boardXSize, int boardYSize, int nnXLen, int nnYLen) {
+  if(idx == boardXSize * boardYSize)
+    return nnXLen * nnYLen;
+  return NNPos::xyToPos(idx % boardXSize, idx / boardXSize, nnXLen);
+}
+
+static inline void writeUInt16(uint8_t* dst, uint16_t x) {
+  std::memcpy(dst, &x, sizeof(uint16_t));
+}
+static inline uint16_t readUInt16(const uint8_t* src) {
+  uint16_t x;
+  std::memcpy(&x, src, sizeof(uint16_t));
+  return x;
+}
+
+CompactNNOutput::CompactNNOutput(const NNOutput& output, int bXSize, int bYSize, int policyTopK)
+  :nnHash(output.nnHash),
+   whiteWinProb(output.whiteWinProb),
+   whiteLossProb(output.whiteLossProb),
+   whiteNoResultProb(output.whiteNoResultProb),
+   whiteScoreMean(output.whiteScoreMean),
+   whiteScoreMeanSq(output.whiteScoreMeanSq),
+   policyRemainderEach(0.0f),
+   nnXLen((uint8_t)output.nnXLen),
+   nnYLen((uint8_t)output.nnYLen),
+   boardXSize((uint8_t)bXSize),
+   boardYSize((uint8_t)bYSize),
+   numTopMoves(0),
+   ownerMapStored(output.whiteOwnerMap != NULL),
+   data()
+{
+  if(bXSize <= 0 || bYSize <= 0 || bXSize > output.nnXLen || bYSize > output.nnYLen)
+    throw StringError("CompactNNOutput: board size does not fit in the neural net output");
+
+  int boardArea = bXSize * bYSize;
+  int numIdxs = boardArea + 1;
+  float probs[NNPos::MAX_NN_POLICY_SIZE];
+  int legalIdxs[NNPos::MAX_NN_POLICY_SIZE];
+  int numLegal = 0;
+  for(int i = 0; i<numIdxs; i++) {
+    probs[i] = output.policyProbs[policyPosOfIdx(i,bXSize,bYSize,nnXLen,nnYLen)];
+    if(probs[i] >= 0)
+      legalIdxs[numLegal++] = i;
+  }
+
+  size_t ownerMapOffset;
+  if(policyTopK <= 0 || policyTopK >= numLegal) {
+    ownerMapOffset = 2 * numIdxs;
+    data.resize(ownerMapOffset + (ownerMapStored ? boardArea : 0));
+    for(int i = 0; i<numIdxs; i++)
+      writeUInt16(&data[2*i], floatToHalf(probs[i]));
+  }
+  else {
+    std::partial_sort(
+      legalIdxs, legalIdxs + policyTopK, legalIdxs + numLegal,
+      [&probs](int a, int b) { return probs[a] > probs[b]; }
+    );
+    numTopMoves = (uint16_t)policyTopK;
+    size_t maskBytes = (numIdxs + 7) / 8;
+    ownerMapOffset = maskBytes + 4 * numTopMoves;
+    data.assign(ownerMapOffset + (ownerMapStored ? boardArea : 0), 0);
+    for(int j = 0; j<numLegal; j++)
+      data[legalIdxs[j] / 8] |= (uint8_t)(1 << (legalIdxs[j] % 8));
+
+    //Measure the remainder against the rounded values, so that the decompressed policy still sums to 1
+    float topSum = 0.0f;
+    for(int k = 0; k<numTopMoves; k++) {
+      uint16_t h = floatToHalf(probs[legalIdxs[k]]);
+      topSum += halfToFloat(h);
+      writeUInt16(&data[maskBytes + 4*k], (uint16_t)legalIdxs[k]);
+      writeUInt16(&data[maskBytes + 4*k + 2], h);
+    }
+    policyRemainderEach = std::max(0.0f, 1.0f - topSum) / (numLegal - numTopMoves);
+  }
+
+  if(ownerMapStored) {
+    for(int y = 0; y<bYSize; y++) {
+      for(int x = 0; x<bXSize; x++) {
+        float v = std::min(1.0f, std::max(-1.0f, output.whiteOwnerMap[NNPos::xyToPos(x,y,nnXLen)]));
+        data[ownerMapOffset + y * bXSize + x] = (uint8_t)(int8_t)std::round(v * 127.0f);
+      }
+    }
+  }
+}
+
+CompactNNOutput::CompactNNOutput()
+  :nnHash(),
+   whiteWinProb(0.0f),
+   whiteLossProb(0.0f),
+   whiteNoResultProb(0.0f),
+   whiteScoreMean(0.0f),
+   whiteScoreMeanSq(0.0f),
+   policyRemainderEach(0.0f),
+   nnXLen(0),
+   nnYLen(0),
+   boardXSize(0),
+   boardYSize(0),
+   numTopMoves(0),
+   ownerMapStored(false),
+   data()
+{}
+
+CompactNNOutput::~CompactNNOutput()
+{}
+
+bool CompactNNOutput::hasOwnerMap() const {
+  return ownerMapStored;
+}
+
+size_t CompactNNOutput::getNumBytes() const {
+  return sizeof(CompactNNOutput) + data.capacity();
+}
+
+void CompactNNOutput::decompress(NNOutput& output) const {
+  output.nnHash = nnHash;
+  output.whiteWinProb = whiteWinProb;
+  output.whiteLossProb = whiteLossProb;
+  output.whiteNoResultProb = whiteNoResultProb;
+  output.whiteScoreMean = whiteScoreMean;
+  output.whiteScoreMeanSq = whiteScoreMeanSq;
+  output.nnXLen = nnXLen;
+  output.nnYLen = nnYLen;
+
+  int boardArea = boardXSize * boardYSize;
+  int numIdxs = boardArea + 1;
+  std::fill(output.policyProbs, output.policyProbs + NNPos::MAX_NN_POLICY_SIZE, -1.0f);
+  size_t ownerMapOffset;
+  if(numTopMoves <= 0) {
+    ownerMapOffset = 2 * numIdxs;
+    for(int i = 0; i<numIdxs; i++)
+      output.policyProbs[policyPosOfIdx(i,boardXSize,boardYSize,nnXLen,nnYLen)] = halfToFloat(readUInt16(&data[2*i]));
+  }
+  else {
+    size_t maskBytes = (numIdxs + 7) / 8;
+    ownerMapOffset = maskBytes + 4 * numTopMoves;
+    for(int i = 0; i<numIdxs; i++) {
+      if(data[i / 8] & (1 << (i % 8)))
+        output.policyProbs[policyPosOfIdx(i,boardXSize,boardYSize,nnXLen,nnYLen)] = policyRemainderEach;
+    }
+    for(int k = 0; k<numTopMoves; k++) {
+      int idx = readUInt16(&data[maskBytes + 4*k]);
+      output.policyProbs[policyPosOfIdx(idx,boardXSize,boardYSize,nnXLen,nnYLen)] = halfToFloat(readUInt16(&data[maskBytes + 4*k + 2]));
+    }
+  }
+
+  if(output.whiteOwnerMap != NULL) {
+    NNOutputPool::freeOwnerMap(output.whiteOwnerMap);
+    output.whiteOwnerMap = NULL;
+  }
+  if(ownerMapStored) {
+    output.whiteOwnerMap = NNOutputPool::allocOwnerMap();
+    std::fill(output.whiteOwnerMap, output.whiteOwnerMap + nnXLen * nnYLen, 0.0f);
+    for(int y = 0; y<boardYSize; y++) {
+      for(int x = 0; x<boardXSize; x++)
+        output.whiteOwnerMap[NNPos::xyToPos(x,y,nnXLen)] = (int8_t)data[ownerMapOffset + y * boardXSize + x] / 127.0f;
+    }
+  }
+}
+
+shared_ptr<NNOutput> CompactNNOutput::decompress() const {
+  shared_ptr<NNOutput> output = NNOutputPool::makeShared();
+  decompress(*output);
+  return output;
+}
+
+//nnHash, the six floats, the four sizes, numTopMoves, and ownerMapStored, padded to a multiple of 8
+static const size_t COMPACT_SERIALIZED_HEADER_BYTES = 48;
+
+size_t CompactNNOutput::getSerializedSize() const {
+  return COMPACT_SERIALIZED_HEADER_BYTES + data.size();
+}
+
+void CompactNNOutput::serialize(uint8_t* buf) const {
+  std::memset(buf, 0, COMPACT_SERIALIZED_HEADER_BYTES);
+  std::memcpy(buf, &nnHash.hash0, 8);
+  std::memcpy(buf + 8, &nnHash.hash1, 8);
+  float floats[6] = {whiteWinProb, whiteLossProb, whiteNoResultProb, whiteScoreMean, whiteScoreMeanSq, policyRemainderEach};
+  std::memcpy(buf + 16, floats, sizeof(floats));
+  buf[40] = nnXLen;
+  buf[41] = nnYLen;
+  buf[42] = boardXSize;
+  buf[43] = boardYSize;
+  writeUInt16(buf + 44, numTopMoves);
+  buf[46] = ownerMapStored ? 1 : 0;
+  if(data.size() > 0)
+    std::memcpy(buf + COMPACT_SERIALIZED_HEADER_BYTES, data.data(), data.size());
+}
+
+size_t CompactNNOutput::getMaxSerializedSize(int bXSize, int bYSize, int policyTopK) {
+  size_t boardArea = (size_t)bXSize * bYSize;
+  size_t numIdxs = boardArea + 1;
+  size_t policyBytes = 2 * numIdxs;
+  //Top moves are only stored when fewer than the legal moves, so there are at most numIdxs-1 of them
+  if(policyTopK > 0)
+    policyBytes = std::max(policyBytes, (numIdxs + 7) / 8 + 4 * std::min((size_t)policyTopK, numIdxs - 1));
+  return COMPACT_SERIALIZED_HEADER_BYTES + policyBytes + boardArea;
+}
+
+unique_ptr<CompactNNOutput> CompactNNOutput::deserialize(const uint8_t* buf, size_t numBytes) {
+  if(numBytes < COMPACT_SERIALIZED_HEADER_BYTES)
+    throw StringError("CompactNNOutput: serialized data too short");
+  unique_ptr<CompactNNOutput> ret(new CompactNNOutput());
+  std::memcpy(&ret->nnHash.hash0, buf, 8);
+  std::memcpy(&ret->nnHash.hash1, buf + 8, 8);
+  float floats[6];
+  std::memcpy(floats, buf + 16, sizeof(floats));
+  ret->whiteWinProb = floats[0];
+  ret->whiteLossProb = floats[1];
+  ret->whiteNoResultProb = floats[2];
+  ret->whiteScoreMean = floats[3];
+  ret->whiteScoreMeanSq = floats[4];
+  ret->policyRemainderEach = floats[5];
+  ret->nnXLen = buf[40];
+  ret->nnYLen = buf[41];
+  ret->boardXSize = buf[42];
+  ret->boardYSize = buf[43];
+  ret->numTopMoves = readUInt16(buf + 44);
+  ret->ownerMapStored = buf[46] != 0;
+
+  if(ret->nnXLen > NNPos::MAX_BOARD_LEN || ret->nnYLen > NNPos::MAX_BOARD_LEN ||
+     ret->boardXSize <= 0 || ret->boardYSize <= 0 || ret->boardXSize > ret->nnXLen || ret->boardYSize > ret->nnYLen)
+    throw StringError("CompactNNOutput: serialized data has invalid sizes");
+  int boardArea = ret->boardXSize * ret->boardYSize;
+  int numIdxs = boardArea + 1;
+  if(ret->numTopMoves > numIdxs)
+    throw StringError("CompactNNOutput: serialized data has invalid number of top moves");
+  size_t policyBytes = ret->numTopMoves <= 0 ? 2 * numIdxs : (numIdxs + 7) / 8 + 4 * ret->numTopMoves;
+  size_t dataBytes = policyBytes + (ret->ownerMapStored ? boardArea : 0);
+  if(numBytes != COMPACT_SERIALIZED_HEADER_BYTES + dataBytes)
+    throw StringError("CompactNNOutput: serialized data has wrong length");
+  ret->data.assign(buf + COMPACT_SERIALIZED_HEADER_BYTES, buf + numBytes);
+
+  size_t maskBytes = (numIdxs + 7) / 8;
+  for(int k = 0; k<ret->numTopMoves; k++) {
+    if(readUInt16(&ret->data[maskBytes + 4*k]) >= numIdxs)
+      throw StringError("CompactNNOutput: serialized data has invalid move");
+  }
+  return ret;
+}
+
+//IEEE half precision, rounding to nearest even, and handling subnormals, infinities, and nans.
+uint16_t CompactNNOutput::floatToHalf(float f) {
+  static const uint32_t f32Infinity = 255u << 23;
+  static const uint32_t f16Overflow = (127u + 16u) << 23;
+  static const uint32_t f16MinNormal = 113u << 23;
+  static const uint32_t denormMagicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(uint32_t));
+  uint32_t sign = x & 0x80000000u;
+  x ^= sign;
+
+  uint16_t h;
+  if(x >= f16Overflow)
+    h = (x > f32Infinity) ? 0x7E00 : 0x7C00;
+  else if(x < f16MinNormal) {
+    //Let the float addition do the rounding of the mantissa, by adding a number that shifts it into place
+    float fx;
+    float denormMagic;
+    std::memcpy(&fx, &x, sizeof(uint32_t));
+    std::memcpy(&denormMagic, &denormMagicBits, sizeof(uint32_t));
+    fx += denormMagic;
+    std::memcpy(&x, &fx, sizeof(uint32_t));
+    h = (uint16_t)(x - denormMagicBits);
+  }
+  else {
+    uint32_t mantissaOdd = (x >> 13) & 1u;
+    x += ((uint32_t)(15 - 127) << 23) + 0xFFFu;
+    x += mantissaOdd;
+    h = (uint16_t)(x >> 13);
+  }
+  return (uint16_t)(h | (sign >> 16));
+}
+
+float CompactNNOutput::halfToFloat(uint16_t h) {
+  static const uint32_t shiftedExponent = 0x7C00u << 13;
+  static const uint32_t denormMagicBits = 113u << 23;
+
+  uint32_t x = ((uint32_t)h & 0x7FFFu) << 13;
+  uint32_t exponent = x & shiftedExponent;
+  x += (127u - 15u) << 23;
+  if(exponent == shiftedExponent)
+    x += (128u - 16u) << 23;
+  else if(exponent == 0) {
+    float fx;
+    float denormMagic;
+    x += 1u << 23;
+    std::memcpy(&fx, &x, sizeof(uint32_t));
+    std::memcpy(&denormMagic, &denormMagicBits, sizeof(uint32_t));
+    fx -= denormMagic;
+    std::memcpy(&x, &fx, sizeof(uint32_t));
+  }
+  x |= ((uint32_t)h & 0x8000u) << 16;
+  float f;
+  std::memcpy(&f, &x, sizeof(uint32_t));
+  return f;
+}
+
+
+//-----------------------------------------------------------------------------------------------------------
+
+bool NNSymmetry::isValid(int symmetry, int boardXSize, int boardYSize) {
+  return symmetry >= 0 && symmetry < NUM_SYMMETRIES && ((symmetry & 0x4) == 0 || boardXSize == boardYSize);
+}
+
+void NNSymmetry::getSymXY(int x, int y, int boardXSize, int boardYSize, int symmetry, int& symX, int& symY) {
+  if(symmetry & 0x4)
+    std::swap(x,y);
+  if(symmetry & 0x1)
+    y = boardYSize-1-y;
+  if(symmetry & 0x2)
+    x = boardXSize-1-x;
+  symX = x;
+  symY = y;
+}
+
+Hash128 NNSymmetry::getCanonicalHash(Hash128 nnHash, const Board& board, const BoardHistory& hist, int& symmetry) {
+  int xSize = board.x_size;
+  int ySize = board.y_size;
+  int numSymmetries = xSize == ySize ? NUM_SYMMETRIES : NUM_SYMMETRIES / 2;
+
+  //Everything in the hash that depends on locations, for the board transformed by each symmetry. Swapping out
+  //that for the identity in nnHash for that of another symmetry gives the hash of the transformed position.
+  //Has to be kept in sync with getHashV3 through V5.
+  Hash128 locHashes[NUM_SYMMETRIES];
+  for(int y = 0; y<ySize; y++) {
+    for(int x = 0; x<xSize; x++) {
+      Loc loc = Location::getLoc(x,y,xSize);
+      Color color = board.colors[loc];
+      bool koLoc;
+      bool blackKoMark = false;
+      bool whiteKoMark = false;
+      if(hist.encorePhase == 0)
+        koLoc = loc == board.ko_loc || hist.superKoBanned[loc];
+      else {
+        koLoc = hist.superKoBanned[loc];
+        blackKoMark = hist.blackKoProhibited[loc];
+        whiteKoMark = hist.whiteKoProhibited[loc];
+      }
+      if(color == C_EMPTY && !koLoc && !blackKoMark && !whiteKoMark)
+        continue;
+
+      for(int s = 0; s<numSymmetries; s++) {
+        int symX;
+        int symY;
+        getSymXY(x,y,xSize,ySize,s,symX,symY);
+        Loc symLoc = Location::getLoc(symX,symY,xSize);
+        locHashes[s] ^= Board::ZOBRIST_BOARD_HASH[symLoc][color];
+        if(koLoc)
+          locHashes[s] ^= Board::ZOBRIST_KO_LOC_HASH[symLoc];
+        if(blackKoMark)
+          locHashes[s] ^= Board::ZOBRIST_KO_MARK_HASH[symLoc][P_BLACK];
+        if(whiteKoMark)
+          locHashes[s] ^= Board::ZOBRIST_KO_MARK_HASH[symLoc][P_WHITE];
+      }
+    }
+  }
+
+  Hash128 best = nnHash;
+  symmetry = 0;
+  for(int s = 1; s<numSymmetries; s++) {
+    Hash128 hash = nnHash ^ locHashes[0] ^ locHashes[s];
+    if(hash < best) {
+      best = hash;
+      symmetry = s;
+    }
+  }
+  return best;
+}
+
+void NNSymmetry::transformOutput(const NNOutput& src, NNOutput& dst, int boardXSize, int boardYSize, int symmetry, bool inverse) {
+  assert(&src != &dst);
+  assert(isValid(symmetry,boardXSize,boardYSize));
+  dst.nnHash = src.nnHash;
+  dst.whiteWinProb = src.whiteWinProb;
+  dst.whiteLossProb = src.whiteLossProb;
+  dst.whiteNoResultProb = src.whiteNoResultProb;
+  dst.whiteScoreMean = src.whiteScoreMean;
+  dst.whiteScoreMeanSq = src.whiteScoreMeanSq;
+  int nnXLen = src.nnXLen;
+  int nnYLen = src.nnYLen;
+  dst.nnXLen = nnXLen;
+  dst.nnYLen = nnYLen;
+
+  if(src.whiteOwnerMap != NULL) {
+    if(dst.whiteOwnerMap == NULL)
+      dst.whiteOwnerMap = NNOutputPool::allocOwnerMap();
+    std::fill(dst.whiteOwnerMap, dst.whiteOwnerMap + nnXLen * nnYLen, 0.0f);
+  }
+  else if(dst.whiteOwnerMap != NULL) {
+    NNOutputPool::freeOwnerMap(dst.whiteOwnerMap);
+    dst.whiteOwnerMap = NULL;
+  }
+
+  std::fill(dst.policyProbs, dst.policyProbs + NNPos::MAX_NN_POLICY_SIZE, -1.0f);
+  int passPos = NNPos::locToPos(Board::PASS_LOC,boardXSize,nnXLen,nnYLen);
+  dst.policyProbs[passPos] = src.policyProbs[passPos];
+  for(int y = 0; y<boardYSize; y++) {
+    for(int x = 0; x<boardXSize; x++) {
+      int symX;
+      int symY;
+      getSymXY(x,y,boardXSize,boardYSize,symmetry,symX,symY);
+      int pos = NNPos::xyToPos(x,y,nnXLen);
+      int symPos = NNPos::xyToPos(symX,symY,nnXLen);
+      int srcPos = inverse ? symPos : pos;
+      int dstPos = inverse ? pos : symPos;
+      dst.policyProbs[dstPos] = src.policyProbs[srcPos];
+      if(src.whiteOwnerMap != NULL)
+        dst.whiteOwnerMap[dstPos] = src.whiteOwnerMap[srcPos];
+    }
+  }
+}
 
 void NNOutput::debugPrint(ostream& out, const Board& board) {
   out << "Win " << Global::strprintf("%.2fc",whiteWinProb*100) << endl;
@@ -1,6 +1,8 @@
 #ifndef NEURALNET_NNINPUTS_H_
 #define NEURALNET_NNINPUTS_H_
 
+#include <memory>
+
 #include "../core/global.h"
 #include "../core/hash.h"
 #include "../core/rand.h"
@@ -87,6 +89,7 @@ struct NNOutput {
   int nnXLen;
   int nnYLen;
   //If not NULL, then this contains a nnXLen*nnYLen-sized map of expected ownership on the board.
+  //Must be allocated with NNOutputPool::allocOwnerMap, since that's how NNOutput frees it.
   float* whiteOwnerMap;
 
   NNOutput(); //Does NOT initialize values
@@ -98,6 +101,104 @@ struct NNOutput {
   void debugPrint(std::ostream& out, const Board& board);
 };
 
+//NNOutputs and their owner maps are allocated at the rate of neural net evals and mostly freed by different
+//threads than allocated them, so they come from thread-caching pools rather than the global allocator.
+namespace NNOutputPool {
+  //Allocates the NNOutput together with its reference counts. Like NNOutput(), does NOT initialize values.
+  std::shared_ptr<NNOutput> makeShared();
+  std::shared_ptr<NNOutput> makeShared(const NNOutput& other);
+
+  //Room for a map of up to NNPos::MAX_BOARD_AREA floats
+  float* allocOwnerMap();
+  void freeOwnerMap(float* ownerMap);
+
+  //Allocations served by the pools so far, and how many times the pools themselves went to the global allocator
+  uint64_t getNumAllocs();
+  uint64_t getNumHeapAllocs();
+  uint64_t getNumBytesReserved();
+  //The above, as one line for logging
+  std::string getStatsString();
+}
+
+//Lossy compact copy of an NNOutput, for holding many of them for a long time such as in the NN cache.
+//An NNOutput always has room for a 19x19 policy and owner map regardless of the board, whereas this stores:
+//* The policy only for the board's own locations and pass, in fp16. Or if policyTopK > 0, only for the policyTopK
+//  most likely moves, with the probability of the rest spread evenly over the other legal moves.
+//* The owner map, if any, only for the board's own locations, quantized to int8.
+//Values and scores are stored exactly. Decompressing gives back an NNOutput that search can use as usual.
+class CompactNNOutput {
+ public:
+  Hash128 nnHash;
+
+  //Compresses an output of an evaluation of a board with the given size
+  CompactNNOutput(const NNOutput& output, int boardXSize, int boardYSize, int policyTopK);
+  ~CompactNNOutput();
+
+  CompactNNOutput(const CompactNNOutput&) = delete;
+  CompactNNOutput& operator=(const CompactNNOutput&) = delete;
+
+  bool hasOwnerMap() const;
+  //Approximate total memory used, for comparing against sizeof(NNOutput) plus its owner map
+  size_t getNumBytes() const;
+
+  void decompress(NNOutput& output) const;
+  std::shared_ptr<NNOutput> decompress() const;
+
+  //Flat byte representation, for storing outside of process memory such as in NNDiskCache.
+  //Deserializing checks that everything is consistent and throws StringError if not.
+  size_t getSerializedSize() const;
+  void serialize(uint8_t* buf) const;
+  static std::unique_ptr<CompactNNOutput> deserialize(const uint8_t* buf, size_t numBytes);
+  //Upper bound on getSerializedSize for any output for a board of the given size compressed with policyTopK
+  static size_t getMaxSerializedSize(int boardXSize, int boardYSize, int policyTopK);
+
+  static uint16_t floatToHalf(float f);
+  static float halfToFloat(uint16_t h);
+
+ private:
+  CompactNNOutput();
+
+  float whiteWinProb;
+  float whiteLossProb;
+  float whiteNoResultProb;
+  float whiteScoreMean;
+  float whiteScoreMeanSq;
+  //When only the top moves are stored, the probability of each other legal move
+  float policyRemainderEach;
+
+  uint8_t nnXLen;
+  uint8_t nnYLen;
+  uint8_t boardXSize;
+  uint8_t boardYSize;
+  //Number of (idx,fp16) pairs stored, or 0 if the policy is stored densely
+  uint16_t numTopMoves;
+  bool ownerMapStored;
+
+  //Dense: fp16 per board location and then pass, negative if illegal.
+  //Top moves: a bitmask of which of those are legal followed by (idx,fp16) pairs.
+  //Then, if present, the int8 owner map over board locations.
+  std::vector<uint8_t> data;
+};
+
+//Rotations and reflections of positions, for sharing neural net evaluations between positions symmetric to each other.
+//Symmetry bit 0 flips y, bit 1 flips x, and bit 2 first transposes x and y, which is a symmetry only of square boards.
+namespace NNSymmetry {
+  const int NUM_SYMMETRIES = NNInputs::NUM_SYMMETRY_COMBINATIONS;
+
+  bool isValid(int symmetry, int boardXSize, int boardYSize);
+  //Where the point (x,y) goes under the symmetry
+  void getSymXY(int x, int y, int boardXSize, int boardYSize, int symmetry, int& symX, int& symY);
+
+  //Given nnHash for the position from NNInputs::getHashV3, V4 or V5, which all hash the board the same way,
+  //returns the least of its hashes under all valid symmetries, and sets symmetry to the one giving that hash.
+  //So all symmetric variants of a position share the same canonical hash.
+  Hash128 getCanonicalHash(Hash128 nnHash, const Board& board, const BoardHistory& hist, int& symmetry);
+
+  //Sets dst to src with the policy and owner map transformed from a position's orientation to its orientation
+  //under the symmetry, or if inverse, back from that orientation. Everything else is copied as is.
+  void transformOutput(const NNOutput& src, NNOutput& dst, int boardXSize, int boardYSize, int symmetry, bool inverse);
+}
+
 //Utility functions for computing the "scoreValue", the unscaled utility of various numbers of points, prior to multiplication by
 //staticScoreUtilityFactor or dynamicScoreUtilityFactor (see searchparams.h)
 namespace ScoreValue {
@@ -6,6 +6,7 @@
 #include "../core/logger.h"
 #include "../neuralnet/desc.h"
 #include "../neuralnet/nninputs.h"
+#include "../neuralnet/nnprofile.h"
 
 // A handle to cross-thread cross-gpu initialization state.
 // Create one of these per process, although creating more is fine.
@@ -23,7 +24,7 @@ struct InputBuffers;
 struct LoadedModel;
 
 // Generic interface to neural net inference.
-// There is a single CUDA backend.
+// There is a CUDA backend and a pure-CPU backend, selected at compile time.
 namespace NeuralNet {
   // Call globalInitialize() once upon program startup to construct the net.
   void globalInitialize();
@@ -35,7 +36,10 @@ namespace NeuralNet {
   ComputeContext* createComputeContext(
     //The indices of all gpus that this context will be used for.
     const std::vector<int>& gpuIdxs,
-    Logger* logger
+    Logger* logger,
+    //If not empty, createComputeHandle autotunes the kernels of the backend for the model, batch size and board size
+    //of each handle, reusing and adding to the results in this file, see NNTuneCache.
+    const std::string& tuneFile
   );
   //A ComputeContext should NOT be freed until all ComputeHandles created using it have also been freed.
   void freeComputeContext(ComputeContext* computeContext);
@@ -59,6 +63,7 @@ namespace NeuralNet {
   // some info messages to it. If requireExactNNLen is true, the backend is
   // allowed to assume that all boards to evaluate will be of size exactly equal
   // to (nnXLen,nnYLen) rather than smaller, and skip any masking operations.
+  // useINT8 runs some layers with quantized weights and activations, for backends that support it.
   ComputeHandle* createComputeHandle(
     ComputeContext* context,
     const LoadedModel* loadedModel,
@@ -70,6 +75,7 @@ namespace NeuralNet {
     bool inputsUseNHWC,
     int gpuIdxForThisThread,
     bool useFP16,
+    bool useINT8,
     bool cudaUseNHWC
   );
   void freeComputeHandle(ComputeHandle* computeHandle);
@@ -103,6 +109,12 @@ namespace NeuralNet {
   // The total number of global features
   int getBatchEltGlobalLen(const InputBuffers* buffers);
 
+  // Instead of filling the buffers above, the inputs can also be provided in memory owned by the caller,
+  // such as rows that clients encoded directly into. Until called again, getOutput reads batch element nIdx from
+  // spatial + nIdx * getBatchEltSpatialLen() and global + nIdx * getBatchEltGlobalLen(), and that memory must
+  // remain valid during getOutput. Passing NULL for both switches back to the buffers' own storage.
+  void setBatchInputsExternal(InputBuffers* buffers, const float* spatial, const float* global);
+
   //Perform Neural Net Evals ---------------------------------------------------------
 
   // Preconditions:
@@ -114,6 +126,16 @@ namespace NeuralNet {
   // All outputs are in logits - all final activation functions softmax, tanh, etc. are NOT applied.
   void getOutput(ComputeHandle* computeHandle, InputBuffers* buffers, int numBatchEltsFilled, std::vector<NNOutput*>& outputs);
 
+  //Profiling -------------------------------------------------------------------
+
+  // Starts timing each part of the net in getOutput on this handle, clearing any earlier profile, or stops.
+  // Returns false if the backend doesn't support profiling. While enabled, getOutput may be slower, since the
+  // backend may need to wait for each part to finish before timing the next.
+  bool setProfilingEnabled(ComputeHandle* computeHandle, bool enabled);
+  // Fills profile with the parts of the net in the order they run, see NNLayerProfile, with totals over all
+  // getOutput calls while profiling was enabled. Empty if the backend doesn't support profiling.
+  void getProfile(const ComputeHandle* computeHandle, std::vector<NNLayerProfile>& profile);
+
 
   //FOR TESTING -----------------------------------------------------------------------
   //For all of the below, the input buffers must have exactly the size expected of the input for the operation.
@@ -0,0 +1,151 @@
+#include "../neuralnet/nnprofile.h"
+
+using namespace std;
+
+static double convFlopsPerRow(const ConvLayerDesc& desc, int nnXLen, int nnYLen) {
+  return 2.0 * nnXLen * nnYLen * desc.convXSize * desc.convYSize * desc.inChannels * desc.outChannels;
+}
+static double matMulFlopsPerRow(const MatMulLayerDesc& desc) {
+  return 2.0 * desc.inChannels * desc.outChannels;
+}
+
+static NNLayerProfile makeLayer(const string& name, const string& kind, double flopsPerRow) {
+  NNLayerProfile layer;
+  layer.name = name;
+  layer.kind = kind;
+  layer.flopsPerRow = flopsPerRow;
+  layer.numCalls = 0;
+  layer.numRows = 0;
+  layer.totalSeconds = 0.0;
+  return layer;
+}
+
+vector<NNLayerProfile> NNProfile::makeLayers(const ModelDesc& desc, int nnXLen, int nnYLen) {
+  vector<NNLayerProfile> profile;
+  const TrunkDesc& trunk = desc.trunk;
+  profile.push_back(makeLayer(
+    trunk.initialConv.name, "initial",
+    convFlopsPerRow(trunk.initialConv,nnXLen,nnYLen) + matMulFlopsPerRow(trunk.initialMatMul)
+  ));
+  for(int i = 0; i<trunk.blocks.size(); i++) {
+    if(trunk.blocks[i].first == ORDINARY_BLOCK_KIND) {
+      const ResidualBlockDesc* block = (const ResidualBlockDesc*)trunk.blocks[i].second;
+      profile.push_back(makeLayer(
+        block->name, "ordinary",
+        convFlopsPerRow(block->regularConv,nnXLen,nnYLen) + convFlopsPerRow(block->finalConv,nnXLen,nnYLen)
+      ));
+    }
+    else if(trunk.blocks[i].first == DILATED_BLOCK_KIND) {
+      const DilatedResidualBlockDesc* block = (const DilatedResidualBlockDesc*)trunk.blocks[i].second;
+      profile.push_back(makeLayer(
+        block->name, "dilated",
+        convFlopsPerRow(block->regularConv,nnXLen,nnYLen) + convFlopsPerRow(block->dilatedConv,nnXLen,nnYLen) +
+        convFlopsPerRow(block->finalConv,nnXLen,nnYLen)
+      ));
+    }
+    else if(trunk.blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+      const GlobalPoolingResidualBlockDesc* block = (const GlobalPoolingResidualBlockDesc*)trunk.blocks[i].second;
+      profile.push_back(makeLayer(
+        block->name, "gpool",
+        convFlopsPerRow(block->regularConv,nnXLen,nnYLen) + convFlopsPerRow(block->gpoolConv,nnXLen,nnYLen) +
+        matMulFlopsPerRow(block->gpoolToBiasMul) + convFlopsPerRow(block->finalConv,nnXLen,nnYLen)
+      ));
+    }
+    else {
+      ASSERT_UNREACHABLE;
+    }
+  }
+  profile.push_back(makeLayer(trunk.trunkTipBN.name, "trunktip", 0.0));
+
+  const PolicyHeadDesc& policyHead = desc.policyHead;
+  profile.push_back(makeLayer(
+    policyHead.name, "policyhead",
+    convFlopsPerRow(policyHead.p1Conv,nnXLen,nnYLen) + convFlopsPerRow(policyHead.g1Conv,nnXLen,nnYLen) +
+    matMulFlopsPerRow(policyHead.gpoolToBiasMul) + convFlopsPerRow(policyHead.p2Conv,nnXLen,nnYLen) +
+    matMulFlopsPerRow(policyHead.gpoolToPassMul)
+  ));
+  const ValueHeadDesc& valueHead = desc.valueHead;
+  profile.push_back(makeLayer(
+    valueHead.name, "valuehead",
+    convFlopsPerRow(valueHead.v1Conv,nnXLen,nnYLen) + matMulFlopsPerRow(valueHead.v2Mul) +
+    matMulFlopsPerRow(valueHead.v3Mul) + matMulFlopsPerRow(valueHead.sv3Mul) +
+    convFlopsPerRow(valueHead.vOwnershipConv,nnXLen,nnYLen)
+  ));
+  return profile;
+}
+
+void NNProfile::record(NNLayerProfile& layer, int batchSize, double seconds) {
+  layer.numCalls += 1;
+  layer.numRows += batchSize;
+  layer.totalSeconds += seconds;
+}
+
+void NNProfile::clear(vector<NNLayerProfile>& profile) {
+  for(NNLayerProfile& layer: profile) {
+    layer.numCalls = 0;
+    layer.numRows = 0;
+    layer.totalSeconds = 0.0;
+  }
+}
+
+void NNProfile::printTable(ostream& out, const vector<NNLayerProfile>& profile) {
+  double totalSeconds = 0.0;
+  double totalFlops = 0.0;
+  for(const NNLayerProfile& layer: profile) {
+    totalSeconds += layer.totalSeconds;
+    totalFlops += layer.flopsPerRow * layer.numRows;
+  }
+
+  out << Global::strprintf(
+    "%-24s %-10s %8s %10s %12s %12s %7s %10s", "layer", "kind", "calls", "rows", "ms/call", "MFLOP/row", "time%", "GFLOP/s"
+  ) << endl;
+  for(const NNLayerProfile& layer: profile) {
+    double msPerCall = layer.numCalls > 0 ? layer.totalSeconds * 1000.0 / layer.numCalls : 0.0;
+    double gflopsPerSecond = layer.totalSeconds > 0 ? layer.flopsPerRow * layer.numRows / layer.totalSeconds / 1e9 : 0.0;
+    out << Global::strprintf(
+      "%-24s %-10s %8llu %10llu %12.4f %12.3f %7.2f %10.2f",
+      layer.name.c_str(), layer.kind.c_str(),
+      (unsigned long long)layer.numCalls, (unsigned long long)layer.numRows,
+      msPerCall, layer.flopsPerRow / 1e6,
+      totalSeconds > 0 ? 100.0 * layer.totalSeconds / totalSeconds : 0.0,
+      gflopsPerSecond
+    ) << endl;
+  }
+  out << Global::strprintf(
+    "%-24s %-10s %8s %10s %12.4f %12.3f %7.2f %10.2f",
+    "total", "", "", "",
+    profile.size() > 0 && profile[0].numCalls > 0 ? totalSeconds * 1000.0 / profile[0].numCalls : 0.0,
+    profile.size() > 0 && profile[0].numRows > 0 ? totalFlops / profile[0].numRows / 1e6 : 0.0,
+    totalSeconds > 0 ? 100.0 : 0.0,
+    totalSeconds > 0 ? totalFlops / totalSeconds / 1e9 : 0.0
+  ) << endl;
+}
+
+static string jsonEscape(const string& s) {
+  string ret;
+  for(char c: s) {
+    if(c == '"' || c == '\\')
+      ret += '\\';
+    ret += c;
+  }
+  return ret;
+}
+
+void NNProfile::printTrace(ostream& out, const vector<NNLayerProfile>& profile) {
+  out << "{\"traceEvents\":[" << endl;
+  double timeUs = 0.0;
+  for(size_t i = 0; i<profile.size(); i++) {
+    const NNLayerProfile& layer = profile[i];
+    double durUs = layer.numCalls > 0 ? layer.totalSeconds * 1e6 / layer.numCalls : 0.0;
+    double rowsPerCall = layer.numCalls > 0 ? (double)layer.numRows / layer.numCalls : 0.0;
+    out << Global::strprintf(
+      "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,"
+      "\"args\":{\"calls\":%llu,\"rowsPerCall\":%.2f,\"mflopPerRow\":%.3f}}%s",
+      jsonEscape(layer.name).c_str(), jsonEscape(layer.kind).c_str(), timeUs, durUs,
+      (unsigned long long)layer.numCalls, rowsPerCall, layer.flopsPerRow / 1e6,
+      i+1 < profile.size() ? "," : ""
+    ) << endl;
+    timeUs += durUs;
+  }
+  out << "]}" << endl;
+}
@@ -0,0 +1,38 @@
+#ifndef NEURALNET_NNPROFILE_H_
+#define NEURALNET_NNPROFILE_H_
+
+#include "../core/global.h"
+#include "../neuralnet/desc.h"
+
+//Time and work spent in one part of the net, summed over the getOutput calls on a ComputeHandle since profiling was
+//enabled on it, see NeuralNet::setProfilingEnabled.
+struct NNLayerProfile {
+  //The name of the layer in the model
+  std::string name;
+  //One of "initial" (including the input transforms), "ordinary", "dilated", "gpool" (residual blocks by kind),
+  //"trunktip", "policyhead" or "valuehead"
+  std::string kind;
+  //Multiply-adds counted as 2 flops, over a full nnXLen x nnYLen board. Only convolutions and matrix multiplies are
+  //counted, batch norms, activations and pooling are small next to them.
+  double flopsPerRow;
+
+  uint64_t numCalls;
+  uint64_t numRows;
+  double totalSeconds;
+};
+
+namespace NNProfile {
+  //The layers of the net in the order getOutput runs them, with nothing recorded yet
+  std::vector<NNLayerProfile> makeLayers(const ModelDesc& desc, int nnXLen, int nnYLen);
+
+  void record(NNLayerProfile& layer, int batchSize, double seconds);
+  void clear(std::vector<NNLayerProfile>& profile);
+
+  //One line per layer, with its share of the total time and its achieved flops
+  void printTable(std::ostream& out, const std::vector<NNLayerProfile>& profile);
+  //Chrome trace event json, for chrome://tracing or ui.perfetto.dev, of one average batch with each layer taking its
+  //average time, one after another
+  void printTrace(std::ostream& out, const std::vector<NNLayerProfile>& profile);
+}
+
+#endif  // NEURALNET_NNPROFILE_H_
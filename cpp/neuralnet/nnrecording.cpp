@@ -0,0 +1,190 @@
+#include "../neuralnet/nnrecording.h"
+
+#include <cstring>
+#include "../core/mmapfile.h"
+
+using namespace std;
+
+static const char RECORDING_MAGIC[8] = {'K','G','N','N','R','E','C','1'};
+static const int32_t RECORDING_FORMAT_VERSION = 1;
+
+NNRecorder::NNRecorder(
+  const string& p,
+  int modelVersion,
+  int nnXLen,
+  int nnYLen,
+  bool canonicalizeSymmetry,
+  const string& modelFileHash,
+  Logger* logger
+)
+  :path(p),
+   out(),
+   recorded(),
+   mutex(),
+   numRecorded(0)
+{
+  out.open(path, ios::out | ios::binary | ios::trunc);
+  if(!out.good())
+    throw StringError("Could not create nn recording file " + path);
+
+  NNRecording::Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+  header.formatVersion = RECORDING_FORMAT_VERSION;
+  header.modelVersion = modelVersion;
+  header.nnXLen = nnXLen;
+  header.nnYLen = nnYLen;
+  header.canonicalizeSymmetry = canonicalizeSymmetry ? 1 : 0;
+  string hash = modelFileHash.substr(0, sizeof(header.modelFileHash)-1);
+  memcpy(header.modelFileHash, hash.c_str(), hash.size());
+  out.write((const char*)&header, sizeof(header));
+  if(!out.good())
+    throw StringError("Could not write nn recording file " + path);
+
+  if(logger != NULL)
+    logger->write("Recording neural net evaluations to " + path);
+}
+
+NNRecorder::~NNRecorder() {
+  out.close();
+}
+
+uint64_t NNRecorder::getNumRecorded() const {
+  return numRecorded.load(std::memory_order_relaxed);
+}
+
+void NNRecorder::record(const NNOutput& p, int boardXSize, int boardYSize) {
+  bool hasOwnerMap = p.whiteOwnerMap != NULL;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = recorded.find(p.nnHash);
+    if(iter != recorded.end() && (iter->second || !hasOwnerMap))
+      return;
+    recorded[p.nnHash] = hasOwnerMap;
+  }
+
+  //Compress and serialize outside the lock, and record in full so that replays see the same policy
+  CompactNNOutput compact(p, boardXSize, boardYSize, 0);
+  uint32_t numBytes = (uint32_t)compact.getSerializedSize();
+  vector<uint8_t> buf(numBytes);
+  compact.serialize(buf.data());
+
+  std::lock_guard<std::mutex> lock(mutex);
+  out.write((const char*)&numBytes, sizeof(numBytes));
+  out.write((const char*)buf.data(), numBytes);
+  if(!out.good())
+    throw StringError("Could not write nn recording file " + path);
+  numRecorded.fetch_add(1, std::memory_order_relaxed);
+}
+
+//-------------------------------------------------------------------------------------
+
+int NNReplay::parseMissPolicy(const string& s) {
+  string lower = Global::toLower(s);
+  if(lower == "fail")
+    return MISS_FAIL;
+  if(lower == "uniform")
+    return MISS_UNIFORM;
+  if(lower == "evaluate")
+    return MISS_EVALUATE;
+  throw StringError("Unknown nn replay miss policy, should be fail, uniform or evaluate: " + s);
+}
+
+NNReplay::NNReplay(const string& path, Logger* logger)
+  :header(),
+   entries(),
+   numLookups(0),
+   numHits(0)
+{
+  MappedFile file(path);
+  const uint8_t* data = (const uint8_t*)file.data;
+  size_t size = file.size;
+  if(size < sizeof(header))
+    throw StringError("Nn recording file too short: " + path);
+  memcpy(&header, data, sizeof(header));
+  header.modelFileHash[sizeof(header.modelFileHash)-1] = '\0';
+  if(memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) != 0)
+    throw StringError("Not an nn recording file: " + path);
+  if(header.formatVersion != RECORDING_FORMAT_VERSION)
+    throw StringError("Nn recording file has unsupported format version " + Global::intToString(header.formatVersion) + ": " + path);
+
+  size_t pos = sizeof(header);
+  size_t numTruncated = 0;
+  while(pos < size) {
+    //A run killed partway through writing a record leaves a short or garbled one at the end
+    uint32_t numBytes;
+    if(size - pos < sizeof(numBytes)) {
+      numTruncated++;
+      break;
+    }
+    memcpy(&numBytes, data + pos, sizeof(numBytes));
+    if(size - pos - sizeof(numBytes) < numBytes) {
+      numTruncated++;
+      break;
+    }
+    pos += sizeof(numBytes);
+    unique_ptr<CompactNNOutput> compact;
+    try {
+      compact = CompactNNOutput::deserialize(data + pos, numBytes);
+    }
+    catch(const StringError&) {
+      numTruncated++;
+      break;
+    }
+    pos += numBytes;
+    //A later record for the same hash is one that now also has an owner map
+    Hash128 nnHash = compact->nnHash;
+    entries[nnHash] = std::move(compact);
+  }
+
+  if(logger != NULL) {
+    logger->write(
+      "Replaying " + Global::uint64ToString(entries.size()) + " neural net evaluations from " + path +
+      (header.modelFileHash[0] != '\0' ? " recorded with model " + string(header.modelFileHash) : string())
+    );
+    if(numTruncated > 0)
+      logger->write("WARNING: nn recording file " + path + " ends with a partial record, ignoring it");
+  }
+}
+
+NNReplay::~NNReplay()
+{}
+
+int NNReplay::getModelVersion() const {
+  return header.modelVersion;
+}
+int NNReplay::getNNXLen() const {
+  return header.nnXLen;
+}
+int NNReplay::getNNYLen() const {
+  return header.nnYLen;
+}
+bool NNReplay::getCanonicalizeSymmetry() const {
+  return header.canonicalizeSymmetry != 0;
+}
+size_t NNReplay::getNumEntries() const {
+  return entries.size();
+}
+
+bool NNReplay::get(Hash128 nnHash, shared_ptr<NNOutput>& ret) {
+  numLookups.fetch_add(1, std::memory_order_relaxed);
+  auto iter = entries.find(nnHash);
+  if(iter == entries.end()) {
+    ret = nullptr;
+    return false;
+  }
+  numHits.fetch_add(1, std::memory_order_relaxed);
+  ret = iter->second->decompress();
+  return true;
+}
+
+uint64_t NNReplay::getNumLookups() const {
+  return numLookups.load(std::memory_order_relaxed);
+}
+uint64_t NNReplay::getNumHits() const {
+  return numHits.load(std::memory_order_relaxed);
+}
+void NNReplay::clearStats() {
+  numLookups.store(0);
+  numHits.store(0);
+}
@@ -0,0 +1,104 @@
+#ifndef NEURALNET_NNRECORDING_H_
+#define NEURALNET_NNRECORDING_H_
+
+#include <fstream>
+#include <map>
+
+#include "../core/global.h"
+#include "../core/hash.h"
+#include "../core/logger.h"
+#include "../core/multithread.h"
+#include "../neuralnet/nninputs.h"
+
+//Recording of the neural net evaluations of a run, which can then be replayed in place of the net, so that search
+//can be benchmarked against realistic policies and values on machines without the model or a gpu, with every run
+//seeing exactly the same evaluations.
+//
+//The file is a header followed by records, each a CompactNNOutput with a dense fp16 policy, so replayed outputs
+//differ from the original ones by that rounding. Outputs are recorded postprocessed and keyed by nnHash, as in
+//NNCacheTable, so replaying needs the same board size for the net, and the same canonicalizeCacheSymmetry.
+namespace NNRecording {
+  struct Header {
+    char magic[8];
+    int32_t formatVersion;
+    int32_t modelVersion;
+    int32_t nnXLen;
+    int32_t nnYLen;
+    int32_t canonicalizeSymmetry;
+    char modelFileHash[72];
+  };
+}
+
+class NNRecorder {
+ public:
+  //Creates or overwrites the file at path
+  NNRecorder(
+    const std::string& path,
+    int modelVersion,
+    int nnXLen,
+    int nnYLen,
+    bool canonicalizeSymmetry,
+    const std::string& modelFileHash,
+    Logger* logger
+  );
+  //Flushes and closes the file
+  ~NNRecorder();
+
+  NNRecorder(const NNRecorder& other) = delete;
+  NNRecorder& operator=(const NNRecorder& other) = delete;
+
+  //Records p under p.nnHash, unless that hash was already recorded, with an owner map if p has none.
+  //The board size is that of the position that p is the output for. Thread-safe.
+  void record(const NNOutput& p, int boardXSize, int boardYSize);
+
+  uint64_t getNumRecorded() const;
+
+ private:
+  std::string path;
+  std::ofstream out;
+  //Whether each recorded hash was recorded with an owner map
+  std::map<Hash128,bool> recorded;
+  std::mutex mutex;
+  std::atomic<uint64_t> numRecorded;
+};
+
+class NNReplay {
+ public:
+  //What to do when asked for an evaluation that wasn't recorded
+  static const int MISS_FAIL = 0;
+  //A uniform policy over the legal moves, even value and score, and no ownership
+  static const int MISS_UNIFORM = 1;
+  //Evaluate it as if there were no replay
+  static const int MISS_EVALUATE = 2;
+  //Parses "fail", "uniform" or "evaluate", throwing StringError otherwise
+  static int parseMissPolicy(const std::string& s);
+
+  //Reads the whole file into memory. Throws StringError if it's not a valid recording.
+  NNReplay(const std::string& path, Logger* logger);
+  ~NNReplay();
+
+  NNReplay(const NNReplay& other) = delete;
+  NNReplay& operator=(const NNReplay& other) = delete;
+
+  int getModelVersion() const;
+  int getNNXLen() const;
+  int getNNYLen() const;
+  bool getCanonicalizeSymmetry() const;
+  size_t getNumEntries() const;
+
+  //Thread-safe. ret is set to nullptr if there's no recording for nnHash.
+  bool get(Hash128 nnHash, std::shared_ptr<NNOutput>& ret);
+
+  //Stats since construction or the last clearStats
+  uint64_t getNumLookups() const;
+  uint64_t getNumHits() const;
+  void clearStats();
+
+ private:
+  NNRecording::Header header;
+  std::map<Hash128,std::unique_ptr<CompactNNOutput>> entries;
+  std::atomic<uint64_t> numLookups;
+  std::atomic<uint64_t> numHits;
+};
+
+#endif  // NEURALNET_NNRECORDING_H_
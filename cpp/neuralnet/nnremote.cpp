@@ -0,0 +1,771 @@
+#include "../neuralnet/nnremote.h"
+
+#include <cstring>
+#include "../core/sha2.h"
+#include "../neuralnet/modelversion.h"
+
+#ifdef _WIN32
+ #define _IS_WINDOWS
+#elif _WIN64
+ #define _IS_WINDOWS
+#elif __unix || __APPLE__
+  #define _IS_UNIX
+#else
+ #error Unknown OS!
+#endif
+
+#ifdef _IS_UNIX
+  #include <cerrno>
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+  const uint64_t PROTOCOL_MAGIC = 0x4b474e4e52454d31ULL;
+  const int32_t PROTOCOL_VERSION = 1;
+
+  //Client to server, first thing on every connection
+  struct HelloMsg {
+    uint64_t magic;
+    int32_t protocolVersion;
+    int32_t nnXLen;
+    int32_t nnYLen;
+    int32_t inputsUseNHWC;
+    int32_t maxBatchSize;
+  };
+  struct HelloReplyMsg {
+    uint64_t magic;
+    int32_t ok;
+    int32_t modelVersion;
+    char modelFileHash[72];
+    char error[256];
+  };
+  //Client to server, if the client is going to evaluate on this connection
+  struct AttachMsg {
+    char memoryName[128];
+  };
+  struct AttachReplyMsg {
+    int32_t ok;
+  };
+  //Both ways, the number of rows to evaluate and then evaluated
+  struct BatchMsg {
+    int32_t numRows;
+  };
+}
+
+//SOCKETS------------------------------------------------------------------------------
+
+#ifdef _IS_UNIX
+
+static sockaddr_un makeSocketAddress(const string& socketPath) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(socketPath.size() <= 0 || socketPath.size() >= sizeof(addr.sun_path))
+    throw StringError("Invalid nn server socket path, must be nonempty and shorter than " +
+                      Global::intToString((int)sizeof(addr.sun_path)) + " chars: " + socketPath);
+  memcpy(addr.sun_path, socketPath.c_str(), socketPath.size());
+  return addr;
+}
+
+//Returns -1 if nothing is listening there
+static int connectSocket(const string& socketPath) {
+  sockaddr_un addr = makeSocketAddress(socketPath);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    throw StringError("Could not create socket");
+#ifdef SO_NOSIGPIPE
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  if(connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int listenSocket(const string& socketPath) {
+  //Replace a socket file left behind by a server that's gone, but not one that's still running
+  int existingFd = connectSocket(socketPath);
+  if(existingFd >= 0) {
+    close(existingFd);
+    throw StringError("An nn server is already listening at " + socketPath);
+  }
+  unlink(socketPath.c_str());
+
+  sockaddr_un addr = makeSocketAddress(socketPath);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    throw StringError("Could not create socket");
+  if(bind(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    throw StringError("Could not bind socket at " + socketPath);
+  }
+  if(listen(fd, 64) != 0) {
+    close(fd);
+    throw StringError("Could not listen on socket at " + socketPath);
+  }
+  return fd;
+}
+
+static int acceptSocket(int listenFd) {
+  while(true) {
+    int fd = accept(listenFd, NULL, NULL);
+    if(fd >= 0 || errno != EINTR)
+      return fd;
+  }
+}
+
+static bool sendFully(int fd, const void* data, size_t len) {
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  const char* p = (const char*)data;
+  while(len > 0) {
+    ssize_t n = send(fd, p, len, flags);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      return false;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+static bool recvFully(int fd, void* data, size_t len) {
+  char* p = (char*)data;
+  while(len > 0) {
+    ssize_t n = recv(fd, p, len, 0);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      return false;
+    }
+    if(n == 0)
+      return false;
+    p += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+//Makes any blocking call on the socket return, in this or another thread
+static void shutdownSocket(int fd) {
+  shutdown(fd, SHUT_RDWR);
+}
+
+static void closeSocket(int fd) {
+  close(fd);
+}
+
+static void removeSocketFile(const string& socketPath) {
+  unlink(socketPath.c_str());
+}
+
+static string getProcessIdString() {
+  return Global::intToString((int)getpid());
+}
+
+#endif
+
+#ifdef _IS_WINDOWS
+
+static int connectSocket(const string& socketPath) {
+  (void)socketPath;
+  throw StringError("Remote nn server is not supported on Windows");
+}
+static int listenSocket(const string& socketPath) {
+  (void)socketPath;
+  throw StringError("Remote nn server is not supported on Windows");
+}
+static int acceptSocket(int listenFd) {
+  (void)listenFd;
+  return -1;
+}
+static bool sendFully(int fd, const void* data, size_t len) {
+  (void)fd; (void)data; (void)len;
+  return false;
+}
+static bool recvFully(int fd, void* data, size_t len) {
+  (void)fd; (void)data; (void)len;
+  return false;
+}
+static void shutdownSocket(int fd) {
+  (void)fd;
+}
+static void closeSocket(int fd) {
+  (void)fd;
+}
+static void removeSocketFile(const string& socketPath) {
+  (void)socketPath;
+}
+static string getProcessIdString() {
+  return "0";
+}
+
+#endif
+
+//LAYOUT-------------------------------------------------------------------------------
+
+NNRemote::Layout::Layout(int maxR, int modelVersion, int nnXLen, int nnYLen)
+  :maxRows(maxR)
+{
+  rowSpatialLen = NNModelVersion::getNumSpatialFeatures(modelVersion) * nnXLen * nnYLen;
+  rowGlobalLen = NNModelVersion::getNumGlobalFeatures(modelVersion);
+  policyLen = NNPos::getPolicySize(nnXLen,nnYLen);
+  ownerMapLen = nnXLen * nnYLen;
+  //Win, loss, no result, score mean, score mean squared, then policy and owner map
+  outputRowLen = 5 + policyLen + ownerMapLen;
+
+  //Everything is 4 bytes wide, so all arrays stay aligned
+  ownerMapFlagsOffset = 0;
+  spatialOffset = ownerMapFlagsOffset + sizeof(int32_t) * maxRows;
+  globalOffset = spatialOffset + sizeof(float) * (size_t)maxRows * rowSpatialLen;
+  outputsOffset = globalOffset + sizeof(float) * (size_t)maxRows * rowGlobalLen;
+  totalBytes = outputsOffset + sizeof(float) * (size_t)maxRows * outputRowLen;
+}
+
+//CLIENT-------------------------------------------------------------------------------
+
+NNRemoteConnection::NNRemoteConnection(int f, SharedMemory* mem, const NNRemote::Layout& lay, int xLen, int yLen)
+  :fd(f),memory(mem),layout(lay),nnXLen(xLen),nnYLen(yLen)
+{}
+
+NNRemoteConnection::~NNRemoteConnection() {
+  closeSocket(fd);
+  delete memory;
+}
+
+void NNRemoteConnection::getOutput(
+  const float* rowsSpatial, const float* rowsGlobal, int numRows, vector<NNOutput*>& outputs
+) {
+  assert(numRows > 0 && numRows <= layout.maxRows);
+  assert(outputs.size() == numRows);
+  char* data = memory->data;
+  int32_t* ownerMapFlags = (int32_t*)(data + layout.ownerMapFlagsOffset);
+  for(int row = 0; row<numRows; row++)
+    ownerMapFlags[row] = outputs[row]->whiteOwnerMap != NULL ? 1 : 0;
+  std::copy(rowsSpatial, rowsSpatial + (size_t)numRows * layout.rowSpatialLen, (float*)(data + layout.spatialOffset));
+  std::copy(rowsGlobal, rowsGlobal + (size_t)numRows * layout.rowGlobalLen, (float*)(data + layout.globalOffset));
+
+  BatchMsg msg;
+  msg.numRows = numRows;
+  if(!sendFully(fd, &msg, sizeof(msg)))
+    throw StringError("Lost connection to nn server");
+  BatchMsg reply;
+  if(!recvFully(fd, &reply, sizeof(reply)) || reply.numRows != numRows)
+    throw StringError("Lost connection to nn server");
+
+  const float* outputRows = (const float*)(data + layout.outputsOffset);
+  for(int row = 0; row<numRows; row++) {
+    const float* out = outputRows + (size_t)row * layout.outputRowLen;
+    NNOutput* output = outputs[row];
+    output->whiteWinProb = out[0];
+    output->whiteLossProb = out[1];
+    output->whiteNoResultProb = out[2];
+    output->whiteScoreMean = out[3];
+    output->whiteScoreMeanSq = out[4];
+    std::copy(out + 5, out + 5 + layout.policyLen, output->policyProbs);
+    if(output->whiteOwnerMap != NULL)
+      std::copy(out + 5 + layout.policyLen, out + 5 + layout.policyLen + layout.ownerMapLen, output->whiteOwnerMap);
+  }
+}
+
+NNRemoteClient::NNRemoteClient(
+  const string& path,
+  int xLen,
+  int yLen,
+  bool useNHWC,
+  int maxBatch,
+  Logger* lg
+)
+  :socketPath(path),
+   nnXLen(xLen),
+   nnYLen(yLen),
+   inputsUseNHWC(useNHWC),
+   maxBatchSize(maxBatch),
+   logger(lg),
+   modelVersion(0),
+   modelFileHash(),
+   numConnectionsMade(0)
+{
+  int fd = connectAndHello();
+  closeSocket(fd);
+  if(logger != NULL)
+    logger->write(
+      "Using nn server at " + socketPath + " with model version " + Global::intToString(modelVersion) +
+      (modelFileHash.size() > 0 ? " hash " + modelFileHash : string())
+    );
+}
+
+NNRemoteClient::~NNRemoteClient()
+{}
+
+int NNRemoteClient::getModelVersion() const {
+  return modelVersion;
+}
+const string& NNRemoteClient::getModelFileHash() const {
+  return modelFileHash;
+}
+const string& NNRemoteClient::getSocketPath() const {
+  return socketPath;
+}
+
+int NNRemoteClient::connectAndHello() {
+  int fd = connectSocket(socketPath);
+  if(fd < 0)
+    throw StringError("Could not connect to nn server at " + socketPath);
+
+  HelloMsg hello;
+  memset(&hello, 0, sizeof(hello));
+  hello.magic = PROTOCOL_MAGIC;
+  hello.protocolVersion = PROTOCOL_VERSION;
+  hello.nnXLen = nnXLen;
+  hello.nnYLen = nnYLen;
+  hello.inputsUseNHWC = inputsUseNHWC ? 1 : 0;
+  hello.maxBatchSize = maxBatchSize;
+  HelloReplyMsg reply;
+  if(!sendFully(fd, &hello, sizeof(hello)) || !recvFully(fd, &reply, sizeof(reply)) || reply.magic != PROTOCOL_MAGIC) {
+    closeSocket(fd);
+    throw StringError("No valid reply from nn server at " + socketPath);
+  }
+  reply.error[sizeof(reply.error)-1] = '\0';
+  reply.modelFileHash[sizeof(reply.modelFileHash)-1] = '\0';
+  if(!reply.ok) {
+    closeSocket(fd);
+    throw StringError("Nn server at " + socketPath + " refused connection: " + string(reply.error));
+  }
+  modelVersion = reply.modelVersion;
+  modelFileHash = string(reply.modelFileHash);
+  return fd;
+}
+
+NNRemoteConnection* NNRemoteClient::connect() {
+  int fd = connectAndHello();
+  NNRemote::Layout layout(maxBatchSize, modelVersion, nnXLen, nnYLen);
+
+  Rand rand;
+  string memoryName =
+    "katago-nnremote-" + getProcessIdString() + "-" +
+    Global::uint64ToString(numConnectionsMade.fetch_add(1)) + "-" + Global::uint64ToHexString(rand.nextUInt64());
+  SharedMemory* memory;
+  try {
+    memory = new SharedMemory(memoryName, layout.totalBytes, false);
+  }
+  catch(const StringError&) {
+    closeSocket(fd);
+    throw;
+  }
+
+  AttachMsg attach;
+  memset(&attach, 0, sizeof(attach));
+  assert(memoryName.size() < sizeof(attach.memoryName));
+  memcpy(attach.memoryName, memoryName.c_str(), memoryName.size());
+  AttachReplyMsg reply;
+  bool ok = sendFully(fd, &attach, sizeof(attach)) && recvFully(fd, &reply, sizeof(reply)) && reply.ok;
+  //Both ends have it mapped now, so the name isn't needed anymore, and nothing is left behind if either one dies
+  SharedMemory::remove(memoryName);
+  if(!ok) {
+    closeSocket(fd);
+    delete memory;
+    throw StringError("Nn server at " + socketPath + " could not attach shared memory");
+  }
+  return new NNRemoteConnection(fd, memory, layout, nnXLen, nnYLen);
+}
+
+//SERVER-------------------------------------------------------------------------------
+
+struct NNRemoteServer::Connection {
+  int fd;
+  SharedMemory* memory;
+  NNRemote::Layout* layout;
+  std::mutex mutex;
+  std::condition_variable rowsDone;
+  int numRowsPending;
+  std::atomic<bool> isDone;
+  std::thread* thread;
+
+  Connection(int f)
+    :fd(f),memory(NULL),layout(NULL),mutex(),rowsDone(),numRowsPending(0),isDone(false),thread(NULL)
+  {}
+  ~Connection() {
+    closeSocket(fd);
+    delete memory;
+    delete layout;
+  }
+};
+
+NNRemoteServer::NNRemoteServer(
+  const string& sockPath,
+  const string& modelFile,
+  Logger& lg,
+  int maxBatch,
+  int xLen,
+  int yLen,
+  bool requireExactLen,
+  bool useNHWC,
+  bool skipNeuralNet,
+  int minBatchFill,
+  double maxBatchWaitMs,
+  const vector<int>& gpuIdxByThread,
+  bool randomize,
+  const string& seed,
+  int defaultSym,
+  bool fp16,
+  bool int8,
+  bool cudaNHWC,
+  const string& tuneFile
+)
+  :socketPath(sockPath),
+   modelFileName(modelFile),
+   logger(&lg),
+   maxBatchSize(maxBatch),
+   nnXLen(xLen),
+   nnYLen(yLen),
+   requireExactNNLen(requireExactLen),
+   inputsUseNHWC(useNHWC),
+   debugSkipNeuralNet(skipNeuralNet),
+   gpuIdxByServerThread(gpuIdxByThread),
+   doRandomize(randomize),
+   randSeed(seed),
+   defaultSymmetry(defaultSym),
+   useFP16(fp16),
+   useINT8(int8),
+   cudaUseNHWC(cudaNHWC),
+   computeContext(NULL),
+   loadedModel(NULL),
+   modelVersion(NNModelVersion::defaultModelVersion),
+   modelFileHash(),
+   rowQueue(NULL),
+   listenFd(-1),
+   isShuttingDown(false),
+   connectionsMutex(),
+   connections(),
+   acceptThread(NULL),
+   serverThreads(),
+   m_numRowsProcessed(0),
+   m_numBatchesProcessed(0),
+   m_numConnectionsAccepted(0)
+{
+  if(nnXLen > NNPos::MAX_BOARD_LEN || nnYLen > NNPos::MAX_BOARD_LEN)
+    throw StringError("Maximum supported nn server board size is " + Global::intToString(NNPos::MAX_BOARD_LEN));
+  if(maxBatchSize <= 0)
+    throw StringError("maxBatchSize is negative: " + Global::intToString(maxBatchSize));
+  if(gpuIdxByServerThread.size() <= 0)
+    throw StringError("NNRemoteServer: must have at least one server thread");
+
+  if(!debugSkipNeuralNet) {
+    {
+      MappedFile file(modelFileName);
+      char hash[65];
+      SHA2::get256((const uint8_t*)file.data, file.size, hash);
+      modelFileHash = string(hash);
+    }
+    vector<int> gpuIdxs = gpuIdxByServerThread;
+    std::sort(gpuIdxs.begin(), gpuIdxs.end());
+    gpuIdxs.erase(std::unique(gpuIdxs.begin(), gpuIdxs.end()), gpuIdxs.end());
+    computeContext = NeuralNet::createComputeContext(gpuIdxs,logger,tuneFile);
+    loadedModel = NeuralNet::loadModelFile(modelFileName, 0);
+    modelVersion = NeuralNet::getModelVersion(loadedModel);
+  }
+
+  //Enough for many clients to each have a batch queued at once
+  rowQueue = new LockFreeBatchQueue<Row>(std::max((size_t)4096, 16 * (size_t)maxBatchSize), (size_t)minBatchFill, maxBatchWaitMs);
+
+  listenFd = listenSocket(socketPath);
+  for(int i = 0; i<gpuIdxByServerThread.size(); i++)
+    serverThreads.push_back(new std::thread(&NNRemoteServer::serve,this,i));
+  acceptThread = new std::thread(&NNRemoteServer::acceptLoop,this);
+  logger->write("Nn server listening at " + socketPath + " with model version " + Global::intToString(modelVersion));
+}
+
+NNRemoteServer::~NNRemoteServer() {
+  isShuttingDown.store(true);
+  shutdownSocket(listenFd);
+  acceptThread->join();
+  delete acceptThread;
+  closeSocket(listenFd);
+  removeSocketFile(socketPath);
+
+  //Connections first, while the server threads are still running. A connection thread may be blocked pushing rows
+  //into a full queue, and it also waits for its rows already queued to be done before it exits, since the server
+  //threads write into the connection's memory.
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    for(size_t i = 0; i<connections.size(); i++)
+      shutdownSocket(connections[i]->fd);
+    reapConnectionsUnsynchronized(true);
+  }
+
+  rowQueue->setKilled(true);
+  for(size_t i = 0; i<serverThreads.size(); i++) {
+    serverThreads[i]->join();
+    delete serverThreads[i];
+  }
+  serverThreads.clear();
+
+  delete rowQueue;
+  if(loadedModel != NULL)
+    NeuralNet::freeLoadedModel(loadedModel);
+  if(computeContext != NULL)
+    NeuralNet::freeComputeContext(computeContext);
+}
+
+int NNRemoteServer::getModelVersion() const {
+  return modelVersion;
+}
+uint64_t NNRemoteServer::numRowsProcessed() const {
+  return m_numRowsProcessed.load(std::memory_order_relaxed);
+}
+uint64_t NNRemoteServer::numBatchesProcessed() const {
+  return m_numBatchesProcessed.load(std::memory_order_relaxed);
+}
+uint64_t NNRemoteServer::numConnectionsAccepted() const {
+  return m_numConnectionsAccepted.load(std::memory_order_relaxed);
+}
+
+void NNRemoteServer::reapConnectionsUnsynchronized(bool all) {
+  for(size_t i = 0; i<connections.size();) {
+    Connection* connection = connections[i];
+    if(all || connection->isDone.load()) {
+      connection->thread->join();
+      delete connection->thread;
+      delete connection;
+      connections.erase(connections.begin() + i);
+    }
+    else
+      i++;
+  }
+}
+
+void NNRemoteServer::acceptLoop() {
+  while(true) {
+    int fd = acceptSocket(listenFd);
+    if(isShuttingDown.load()) {
+      if(fd >= 0)
+        closeSocket(fd);
+      break;
+    }
+    if(fd < 0) {
+      logger->write("Nn server failed to accept connection, no longer accepting");
+      break;
+    }
+    m_numConnectionsAccepted.fetch_add(1, std::memory_order_relaxed);
+    Connection* connection = new Connection(fd);
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    reapConnectionsUnsynchronized(false);
+    connections.push_back(connection);
+    connection->thread = new std::thread(&NNRemoteServer::handleConnection,this,connection);
+  }
+}
+
+void NNRemoteServer::handleConnection(Connection* connection) {
+  int fd = connection->fd;
+
+  HelloMsg hello;
+  if(!recvFully(fd, &hello, sizeof(hello)) || hello.magic != PROTOCOL_MAGIC) {
+    connection->isDone.store(true);
+    return;
+  }
+  HelloReplyMsg reply;
+  memset(&reply, 0, sizeof(reply));
+  reply.magic = PROTOCOL_MAGIC;
+  reply.modelVersion = modelVersion;
+  assert(modelFileHash.size() < sizeof(reply.modelFileHash));
+  memcpy(reply.modelFileHash, modelFileHash.c_str(), modelFileHash.size());
+  string error;
+  if(hello.protocolVersion != PROTOCOL_VERSION)
+    error = "protocol version " + Global::intToString(hello.protocolVersion) + " but server has " + Global::intToString(PROTOCOL_VERSION);
+  else if(hello.nnXLen != nnXLen || hello.nnYLen != nnYLen)
+    error = "client nn board size " + Global::intToString(hello.nnXLen) + "x" + Global::intToString(hello.nnYLen) +
+      " but server has " + Global::intToString(nnXLen) + "x" + Global::intToString(nnYLen);
+  else if((hello.inputsUseNHWC != 0) != inputsUseNHWC)
+    error = "client and server disagree on inputsUseNHWC";
+  else if(hello.maxBatchSize <= 0 || hello.maxBatchSize > 65536)
+    error = "invalid client max batch size " + Global::intToString(hello.maxBatchSize);
+  reply.ok = error.size() <= 0 ? 1 : 0;
+  error = error.substr(0, sizeof(reply.error)-1);
+  memcpy(reply.error, error.c_str(), error.size());
+  if(!sendFully(fd, &reply, sizeof(reply)) || !reply.ok) {
+    connection->isDone.store(true);
+    return;
+  }
+
+  //Clients that only wanted to check on the server hang up here
+  AttachMsg attach;
+  if(!recvFully(fd, &attach, sizeof(attach))) {
+    connection->isDone.store(true);
+    return;
+  }
+  attach.memoryName[sizeof(attach.memoryName)-1] = '\0';
+  connection->layout = new NNRemote::Layout(hello.maxBatchSize, modelVersion, nnXLen, nnYLen);
+  AttachReplyMsg attachReply;
+  attachReply.ok = 1;
+  try {
+    //The client created and sized it, so don't let a client name anything else, and check that it's as big as the rows
+    //the client said it would send
+    connection->memory = new SharedMemory(string(attach.memoryName), connection->layout->totalBytes, true);
+  }
+  catch(const StringError& e) {
+    logger->write(string("Nn server could not attach client shared memory: ") + e.what());
+    attachReply.ok = 0;
+  }
+  if(!sendFully(fd, &attachReply, sizeof(attachReply)) || !attachReply.ok) {
+    connection->isDone.store(true);
+    return;
+  }
+
+  while(!isShuttingDown.load()) {
+    BatchMsg msg;
+    if(!recvFully(fd, &msg, sizeof(msg)))
+      break;
+    if(msg.numRows <= 0 || msg.numRows > connection->layout->maxRows) {
+      logger->write("Nn server got invalid batch of " + Global::intToString(msg.numRows) + " rows, disconnecting client");
+      break;
+    }
+    {
+      std::lock_guard<std::mutex> lock(connection->mutex);
+      connection->numRowsPending = msg.numRows;
+    }
+    for(int i = 0; i<msg.numRows; i++) {
+      Row row;
+      row.connection = connection;
+      row.rowIdx = i;
+      rowQueue->push(row);
+    }
+    {
+      std::unique_lock<std::mutex> lock(connection->mutex);
+      while(connection->numRowsPending > 0)
+        connection->rowsDone.wait(lock);
+    }
+    if(isShuttingDown.load())
+      break;
+    if(!sendFully(fd, &msg, sizeof(msg)))
+      break;
+  }
+  connection->isDone.store(true);
+}
+
+void NNRemoteServer::serve(int threadIdx) {
+  ComputeHandle* gpuHandle = NULL;
+  InputBuffers* inputBuffers = NULL;
+  if(!debugSkipNeuralNet) {
+    gpuHandle = NeuralNet::createComputeHandle(
+      computeContext,
+      loadedModel,
+      logger,
+      maxBatchSize,
+      nnXLen,
+      nnYLen,
+      requireExactNNLen,
+      inputsUseNHWC,
+      gpuIdxByServerThread[threadIdx],
+      useFP16,
+      useINT8,
+      cudaUseNHWC
+    );
+    inputBuffers = NeuralNet::createInputBuffers(loadedModel,maxBatchSize,nnXLen,nnYLen);
+  }
+  Rand rand(randSeed + ":NNRemoteServerThread:" + Global::intToString(threadIdx));
+
+  vector<Row> rows(maxBatchSize);
+  vector<shared_ptr<NNOutput>> outputs;
+  vector<NNOutput*> outputBuf;
+  while(true) {
+    int numRows = (int)rowQueue->waitPopBatch(rows.data(),maxBatchSize);
+    if(numRows <= 0)
+      break;
+
+    outputs.clear();
+    outputBuf.clear();
+    for(int i = 0; i<numRows; i++) {
+      const NNRemote::Layout& layout = *(rows[i].connection->layout);
+      const char* data = rows[i].connection->memory->data;
+      bool includeOwnerMap = ((const int32_t*)(data + layout.ownerMapFlagsOffset))[rows[i].rowIdx] != 0;
+      shared_ptr<NNOutput> output = NNOutputPool::makeShared();
+      output->nnXLen = nnXLen;
+      output->nnYLen = nnYLen;
+      output->whiteOwnerMap = includeOwnerMap ? NNOutputPool::allocOwnerMap() : NULL;
+      outputBuf.push_back(output.get());
+      outputs.push_back(std::move(output));
+    }
+
+    if(debugSkipNeuralNet) {
+      int policyLen = NNPos::getPolicySize(nnXLen,nnYLen);
+      for(int i = 0; i<numRows; i++) {
+        NNOutput* output = outputBuf[i];
+        for(int pos = 0; pos<policyLen; pos++)
+          output->policyProbs[pos] = rand.nextGaussian();
+        output->whiteWinProb = rand.nextGaussian() * 0.20;
+        output->whiteLossProb = rand.nextGaussian() * 0.20;
+        output->whiteNoResultProb = rand.nextGaussian() * 0.20;
+        output->whiteScoreMean = rand.nextGaussian() * 0.20;
+        output->whiteScoreMeanSq = rand.nextGaussian() * 0.20;
+        if(output->whiteOwnerMap != NULL) {
+          for(int pos = 0; pos<nnXLen*nnYLen; pos++)
+            output->whiteOwnerMap[pos] = rand.nextGaussian() * 0.20;
+        }
+      }
+    }
+    else {
+      int rowSpatialLen = NeuralNet::getBatchEltSpatialLen(inputBuffers);
+      int rowGlobalLen = NeuralNet::getBatchEltGlobalLen(inputBuffers);
+      for(int i = 0; i<numRows; i++) {
+        const NNRemote::Layout& layout = *(rows[i].connection->layout);
+        const char* data = rows[i].connection->memory->data;
+        assert(layout.rowSpatialLen == rowSpatialLen);
+        assert(layout.rowGlobalLen == rowGlobalLen);
+        const float* spatial = (const float*)(data + layout.spatialOffset) + (size_t)rows[i].rowIdx * rowSpatialLen;
+        const float* global = (const float*)(data + layout.globalOffset) + (size_t)rows[i].rowIdx * rowGlobalLen;
+        std::copy(spatial, spatial + rowSpatialLen, NeuralNet::getBatchEltSpatialInplace(inputBuffers,i));
+        std::copy(global, global + rowGlobalLen, NeuralNet::getBatchEltGlobalInplace(inputBuffers,i));
+      }
+
+      int symmetry = defaultSymmetry;
+      if(doRandomize)
+        symmetry = rand.nextUInt(NNInputs::NUM_SYMMETRY_COMBINATIONS);
+      bool* symmetriesBuffer = NeuralNet::getSymmetriesInplace(inputBuffers);
+      symmetriesBuffer[0] = (symmetry & 0x1) != 0;
+      symmetriesBuffer[1] = (symmetry & 0x2) != 0;
+      symmetriesBuffer[2] = (symmetry & 0x4) != 0;
+
+      NeuralNet::getOutput(gpuHandle, inputBuffers, numRows, outputBuf);
+    }
+
+    m_numRowsProcessed.fetch_add(numRows, std::memory_order_relaxed);
+    m_numBatchesProcessed.fetch_add(1, std::memory_order_relaxed);
+
+    for(int i = 0; i<numRows; i++) {
+      Connection* connection = rows[i].connection;
+      const NNRemote::Layout& layout = *(connection->layout);
+      float* out = (float*)(connection->memory->data + layout.outputsOffset) + (size_t)rows[i].rowIdx * layout.outputRowLen;
+      const NNOutput* output = outputBuf[i];
+      out[0] = output->whiteWinProb;
+      out[1] = output->whiteLossProb;
+      out[2] = output->whiteNoResultProb;
+      out[3] = output->whiteScoreMean;
+      out[4] = output->whiteScoreMeanSq;
+      std::copy(output->policyProbs, output->policyProbs + layout.policyLen, out + 5);
+      if(output->whiteOwnerMap != NULL)
+        std::copy(output->whiteOwnerMap, output->whiteOwnerMap + layout.ownerMapLen, out + 5 + layout.policyLen);
+
+      std::lock_guard<std::mutex> lock(connection->mutex);
+      connection->numRowsPending--;
+      if(connection->numRowsPending <= 0)
+        connection->rowsDone.notify_all();
+    }
+  }
+
+  if(inputBuffers != NULL)
+    NeuralNet::freeInputBuffers(inputBuffers);
+  if(gpuHandle != NULL)
+    NeuralNet::freeComputeHandle(gpuHandle);
+}
@@ -0,0 +1,197 @@
+#ifndef NEURALNET_NNREMOTE_H_
+#define NEURALNET_NNREMOTE_H_
+
+#include "../core/global.h"
+#include "../core/lockfreebatchqueue.h"
+#include "../core/logger.h"
+#include "../core/mmapfile.h"
+#include "../core/multithread.h"
+#include "../core/rand.h"
+#include "../neuralnet/nninputs.h"
+#include "../neuralnet/nninterface.h"
+
+//Neural net evaluation by a separate server process on the same machine, so that batches form across all the
+//processes using it rather than within each one, and only that process holds the model and gpus.
+//
+//Clients connect over a Unix domain socket, one connection per NNEvaluator server thread. Each connection has a
+//shared memory region holding one batch of model input rows and outputs, which the client creates and the server
+//maps. To evaluate, the client writes its rows there and sends their number over the socket, and the server replies
+//once it has written the outputs for all of them, in logits like NeuralNet::getOutput. The server evaluates rows
+//from all connections together, in batches of up to its own maxBatchSize.
+//Messages are fixed-size structs in native byte order, since both ends are on the same machine.
+//
+//Clients still encode the rows and postprocess the outputs themselves, and keep their own caches, so that the server
+//is oblivious of boards and only runs the net. The server chooses the symmetries, see NNRemoteServer.
+namespace NNRemote {
+  //Layout of a connection's shared memory, determined by what both ends agree on in the handshake
+  struct Layout {
+    int maxRows;
+    int rowSpatialLen;
+    int rowGlobalLen;
+    int policyLen;
+    int ownerMapLen;
+    int outputRowLen;
+
+    //In bytes from the start of the region
+    size_t ownerMapFlagsOffset;
+    size_t spatialOffset;
+    size_t globalOffset;
+    size_t outputsOffset;
+    size_t totalBytes;
+
+    Layout(int maxRows, int modelVersion, int nnXLen, int nnYLen);
+  };
+}
+
+//Client side connection, used by one thread at a time
+class NNRemoteConnection {
+ public:
+  ~NNRemoteConnection();
+  NNRemoteConnection(const NNRemoteConnection& other) = delete;
+  NNRemoteConnection& operator=(const NNRemoteConnection& other) = delete;
+
+  //Like NeuralNet::getOutput, for numRows consecutive rows of inputs laid out as NNEvaluator encodes them.
+  //Owner maps are filled in for the outputs that have one allocated. Throws StringError if the server goes away.
+  void getOutput(const float* rowsSpatial, const float* rowsGlobal, int numRows, std::vector<NNOutput*>& outputs);
+
+ private:
+  int fd;
+  SharedMemory* memory;
+  NNRemote::Layout layout;
+  int nnXLen;
+  int nnYLen;
+
+  NNRemoteConnection(int fd, SharedMemory* memory, const NNRemote::Layout& layout, int nnXLen, int nnYLen);
+  friend class NNRemoteClient;
+};
+
+class NNRemoteClient {
+ public:
+  //Connects once to the server listening at socketPath to check that it agrees on the board size and input layout,
+  //and to learn about its model. Throws StringError if there's no server or it doesn't agree.
+  NNRemoteClient(
+    const std::string& socketPath,
+    int nnXLen,
+    int nnYLen,
+    bool inputsUseNHWC,
+    int maxBatchSize,
+    Logger* logger
+  );
+  ~NNRemoteClient();
+
+  NNRemoteClient(const NNRemoteClient& other) = delete;
+  NNRemoteClient& operator=(const NNRemoteClient& other) = delete;
+
+  int getModelVersion() const;
+  //SHA256 of the server's model file as hex, or empty if it has none
+  const std::string& getModelFileHash() const;
+  const std::string& getSocketPath() const;
+
+  //A new connection with its own shared memory. Thread-safe.
+  NNRemoteConnection* connect();
+
+ private:
+  std::string socketPath;
+  int nnXLen;
+  int nnYLen;
+  bool inputsUseNHWC;
+  int maxBatchSize;
+  Logger* logger;
+  int modelVersion;
+  std::string modelFileHash;
+  std::atomic<uint64_t> numConnectionsMade;
+
+  //Opens a socket and does the first half of the handshake, returning the socket
+  int connectAndHello();
+};
+
+//The server end, see the nnserver subcommand. Rows from all connections go through one queue, from which
+//server threads take batches as NNEvaluator does, including waiting adaptively for them to fill, see
+//LockFreeBatchQueue. If debugSkipNeuralNet, no model is loaded and outputs are random, for testing.
+class NNRemoteServer {
+ public:
+  NNRemoteServer(
+    const std::string& socketPath,
+    const std::string& modelFileName,
+    Logger& logger,
+    int maxBatchSize,
+    int nnXLen,
+    int nnYLen,
+    bool requireExactNNLen,
+    bool inputsUseNHWC,
+    bool debugSkipNeuralNet,
+    int minBatchFill,
+    double maxBatchWaitMs,
+    const std::vector<int>& gpuIdxByServerThread,
+    bool doRandomize,
+    const std::string& randSeed,
+    int defaultSymmetry,
+    bool useFP16,
+    bool useINT8,
+    bool cudaUseNHWC,
+    const std::string& tuneFile //see NeuralNet::createComputeContext
+  );
+  //Disconnects all clients, which get errors on their next evaluation
+  ~NNRemoteServer();
+
+  NNRemoteServer(const NNRemoteServer& other) = delete;
+  NNRemoteServer& operator=(const NNRemoteServer& other) = delete;
+
+  int getModelVersion() const;
+
+  //Stats since construction
+  uint64_t numRowsProcessed() const;
+  uint64_t numBatchesProcessed() const;
+  uint64_t numConnectionsAccepted() const;
+
+ private:
+  struct Connection;
+  struct Row {
+    Connection* connection;
+    int rowIdx;
+  };
+
+  std::string socketPath;
+  std::string modelFileName;
+  Logger* logger;
+  int maxBatchSize;
+  int nnXLen;
+  int nnYLen;
+  bool requireExactNNLen;
+  bool inputsUseNHWC;
+  bool debugSkipNeuralNet;
+  std::vector<int> gpuIdxByServerThread;
+  bool doRandomize;
+  std::string randSeed;
+  int defaultSymmetry;
+  bool useFP16;
+  bool useINT8;
+  bool cudaUseNHWC;
+
+  ComputeContext* computeContext;
+  LoadedModel* loadedModel;
+  int modelVersion;
+  std::string modelFileHash;
+
+  LockFreeBatchQueue<Row>* rowQueue;
+  int listenFd;
+  std::atomic<bool> isShuttingDown;
+
+  std::mutex connectionsMutex;
+  std::vector<Connection*> connections;
+
+  std::thread* acceptThread;
+  std::vector<std::thread*> serverThreads;
+
+  std::atomic<uint64_t> m_numRowsProcessed;
+  std::atomic<uint64_t> m_numBatchesProcessed;
+  std::atomic<uint64_t> m_numConnectionsAccepted;
+
+  void acceptLoop();
+  void handleConnection(Connection* connection);
+  void serve(int threadIdx);
+  //Joins and frees connections whose clients have gone. Must hold connectionsMutex.
+  void reapConnectionsUnsynchronized(bool all);
+};
+
+#endif  // NEURALNET_NNREMOTE_H_
@@ -0,0 +1,317 @@
+#include "../neuralnet/nnservergroup.h"
+
+#include <map>
+
+using namespace std;
+
+//What one thread keeps for serving one evaluator
+struct NNServerGroup::ServerEntry {
+  NNServerBuf* buf;
+  ComputeHandle* gpuHandle;
+  bool hasGpuHandle;
+  Rand rand;
+
+  ServerEntry(NNServerBuf* b, const string& randSeed)
+    :buf(b),gpuHandle(NULL),hasGpuHandle(false),rand(randSeed)
+  {}
+  ~ServerEntry() {
+    if(hasGpuHandle)
+      NeuralNet::freeComputeHandle(gpuHandle);
+    delete buf;
+  }
+  ServerEntry(const ServerEntry& other) = delete;
+  ServerEntry& operator=(const ServerEntry& other) = delete;
+};
+
+struct NNServerGroup::ThreadState {
+  int threadIdx;
+  map<Member*,ServerEntry*> entries;
+  Member* lastMember;
+  //Where to start scanning members next, so that ties are broken round robin
+  size_t nextMemberIdx;
+
+  ThreadState(int idx)
+    :threadIdx(idx),entries(),lastMember(NULL),nextMemberIdx(0)
+  {}
+};
+
+NNServerGroup::NNServerGroup(
+  const vector<int>& gpuIdxByThread,
+  double maxBatchWaitMs,
+  Logger& lg
+)
+  :gpuIdxByServerThread(gpuIdxByThread),
+   maxBatchWait(
+     std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+       std::chrono::duration<double,std::milli>(std::max(maxBatchWaitMs,0.0))
+     )
+   ),
+   logger(&lg),
+   mutex(),
+   threadsCondVar(),
+   removalCondVar(),
+   members(),
+   isKilled(false),
+   numThreadsWaiting(0),
+   m_numBatches(0),
+   m_numEvaluatorSwitches(0),
+   serverThreads()
+{
+  if(gpuIdxByServerThread.size() <= 0)
+    throw StringError("NNServerGroup: must have at least one server thread");
+  for(int i = 0; i<gpuIdxByServerThread.size(); i++)
+    serverThreads.push_back(new std::thread(&NNServerGroup::serve,this,i));
+}
+
+NNServerGroup::~NNServerGroup() {
+  assert(members.size() == 0);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    isKilled = true;
+    threadsCondVar.notify_all();
+  }
+  for(size_t i = 0; i<serverThreads.size(); i++)
+    serverThreads[i]->join();
+  for(size_t i = 0; i<serverThreads.size(); i++)
+    delete serverThreads[i];
+  serverThreads.clear();
+}
+
+int NNServerGroup::getNumServerThreads() const {
+  return (int)gpuIdxByServerThread.size();
+}
+uint64_t NNServerGroup::numBatches() const {
+  return m_numBatches.load(std::memory_order_relaxed);
+}
+uint64_t NNServerGroup::numEvaluatorSwitches() const {
+  return m_numEvaluatorSwitches.load(std::memory_order_relaxed);
+}
+
+void NNServerGroup::addEvaluator(
+  NNEvaluator* nnEval, bool doRandomize, const string& randSeed, int defaultSymmetry,
+  bool useFP16, bool useINT8, bool cudaUseNHWC
+) {
+  Member* member = new Member();
+  member->nnEval = nnEval;
+  member->doRandomize = doRandomize;
+  member->randSeed = randSeed;
+  member->defaultSymmetry = defaultSymmetry;
+  member->useFP16 = useFP16;
+  member->useINT8 = useINT8;
+  member->cudaUseNHWC = cudaUseNHWC;
+  member->isRemoving = false;
+  member->numThreadsServing = 0;
+  member->numThreadsWithHandle = 0;
+  member->numHighPriorityBatchesInARow = 0;
+  member->hasWaitingRows = false;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for(size_t i = 0; i<members.size(); i++) {
+    if(members[i]->nnEval == nnEval) {
+      delete member;
+      throw StringError("NNServerGroup: evaluator added twice");
+    }
+  }
+  members.push_back(member);
+  //Rows may have been queued already
+  threadsCondVar.notify_all();
+}
+
+void NNServerGroup::removeEvaluator(NNEvaluator* nnEval) {
+  std::unique_lock<std::mutex> lock(mutex);
+  Member* member = NULL;
+  size_t memberIdx = 0;
+  for(size_t i = 0; i<members.size(); i++) {
+    if(members[i]->nnEval == nnEval) {
+      member = members[i];
+      memberIdx = i;
+    }
+  }
+  if(member == NULL)
+    throw StringError("NNServerGroup: removing evaluator that isn't in the group");
+
+  member->isRemoving = true;
+  //Threads free their handles for it before they next look for work
+  threadsCondVar.notify_all();
+  while(member->numThreadsServing > 0 || member->numThreadsWithHandle > 0)
+    removalCondVar.wait(lock);
+
+  members.erase(members.begin() + memberIdx);
+  delete member;
+}
+
+void NNServerGroup::notifyArrival() {
+  //Pairs with the increment of numThreadsWaiting before a thread looks for rows, so that either the thread finds
+  //the row just queued, or we see that it's going to wait and wake it. Taking the mutex makes sure that it's
+  //waiting by the time we notify.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(numThreadsWaiting.load(std::memory_order_relaxed) > 0) {
+    std::lock_guard<std::mutex> lock(mutex);
+    threadsCondVar.notify_one();
+  }
+}
+
+void NNServerGroup::releaseRemovedUnsynchronized(ThreadState& state) {
+  for(auto iter = state.entries.begin(); iter != state.entries.end();) {
+    Member* member = iter->first;
+    if(member->isRemoving) {
+      delete iter->second;
+      iter = state.entries.erase(iter);
+      member->numThreadsWithHandle--;
+      if(state.lastMember == member)
+        state.lastMember = NULL;
+      removalCondVar.notify_all();
+    }
+    else
+      ++iter;
+  }
+}
+
+NNServerGroup::Member* NNServerGroup::takeBatchUnsynchronized(
+  ThreadState& state, LockFreeBatchQueue<NNResultBuf*>*& queue, uint64_t& firstQueuePos, int& numRows,
+  std::chrono::steady_clock::time_point& wakeTime
+) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  wakeTime = std::chrono::steady_clock::time_point::max();
+  //How long rows waiting count for relative to how full the batch is
+  double waitScaleMs = std::max(std::chrono::duration<double,std::milli>(maxBatchWait).count(), 1.0);
+
+  Member* best = NULL;
+  size_t bestIdx = 0;
+  bool bestIsHighPriority = false;
+  double bestScore = -1.0;
+  size_t numMembers = members.size();
+  for(size_t k = 0; k<numMembers; k++) {
+    size_t idx = (state.nextMemberIdx + k) % numMembers;
+    Member* member = members[idx];
+    if(member->isRemoving)
+      continue;
+    int numHighPriority;
+    int numNormal;
+    member->nnEval->countQueuedRows(numHighPriority,numNormal);
+    if(numNormal <= 0)
+      member->hasWaitingRows = false;
+    else if(!member->hasWaitingRows) {
+      member->hasWaitingRows = true;
+      member->waitingSince = now;
+    }
+
+    //High priority rows go first, unless normal ones have been passed over too many times in a row
+    if(numHighPriority > 0 &&
+       (numNormal <= 0 || member->numHighPriorityBatchesInARow < NNEvaluator::MAX_HIGH_PRIORITY_BATCHES_IN_A_ROW)) {
+      best = member;
+      bestIdx = idx;
+      bestIsHighPriority = true;
+      break;
+    }
+    if(numNormal <= 0)
+      continue;
+
+    std::chrono::steady_clock::duration waited = now - member->waitingSince;
+    bool isReady =
+      numNormal >= member->nnEval->getMinBatchFill() ||
+      maxBatchWait <= std::chrono::steady_clock::duration::zero() ||
+      waited >= maxBatchWait;
+    if(!isReady) {
+      wakeTime = std::min(wakeTime, member->waitingSince + maxBatchWait);
+      continue;
+    }
+    double score =
+      (double)numNormal / member->nnEval->getMaxBatchSize() +
+      std::chrono::duration<double,std::milli>(waited).count() / waitScaleMs;
+    if(score > bestScore) {
+      best = member;
+      bestIdx = idx;
+      bestScore = score;
+    }
+  }
+  if(best == NULL)
+    return NULL;
+
+  state.nextMemberIdx = bestIdx + 1;
+  auto iter = state.entries.find(best);
+  ServerEntry* entry;
+  if(iter != state.entries.end())
+    entry = iter->second;
+  else {
+    entry = new ServerEntry(
+      best->nnEval->createServerBuf(),
+      best->randSeed + ":NNEvalServerThread:" + Global::intToString(state.threadIdx)
+    );
+    state.entries[best] = entry;
+    best->numThreadsWithHandle++;
+  }
+
+  numRows = best->nnEval->takeQueuedBatch(*(entry->buf),bestIsHighPriority,queue,firstQueuePos);
+  if(numRows <= 0)
+    return NULL;
+  if(bestIsHighPriority)
+    best->numHighPriorityBatchesInARow++;
+  else {
+    best->numHighPriorityBatchesInARow = 0;
+    //Any rows left over count as waiting from now on
+    best->hasWaitingRows = false;
+  }
+  return best;
+}
+
+void NNServerGroup::serve(int threadIdx) {
+  ThreadState state(threadIdx);
+  int gpuIdxForThisThread = gpuIdxByServerThread[threadIdx];
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    releaseRemovedUnsynchronized(state);
+    if(isKilled)
+      break;
+
+    LockFreeBatchQueue<NNResultBuf*>* queue = NULL;
+    uint64_t firstQueuePos = 0;
+    int numRows = 0;
+    std::chrono::steady_clock::time_point wakeTime;
+    //See notifyArrival
+    numThreadsWaiting.fetch_add(1, std::memory_order_seq_cst);
+    Member* member = takeBatchUnsynchronized(state,queue,firstQueuePos,numRows,wakeTime);
+    if(member == NULL) {
+      if(wakeTime == std::chrono::steady_clock::time_point::max())
+        threadsCondVar.wait(lock);
+      else
+        threadsCondVar.wait_until(lock,wakeTime);
+      numThreadsWaiting.fetch_sub(1, std::memory_order_relaxed);
+      continue;
+    }
+    numThreadsWaiting.fetch_sub(1, std::memory_order_relaxed);
+
+    member->numThreadsServing++;
+    ServerEntry* entry = state.entries[member];
+    if(state.lastMember != member) {
+      if(state.lastMember != NULL)
+        m_numEvaluatorSwitches.fetch_add(1, std::memory_order_relaxed);
+      state.lastMember = member;
+    }
+    lock.unlock();
+
+    if(!entry->hasGpuHandle) {
+      entry->gpuHandle = member->nnEval->createServerComputeHandle(
+        logger,gpuIdxForThisThread,member->useFP16,member->useINT8,member->cudaUseNHWC
+      );
+      entry->hasGpuHandle = true;
+    }
+    member->nnEval->serveBatch(
+      *(entry->buf),entry->gpuHandle,entry->rand,member->doRandomize,member->defaultSymmetry,queue,firstQueuePos,numRows
+    );
+    m_numBatches.fetch_add(1, std::memory_order_relaxed);
+
+    lock.lock();
+    member->numThreadsServing--;
+    if(member->isRemoving)
+      removalCondVar.notify_all();
+  }
+
+  for(auto iter = state.entries.begin(); iter != state.entries.end(); ++iter) {
+    delete iter->second;
+    iter->first->numThreadsWithHandle--;
+  }
+  state.entries.clear();
+  removalCondVar.notify_all();
+}
@@ -0,0 +1,103 @@
+#ifndef NEURALNET_NNSERVERGROUP_H_
+#define NEURALNET_NNSERVERGROUP_H_
+
+#include <chrono>
+
+#include "../core/global.h"
+#include "../core/logger.h"
+#include "../core/multithread.h"
+#include "../neuralnet/nneval.h"
+
+//One set of server threads shared by several NNEvaluators, typically for different models, instead of each having
+//threads of its own. Each evaluator keeps its own queues, caches and model, so that clients use it exactly as usual,
+//see NNEvaluator::joinServerGroup. The threads keep one compute handle per evaluator, made when they first serve it.
+//
+//Whenever a thread is free, it picks which evaluator's batch to run next. High priority rows go first, as for a
+//single evaluator. Otherwise the pick is the evaluator whose queue is fullest relative to a batch, plus how long its
+//rows have been waiting relative to maxBatchWaitMs, so that no evaluator starves. If maxBatchWaitMs > 0, a batch
+//with fewer rows than the minBatchFill of its evaluator is held back until it fills or has waited that long.
+//So with several models but limited traffic for each, the threads run fuller batches and spend less time idle
+//than with a separate set of threads per model.
+class NNServerGroup {
+ public:
+  NNServerGroup(
+    const std::vector<int>& gpuIdxByServerThread,
+    double maxBatchWaitMs,
+    Logger& logger
+  );
+  //All evaluators must have left the group first
+  ~NNServerGroup();
+
+  NNServerGroup(const NNServerGroup& other) = delete;
+  NNServerGroup& operator=(const NNServerGroup& other) = delete;
+
+  int getNumServerThreads() const;
+
+  //Stats since construction
+  //Number of batches run, and how many of them were for a different evaluator than the previous one on that thread
+  uint64_t numBatches() const;
+  uint64_t numEvaluatorSwitches() const;
+
+  //Helpers for NNEvaluator, for internal use only.
+  //removeEvaluator waits until no thread is running a batch for it and all their compute handles for it are freed.
+  void addEvaluator(
+    NNEvaluator* nnEval, bool doRandomize, const std::string& randSeed, int defaultSymmetry,
+    bool useFP16, bool useINT8, bool cudaUseNHWC
+  );
+  void removeEvaluator(NNEvaluator* nnEval);
+  //Called after every row queued for an evaluator in the group, wakes a waiting thread if there is one
+  void notifyArrival();
+
+ private:
+  struct Member {
+    NNEvaluator* nnEval;
+    bool doRandomize;
+    std::string randSeed;
+    int defaultSymmetry;
+    bool useFP16;
+    bool useINT8;
+    bool cudaUseNHWC;
+
+    //Everything below is protected by mutex
+    bool isRemoving;
+    //Threads currently running a batch for this, and threads holding a compute handle for it
+    int numThreadsServing;
+    int numThreadsWithHandle;
+    int numHighPriorityBatchesInARow;
+    //Since when rows have been waiting in the normal queue, if they have
+    bool hasWaitingRows;
+    std::chrono::steady_clock::time_point waitingSince;
+  };
+  struct ServerEntry;
+  struct ThreadState;
+
+  std::vector<int> gpuIdxByServerThread;
+  std::chrono::steady_clock::duration maxBatchWait;
+  Logger* logger;
+
+  std::mutex mutex;
+  //Threads wait on this for rows to arrive, and removeEvaluator for threads to be done with an evaluator
+  std::condition_variable threadsCondVar;
+  std::condition_variable removalCondVar;
+  std::vector<Member*> members;
+  bool isKilled;
+  //Number of threads between announcing that they will wait and waking, which notifyArrival checks without locking
+  std::atomic<int> numThreadsWaiting;
+
+  std::atomic<uint64_t> m_numBatches;
+  std::atomic<uint64_t> m_numEvaluatorSwitches;
+
+  std::vector<std::thread*> serverThreads;
+
+  void serve(int threadIdx);
+  //Picks a member with a batch to run right now and takes the batch, or returns NULL and sets wakeTime to
+  //when to try again if nothing changes. Must hold mutex.
+  Member* takeBatchUnsynchronized(
+    ThreadState& state, LockFreeBatchQueue<NNResultBuf*>*& queue, uint64_t& firstQueuePos, int& numRows,
+    std::chrono::steady_clock::time_point& wakeTime
+  );
+  //Frees the thread's compute handles for evaluators being removed. Must hold mutex.
+  void releaseRemovedUnsynchronized(ThreadState& state);
+};
+
+#endif  // NEURALNET_NNSERVERGROUP_H_
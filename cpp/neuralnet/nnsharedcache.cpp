@@ -0,0 +1,313 @@
+#include "../neuralnet/nnsharedcache.h"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+//Bump this whenever the layout of the region or of CompactNNOutput serialization changes
+static const uint32_t SHARED_CACHE_VERSION = 3;
+
+static const uint32_t STATE_UNINITIALIZED = 0;
+static const uint32_t STATE_INITIALIZING = 1;
+static const uint32_t STATE_READY = 2;
+//How long to wait for another process to finish initializing the region
+static const double MAX_INIT_WAIT_SECONDS = 10.0;
+
+struct NNSharedCache::Header {
+  std::atomic<uint32_t> state;
+  uint32_t version;
+  uint64_t regionBytes;
+  uint64_t numSets;
+  uint64_t slotWords;
+  char padding[32];
+};
+
+//Each slot is an array of 64-bit words, all accessed atomically since other processes may be writing them:
+static const int SLOT_SEQ = 0;        //Odd while being written
+static const int SLOT_TAG = 1;        //Model and settings the entry is for, 0 if empty
+static const int SLOT_KEY0 = 2;       //nnHash
+static const int SLOT_KEY1 = 3;
+static const int SLOT_INFO = 4;       //Serialized size in the low 32 bits, and whether there is an owner map
+static const int SLOT_REFERENCED = 5; //Set on hits, cleared as the clock hand passes
+static const int SLOT_STALL = 6;      //Low 32 bits of an odd SLOT_SEQ in the high bits, and when a writer first saw it
+static const int SLOT_CHECKSUM = 7;   //Of the tag, key, info and payload, written last
+static const int SLOT_PAYLOAD = 8;    //The serialized CompactNNOutput
+
+static const uint64_t INFO_HAS_OWNER_MAP = 1ULL << 32;
+//Enough for any CompactNNOutput, see CompactNNOutput::getMaxSerializedSize
+static const uint64_t MAX_PAYLOAD_WORDS = 256;
+
+static const int64_t HEADER_BYTES = 64;
+
+//A writer that was taken over may still be storing its own entry after the one that took over published, so readers
+//check that everything they copied out is from one write, and not only that the sequence number didn't change
+static uint64_t checksumOf(uint64_t slotTag, Hash128 nnHash, uint64_t info, const uint64_t* payload, uint64_t numWords) {
+  uint64_t h = Hash::murmurMix(slotTag ^ Hash::murmurMix(nnHash.hash0 ^ Hash::murmurMix(nnHash.hash1 ^ info)));
+  for(uint64_t i = 0; i<numWords; i++)
+    h = Hash::murmurMix(h ^ payload[i]);
+  return h;
+}
+
+//Milliseconds on a clock shared by all processes on the machine, wrapping around
+static uint32_t getSharedClockMs() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+NNSharedCache::NNSharedCache(
+  const string& name,
+  int64_t maxBytes,
+  Hash128 modelSalt,
+  int topK,
+  Logger* logger
+)
+  :memory(NULL),
+   numSets(0),
+   setMask(0),
+   slotWords(0),
+   tag(0),
+   policyTopK(topK),
+   numLookups(0),
+   numHits(0),
+   numInserts(0),
+   numContentions(0),
+   numTakeovers(0)
+{
+  static_assert(sizeof(Header) == HEADER_BYTES, "");
+  if(maxBytes < MIN_BYTES)
+    throw StringError("NNSharedCache: size must be at least " + Global::int64ToString(MIN_BYTES) + " bytes");
+  if(policyTopK < 0)
+    throw StringError("NNSharedCache: policyTopK is negative: " + Global::intToString(policyTopK));
+
+  //Never 0, which marks empty slots
+  tag = Hash::murmurMix(modelSalt.hash0 ^ Hash::murmurMix(modelSalt.hash1)) | 1;
+
+  memory = new SharedMemory(name, (size_t)maxBytes, false);
+  Header* header = (Header*)memory->data;
+
+  uint32_t expected = STATE_UNINITIALIZED;
+  if(header->state.compare_exchange_strong(expected, STATE_INITIALIZING)) {
+    //We created it, so lay it out. Slots are sized for this process's outputs on the largest board, which
+    //processes sharing it should all agree on, and padded to cache lines.
+    uint64_t payloadBytes = CompactNNOutput::getMaxSerializedSize(NNPos::MAX_BOARD_LEN, NNPos::MAX_BOARD_LEN, policyTopK);
+    uint64_t newSlotWords = (SLOT_PAYLOAD + (payloadBytes + 7) / 8 + 7) / 8 * 8;
+    uint64_t maxSets = ((uint64_t)maxBytes - HEADER_BYTES) / (NUM_WAYS * newSlotWords * 8);
+    uint64_t sets = 1;
+    while(sets * 2 <= maxSets)
+      sets *= 2;
+    header->version = SHARED_CACHE_VERSION;
+    header->regionBytes = (uint64_t)maxBytes;
+    header->numSets = sets;
+    header->slotWords = newSlotWords;
+    header->state.store(STATE_READY, std::memory_order_release);
+    if(logger != NULL)
+      logger->write(
+        "Created NN shared cache " + name + " with " + Global::uint64ToString(sets * NUM_WAYS) + " entries of " +
+        Global::uint64ToString(newSlotWords * 8) + " bytes"
+      );
+  }
+  else {
+    auto start = std::chrono::steady_clock::now();
+    while(header->state.load(std::memory_order_acquire) != STATE_READY) {
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if(elapsed > MAX_INIT_WAIT_SECONDS) {
+        delete memory;
+        throw StringError(
+          "NNSharedCache: timed out waiting for another process to initialize " + name +
+          ", if that process died, remove it with SharedMemory::remove or from /dev/shm"
+        );
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if(logger != NULL)
+      logger->write("Opened NN shared cache " + name);
+  }
+
+  if(header->version != SHARED_CACHE_VERSION || header->regionBytes != (uint64_t)maxBytes ||
+     header->numSets <= 0 || (header->numSets & (header->numSets - 1)) != 0 ||
+     HEADER_BYTES + header->numSets * NUM_WAYS * header->slotWords * 8 > (uint64_t)maxBytes ||
+     header->slotWords <= SLOT_PAYLOAD || header->slotWords - SLOT_PAYLOAD > MAX_PAYLOAD_WORDS) {
+    delete memory;
+    throw StringError("NNSharedCache: " + name + " was created by a different version or with different settings");
+  }
+  numSets = header->numSets;
+  setMask = numSets - 1;
+  slotWords = header->slotWords;
+}
+
+NNSharedCache::~NNSharedCache() {
+  delete memory;
+}
+
+std::atomic<uint64_t>* NNSharedCache::getSlot(uint64_t setIdx, int way) const {
+  uint64_t slotIdx = setIdx * NUM_WAYS + way;
+  return (std::atomic<uint64_t>*)(memory->data + HEADER_BYTES) + slotIdx * slotWords;
+}
+
+bool NNSharedCache::get(Hash128 nnHash, shared_ptr<NNOutput>& ret) {
+  numLookups.fetch_add(1, std::memory_order_relaxed);
+  ret = nullptr;
+  uint64_t maxPayloadBytes = (slotWords - SLOT_PAYLOAD) * 8;
+  uint64_t setIdx = nnHash.hash0 & setMask;
+  for(int way = 0; way<NUM_WAYS; way++) {
+    std::atomic<uint64_t>* slot = getSlot(setIdx, way);
+    uint64_t seq = slot[SLOT_SEQ].load(std::memory_order_acquire);
+    if(slot[SLOT_TAG].load(std::memory_order_relaxed) != tag ||
+       slot[SLOT_KEY0].load(std::memory_order_relaxed) != nnHash.hash0 ||
+       slot[SLOT_KEY1].load(std::memory_order_relaxed) != nnHash.hash1)
+      continue;
+    if(seq % 2 != 0) {
+      numContentions.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    uint64_t info = slot[SLOT_INFO].load(std::memory_order_relaxed);
+    uint64_t numBytes = info & 0xFFFFFFFFULL;
+    if(numBytes > maxPayloadBytes)
+      return false;
+
+    //Copy it out, then make sure nobody wrote the slot meanwhile
+    uint64_t buf[MAX_PAYLOAD_WORDS];
+    uint64_t numWords = (numBytes + 7) / 8;
+    for(uint64_t i = 0; i<numWords; i++)
+      buf[i] = slot[SLOT_PAYLOAD + i].load(std::memory_order_relaxed);
+    uint64_t checksum = slot[SLOT_CHECKSUM].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(slot[SLOT_SEQ].load(std::memory_order_relaxed) != seq ||
+       checksumOf(tag, nnHash, info, buf, numWords) != checksum) {
+      numContentions.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    try {
+      ret = CompactNNOutput::deserialize((const uint8_t*)buf, numBytes)->decompress();
+    }
+    catch(const StringError&) {
+      return false;
+    }
+    ret->nnHash = nnHash;
+    if(slot[SLOT_REFERENCED].load(std::memory_order_relaxed) == 0)
+      slot[SLOT_REFERENCED].store(1, std::memory_order_relaxed);
+    numHits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+void NNSharedCache::set(const NNOutput& p, int boardXSize, int boardYSize) {
+  uint64_t maxPayloadBytes = (slotWords - SLOT_PAYLOAD) * 8;
+  CompactNNOutput compact(p, boardXSize, boardYSize, policyTopK);
+  uint64_t numBytes = compact.getSerializedSize();
+  //Can only happen if the process that created the region had a smaller policyTopK
+  if(numBytes > maxPayloadBytes)
+    return;
+  bool hasOwnerMap = p.whiteOwnerMap != NULL;
+
+  //Pick the slot: the same position if it's already there, unless this one adds an owner map, otherwise an empty or
+  //stale one, otherwise the first one the clock hand finds that wasn't hit since it last passed.
+  uint64_t setIdx = p.nnHash.hash0 & setMask;
+  std::atomic<uint64_t>* victim = NULL;
+  std::atomic<uint64_t>* stale = NULL;
+  for(int way = 0; way<NUM_WAYS; way++) {
+    std::atomic<uint64_t>* slot = getSlot(setIdx, way);
+    uint64_t slotTag = slot[SLOT_TAG].load(std::memory_order_relaxed);
+    if(slotTag == tag &&
+       slot[SLOT_KEY0].load(std::memory_order_relaxed) == p.nnHash.hash0 &&
+       slot[SLOT_KEY1].load(std::memory_order_relaxed) == p.nnHash.hash1) {
+      if(!hasOwnerMap || (slot[SLOT_INFO].load(std::memory_order_relaxed) & INFO_HAS_OWNER_MAP) != 0)
+        return;
+      victim = slot;
+      break;
+    }
+    if(stale == NULL && slotTag != tag)
+      stale = slot;
+  }
+  if(victim == NULL)
+    victim = stale;
+  if(victim == NULL) {
+    for(int pass = 0; pass < 2 && victim == NULL; pass++) {
+      for(int way = 0; way<NUM_WAYS; way++) {
+        std::atomic<uint64_t>* slot = getSlot(setIdx, way);
+        if(slot[SLOT_REFERENCED].load(std::memory_order_relaxed) == 0) {
+          victim = slot;
+          break;
+        }
+        slot[SLOT_REFERENCED].store(0, std::memory_order_relaxed);
+      }
+    }
+    if(victim == NULL)
+      victim = getSlot(setIdx, (int)(p.nnHash.hash1 % NUM_WAYS));
+  }
+
+  //Claim it. If it's already claimed, and has stayed claimed at the same sequence number for too long, its writer
+  //presumably died partway, so take it over rather than leave it unusable.
+  uint64_t seq = victim[SLOT_SEQ].load(std::memory_order_relaxed);
+  uint64_t claimedSeq;
+  bool claimed;
+  if(seq % 2 == 0) {
+    claimedSeq = seq+1;
+    claimed = victim[SLOT_SEQ].compare_exchange_strong(seq, claimedSeq, std::memory_order_acquire);
+  }
+  else {
+    claimedSeq = seq+2;
+    claimed = false;
+    uint32_t now = getSharedClockMs();
+    uint64_t stall = victim[SLOT_STALL].load(std::memory_order_relaxed);
+    if((uint32_t)(stall >> 32) != (uint32_t)seq)
+      victim[SLOT_STALL].compare_exchange_strong(stall, ((uint64_t)(uint32_t)seq << 32) | now, std::memory_order_relaxed);
+    else if(now - (uint32_t)stall >= (uint32_t)STALLED_WRITE_MS) {
+      claimed = victim[SLOT_SEQ].compare_exchange_strong(seq, claimedSeq, std::memory_order_acquire);
+      if(claimed)
+        numTakeovers.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  if(!claimed) {
+    numContentions.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+
+  uint64_t buf[MAX_PAYLOAD_WORDS];
+  uint64_t numWords = (numBytes + 7) / 8;
+  buf[numWords-1] = 0;
+  compact.serialize((uint8_t*)buf);
+  uint64_t info = numBytes | (hasOwnerMap ? INFO_HAS_OWNER_MAP : 0);
+  victim[SLOT_TAG].store(tag, std::memory_order_relaxed);
+  victim[SLOT_KEY0].store(p.nnHash.hash0, std::memory_order_relaxed);
+  victim[SLOT_KEY1].store(p.nnHash.hash1, std::memory_order_relaxed);
+  victim[SLOT_INFO].store(info, std::memory_order_relaxed);
+  victim[SLOT_REFERENCED].store(1, std::memory_order_relaxed);
+  for(uint64_t i = 0; i<numWords; i++)
+    victim[SLOT_PAYLOAD + i].store(buf[i], std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  victim[SLOT_CHECKSUM].store(checksumOf(tag, p.nnHash, info, buf, numWords), std::memory_order_relaxed);
+
+  //Fails only if we stalled long enough to be taken over ourselves, in which case the new writer publishes
+  if(victim[SLOT_SEQ].compare_exchange_strong(claimedSeq, claimedSeq+1, std::memory_order_release))
+    numInserts.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t NNSharedCache::getNumLookups() const {
+  return numLookups.load(std::memory_order_relaxed);
+}
+uint64_t NNSharedCache::getNumHits() const {
+  return numHits.load(std::memory_order_relaxed);
+}
+uint64_t NNSharedCache::getNumInserts() const {
+  return numInserts.load(std::memory_order_relaxed);
+}
+uint64_t NNSharedCache::getNumContentions() const {
+  return numContentions.load(std::memory_order_relaxed);
+}
+uint64_t NNSharedCache::getNumTakeovers() const {
+  return numTakeovers.load(std::memory_order_relaxed);
+}
+void NNSharedCache::clearStats() {
+  numLookups.store(0);
+  numHits.store(0);
+  numInserts.store(0);
+  numContentions.store(0);
+  numTakeovers.store(0);
+}
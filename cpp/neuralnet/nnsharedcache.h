@@ -0,0 +1,82 @@
+#ifndef NEURALNET_NNSHAREDCACHE_H_
+#define NEURALNET_NNSHAREDCACHE_H_
+
+#include "../core/global.h"
+#include "../core/hash.h"
+#include "../core/logger.h"
+#include "../core/mmapfile.h"
+#include "../neuralnet/nninputs.h"
+
+//Cache of neural net outputs in shared memory, so that processes on the same machine evaluating the same model
+//share their evaluations instead of each doing them and keeping their own copies.
+//Sits between NNCacheTable and NNDiskCache: lookups that miss in the process's own table try here next.
+//
+//The region is a set-associative table of fixed-size slots, each holding a CompactNNOutput. Nothing takes a lock:
+//each slot has a sequence number that is odd while the slot is being written, and which readers check before and
+//after copying the slot out, missing if it changed. Writers claim a slot by bumping its sequence number, and skip
+//the insert if another writer has it. Replacement within a set is by the clock algorithm.
+//
+//A process dying partway through writing a slot leaves that one slot odd, and once other writers have seen it stay
+//that way for STALLED_WRITE_MS they take it over. Since a writer that was only stopped may resume and keep writing
+//after that, each slot also has a checksum written last, and readers miss unless what they copied matches it.
+//
+//Every slot is tagged with a hash of the model and other settings the output depends on, so that entries from
+//processes running a different net are never returned, and are the first to be replaced.
+class NNSharedCache {
+ public:
+  static const int NUM_WAYS = 4;
+  //Far longer than any write takes, unless the writer is stopped or dead
+  static const int STALLED_WRITE_MS = 1000;
+
+  //Opens the shared memory region with the given name, creating it with maxBytes if it doesn't exist yet.
+  //All processes sharing it must use the same size. Entries are stored with the given policyTopK, see CompactNNOutput.
+  NNSharedCache(
+    const std::string& name,
+    int64_t maxBytes,
+    Hash128 modelSalt,
+    int policyTopK,
+    Logger* logger
+  );
+  ~NNSharedCache();
+
+  NNSharedCache(const NNSharedCache& other) = delete;
+  NNSharedCache& operator=(const NNSharedCache& other) = delete;
+
+  //These are thread-safe, and safe with respect to other processes. For get, ret will be set to nullptr upon
+  //a failure to find. For set, the board size is that of the position that p is the output for.
+  bool get(Hash128 nnHash, std::shared_ptr<NNOutput>& ret);
+  void set(const NNOutput& p, int boardXSize, int boardYSize);
+
+  //Stats for this process since construction or the last clearStats
+  uint64_t getNumLookups() const;
+  uint64_t getNumHits() const;
+  uint64_t getNumInserts() const;
+  //Number of lookups and inserts given up because another process or thread was writing the same slot
+  uint64_t getNumContentions() const;
+  //Number of slots taken over from writers that stalled
+  uint64_t getNumTakeovers() const;
+  void clearStats();
+
+  static const int64_t MIN_BYTES = 1 << 20;
+
+ private:
+  struct Header;
+
+  SharedMemory* memory;
+  uint64_t numSets;
+  uint64_t setMask;
+  uint64_t slotWords;
+  //Distinguishes entries from different models and settings
+  uint64_t tag;
+  int policyTopK;
+
+  std::atomic<uint64_t> numLookups;
+  std::atomic<uint64_t> numHits;
+  std::atomic<uint64_t> numInserts;
+  std::atomic<uint64_t> numContentions;
+  std::atomic<uint64_t> numTakeovers;
+
+  std::atomic<uint64_t>* getSlot(uint64_t setIdx, int way) const;
+};
+
+#endif  // NEURALNET_NNSHAREDCACHE_H_
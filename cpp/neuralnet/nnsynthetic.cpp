@@ -0,0 +1,105 @@
+#include "../neuralnet/nnsynthetic.h"
+
+#include <cstring>
+#include "../core/hash.h"
+#include "../core/rand.h"
+
+using namespace std;
+
+static std::chrono::steady_clock::duration msToDuration(double ms) {
+  return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double,std::milli>(ms));
+}
+
+NNSyntheticBackend::NNSyntheticBackend(int numDev, double batchLatencyMs, double rowLatencyMs, int xLen, int yLen)
+  :numDevices(numDev),
+   batchLatency(msToDuration(batchLatencyMs)),
+   rowLatency(msToDuration(rowLatencyMs)),
+   nnXLen(xLen),
+   nnYLen(yLen),
+   mutex(),
+   deviceFree(),
+   numDevicesFree(numDev),
+   m_numBatches(0),
+   m_totalBusyNs(0),
+   m_totalDeviceWaitNs(0)
+{
+  if(numDevices <= 0)
+    throw StringError("NNSyntheticBackend: numDevices must be positive: " + Global::intToString(numDevices));
+  if(batchLatencyMs < 0 || rowLatencyMs < 0)
+    throw StringError("NNSyntheticBackend: latencies must be nonnegative");
+}
+
+NNSyntheticBackend::~NNSyntheticBackend()
+{}
+
+uint64_t NNSyntheticBackend::numBatches() const {
+  return m_numBatches.load(std::memory_order_relaxed);
+}
+double NNSyntheticBackend::totalBusyMs() const {
+  return m_totalBusyNs.load(std::memory_order_relaxed) / 1e6;
+}
+double NNSyntheticBackend::totalDeviceWaitMs() const {
+  return m_totalDeviceWaitNs.load(std::memory_order_relaxed) / 1e6;
+}
+
+static uint64_t hashFloats(const float* data, int len, uint64_t hash) {
+  for(int i = 0; i<len; i++) {
+    uint32_t bits;
+    std::memcpy(&bits, data + i, sizeof(uint32_t));
+    hash = Hash::murmurMix(hash ^ bits);
+  }
+  return hash;
+}
+
+void NNSyntheticBackend::getOutput(
+  const float* rowsSpatial, int rowSpatialLen, const float* rowsGlobal, int rowGlobalLen,
+  int numRows, vector<NNOutput*>& outputs
+) {
+  assert(outputs.size() == numRows);
+  std::chrono::steady_clock::time_point queuedTime = std::chrono::steady_clock::now();
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(numDevicesFree <= 0)
+      deviceFree.wait(lock);
+    numDevicesFree--;
+  }
+  std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+  int policySize = NNPos::getPolicySize(nnXLen,nnYLen);
+  for(int row = 0; row<numRows; row++) {
+    uint64_t hash = 0x53594e5448455449ULL;
+    hash = hashFloats(rowsSpatial + (size_t)row * rowSpatialLen, rowSpatialLen, hash);
+    hash = hashFloats(rowsGlobal + (size_t)row * rowGlobalLen, rowGlobalLen, hash);
+    Rand rand(hash);
+
+    //Logits, same scale as for debugSkipNeuralNet
+    NNOutput* output = outputs[row];
+    for(int i = 0; i<policySize; i++)
+      output->policyProbs[i] = rand.nextGaussian();
+    output->whiteWinProb = rand.nextGaussian() * 0.20;
+    output->whiteLossProb = rand.nextGaussian() * 0.20;
+    output->whiteNoResultProb = rand.nextGaussian() * 0.20;
+    output->whiteScoreMean = rand.nextGaussian() * 0.20;
+    output->whiteScoreMeanSq = rand.nextGaussian() * 0.20;
+    if(output->whiteOwnerMap != NULL) {
+      for(int i = 0; i<nnXLen*nnYLen; i++)
+        output->whiteOwnerMap[i] = rand.nextGaussian() * 0.20;
+    }
+  }
+
+  std::this_thread::sleep_until(startTime + batchLatency + rowLatency * numRows);
+  std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    numDevicesFree++;
+    deviceFree.notify_one();
+  }
+
+  m_numBatches.fetch_add(1, std::memory_order_relaxed);
+  m_totalBusyNs.fetch_add(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count(), std::memory_order_relaxed
+  );
+  m_totalDeviceWaitNs.fetch_add(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(startTime - queuedTime).count(), std::memory_order_relaxed
+  );
+}
@@ -0,0 +1,54 @@
+#ifndef NEURALNET_NNSYNTHETIC_H_
+#define NEURALNET_NNSYNTHETIC_H_
+
+#include <chrono>
+
+#include "../core/global.h"
+#include "../core/multithread.h"
+#include "../neuralnet/nninputs.h"
+
+//Stands in for a neural net on a gpu, for benchmarking batching, server thread counts and search thread counts
+//on machines without one. Unlike debugSkipNeuralNet, evaluators using this encode rows and queue them exactly as
+//for a real net, and each batch takes as long as batchLatencyMs + rowLatencyMs * numRows. At most numDevices
+//batches run at once, further ones wait for a device to be free, as server threads sharing a gpu would.
+//
+//Outputs are pseudo-random but deterministic, from a hash of the input row, so the same position always gets the
+//same evaluation whatever batch it's in. Symmetries are ignored, as if the net were perfectly symmetric.
+class NNSyntheticBackend {
+ public:
+  NNSyntheticBackend(int numDevices, double batchLatencyMs, double rowLatencyMs, int nnXLen, int nnYLen);
+  ~NNSyntheticBackend();
+
+  NNSyntheticBackend(const NNSyntheticBackend& other) = delete;
+  NNSyntheticBackend& operator=(const NNSyntheticBackend& other) = delete;
+
+  //Like NeuralNet::getOutput, for numRows consecutive rows of inputs laid out as NNEvaluator encodes them.
+  //Owner maps are filled in for the outputs that have one allocated. Threadsafe.
+  void getOutput(
+    const float* rowsSpatial, int rowSpatialLen, const float* rowsGlobal, int rowGlobalLen,
+    int numRows, std::vector<NNOutput*>& outputs
+  );
+
+  //Stats since construction
+  uint64_t numBatches() const;
+  //Total time that batches spent running and waiting for a device
+  double totalBusyMs() const;
+  double totalDeviceWaitMs() const;
+
+ private:
+  int numDevices;
+  std::chrono::steady_clock::duration batchLatency;
+  std::chrono::steady_clock::duration rowLatency;
+  int nnXLen;
+  int nnYLen;
+
+  std::mutex mutex;
+  std::condition_variable deviceFree;
+  int numDevicesFree;
+
+  std::atomic<uint64_t> m_numBatches;
+  std::atomic<uint64_t> m_totalBusyNs;
+  std::atomic<uint64_t> m_totalDeviceWaitNs;
+};
+
+#endif  // NEURALNET_NNSYNTHETIC_H_
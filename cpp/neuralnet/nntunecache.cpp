@@ -0,0 +1,94 @@
+#include "../neuralnet/nntunecache.h"
+
+#include <cstdlib>
+#include <fstream>
+
+#include "../core/makedir.h"
+
+using namespace std;
+
+NNTuneCache::NNTuneCache(const string& f, Logger* lg)
+  :file(f),logger(lg),entries(),mutex(),warnedWriteFailed(false)
+{
+  ifstream in(file);
+  if(!in.good())
+    return;
+  string line;
+  while(getline(in,line)) {
+    //A line cut short by a process dying partway through appending it has the next append run onto it, which makes
+    //a key that is never looked up, so it does no harm
+    line = Global::trim(line);
+    size_t space = line.find(' ');
+    if(space == string::npos)
+      continue;
+    string key = Global::trim(line.substr(space+1));
+    if(key.size() <= 0)
+      continue;
+    entries[key] = line.substr(0,space);
+  }
+  if(logger != NULL)
+    logger->write("Loaded " + Global::uint64ToString(entries.size()) + " neural net tuning results from " + file);
+}
+
+NNTuneCache::~NNTuneCache() {
+}
+
+bool NNTuneCache::get(const string& key, string& value) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto iter = entries.find(key);
+  if(iter == entries.end())
+    return false;
+  value = iter->second;
+  return true;
+}
+
+void NNTuneCache::set(const string& key, const string& value) {
+  assert(key.size() > 0 && key.find('\n') == string::npos);
+  assert(value.size() > 0 && value.find(' ') == string::npos && value.find('\n') == string::npos);
+  std::lock_guard<std::mutex> lock(mutex);
+  entries[key] = value;
+
+  size_t slash = file.find_last_of("/\\");
+  if(slash != string::npos && slash > 0) {
+    try {
+      MakeDir::make(file.substr(0,slash));
+    }
+    catch(const StringError&) {
+      //Reported below, when opening the file fails
+    }
+  }
+  ofstream out(file, ios::app);
+  out << value << " " << key << "\n";
+  out.close();
+  if(out.fail() && !warnedWriteFailed) {
+    warnedWriteFailed = true;
+    if(logger != NULL)
+      logger->write("WARNING: could not write neural net tuning results to " + file + ", they will be redone next time");
+  }
+}
+
+const string& NNTuneCache::getFile() const {
+  return file;
+}
+
+string NNTuneCache::defaultFile() {
+#ifdef _WIN32
+  const char* home = getenv("USERPROFILE");
+#else
+  const char* home = getenv("HOME");
+#endif
+  if(home == NULL || string(home).size() <= 0)
+    return string();
+  return string(home) + "/.katago/tuning.txt";
+}
+
+string NNTuneCache::getCpuName() {
+  ifstream in("/proc/cpuinfo");
+  string line;
+  while(in.good() && getline(in,line)) {
+    size_t colon = line.find(':');
+    if(colon != string::npos && Global::trim(line.substr(0,colon)) == "model name")
+      return Global::trim(line.substr(colon+1));
+  }
+  return "unknown";
+}
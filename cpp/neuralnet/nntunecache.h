@@ -0,0 +1,46 @@
+#ifndef NEURALNET_NNTUNECACHE_H_
+#define NEURALNET_NNTUNECACHE_H_
+
+#include <map>
+
+#include "../core/global.h"
+#include "../core/logger.h"
+#include "../core/multithread.h"
+
+//Winners of the kernel autotuning that the backends do in createComputeHandle, persisted in a text file so that
+//later startups on the same machine reuse them instead of benchmarking again.
+//
+//Each line of the file is "value key". The key names everything the winner depends on - the backend, the cpu,
+//the layer shape, and the batch and board size - and the value is the winning kernel, in the backend's own
+//terms. Lines are only ever appended and the last one for a key wins, so several processes tuning into the same
+//file at once at worst repeat each other's work.
+class NNTuneCache {
+ public:
+  //Reads the file if it exists. It and its directory are created on the first set.
+  NNTuneCache(const std::string& file, Logger* logger);
+  ~NNTuneCache();
+
+  NNTuneCache(const NNTuneCache& other) = delete;
+  NNTuneCache& operator=(const NNTuneCache& other) = delete;
+
+  //These are thread-safe. Keys must be non-empty and values a single word, and neither may contain newlines.
+  bool get(const std::string& key, std::string& value) const;
+  //If the file can't be written, logs a warning once and keeps value in memory only
+  void set(const std::string& key, const std::string& value);
+
+  const std::string& getFile() const;
+
+  //tuning.txt in the .katago directory in the user's home directory, or empty if there is no home directory
+  static std::string defaultFile();
+  //The model name of the cpu as the OS reports it, or "unknown", for keying results of cpu kernels
+  static std::string getCpuName();
+
+ private:
+  std::string file;
+  Logger* logger;
+  std::map<std::string,std::string> entries;
+  mutable std::mutex mutex;
+  bool warnedWriteFailed;
+};
+
+#endif  // NEURALNET_NNTUNECACHE_H_
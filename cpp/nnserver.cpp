@@ -0,0 +1,182 @@
+#include "core/global.h"
+#include "core/config_parser.h"
+#include "core/timer.h"
+#include "neuralnet/nnremote.h"
+#include "program/setup.h"
+#include "main.h"
+
+using namespace std;
+
+#define TCLAP_NAMESTARTSTRING "-" //Use single dashes for all flags
+#include <tclap/CmdLine.h>
+
+#include <csignal>
+static std::atomic<bool> sigReceived(false);
+static void signalHandler(int signal)
+{
+  if(signal == SIGINT || signal == SIGTERM)
+    sigReceived.store(true);
+}
+
+int MainCmds::nnserver(int argc, const char* const* argv) {
+  Board::initHash();
+  Rand seedRand;
+
+  string configFile;
+  string modelFile;
+  string socketPath;
+  string logFile;
+  try {
+    TCLAP::CmdLine cmd("Run a neural net for other processes on this machine, see nnServerSocket in their configs", ' ', Version::getKataGoVersionForHelp(),true);
+    TCLAP::ValueArg<string> configFileArg("","config-file","Config file to use (see configs/nnserver_example.cfg)",true,string(),"FILE");
+    TCLAP::ValueArg<string> modelFileArg("","model-file","Neural net model file",true,string(),"FILE");
+    TCLAP::ValueArg<string> socketArg("","socket","Unix domain socket to listen at, overriding nnServerSocket in the config",false,string(),"FILE");
+    TCLAP::ValueArg<string> logFileArg("","log-file","Log file to output to",true,string(),"FILE");
+    cmd.add(configFileArg);
+    cmd.add(modelFileArg);
+    cmd.add(socketArg);
+    cmd.add(logFileArg);
+    cmd.parse(argc,argv);
+    configFile = configFileArg.getValue();
+    modelFile = modelFileArg.getValue();
+    socketPath = socketArg.getValue();
+    logFile = logFileArg.getValue();
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+  ConfigParser cfg(configFile);
+
+  Logger logger;
+  logger.addFile(logFile);
+  bool logToStdout = cfg.getBool("logToStdout");
+  logger.setLogToStdout(logToStdout);
+
+  logger.write("NN server starting...");
+  logger.write(string("Git revision: ") + Version::getGitRevision());
+
+  if(socketPath == string())
+    socketPath = cfg.getString("nnServerSocket");
+
+  //These must match those of every client, see maxBoardSizeForNNBuffer and inputsUseNHWC in their configs
+  int nnXLen = NNPos::MAX_BOARD_LEN;
+  int nnYLen = NNPos::MAX_BOARD_LEN;
+  if(cfg.contains("maxBoardXSizeForNNBuffer"))
+    nnXLen = cfg.getInt("maxBoardXSizeForNNBuffer", 7, NNPos::MAX_BOARD_LEN);
+  else if(cfg.contains("maxBoardSizeForNNBuffer"))
+    nnXLen = cfg.getInt("maxBoardSizeForNNBuffer", 7, NNPos::MAX_BOARD_LEN);
+  if(cfg.contains("maxBoardYSizeForNNBuffer"))
+    nnYLen = cfg.getInt("maxBoardYSizeForNNBuffer", 7, NNPos::MAX_BOARD_LEN);
+  else if(cfg.contains("maxBoardSizeForNNBuffer"))
+    nnYLen = cfg.getInt("maxBoardSizeForNNBuffer", 7, NNPos::MAX_BOARD_LEN);
+  bool requireExactNNLen = cfg.contains("requireMaxBoardSize") ? cfg.getBool("requireMaxBoardSize") : false;
+  bool inputsUseNHWC = cfg.contains("inputsUseNHWC") ? cfg.getBool("inputsUseNHWC") : true;
+  bool debugSkipNeuralNet = cfg.contains("debugSkipNeuralNet") ? cfg.getBool("debugSkipNeuralNet") : false;
+
+  int maxBatchSize = cfg.getInt("nnMaxBatchSize", 1, 65536);
+  int minBatchFill = cfg.contains("nnMinBatchFill") ? cfg.getInt("nnMinBatchFill",1,65536) : 1;
+  double maxBatchWaitMs = cfg.contains("nnMaxBatchWaitMs") ? cfg.getDouble("nnMaxBatchWaitMs",0.0,10000.0) : 0.0;
+  if(minBatchFill > maxBatchSize)
+    minBatchFill = maxBatchSize;
+
+  int numNNServerThreads = cfg.getInt("numNNServerThreadsPerModel",1,1024);
+  vector<int> gpuIdxByServerThread;
+  for(int j = 0; j<numNNServerThreads; j++) {
+    string threadIdxStr = Global::intToString(j);
+    if(cfg.contains("gpuToUseThread"+threadIdxStr))
+      gpuIdxByServerThread.push_back(cfg.getInt("gpuToUseThread"+threadIdxStr,0,1023));
+    else if(cfg.contains("cudaGpuToUseThread"+threadIdxStr))
+      gpuIdxByServerThread.push_back(cfg.getInt("cudaGpuToUseThread"+threadIdxStr,0,1023));
+    else if(cfg.contains("gpuToUse"))
+      gpuIdxByServerThread.push_back(cfg.getInt("gpuToUse",0,1023));
+    else if(cfg.contains("cudaGpuToUse"))
+      gpuIdxByServerThread.push_back(cfg.getInt("cudaGpuToUse",0,1023));
+    else
+      gpuIdxByServerThread.push_back(0);
+  }
+
+  bool useFP16 = false;
+  if(cfg.contains("useFP16"))
+    useFP16 = cfg.getBool("useFP16");
+  else if(cfg.contains("cudaUseFP16"))
+    useFP16 = cfg.getBool("cudaUseFP16");
+  bool useINT8 = cfg.contains("useINT8") ? cfg.getBool("useINT8") : false;
+  bool cudaUseNHWC = cfg.contains("cudaUseNHWC") ? cfg.getBool("cudaUseNHWC") : false;
+  string tuneFile = Setup::loadTuneFile(cfg);
+
+  bool nnRandomize = cfg.getBool("nnRandomize");
+  string nnRandSeed;
+  if(cfg.contains("nnRandSeed"))
+    nnRandSeed = cfg.getString("nnRandSeed");
+  else
+    nnRandSeed = Global::uint64ToString(seedRand.nextUInt64());
+  logger.write("nnRandSeed = " + nnRandSeed);
+
+  double statsIntervalSeconds = cfg.contains("statsIntervalSeconds") ? cfg.getDouble("statsIntervalSeconds",1.0,1e7) : 60.0;
+
+  Setup::initializeSession(cfg);
+
+  //Check for unused config keys
+  cfg.warnUnusedKeys(cerr,&logger);
+
+  if(!std::atomic_is_lock_free(&sigReceived))
+    throw StringError("sigReceived is not lock free, signal-quitting mechanism for terminating nn server will NOT work!");
+  std::signal(SIGINT, signalHandler);
+  std::signal(SIGTERM, signalHandler);
+
+  NNRemoteServer* server = new NNRemoteServer(
+    socketPath,
+    modelFile,
+    logger,
+    maxBatchSize,
+    nnXLen,
+    nnYLen,
+    requireExactNNLen,
+    inputsUseNHWC,
+    debugSkipNeuralNet,
+    minBatchFill,
+    maxBatchWaitMs,
+    gpuIdxByServerThread,
+    nnRandomize,
+    nnRandSeed,
+    0, //defaultSymmetry
+    useFP16,
+    useINT8,
+    cudaUseNHWC,
+    tuneFile
+  );
+  if(!logToStdout)
+    cout << "NN server listening at " << socketPath << endl;
+
+  ClockTimer timer;
+  double lastStatsTime = 0.0;
+  uint64_t lastNumRows = 0;
+  uint64_t lastNumBatches = 0;
+  while(!sigReceived.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    double now = timer.getSeconds();
+    if(now - lastStatsTime < statsIntervalSeconds && !sigReceived.load())
+      continue;
+    uint64_t numRows = server->numRowsProcessed();
+    uint64_t numBatches = server->numBatchesProcessed();
+    uint64_t deltaRows = numRows - lastNumRows;
+    uint64_t deltaBatches = numBatches - lastNumBatches;
+    logger.write(
+      "NN server connections " + Global::uint64ToString(server->numConnectionsAccepted()) +
+      " rows " + Global::uint64ToString(numRows) +
+      " batches " + Global::uint64ToString(numBatches) +
+      " rows/s " + Global::doubleToString(deltaRows / std::max(now - lastStatsTime, 1e-3)) +
+      " avg batch size " + Global::doubleToString(deltaBatches > 0 ? (double)deltaRows / deltaBatches : 0.0)
+    );
+    lastStatsTime = now;
+    lastNumRows = numRows;
+    lastNumBatches = numBatches;
+  }
+
+  logger.write("NN server shutting down, disconnecting clients");
+  delete server;
+  NeuralNet::globalCleanup();
+  logger.write("All cleaned up, quitting");
+  return 0;
+}
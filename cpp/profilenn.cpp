@@ -0,0 +1,208 @@
+#include "core/global.h"
+#include "core/rand.h"
+#include "core/timer.h"
+#include "neuralnet/modelversion.h"
+#include "neuralnet/nninterface.h"
+#include "neuralnet/nntunecache.h"
+#include "main.h"
+
+#include <fstream>
+
+using namespace std;
+
+#define TCLAP_NAMESTARTSTRING "-" //Use single dashes for all flags
+#include <tclap/CmdLine.h>
+
+//Fills the input buffers with positions from random play, so that the net sees roughly the sparsity of real games
+static void fillRandomPlayInputs(
+  InputBuffers* inputBuffers, int modelVersion, int nnXLen, int nnYLen, int batchSize, Rand& rand
+) {
+  const int inputsVersion = NNModelVersion::getInputsVersion(modelVersion);
+  const Rules rules = Rules::getTrompTaylorish();
+  const double drawEquivalentWinsForWhite = 0.5;
+  const bool useNHWC = true;
+  for(int i = 0; i<batchSize; i++) {
+    Board board(nnXLen,nnYLen);
+    Player pla = P_BLACK;
+    BoardHistory hist(board,pla,rules,0);
+    int numMoves = (int)rand.nextUInt(nnXLen * nnYLen);
+    for(int m = 0; m<numMoves && !hist.isGameFinished; m++) {
+      Loc loc = Board::PASS_LOC;
+      for(int attempt = 0; attempt<20; attempt++) {
+        Loc candidate = Location::getLoc(rand.nextUInt(nnXLen),rand.nextUInt(nnYLen),board.x_size);
+        if(hist.isLegal(board,candidate,pla)) {
+          loc = candidate;
+          break;
+        }
+      }
+      hist.makeBoardMoveAssumeLegal(board,loc,pla,NULL);
+      pla = getOpp(pla);
+    }
+
+    float* rowSpatial = NeuralNet::getBatchEltSpatialInplace(inputBuffers,i);
+    float* rowGlobal = NeuralNet::getBatchEltGlobalInplace(inputBuffers,i);
+    std::fill(rowSpatial, rowSpatial + NeuralNet::getBatchEltSpatialLen(inputBuffers), 0.0f);
+    std::fill(rowGlobal, rowGlobal + NeuralNet::getBatchEltGlobalLen(inputBuffers), 0.0f);
+    static_assert(NNModelVersion::latestInputsVersionImplemented == 5, "");
+    if(inputsVersion == 3)
+      NNInputs::fillRowV3(board,hist,pla,drawEquivalentWinsForWhite,nnXLen,nnYLen,useNHWC,rowSpatial,rowGlobal);
+    else if(inputsVersion == 4)
+      NNInputs::fillRowV4(board,hist,pla,drawEquivalentWinsForWhite,nnXLen,nnYLen,useNHWC,rowSpatial,rowGlobal);
+    else if(inputsVersion == 5)
+      NNInputs::fillRowV5(board,hist,pla,drawEquivalentWinsForWhite,nnXLen,nnYLen,useNHWC,rowSpatial,rowGlobal);
+    else
+      ASSERT_UNREACHABLE;
+  }
+}
+
+int MainCmds::profilenn(int argc, const char* const* argv) {
+  Board::initHash();
+  Rand seedRand;
+
+  string modelFile;
+  int batchSize;
+  int numBatches;
+  int boardSize;
+  int gpuIdx;
+  bool useFP16;
+  bool useINT8;
+  bool cudaUseNHWC;
+  string tuneFile;
+  string format;
+  string outputFile;
+  try {
+    TCLAP::CmdLine cmd("Time each residual block and head of a neural net in the current backend", ' ', Version::getKataGoVersionForHelp(),true);
+    TCLAP::ValueArg<string> modelFileArg("","model","Neural net model file",true,string(),"FILE");
+    TCLAP::ValueArg<int> batchSizeArg("","batch-size","Batch size to run (default 8)",false,8,"N");
+    TCLAP::ValueArg<int> numBatchesArg("","num-batches","Number of batches to time, after one untimed (default 20)",false,20,"N");
+    TCLAP::ValueArg<int> boardSizeArg("","board-size","Board size for the net (default 19)",false,19,"SIZE");
+    TCLAP::ValueArg<int> gpuIdxArg("","gpu","Gpu to use (default 0)",false,0,"IDX");
+    TCLAP::SwitchArg useFP16Arg("","fp16","Use fp16, for backends that support it");
+    TCLAP::SwitchArg useINT8Arg("","int8","Use int8, for backends that support it");
+    TCLAP::SwitchArg cudaUseNHWCArg("","cuda-nhwc","Use NHWC layout in the CUDA backend");
+    TCLAP::ValueArg<string> tuneFileArg("","tune-file","File of autotuning results to use and add to (default as for nnTuneFile)",false,string(),"FILE");
+    TCLAP::SwitchArg noAutoTuneArg("","no-autotune","Use the backend's default kernels instead of autotuning them, as for nnAutoTune = false");
+    TCLAP::ValueArg<string> formatArg("","format","table, or trace for Chrome trace event json (default table)",false,"table","FORMAT");
+    TCLAP::ValueArg<string> outputFileArg("","output","File to write to instead of stdout",false,string(),"FILE");
+    cmd.add(modelFileArg);
+    cmd.add(batchSizeArg);
+    cmd.add(numBatchesArg);
+    cmd.add(boardSizeArg);
+    cmd.add(gpuIdxArg);
+    cmd.add(useFP16Arg);
+    cmd.add(useINT8Arg);
+    cmd.add(cudaUseNHWCArg);
+    cmd.add(tuneFileArg);
+    cmd.add(noAutoTuneArg);
+    cmd.add(formatArg);
+    cmd.add(outputFileArg);
+    cmd.parse(argc,argv);
+    modelFile = modelFileArg.getValue();
+    batchSize = batchSizeArg.getValue();
+    numBatches = numBatchesArg.getValue();
+    boardSize = boardSizeArg.getValue();
+    gpuIdx = gpuIdxArg.getValue();
+    useFP16 = useFP16Arg.getValue();
+    useINT8 = useINT8Arg.getValue();
+    cudaUseNHWC = cudaUseNHWCArg.getValue();
+    if(noAutoTuneArg.getValue())
+      tuneFile = string();
+    else if(tuneFileArg.isSet())
+      tuneFile = tuneFileArg.getValue();
+    else
+      tuneFile = NNTuneCache::defaultFile();
+    format = formatArg.getValue();
+    outputFile = outputFileArg.getValue();
+
+    if(batchSize <= 0 || numBatches <= 0) {
+      cerr << "Error: -batch-size and -num-batches must be positive" << endl;
+      return 1;
+    }
+    if(boardSize < 2 || boardSize > NNPos::MAX_BOARD_LEN) {
+      cerr << "Error: -board-size must be from 2 to " << NNPos::MAX_BOARD_LEN << endl;
+      return 1;
+    }
+    if(format != "table" && format != "trace") {
+      cerr << "Error: -format must be table or trace" << endl;
+      return 1;
+    }
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+
+  Logger logger;
+  logger.setLogToStdout(false);
+  logger.setLogToStderr(true);
+
+  NeuralNet::globalInitialize();
+  LoadedModel* loadedModel = NeuralNet::loadModelFile(modelFile, 0);
+  int modelVersion = NeuralNet::getModelVersion(loadedModel);
+  ComputeContext* context = NeuralNet::createComputeContext({gpuIdx},&logger,tuneFile);
+  bool requireExactNNLen = true;
+  bool inputsUseNHWC = true;
+  ComputeHandle* handle = NeuralNet::createComputeHandle(
+    context,loadedModel,&logger,batchSize,boardSize,boardSize,requireExactNNLen,inputsUseNHWC,
+    gpuIdx,useFP16,useINT8,cudaUseNHWC
+  );
+  InputBuffers* inputBuffers = NeuralNet::createInputBuffers(loadedModel,batchSize,boardSize,boardSize);
+
+  bool* symmetries = NeuralNet::getSymmetriesInplace(inputBuffers);
+  symmetries[0] = false;
+  symmetries[1] = false;
+  symmetries[2] = false;
+  fillRandomPlayInputs(inputBuffers,modelVersion,boardSize,boardSize,batchSize,seedRand);
+
+  vector<shared_ptr<NNOutput>> outputs;
+  vector<NNOutput*> outputBuf;
+  for(int i = 0; i<batchSize; i++) {
+    shared_ptr<NNOutput> output = make_shared<NNOutput>();
+    output->nnXLen = boardSize;
+    output->nnYLen = boardSize;
+    output->whiteOwnerMap = NULL;
+    outputs.push_back(output);
+    outputBuf.push_back(output.get());
+  }
+
+  int ret = 0;
+  //Untimed, so that lazy initialization in the backend isn't counted
+  NeuralNet::getOutput(handle,inputBuffers,batchSize,outputBuf);
+  if(!NeuralNet::setProfilingEnabled(handle,true)) {
+    cerr << "Error: this neural net backend does not support profiling" << endl;
+    ret = 1;
+  }
+  else {
+    ClockTimer timer;
+    for(int i = 0; i<numBatches; i++)
+      NeuralNet::getOutput(handle,inputBuffers,batchSize,outputBuf);
+    double seconds = timer.getSeconds();
+    NeuralNet::setProfilingEnabled(handle,false);
+
+    vector<NNLayerProfile> profile;
+    NeuralNet::getProfile(handle,profile);
+
+    ofstream fileOut;
+    if(outputFile != string()) {
+      fileOut.open(outputFile);
+      if(!fileOut.good())
+        throw IOError("Could not open " + outputFile);
+    }
+    ostream& out = outputFile != string() ? fileOut : cout;
+    if(format == "table") {
+      out << "Model " << modelFile << " board size " << boardSize << " batch size " << batchSize
+          << ", " << numBatches << " batches in " << Global::strprintf("%.3f", seconds) << " seconds" << endl;
+      NNProfile::printTable(out,profile);
+    }
+    else {
+      NNProfile::printTrace(out,profile);
+    }
+  }
+
+  NeuralNet::freeInputBuffers(inputBuffers);
+  NeuralNet::freeComputeHandle(handle);
+  NeuralNet::freeComputeContext(context);
+  NeuralNet::freeLoadedModel(loadedModel);
+  NeuralNet::globalCleanup();
+  return ret;
+}
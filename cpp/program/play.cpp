@@ -284,11 +284,10 @@ bool MatchPairer::getMatchup(
     for(int i = 0; i<nnEvals.size(); i++) {
       if(nnEvals[i] != NULL) {
         logger.write(nnEvals[i]->getModelFileName());
-        logger.write("NN rows: " + Global::int64ToString(nnEvals[i]->numRowsProcessed()));
-        logger.write("NN batches: " + Global::int64ToString(nnEvals[i]->numBatchesProcessed()));
-        logger.write("NN avg batch size: " + Global::doubleToString(nnEvals[i]->averageProcessedBatchSize()));
+        nnEvals[i]->logStats(logger, "");
       }
     }
+    logger.write(NNOutputPool::getStatsString());
   }
 
   pair<int,int> matchup = getMatchupPairUnsynchronized();
@@ -525,6 +524,8 @@ void Play::playExtraBlack(
   hist.setKomi(roundAndClipKomi(extraBlackAndKomi.komiBase,board));
 
   NNResultBuf buf;
+  //Game initialization waits on each of these in turn
+  buf.highPriority = true;
   for(int i = 0; i<extraBlackAndKomi.extraBlack; i++) {
     double drawEquivalentWinsForWhite = bot->searchParams.drawEquivalentWinsForWhite;
     bot->nnEvaluator->evaluate(board,hist,pla,drawEquivalentWinsForWhite,buf,NULL,false,false);
@@ -934,6 +935,8 @@ FinishedGameData* Play::runGame(
     //and add entropy
     {
       NNResultBuf buf;
+      //Game initialization waits on each of these in turn
+      buf.highPriority = true;
 
       //This gives us about 15 moves on average for 19x19.
       int numInitialMovesToPlay = (int)floor(gameRand.nextExponential() * (board.x_size * board.y_size / 25.0));
@@ -1390,6 +1393,8 @@ void Play::maybeForkGame(
   double bestScore = 0.0;
 
   NNResultBuf buf;
+  //Game initialization waits on each of these in turn
+  buf.highPriority = true;
   double drawEquivalentWinsForWhite = 0.5;
   for(int i = 0; i<numChoices; i++) {
     Loc loc = possibleMoves[i];
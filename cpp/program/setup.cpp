@@ -1,6 +1,7 @@
 #include "../program/setup.h"
 
 #include "../neuralnet/nninterface.h"
+#include "../neuralnet/nntunecache.h"
 
 using namespace std;
 
@@ -21,10 +22,12 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
   bool alwaysIncludeOwnerMap,
   int defaultNNXLen,
   int defaultNNYLen,
-  int forcedSymmetry
+  int forcedSymmetry,
+  NNServerGroup* serverGroup
 ) {
   vector<NNEvaluator*> nnEvals;
   assert(nnModelNames.size() == nnModelFiles.size());
+  string tuneFile = loadTuneFile(cfg);
   for(size_t i = 0; i<nnModelFiles.size(); i++) {
     string idxStr = Global::intToString(i);
     const string& nnModelName = nnModelNames[i];
@@ -33,8 +36,22 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
     bool debugSkipNeuralNet = cfg.contains("debugSkipNeuralNet") ? cfg.getBool("debugSkipNeuralNet") : debugSkipNeuralNetDefault;
     int modelFileIdx = i;
 
+    NNEvaluator::Options nnOptions;
+    nnOptions.tuneFile = tuneFile;
+
+    //If set, the net is run by the nnserver listening at this socket instead of in this process
+    if(cfg.contains("nnServerSocket"+idxStr))
+      nnOptions.nnServerSocket = cfg.getString("nnServerSocket"+idxStr);
+    else if(cfg.contains("nnServerSocket"))
+      nnOptions.nnServerSocket = cfg.getString("nnServerSocket");
+
     int nnXLen = std::max(defaultNNXLen,7);
     int nnYLen = std::max(defaultNNYLen,7);
+    //The server's buffers have a fixed size, so by default use the same one regardless of the board size
+    if(nnOptions.nnServerSocket.size() > 0) {
+      nnXLen = NNPos::MAX_BOARD_LEN;
+      nnYLen = NNPos::MAX_BOARD_LEN;
+    }
     if(cfg.contains("maxBoardXSizeForNNBuffer" + idxStr))
       nnXLen = cfg.getInt("maxBoardXSizeForNNBuffer" + idxStr, 7, NNPos::MAX_BOARD_LEN);
     else if(cfg.contains("maxBoardXSizeForNNBuffer"))
@@ -71,6 +88,90 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
     else if(cfg.contains("nnPolicyTemperature"))
       nnPolicyTemperature = cfg.getFloat("nnPolicyTemperature",0.01f,5.0f);
 
+    if(cfg.contains("nnMinBatchFill"+idxStr))
+      nnOptions.minBatchFill = cfg.getInt("nnMinBatchFill"+idxStr,1,65536);
+    else if(cfg.contains("nnMinBatchFill"))
+      nnOptions.minBatchFill = cfg.getInt("nnMinBatchFill",1,65536);
+
+    if(cfg.contains("nnMaxBatchWaitMs"+idxStr))
+      nnOptions.maxBatchWaitMs = cfg.getDouble("nnMaxBatchWaitMs"+idxStr,0.0,10000.0);
+    else if(cfg.contains("nnMaxBatchWaitMs"))
+      nnOptions.maxBatchWaitMs = cfg.getDouble("nnMaxBatchWaitMs",0.0,10000.0);
+
+    if(cfg.contains("nnCacheCompress"+idxStr))
+      nnOptions.compressCache = cfg.getBool("nnCacheCompress"+idxStr);
+    else if(cfg.contains("nnCacheCompress"))
+      nnOptions.compressCache = cfg.getBool("nnCacheCompress");
+
+    if(cfg.contains("nnCachePolicyTopK"+idxStr))
+      nnOptions.cachePolicyTopK = cfg.getInt("nnCachePolicyTopK"+idxStr,0,NNPos::MAX_NN_POLICY_SIZE);
+    else if(cfg.contains("nnCachePolicyTopK"))
+      nnOptions.cachePolicyTopK = cfg.getInt("nnCachePolicyTopK",0,NNPos::MAX_NN_POLICY_SIZE);
+
+    if(cfg.contains("nnCacheCanonicalizeSymmetry"+idxStr))
+      nnOptions.canonicalizeCacheSymmetry = cfg.getBool("nnCacheCanonicalizeSymmetry"+idxStr);
+    else if(cfg.contains("nnCacheCanonicalizeSymmetry"))
+      nnOptions.canonicalizeCacheSymmetry = cfg.getBool("nnCacheCanonicalizeSymmetry");
+
+    if(cfg.contains("nnDiskCacheFile"+idxStr))
+      nnOptions.diskCacheFile = cfg.getString("nnDiskCacheFile"+idxStr);
+    else if(cfg.contains("nnDiskCacheFile"))
+      nnOptions.diskCacheFile = cfg.getString("nnDiskCacheFile");
+
+    int64_t nnDiskCacheMaxMB = 1024;
+    if(cfg.contains("nnDiskCacheMaxMB"+idxStr))
+      nnDiskCacheMaxMB = cfg.getInt64("nnDiskCacheMaxMB"+idxStr,1,(int64_t)1 << 30);
+    else if(cfg.contains("nnDiskCacheMaxMB"))
+      nnDiskCacheMaxMB = cfg.getInt64("nnDiskCacheMaxMB",1,(int64_t)1 << 30);
+
+    if(cfg.contains("nnSharedCacheName"+idxStr))
+      nnOptions.sharedCacheName = cfg.getString("nnSharedCacheName"+idxStr);
+    else if(cfg.contains("nnSharedCacheName"))
+      nnOptions.sharedCacheName = cfg.getString("nnSharedCacheName");
+
+    int64_t nnSharedCacheMaxMB = 1024;
+    if(cfg.contains("nnSharedCacheMaxMB"+idxStr))
+      nnSharedCacheMaxMB = cfg.getInt64("nnSharedCacheMaxMB"+idxStr,1,(int64_t)1 << 30);
+    else if(cfg.contains("nnSharedCacheMaxMB"))
+      nnSharedCacheMaxMB = cfg.getInt64("nnSharedCacheMaxMB",1,(int64_t)1 << 30);
+
+    //For benchmarking without a gpu, simulate a net taking this long per batch and per row, see NNSyntheticBackend
+    if(cfg.contains("nnSyntheticNumDevices"+idxStr))
+      nnOptions.syntheticNumDevices = cfg.getInt("nnSyntheticNumDevices"+idxStr,0,1024);
+    else if(cfg.contains("nnSyntheticNumDevices"))
+      nnOptions.syntheticNumDevices = cfg.getInt("nnSyntheticNumDevices",0,1024);
+
+    if(cfg.contains("nnSyntheticBatchLatencyMs"+idxStr))
+      nnOptions.syntheticBatchLatencyMs = cfg.getDouble("nnSyntheticBatchLatencyMs"+idxStr,0.0,10000.0);
+    else if(cfg.contains("nnSyntheticBatchLatencyMs"))
+      nnOptions.syntheticBatchLatencyMs = cfg.getDouble("nnSyntheticBatchLatencyMs",0.0,10000.0);
+
+    if(cfg.contains("nnSyntheticRowLatencyMs"+idxStr))
+      nnOptions.syntheticRowLatencyMs = cfg.getDouble("nnSyntheticRowLatencyMs"+idxStr,0.0,10000.0);
+    else if(cfg.contains("nnSyntheticRowLatencyMs"))
+      nnOptions.syntheticRowLatencyMs = cfg.getDouble("nnSyntheticRowLatencyMs",0.0,10000.0);
+
+    //Record every evaluation to a file, or serve evaluations from such a recording in place of the net, see NNRecorder
+    if(cfg.contains("nnRecordFile"+idxStr))
+      nnOptions.recordFile = cfg.getString("nnRecordFile"+idxStr);
+    else if(cfg.contains("nnRecordFile"))
+      nnOptions.recordFile = cfg.getString("nnRecordFile");
+
+    if(cfg.contains("nnReplayFile"+idxStr))
+      nnOptions.replayFile = cfg.getString("nnReplayFile"+idxStr);
+    else if(cfg.contains("nnReplayFile"))
+      nnOptions.replayFile = cfg.getString("nnReplayFile");
+
+    if(cfg.contains("nnReplayMissPolicy"+idxStr))
+      nnOptions.replayMissPolicy = NNReplay::parseMissPolicy(cfg.getString("nnReplayMissPolicy"+idxStr));
+    else if(cfg.contains("nnReplayMissPolicy"))
+      nnOptions.replayMissPolicy = NNReplay::parseMissPolicy(cfg.getString("nnReplayMissPolicy"));
+
+    if(cfg.contains("nnDiskCacheReadOnly"+idxStr))
+      nnOptions.diskCacheReadOnly = cfg.getBool("nnDiskCacheReadOnly"+idxStr);
+    else if(cfg.contains("nnDiskCacheReadOnly"))
+      nnOptions.diskCacheReadOnly = cfg.getBool("nnDiskCacheReadOnly");
+
     bool nnRandomize = cfg.getBool("nnRandomize");
     string nnRandSeed;
     if(cfg.contains("nnRandSeed" + idxStr))
@@ -122,6 +223,12 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
     else if(cfg.contains("cudaUseFP16"))
       useFP16 = cfg.getBool("cudaUseFP16");
 
+    bool useINT8 = false;
+    if(cfg.contains("useINT8-"+idxStr))
+      useINT8 = cfg.getBool("useINT8-"+idxStr);
+    else if(cfg.contains("useINT8"))
+      useINT8 = cfg.getBool("useINT8");
+
     bool cudaUseNHWC = false;
     if(cfg.contains("cudaUseNHWC"+idxStr))
       cudaUseNHWC = cfg.getBool("cudaUseNHWC"+idxStr);
@@ -131,9 +238,13 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
     logger.write(
       "After dedups: nnModelFile" + idxStr + " = " + nnModelFile
       + " useFP16 " + Global::boolToString(useFP16)
+      + " useINT8 " + Global::boolToString(useINT8)
       + " cudaUseNHWC " + Global::boolToString(cudaUseNHWC)
     );
 
+    nnOptions.diskCacheMaxBytes = nnDiskCacheMaxMB * 1024 * 1024;
+    nnOptions.sharedCacheMaxBytes = nnSharedCacheMaxMB * 1024 * 1024;
+
     NNEvaluator* nnEval = new NNEvaluator(
       nnModelName,
       nnModelFile,
@@ -150,20 +261,33 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
       cfg.getInt("nnMutexPoolSizePowerOfTwo", -1, 24),
       debugSkipNeuralNet,
       alwaysIncludeOwnerMap,
-      nnPolicyTemperature
+      nnPolicyTemperature,
+      nnOptions
     );
 
     int defaultSymmetry = forcedSymmetry >= 0 ? forcedSymmetry : 0;
-    nnEval->spawnServerThreads(
-      numNNServerThreadsPerModel,
-      (forcedSymmetry >= 0 ? false : nnRandomize),
-      nnRandSeed,
-      defaultSymmetry,
-      logger,
-      gpuIdxByServerThread,
-      useFP16,
-      cudaUseNHWC
-    );
+    if(serverGroup != NULL)
+      nnEval->joinServerGroup(
+        *serverGroup,
+        (forcedSymmetry >= 0 ? false : nnRandomize),
+        nnRandSeed,
+        defaultSymmetry,
+        useFP16,
+        useINT8,
+        cudaUseNHWC
+      );
+    else
+      nnEval->spawnServerThreads(
+        numNNServerThreadsPerModel,
+        (forcedSymmetry >= 0 ? false : nnRandomize),
+        nnRandSeed,
+        defaultSymmetry,
+        logger,
+        gpuIdxByServerThread,
+        useFP16,
+        useINT8,
+        cudaUseNHWC
+      );
 
     nnEvals.push_back(nnEval);
   }
@@ -171,6 +295,45 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
   return nnEvals;
 }
 
+string Setup::loadTuneFile(ConfigParser& cfg) {
+  bool nnAutoTune = cfg.contains("nnAutoTune") ? cfg.getBool("nnAutoTune") : true;
+  if(!nnAutoTune)
+    return string();
+  if(cfg.contains("nnTuneFile"))
+    return cfg.getString("nnTuneFile");
+  return NNTuneCache::defaultFile();
+}
+
+NNServerGroup* Setup::initializeNNServerGroup(
+  ConfigParser& cfg,
+  Logger& logger
+) {
+  if(!cfg.contains("shareNNServerThreads") || !cfg.getBool("shareNNServerThreads"))
+    return NULL;
+
+  int numNNServerThreads = cfg.getInt("numNNServerThreadsPerModel",1,1024);
+  vector<int> gpuIdxByServerThread;
+  for(int j = 0; j<numNNServerThreads; j++) {
+    string threadIdxStr = Global::intToString(j);
+    if(cfg.contains("gpuToUseThread"+threadIdxStr))
+      gpuIdxByServerThread.push_back(cfg.getInt("gpuToUseThread"+threadIdxStr,0,1023));
+    else if(cfg.contains("cudaGpuToUseThread"+threadIdxStr))
+      gpuIdxByServerThread.push_back(cfg.getInt("cudaGpuToUseThread"+threadIdxStr,0,1023));
+    else if(cfg.contains("gpuToUse"))
+      gpuIdxByServerThread.push_back(cfg.getInt("gpuToUse",0,1023));
+    else if(cfg.contains("cudaGpuToUse"))
+      gpuIdxByServerThread.push_back(cfg.getInt("cudaGpuToUse",0,1023));
+    else
+      gpuIdxByServerThread.push_back(0);
+  }
+
+  double nnMaxBatchWaitMs = 0.0;
+  if(cfg.contains("nnMaxBatchWaitMs"))
+    nnMaxBatchWaitMs = cfg.getDouble("nnMaxBatchWaitMs",0.0,10000.0);
+
+  logger.write("Sharing " + Global::intToString(numNNServerThreads) + " nn server threads between all models");
+  return new NNServerGroup(gpuIdxByServerThread, nnMaxBatchWaitMs, logger);
+}
 
 vector<SearchParams> Setup::loadParams(
   ConfigParser& cfg
@@ -3,6 +3,7 @@
 
 #include "../core/config_parser.h"
 #include "../core/global.h"
+#include "../neuralnet/nnservergroup.h"
 #include "../search/asyncbot.h"
 
 //Some bits of initialization and main function logic shared between various programs
@@ -21,7 +22,22 @@ namespace Setup {
     bool alwaysIncludeOwnerMap,
     int defaultNNXLen,
     int defaultNNYLen,
-    int forcedSymmetry //-1 if not forcing a symmetry
+    int forcedSymmetry, //-1 if not forcing a symmetry
+    NNServerGroup* serverGroup = NULL //if not NULL, the evaluators are served by its threads instead of their own
+  );
+
+  //For programs that evaluate several models at once. If the config enables shareNNServerThreads, returns a group of
+  //numNNServerThreadsPerModel server threads in total to pass to initializeNNEvaluators, else returns NULL.
+  //Must be deleted after all the evaluators using it.
+  NNServerGroup* initializeNNServerGroup(
+    ConfigParser& cfg,
+    Logger& logger
+  );
+
+  //The file for the neural net backends to keep autotuning results in, see NNTuneCache, or empty if nnAutoTune is
+  //set to false. Defaults to NNTuneCache::defaultFile unless the config sets nnTuneFile.
+  std::string loadTuneFile(
+    ConfigParser& cfg
   );
 
   //Loads search parameters for bot from config, by bot idx.
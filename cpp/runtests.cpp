@@ -4,6 +4,8 @@
 #include "core/rand.h"
 #include "core/elo.h"
 #include "core/fancymath.h"
+#include "core/blockpool.h"
+#include "core/epochreclaim.h"
 #include "game/board.h"
 #include "game/rules.h"
 #include "game/boardhistory.h"
@@ -23,6 +25,8 @@ int MainCmds::runtests(int argc, const char* const* argv) {
   Rand::runTests();
   FancyMath::runTests();
   ComputeElos::runTests();
+  BlockPool::runTests();
+  EpochReclaimer::runTests();
 
 
   Tests::runBoardIOTests();
@@ -36,6 +40,24 @@ int MainCmds::runtests(int argc, const char* const* argv) {
 
   Tests::runSgfTests();
 
+  Tests::runLockFreeBatchQueueTests();
+
+  Tests::runCompactNNOutputTests();
+  Tests::runNNSymmetryTests();
+  Tests::runNNModelBinaryTests();
+  Tests::runNNCacheTableTests();
+  Tests::runNNInFlightTableTests();
+  Tests::runNNDiskCacheTests();
+  Tests::runNNSharedCacheTests();
+  Tests::runNNTuneCacheTests();
+
+  Tests::runNNEvaluatorAsyncTests();
+  Tests::runNNEvaluatorPriorityTests();
+  Tests::runNNServerGroupTests();
+  Tests::runNNRemoteTests();
+  Tests::runNNSyntheticBackendTests();
+  Tests::runNNRecordingTests();
+
   ScoreValue::freeTables();
 
   cout << "All tests passed" << endl;
@@ -127,6 +149,20 @@ int MainCmds::runnnlayertests(int argc, const char* const* argv) {
   return 0;
 }
 
+int MainCmds::runbatchqueuebench(int argc, const char* const* argv) {
+  if(argc != 5) {
+    cerr << "Must supply exactly four arguments: NUM_CONSUMERS BATCH_SIZE COMPUTE_MICROS SECONDS_PER_RUN" << endl;
+    return 1;
+  }
+  Tests::runBatchQueueBenchmark(
+    Global::stringToInt(argv[1]),
+    Global::stringToInt(argv[2]),
+    Global::stringToInt(argv[3]),
+    Global::stringToDouble(argv[4])
+  );
+  return 0;
+}
+
 int MainCmds::runnnontinyboardtest(int argc, const char* const* argv) {
   if(argc != 6) {
     cerr << "Must supply exactly five arguments: MODEL_FILE INPUTSNHWC CUDANHWC SYMMETRY FP16" << endl;
@@ -206,6 +206,7 @@ int MainCmds::sandbox() {
   // LoadedModel* loadedModel = NeuralNet::loadModelFile("/efs/data/GoNN/exportedmodels/cuda/value24-140/model.txt", 0);
   // LoadedModel* loadedModel = NeuralNet::loadModelFile("/efs/data/GoNN/exportedmodels/tensorflow/value24-140/model.graph_optimized.pb", 0);
   bool useFP16 = true;
+  bool useINT8 = false;
   bool cudaUseNHWC = true;
   int maxBatchSize = 128;
   int nnXLen = 14;
@@ -213,10 +214,10 @@ int MainCmds::sandbox() {
   bool requireExactNNLen = false;
   bool inputsUseNHWC = true;
   int gpuIdxForThisThread = 0;
-  ComputeContext* context = NeuralNet::createComputeContext({gpuIdxForThisThread},&logger);
+  ComputeContext* context = NeuralNet::createComputeContext({gpuIdxForThisThread},&logger,"");
   ComputeHandle* gpuHandle = NeuralNet::createComputeHandle(
     context,loadedModel,&logger,maxBatchSize,nnXLen,nnYLen,requireExactNNLen,inputsUseNHWC,
-    gpuIdxForThisThread,useFP16,cudaUseNHWC
+    gpuIdxForThisThread,useFP16,useINT8,cudaUseNHWC
   );
   InputBuffers* inputBuffers = NeuralNet::createInputBuffers(loadedModel,maxBatchSize,nnXLen,nnYLen);
 
@@ -1022,6 +1022,7 @@ void Search::computeRootValues(Logger& logger) {
   Board board = rootBoard;
   const BoardHistory& hist = rootHistory;
   NNResultBuf nnResultBuf;
+  nnResultBuf.highPriority = true;
   bool skipCache = false;
   bool includeOwnerMap = true;
   nnEvaluator->evaluate(
@@ -1087,7 +1088,7 @@ void Search::maybeAddPolicyNoise(SearchThread& thread, SearchNode& node, bool is
     return;
 
   //Copy nnOutput as we're about to modify its policy to add noise or temperature
-  shared_ptr<NNOutput> newNNOutput = std::make_shared<NNOutput>(*(node.nnOutput));
+  shared_ptr<NNOutput> newNNOutput = NNOutputPool::makeShared(*(node.nnOutput));
   //Replace the old pointer
   node.nnOutput = newNNOutput;
 
@@ -1772,6 +1773,9 @@ void Search::initNodeNNOutput(
   bool isRoot, bool skipCache, int32_t virtualLossesToSubtract, bool isReInit
 ) {
   bool includeOwnerMap = isRoot || alwaysIncludeOwnerMap;
+  thread.nnResultBuf.searchDepth = (int)(thread.history.moveHistory.size() - rootHistory.moveHistory.size());
+  //Nothing else can happen in the search until the root is evaluated
+  thread.nnResultBuf.highPriority = isRoot;
   nnEvaluator->evaluate(
     thread.board, thread.history, thread.pla,
     searchParams.drawEquivalentWinsForWhite,
@@ -290,9 +290,8 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
     //Do logging and cleanup while unlocked, so that our freeing and stopping of this neural net doesn't
     //block anyone else
     logger.write(netAndStuff->nnEval->getModelFileName());
-    logger.write("NN rows: " + Global::int64ToString(netAndStuff->nnEval->numRowsProcessed()));
-    logger.write("NN batches: " + Global::int64ToString(netAndStuff->nnEval->numBatchesProcessed()));
-    logger.write("NN avg batch size: " + Global::doubleToString(netAndStuff->nnEval->averageProcessedBatchSize()));
+    netAndStuff->nnEval->logStats(logger, "");
+    logger.write(NNOutputPool::getStatsString());
 
     assert(netAndStuff->numGameThreads == 0);
     assert(netAndStuff->isDraining);
@@ -0,0 +1,411 @@
+#include "../tests/tests.h"
+
+#include "../core/lockfreebatchqueue.h"
+#include "../core/timer.h"
+
+using namespace std;
+
+void Tests::runLockFreeBatchQueueTests() {
+  {
+    LockFreeBatchQueue<int> queue(8,1,0.0);
+    int buf[8];
+    for(int i = 0; i<5; i++)
+      queue.push(i);
+    testAssert(queue.waitPopBatch(buf,3) == 3);
+    testAssert(buf[0] == 0 && buf[1] == 1 && buf[2] == 2);
+    testAssert(queue.waitPopBatch(buf,3) == 2);
+    testAssert(buf[0] == 3 && buf[1] == 4);
+
+    //Wrap around the ring a few times
+    for(int round = 0; round < 10; round++) {
+      for(int i = 0; i<7; i++)
+        queue.push(round * 7 + i);
+      size_t n = 0;
+      while(n < 7) {
+        size_t popped = queue.waitPopBatch(buf,8);
+        for(size_t i = 0; i<popped; i++)
+          testAssert(buf[i] == round * 7 + (int)(n + i));
+        n += popped;
+      }
+      testAssert(n == 7);
+    }
+  }
+
+  //Taken batches stop at the end of the ring, and their slots aren't reused until released
+  {
+    LockFreeBatchQueue<int> queue(8,1,0.0);
+    testAssert(queue.getCapacity() == 8);
+    int buf[8];
+    for(int i = 0; i<6; i++) {
+      uint64_t pos = queue.claim();
+      testAssert(queue.getSlotIdx(pos) == (size_t)i);
+      queue.publish(pos,i);
+    }
+    uint64_t firstPos;
+    testAssert(queue.waitTakeBatch(buf,8,firstPos) == 6);
+    testAssert(firstPos == 0);
+    queue.release(firstPos,6);
+    for(int i = 6; i<11; i++)
+      queue.push(i);
+    testAssert(queue.waitTakeBatch(buf,8,firstPos) == 2);
+    testAssert(queue.getSlotIdx(firstPos) == 6 && buf[0] == 6 && buf[1] == 7);
+    testAssert(queue.waitTakeBatch(buf,8,firstPos) == 3);
+    testAssert(queue.getSlotIdx(firstPos) == 0 && buf[0] == 8 && buf[2] == 10);
+    queue.release(firstPos,3);
+
+    //Slots 6 and 7 are still held, so a producer needing slot 6 waits until they are released
+    for(int i = 11; i<14; i++)
+      queue.push(i);
+    std::atomic<bool> pushed(false);
+    std::thread producer([&]() {
+      queue.push(14);
+      pushed.store(true);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    testAssert(!pushed.load());
+    queue.release(6,2);
+    producer.join();
+    testAssert(queue.waitPopBatch(buf,8) == 4);
+    testAssert(buf[0] == 11 && buf[3] == 14);
+  }
+
+  //Killing wakes up consumers blocked on an empty queue
+  {
+    LockFreeBatchQueue<int> queue(8,1,0.0);
+    std::atomic<int> result(-1);
+    std::thread consumer([&]() {
+      int buf[4];
+      result.store((int)queue.waitPopBatch(buf,4));
+    });
+    queue.setKilled(true);
+    consumer.join();
+    testAssert(result.load() == 0);
+    queue.setKilled(false);
+    queue.push(7);
+    int buf[4];
+    testAssert(queue.waitPopBatch(buf,4) == 1 && buf[0] == 7);
+  }
+
+  //Trying to take never blocks, and interrupting wakes up consumers waiting interruptibly, and only those that
+  //started from before the interrupt
+  {
+    LockFreeBatchQueue<int> queue(8,1,0.0);
+    int buf[4];
+    uint64_t firstPos;
+    testAssert(queue.tryTakeBatch(buf,4,firstPos) == 0);
+    queue.push(3);
+    testAssert(queue.tryTakeBatch(buf,4,firstPos) == 1 && buf[0] == 3);
+    queue.release(firstPos,1);
+
+    uint64_t interruptsSeen = queue.getNumInterrupts();
+    std::atomic<int> result(-1);
+    std::thread consumer([&]() {
+      int consumerBuf[4];
+      uint64_t consumerFirstPos;
+      result.store((int)queue.waitTakeBatchInterruptible(consumerBuf,4,interruptsSeen,consumerFirstPos));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    testAssert(result.load() == -1);
+    queue.interruptWaits();
+    consumer.join();
+    testAssert(result.load() == 0);
+    testAssert(queue.waitTakeBatchInterruptible(buf,4,interruptsSeen,firstPos) == 0);
+    queue.push(4);
+    testAssert(queue.waitTakeBatchInterruptible(buf,4,queue.getNumInterrupts(),firstPos) == 1 && buf[0] == 4);
+    queue.release(firstPos,1);
+  }
+
+  //Adaptive filling still returns whatever is there once out of time
+  {
+    LockFreeBatchQueue<int> queue(16,4,5.0);
+    testAssert(queue.getMinFill() == 4);
+    int buf[8];
+    for(int i = 0; i<4; i++)
+      queue.push(i);
+    testAssert(queue.waitPopBatch(buf,8) == 4);
+    queue.push(4);
+    testAssert(queue.waitPopBatch(buf,8) == 1 && buf[0] == 4);
+    testAssert(queue.getNumFillWaits() <= 1);
+
+    LockFreeBatchQueue<int> nonAdaptive(16,4,0.0);
+    testAssert(nonAdaptive.getMinFill() == 1);
+  }
+
+  //Adaptive filling waits for rows that arrive fast enough to fill the batch in time, waits out the deadline for
+  //rows that don't come, and after a few of those timeouts, stops waiting at all
+  {
+    const double maxWaitMs = 100.0;
+    LockFreeBatchQueue<int> queue(16,4,maxWaitMs);
+    int buf[8];
+
+    std::thread producer([&]() {
+      for(int i = 0; i<4; i++) {
+        queue.push(i);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+    testAssert(queue.waitPopBatch(buf,8) == 4);
+    producer.join();
+    testAssert(queue.getNumFillWaits() == 1);
+    testAssert(queue.getNumFillTimeouts() == 0);
+    testAssert(queue.getNumFillWaitsSkipped() == 0);
+
+    ClockTimer timer;
+    queue.push(4);
+    testAssert(queue.waitPopBatch(buf,8) == 1 && buf[0] == 4);
+    testAssert(timer.getSeconds() >= 0.9 * maxWaitMs / 1000.0);
+    testAssert(queue.getNumFillTimeouts() == 1);
+
+    int numRounds = 0;
+    while(queue.getNumFillWaitsSkipped() == 0) {
+      testAssert(numRounds++ < 10);
+      timer.reset();
+      queue.push(5);
+      testAssert(queue.waitPopBatch(buf,8) == 1 && buf[0] == 5);
+    }
+    testAssert(timer.getSeconds() < 0.5 * maxWaitMs / 1000.0);
+    testAssert(queue.getNumFillTimeouts() == 1 + (uint64_t)(numRounds - 1));
+
+    //A full batch is taken immediately, without waiting
+    for(int i = 0; i<4; i++)
+      queue.push(i);
+    uint64_t numFillWaits = queue.getNumFillWaits();
+    testAssert(queue.waitPopBatch(buf,8) == 4);
+    testAssert(queue.getNumFillWaits() == numFillWaits);
+  }
+
+  //Many producers and consumers, with a ring small enough that producers have to wait for slots to be freed
+  for(int minFill = 1; minFill <= 4; minFill += 3) {
+    const int numProducers = 6;
+    const int numConsumers = 3;
+    const int numPerProducer = 5000;
+    LockFreeBatchQueue<int> queue(16,minFill,minFill > 1 ? 0.5 : 0.0);
+    vector<std::atomic<int>> timesSeen(numProducers * numPerProducer);
+    for(size_t i = 0; i<timesSeen.size(); i++)
+      timesSeen[i].store(0);
+    std::atomic<int> numConsumed(0);
+
+    vector<std::thread> consumers;
+    for(int c = 0; c<numConsumers; c++) {
+      consumers.push_back(std::thread([&]() {
+        int buf[5];
+        while(true) {
+          size_t n = queue.waitPopBatch(buf,5);
+          if(n == 0)
+            break;
+          testAssert(n <= 5);
+          for(size_t i = 0; i<n; i++)
+            timesSeen[buf[i]].fetch_add(1);
+          numConsumed.fetch_add((int)n);
+        }
+      }));
+    }
+    vector<std::thread> producers;
+    for(int p = 0; p<numProducers; p++) {
+      producers.push_back(std::thread([&queue,p]() {
+        for(int i = 0; i<numPerProducer; i++)
+          queue.push(p * numPerProducer + i);
+      }));
+    }
+    for(size_t p = 0; p<producers.size(); p++)
+      producers[p].join();
+    while(numConsumed.load() < numProducers * numPerProducer)
+      std::this_thread::yield();
+    queue.setKilled(true);
+    for(size_t c = 0; c<consumers.size(); c++)
+      consumers[c].join();
+
+    for(size_t i = 0; i<timesSeen.size(); i++)
+      testAssert(timesSeen[i].load() == 1);
+  }
+}
+
+//The queue that NNEvaluator used before LockFreeBatchQueue, for comparison: a circular buffer of batch-sized arrays
+//with every push and pop under one mutex. Only pops whole arrays, so maxCount must be the batch size.
+template<typename T>
+class MutexBatchQueue
+{
+  std::mutex bufferMutex;
+  std::condition_variable serverWaitingForBatchStart;
+  bool isKilled;
+  int maxNumRows;
+  int numResultBufss;
+  int numResultBufssMask;
+  T** resultBufss;
+  int currentResultBufsLen;
+  int currentResultBufsIdx;
+  int oldestResultBufsIdx;
+
+ public:
+  MutexBatchQueue(int maxConcurrent, int maxBatchSize)
+    :bufferMutex(),serverWaitingForBatchStart(),isKilled(false),maxNumRows(maxBatchSize),
+     numResultBufss(1),numResultBufssMask(0),resultBufss(NULL),
+     currentResultBufsLen(0),currentResultBufsIdx(0),oldestResultBufsIdx(0)
+  {
+    while(numResultBufss < maxConcurrent / maxBatchSize + 3)
+      numResultBufss *= 2;
+    numResultBufssMask = numResultBufss - 1;
+    resultBufss = new T*[numResultBufss];
+    for(int i = 0; i<numResultBufss; i++)
+      resultBufss[i] = new T[maxBatchSize];
+  }
+  ~MutexBatchQueue() {
+    for(int i = 0; i<numResultBufss; i++)
+      delete[] resultBufss[i];
+    delete[] resultBufss;
+  }
+
+  void push(const T& elt) {
+    unique_lock<std::mutex> lock(bufferMutex);
+    resultBufss[currentResultBufsIdx][currentResultBufsLen] = elt;
+    currentResultBufsLen += 1;
+    if(currentResultBufsLen == 1 && currentResultBufsIdx == oldestResultBufsIdx)
+      serverWaitingForBatchStart.notify_one();
+    if(currentResultBufsLen >= maxNumRows) {
+      currentResultBufsLen = 0;
+      currentResultBufsIdx = (currentResultBufsIdx + 1) & numResultBufssMask;
+    }
+  }
+
+  size_t waitPopBatch(T* buf, size_t maxCount) {
+    assert((int)maxCount == maxNumRows);
+    (void)maxCount;
+    unique_lock<std::mutex> lock(bufferMutex);
+    while(currentResultBufsLen <= 0 && currentResultBufsIdx == oldestResultBufsIdx && !isKilled)
+      serverWaitingForBatchStart.wait(lock);
+    if(isKilled)
+      return 0;
+    int numRows;
+    if(currentResultBufsIdx == oldestResultBufsIdx) {
+      numRows = currentResultBufsLen;
+      currentResultBufsLen = 0;
+      currentResultBufsIdx = (currentResultBufsIdx + 1) & numResultBufssMask;
+    }
+    else
+      numRows = maxNumRows;
+    std::copy(resultBufss[oldestResultBufsIdx], resultBufss[oldestResultBufsIdx] + numRows, buf);
+    oldestResultBufsIdx = (oldestResultBufsIdx + 1) & numResultBufssMask;
+    return (size_t)numRows;
+  }
+
+  void setKilled(bool b) {
+    lock_guard<std::mutex> lock(bufferMutex);
+    isKilled = b;
+    serverWaitingForBatchStart.notify_all();
+  }
+};
+
+namespace {
+  //Mimics an NNResultBuf: the client blocks on it until a consumer marks it done
+  struct BenchRequest {
+    std::mutex mutex;
+    std::condition_variable condVar;
+    bool done;
+    BenchRequest() :mutex(),condVar(),done(false) {}
+  };
+
+  struct BenchResult {
+    double requestsPerSecond;
+    double avgBatchSize;
+    double avgPushNanos;
+  };
+}
+
+//Each producer repeatedly pushes a request and waits for it to be completed, like a search thread calling
+//NNEvaluator::evaluate. Each consumer repeatedly pops a batch, busy-waits computeMicros like a backend would,
+//and completes the requests in it.
+template<typename Queue>
+static BenchResult runQueueBench(Queue& queue, int numProducers, int numConsumers, int batchSize, int computeMicros, double seconds) {
+  std::atomic<bool> shouldStop(false);
+  std::atomic<int64_t> numRequests(0);
+  std::atomic<int64_t> numBatches(0);
+  std::atomic<int64_t> pushNanos(0);
+
+  vector<BenchRequest> requests(numProducers);
+  vector<std::thread> producers;
+  vector<std::thread> consumers;
+  for(int c = 0; c<numConsumers; c++) {
+    consumers.push_back(std::thread([&]() {
+      vector<BenchRequest*> buf(batchSize);
+      while(true) {
+        size_t n = queue.waitPopBatch(buf.data(),batchSize);
+        if(n == 0)
+          break;
+        if(computeMicros > 0) {
+          std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::microseconds(computeMicros);
+          while(std::chrono::steady_clock::now() < end) {}
+        }
+        for(size_t i = 0; i<n; i++) {
+          lock_guard<std::mutex> lock(buf[i]->mutex);
+          buf[i]->done = true;
+          buf[i]->condVar.notify_all();
+        }
+        numBatches.fetch_add(1,std::memory_order_relaxed);
+      }
+    }));
+  }
+
+  ClockTimer timer;
+  for(int p = 0; p<numProducers; p++) {
+    producers.push_back(std::thread([&,p]() {
+      BenchRequest& request = requests[p];
+      int64_t localRequests = 0;
+      int64_t localPushNanos = 0;
+      while(!shouldStop.load(std::memory_order_relaxed)) {
+        request.done = false;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        queue.push(&request);
+        localPushNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        unique_lock<std::mutex> lock(request.mutex);
+        while(!request.done)
+          request.condVar.wait(lock);
+        localRequests++;
+      }
+      numRequests.fetch_add(localRequests);
+      pushNanos.fetch_add(localPushNanos);
+    }));
+  }
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  shouldStop.store(true);
+  for(size_t p = 0; p<producers.size(); p++)
+    producers[p].join();
+  double elapsed = timer.getSeconds();
+  //All requests have been completed at this point, since every producer waited for its last one
+  queue.setKilled(true);
+  for(size_t c = 0; c<consumers.size(); c++)
+    consumers[c].join();
+
+  BenchResult result;
+  result.requestsPerSecond = numRequests.load() / elapsed;
+  result.avgBatchSize = (double)numRequests.load() / std::max((int64_t)1, numBatches.load());
+  result.avgPushNanos = (double)pushNanos.load() / std::max((int64_t)1, numRequests.load());
+  return result;
+}
+
+void Tests::runBatchQueueBenchmark(int numConsumers, int batchSize, int computeMicros, double seconds) {
+  cout << "Consumers " << numConsumers << " batch size " << batchSize << " compute micros per batch " << computeMicros
+       << " hardware threads " << std::thread::hardware_concurrency() << endl;
+  for(int numProducers = 1; numProducers <= 256; numProducers *= 4) {
+    int maxConcurrent = numProducers;
+    for(int impl = 0; impl < 2; impl++) {
+      BenchResult result;
+      string name;
+      if(impl == 0) {
+        MutexBatchQueue<BenchRequest*> queue(maxConcurrent,batchSize);
+        result = runQueueBench(queue,numProducers,numConsumers,batchSize,computeMicros,seconds);
+        name = "mutex   ";
+      }
+      else {
+        LockFreeBatchQueue<BenchRequest*> queue((size_t)maxConcurrent + 3 * (size_t)batchSize,1,0.0);
+        result = runQueueBench(queue,numProducers,numConsumers,batchSize,computeMicros,seconds);
+        name = "lockfree";
+      }
+      cout << "Producers " << Global::strprintf("%3d",numProducers) << " " << name
+           << " requests/s " << Global::strprintf("%10.0f",result.requestsPerSecond)
+           << " avg batch " << Global::strprintf("%6.2f",result.avgBatchSize)
+           << " avg push ns " << Global::strprintf("%8.0f",result.avgPushNanos)
+           << endl;
+    }
+  }
+}
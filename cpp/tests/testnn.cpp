@@ -1,7 +1,12 @@
 #include "../tests/tests.h"
 #include "../neuralnet/nninterface.h"
+#include "../neuralnet/desc.h"
+#ifdef USE_CPU_BACKEND
+#include "../neuralnet/cpukernels.h"
+#endif
 
 #include <cmath>
+#include <cstring>
 
 using namespace std;
 
@@ -72,6 +77,7 @@ static void checkApproxEqual(
       cout << "-------" << endl;
     }
   }
+  testAssert(!mismatch);
 }
 #define CHECK_APPROX_EQUAL(label,vec,expected,n,c,h,w,useFP16) (checkApproxEqual((label),(vec),(expected),(n),(c),(h),(w),(useFP16),__FILE__,#vec,__LINE__))
 
@@ -843,16 +849,470 @@ static void testGlobalPoolingResidualBlock(int64_t& numTestsRun) {
 
 }
 
+//Seeded random convolutions against a direct reference, on shapes and board sizes that don't divide evenly into
+//tiles. The backend checks each other algorithm it supports against its default one.
+static void testRandomConvLayer(int64_t& numTestsRun) {
+  Rand rand("testRandomConvLayer");
+
+  //convYSize, convXSize, dilationY, dilationX, inChannels, outChannels, batchSize, nnXLen, nnYLen
+  const int configs[][9] = {
+    {3,3,1,1, 5,7, 1, 9,9},
+    {3,3,1,1, 4,3, 3, 7,5},
+    {3,3,1,1, 3,6, 2, 19,19},
+    {3,3,2,2, 6,4, 2, 9,7},
+    {5,5,1,1, 3,5, 2, 8,6},
+    {1,1,1,1, 7,5, 3, 5,9},
+    {1,3,1,1, 4,4, 1, 6,7},
+  };
 
+  for(const int* config : configs) {
+    ConvLayerDesc desc;
+    desc.convYSize = config[0];
+    desc.convXSize = config[1];
+    desc.dilationY = config[2];
+    desc.dilationX = config[3];
+    desc.inChannels = config[4];
+    desc.outChannels = config[5];
+    int batchSize = config[6];
+    int nnXLen = config[7];
+    int nnYLen = config[8];
+    string label = Global::strprintf(
+      "Random conv %dx%d dilation %d ic %d oc %d batch %d board %dx%d",
+      desc.convYSize, desc.convXSize, desc.dilationY, desc.inChannels, desc.outChannels, batchSize, nnXLen, nnYLen
+    );
+    desc.name = label;
+
+    desc.weights.resize((size_t)desc.outChannels * desc.inChannels * desc.convYSize * desc.convXSize);
+    for(float& w : desc.weights)
+      w = (float)rand.nextGaussian() * 0.5f;
+    vector<float> input((size_t)batchSize * desc.inChannels * nnYLen * nnXLen);
+    for(float& v : input)
+      v = (float)rand.nextGaussian();
+
+    vector<float> expected((size_t)batchSize * desc.outChannels * nnYLen * nnXLen);
+    for(int n = 0; n < batchSize; n++) {
+      for(int oc = 0; oc < desc.outChannels; oc++) {
+        for(int y = 0; y < nnYLen; y++) {
+          for(int x = 0; x < nnXLen; x++) {
+            double sum = 0.0;
+            for(int ic = 0; ic < desc.inChannels; ic++) {
+              for(int dy = 0; dy < desc.convYSize; dy++) {
+                for(int dx = 0; dx < desc.convXSize; dx++) {
+                  int iy = y + (dy - desc.convYSize / 2) * desc.dilationY;
+                  int ix = x + (dx - desc.convXSize / 2) * desc.dilationX;
+                  if(iy < 0 || iy >= nnYLen || ix < 0 || ix >= nnXLen)
+                    continue;
+                  float w = desc.weights[((oc * desc.inChannels + ic) * desc.convYSize + dy) * desc.convXSize + dx];
+                  sum += (double)w * input[((n * desc.inChannels + ic) * nnYLen + iy) * nnXLen + ix];
+                }
+              }
+            }
+            expected[((n * desc.outChannels + oc) * nnYLen + y) * nnXLen + x] = (float)sum;
+          }
+        }
+      }
+    }
 
-void Tests::runNNLayerTests() {
-  NeuralNet::globalInitialize();
-  int64_t numTestsRun = 0;
+    for(int useNHWC = 0; useNHWC <= 1; useNHWC++) {
+      for(int useFP16 = 0; useFP16 <= 1; useFP16++) {
+        vector<float> inputThisLoop = useNHWC ? NCHWtoNHWC(input,batchSize,desc.inChannels,nnYLen,nnXLen) : input;
+        vector<float> expectedThisLoop = useNHWC ? NCHWtoNHWC(expected,batchSize,desc.outChannels,nnYLen,nnXLen) : expected;
+
+        vector<float> outputThisLoop;
+        bool supported = NeuralNet::testEvaluateConv(
+          &desc,batchSize,nnXLen,nnYLen,useFP16,useNHWC,inputThisLoop,outputThisLoop
+        );
+
+        if(supported) {
+          numTestsRun += 1;
+          string subLabel = label + Global::strprintf(" useNHWC %d useFP16 %d", useNHWC, useFP16);
+          if(useNHWC)
+            CHECK_APPROX_EQUAL(subLabel,outputThisLoop,expectedThisLoop,batchSize,nnYLen,nnXLen,desc.outChannels,useFP16);
+          else
+            CHECK_APPROX_EQUAL(subLabel,outputThisLoop,expectedThisLoop,batchSize,desc.outChannels,nnYLen,nnXLen,useFP16);
+        }
+      }
+    }
+  }
+}
+
+#ifdef USE_CPU_BACKEND
+//Every kernel on every instruction set this machine has, against the generic kernels on the same seeded inputs,
+//with sizes that leave partial panels and partial vectors.
+static void testCpuKernelsAgainstGeneric() {
+  Rand rand("testCpuKernelsAgainstGeneric");
+
+  const int m = 37;
+  const int k = 29;
+  const int n = 45;
+  vector<float> a((size_t)m * k);
+  vector<float> b((size_t)k * n);
+  vector<float> cInit((size_t)m * n);
+  for(float& v : a) v = (float)rand.nextGaussian();
+  for(float& v : b) v = (float)rand.nextGaussian();
+  for(float& v : cInit) v = (float)rand.nextGaussian();
+  CpuKernels::PackedMatrix packedB(b.data(), k, n, n);
+
+  vector<int8_t> b8((size_t)k * n);
+  for(int8_t& v : b8) v = (int8_t)((int)rand.nextUInt(255) - 127);
+  CpuKernels::PackedMatrixInt8 packedB8(b8.data(), k, n, n);
+  vector<uint8_t> a8((size_t)m * packedB8.paddedRows);
+  for(uint8_t& v : a8) v = (uint8_t)rand.nextUInt(256);
+  vector<float> colScales(n);
+  for(float& v : colScales) v = (float)rand.nextDouble(0.001, 0.01);
+
+  const size_t numPositions = 23;
+  const int numChannels = 21;
+  vector<float> in(numPositions * numChannels);
+  vector<float> scale(numChannels);
+  vector<float> bias(numChannels);
+  vector<float> mask(numPositions);
+  for(float& v : in) v = (float)rand.nextGaussian();
+  for(float& v : scale) v = (float)rand.nextGaussian();
+  for(float& v : bias) v = (float)rand.nextGaussian();
+  for(float& v : mask) v = (float)rand.nextUInt(2);
+
+  struct Outputs {
+    vector<float> sgemm;
+    vector<float> scaleBias;
+    vector<float> scaleBiasRelu;
+    vector<uint8_t> quantized;
+    vector<float> gemmU8S8;
+  };
+  auto runKernels = [&]() {
+    Outputs out;
+    out.sgemm = cInit;
+    CpuKernels::sgemmAccumulate(m, a.data(), k, packedB, out.sgemm.data(), n);
+    out.scaleBias.resize(in.size());
+    CpuKernels::scaleBiasMaskRelu(numPositions, numChannels, in.data(), scale.data(), bias.data(), NULL, false, out.scaleBias.data());
+    out.scaleBiasRelu = in;
+    CpuKernels::scaleBiasMaskRelu(
+      numPositions, numChannels, out.scaleBiasRelu.data(), scale.data(), bias.data(), mask.data(), true, out.scaleBiasRelu.data()
+    );
+    out.quantized.resize(in.size());
+    CpuKernels::quantizeU8(in.size(), in.data(), 50.0f, out.quantized.data());
+    out.gemmU8S8 = cInit;
+    CpuKernels::gemmU8S8Accumulate(m, a8.data(), packedB8.paddedRows, packedB8, colScales.data(), out.gemmU8S8.data(), n);
+    return out;
+  };
+
+  auto checkFloats = [](const string& label, const vector<float>& vec, const vector<float>& expected) {
+    testAssert(vec.size() == expected.size());
+    for(size_t i = 0; i<vec.size(); i++) {
+      if(!approxEqual(vec[i], expected[i], false)) {
+        cout << label << " gives " << vec[i] << " but generic gives " << expected[i] << " at " << i << endl;
+        testAssert(false);
+      }
+    }
+  };
+
+  vector<int> isas = CpuKernels::getSupportedInstructionSets();
+  CpuKernels::setMaxInstructionSetForTesting(CpuKernels::ISA_GENERIC);
+  Outputs expected = runKernels();
+  for(int isa : isas) {
+    CpuKernels::setMaxInstructionSetForTesting(isa);
+    Outputs out = runKernels();
+    string name = CpuKernels::getInstructionSetName(isa);
+    checkFloats(name + " sgemmAccumulate", out.sgemm, expected.sgemm);
+    checkFloats(name + " scaleBiasMaskRelu", out.scaleBias, expected.scaleBias);
+    checkFloats(name + " scaleBiasMaskRelu with mask and relu", out.scaleBiasRelu, expected.scaleBiasRelu);
+    testAssert(out.quantized == expected.quantized);
+    checkFloats(name + " gemmU8S8Accumulate", out.gemmU8S8, expected.gemmU8S8);
+  }
+  CpuKernels::setMaxInstructionSetForTesting(isas.back());
+}
+#endif
+
+static void testAllLayers(int64_t& numTestsRun) {
   testConvLayer(numTestsRun);
   testBatchNormLayer(numTestsRun);
   testResidualBlock(numTestsRun);
   testGlobalPoolingResidualBlock(numTestsRun);
+  testRandomConvLayer(numTestsRun);
+}
+
+void Tests::runNNLayerTests() {
+  NeuralNet::globalInitialize();
+  int64_t numTestsRun = 0;
+#ifdef USE_CPU_BACKEND
+  testCpuKernelsAgainstGeneric();
+  vector<int> isas = CpuKernels::getSupportedInstructionSets();
+  for(int isa : isas) {
+    CpuKernels::setMaxInstructionSetForTesting(isa);
+    cout << "Testing layers with " << CpuKernels::getInstructionSetName(isa) << " kernels" << endl;
+    testAllLayers(numTestsRun);
+  }
+  CpuKernels::setMaxInstructionSetForTesting(isas.back());
+#else
+  testAllLayers(numTestsRun);
+#endif
   NeuralNet::globalCleanup();
   cout << "Tested " << numTestsRun << " configurations" << endl;
   cout << "Done" << endl;
 }
+
+//Binary model round trip ---------------------------------------------------------------
+
+static void checkSameWeights(const string& name, const vector<float>& a, const vector<float>& b) {
+  if(a.size() != b.size() || (a.size() > 0 && std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) != 0)) {
+    cout << name << ": weights differ after a binary round trip" << endl;
+    testAssert(false);
+  }
+}
+
+static void checkSameDesc(const ConvLayerDesc& a, const ConvLayerDesc& b) {
+  testAssert(a.name == b.name);
+  testAssert(a.convYSize == b.convYSize && a.convXSize == b.convXSize);
+  testAssert(a.inChannels == b.inChannels && a.outChannels == b.outChannels);
+  testAssert(a.dilationY == b.dilationY && a.dilationX == b.dilationX);
+  checkSameWeights(a.name, a.weights, b.weights);
+}
+static void checkSameDesc(const BatchNormLayerDesc& a, const BatchNormLayerDesc& b) {
+  testAssert(a.name == b.name);
+  testAssert(a.numChannels == b.numChannels);
+  testAssert(std::memcmp(&a.epsilon, &b.epsilon, sizeof(float)) == 0);
+  testAssert(a.hasScale == b.hasScale && a.hasBias == b.hasBias);
+  checkSameWeights(a.name + " mean", a.mean, b.mean);
+  checkSameWeights(a.name + " variance", a.variance, b.variance);
+  checkSameWeights(a.name + " scale", a.scale, b.scale);
+  checkSameWeights(a.name + " bias", a.bias, b.bias);
+}
+static void checkSameDesc(const ActivationLayerDesc& a, const ActivationLayerDesc& b) {
+  testAssert(a.name == b.name);
+}
+static void checkSameDesc(const MatMulLayerDesc& a, const MatMulLayerDesc& b) {
+  testAssert(a.name == b.name);
+  testAssert(a.inChannels == b.inChannels && a.outChannels == b.outChannels);
+  checkSameWeights(a.name, a.weights, b.weights);
+}
+static void checkSameDesc(const MatBiasLayerDesc& a, const MatBiasLayerDesc& b) {
+  testAssert(a.name == b.name);
+  testAssert(a.numChannels == b.numChannels);
+  checkSameWeights(a.name, a.weights, b.weights);
+}
+static void checkSameDesc(const ResidualBlockDesc& a, const ResidualBlockDesc& b) {
+  testAssert(a.name == b.name);
+  checkSameDesc(a.preBN, b.preBN);
+  checkSameDesc(a.preActivation, b.preActivation);
+  checkSameDesc(a.regularConv, b.regularConv);
+  checkSameDesc(a.midBN, b.midBN);
+  checkSameDesc(a.midActivation, b.midActivation);
+  checkSameDesc(a.finalConv, b.finalConv);
+}
+static void checkSameDesc(const DilatedResidualBlockDesc& a, const DilatedResidualBlockDesc& b) {
+  testAssert(a.name == b.name);
+  checkSameDesc(a.preBN, b.preBN);
+  checkSameDesc(a.preActivation, b.preActivation);
+  checkSameDesc(a.regularConv, b.regularConv);
+  checkSameDesc(a.dilatedConv, b.dilatedConv);
+  checkSameDesc(a.midBN, b.midBN);
+  checkSameDesc(a.midActivation, b.midActivation);
+  checkSameDesc(a.finalConv, b.finalConv);
+}
+static void checkSameDesc(const GlobalPoolingResidualBlockDesc& a, const GlobalPoolingResidualBlockDesc& b) {
+  testAssert(a.name == b.name);
+  testAssert(a.version == b.version);
+  checkSameDesc(a.preBN, b.preBN);
+  checkSameDesc(a.preActivation, b.preActivation);
+  checkSameDesc(a.regularConv, b.regularConv);
+  checkSameDesc(a.gpoolConv, b.gpoolConv);
+  checkSameDesc(a.gpoolBN, b.gpoolBN);
+  checkSameDesc(a.gpoolActivation, b.gpoolActivation);
+  checkSameDesc(a.gpoolToBiasMul, b.gpoolToBiasMul);
+  checkSameDesc(a.midBN, b.midBN);
+  checkSameDesc(a.midActivation, b.midActivation);
+  checkSameDesc(a.finalConv, b.finalConv);
+}
+static void checkSameDesc(const TrunkDesc& a, const TrunkDesc& b) {
+  testAssert(a.name == b.name);
+  testAssert(a.version == b.version);
+  testAssert(a.numBlocks == b.numBlocks);
+  testAssert(a.trunkNumChannels == b.trunkNumChannels);
+  testAssert(a.midNumChannels == b.midNumChannels);
+  testAssert(a.regularNumChannels == b.regularNumChannels);
+  testAssert(a.dilatedNumChannels == b.dilatedNumChannels);
+  testAssert(a.gpoolNumChannels == b.gpoolNumChannels);
+  checkSameDesc(a.initialConv, b.initialConv);
+  checkSameDesc(a.initialMatMul, b.initialMatMul);
+  testAssert(a.blocks.size() == b.blocks.size());
+  for(size_t i = 0; i<a.blocks.size(); i++) {
+    testAssert(a.blocks[i].first == b.blocks[i].first);
+    if(a.blocks[i].first == ORDINARY_BLOCK_KIND)
+      checkSameDesc(*(const ResidualBlockDesc*)a.blocks[i].second, *(const ResidualBlockDesc*)b.blocks[i].second);
+    else if(a.blocks[i].first == DILATED_BLOCK_KIND)
+      checkSameDesc(*(const DilatedResidualBlockDesc*)a.blocks[i].second, *(const DilatedResidualBlockDesc*)b.blocks[i].second);
+    else if(a.blocks[i].first == GLOBAL_POOLING_BLOCK_KIND)
+      checkSameDesc(
+        *(const GlobalPoolingResidualBlockDesc*)a.blocks[i].second, *(const GlobalPoolingResidualBlockDesc*)b.blocks[i].second
+      );
+    else
+      testAssert(false);
+  }
+  checkSameDesc(a.trunkTipBN, b.trunkTipBN);
+  checkSameDesc(a.trunkTipActivation, b.trunkTipActivation);
+}
+static void checkSameDesc(const PolicyHeadDesc& a, const PolicyHeadDesc& b) {
+  testAssert(a.name == b.name);
+  testAssert(a.version == b.version);
+  checkSameDesc(a.p1Conv, b.p1Conv);
+  checkSameDesc(a.g1Conv, b.g1Conv);
+  checkSameDesc(a.g1BN, b.g1BN);
+  checkSameDesc(a.g1Activation, b.g1Activation);
+  checkSameDesc(a.gpoolToBiasMul, b.gpoolToBiasMul);
+  checkSameDesc(a.p1BN, b.p1BN);
+  checkSameDesc(a.p1Activation, b.p1Activation);
+  checkSameDesc(a.p2Conv, b.p2Conv);
+  checkSameDesc(a.gpoolToPassMul, b.gpoolToPassMul);
+}
+static void checkSameDesc(const ValueHeadDesc& a, const ValueHeadDesc& b) {
+  testAssert(a.name == b.name);
+  testAssert(a.version == b.version);
+  checkSameDesc(a.v1Conv, b.v1Conv);
+  checkSameDesc(a.v1BN, b.v1BN);
+  checkSameDesc(a.v1Activation, b.v1Activation);
+  checkSameDesc(a.v2Mul, b.v2Mul);
+  checkSameDesc(a.v2Bias, b.v2Bias);
+  checkSameDesc(a.v2Activation, b.v2Activation);
+  checkSameDesc(a.v3Mul, b.v3Mul);
+  checkSameDesc(a.v3Bias, b.v3Bias);
+  checkSameDesc(a.sv3Mul, b.sv3Mul);
+  checkSameDesc(a.sv3Bias, b.sv3Bias);
+  checkSameDesc(a.vOwnershipConv, b.vOwnershipConv);
+}
+static void checkSameDesc(const ModelDesc& a, const ModelDesc& b) {
+  testAssert(a.name == b.name);
+  testAssert(a.version == b.version);
+  testAssert(a.xSizePreV3 == b.xSizePreV3 && a.ySizePreV3 == b.ySizePreV3);
+  testAssert(a.numInputChannels == b.numInputChannels);
+  testAssert(a.numInputGlobalChannels == b.numInputGlobalChannels);
+  testAssert(a.numValueChannels == b.numValueChannels);
+  testAssert(a.numScoreValueChannels == b.numScoreValueChannels);
+  testAssert(a.numOwnershipChannels == b.numOwnershipChannels);
+  checkSameDesc(a.trunk, b.trunk);
+  checkSameDesc(a.policyHead, b.policyHead);
+  checkSameDesc(a.valueHead, b.valueHead);
+}
+
+//A small text model with seeded random weights, with one block of each kind
+static string makeRandomTextModel(Rand& rand) {
+  ostringstream out;
+  auto weights = [&](int n, bool positive) {
+    for(int i = 0; i<n; i++) {
+      double w = rand.nextGaussian() * 0.1;
+      out << (i > 0 ? " " : "") << Global::strprintf("%.9g", positive ? std::fabs(w) + 0.5 : w);
+    }
+    out << "\n";
+  };
+  auto conv = [&](const string& name, int k, int ic, int oc, int dilation) {
+    out << name << " " << k << " " << k << " " << ic << " " << oc << " " << dilation << " " << dilation << "\n";
+    weights(k * k * ic * oc, false);
+  };
+  auto bn = [&](const string& name, int c, bool hasScale, bool hasBias) {
+    out << name << " " << c << " 0.001 " << (int)hasScale << " " << (int)hasBias << "\n";
+    weights(c, false);
+    weights(c, true);
+    if(hasScale)
+      weights(c, true);
+    if(hasBias)
+      weights(c, false);
+  };
+  auto act = [&](const string& name) { out << name << "\n"; };
+  auto matMul = [&](const string& name, int ic, int oc) {
+    out << name << " " << ic << " " << oc << "\n";
+    weights(ic * oc, false);
+  };
+  auto matBias = [&](const string& name, int c) {
+    out << name << " " << c << "\n";
+    weights(c, false);
+  };
+
+  const int c = 8;
+  const int regular = 6;
+  const int dilated = 2;
+  const int gpool = 4;
+  out << "binarytest 6 13 12\n";
+  out << "trunk 3 " << c << " " << regular + dilated << " " << regular << " " << dilated << " " << gpool << "\n";
+  conv("conv1", 5, 13, c, 1);
+  matMul("ginputmatmul", 12, c);
+
+  out << "ordinary_block\nblock0\n";
+  bn("block0/norm1", c, true, true);
+  act("block0/act1");
+  conv("block0/w1", 3, c, regular + dilated, 1);
+  bn("block0/norm2", regular + dilated, false, true);
+  act("block0/act2");
+  conv("block0/w2", 3, regular + dilated, c, 1);
+
+  out << "dilated_block\nblock1\n";
+  bn("block1/norm1", c, true, false);
+  act("block1/act1");
+  conv("block1/w1", 3, c, regular, 1);
+  conv("block1/w1d", 3, c, dilated, 2);
+  bn("block1/norm2", regular + dilated, true, true);
+  act("block1/act2");
+  conv("block1/w2", 3, regular + dilated, c, 1);
+
+  out << "gpool_block\nblock2\n";
+  bn("block2/norm1", c, true, true);
+  act("block2/act1");
+  conv("block2/w1", 3, c, regular, 1);
+  conv("block2/w1b", 3, c, gpool, 1);
+  bn("block2/normg", gpool, true, true);
+  act("block2/actg");
+  matMul("block2/gmat", 3 * gpool, regular);
+  bn("block2/norm2", regular, true, true);
+  act("block2/act2");
+  conv("block2/w2", 3, regular, c, 1);
+
+  bn("trunk/norm", c, true, true);
+  act("trunk/act");
+
+  const int policy = 4;
+  out << "policyhead\n";
+  conv("p1", 1, c, policy, 1);
+  conv("g1", 1, c, gpool, 1);
+  bn("g1bn", gpool, true, true);
+  act("g1act");
+  matMul("gtob", 3 * gpool, policy);
+  bn("p1bn", policy, true, true);
+  act("p1act");
+  conv("p2", 1, policy, 1, 1);
+  matMul("gtopass", 3 * gpool, 1);
+
+  const int value = 4;
+  const int valueMid = 8;
+  out << "valuehead\n";
+  conv("v1", 1, c, value, 1);
+  bn("v1bn", value, true, true);
+  act("v1act");
+  matMul("v2", 3 * value, valueMid);
+  matBias("v2b", valueMid);
+  act("v2act");
+  matMul("v3", valueMid, 3);
+  matBias("v3b", 3);
+  matMul("sv3", valueMid, 2);
+  matBias("sv3b", 2);
+  conv("vown", 1, value, 1, 1);
+  return out.str();
+}
+
+void Tests::runNNModelBinaryTests() {
+  cout << "Running binary model round trip tests" << endl;
+  Rand rand("runNNModelBinaryTests");
+  istringstream in(makeRandomTextModel(rand));
+  ModelDesc textDesc(in);
+
+  const string path = "nnmodelbinarytest.bin.tmp";
+  const string path2 = "nnmodelbinarytest2.bin.tmp";
+  textDesc.saveToBinaryFile(path, false);
+  ModelDesc binaryDesc;
+  ModelDesc::loadFromFileMaybeGZipped(path, binaryDesc);
+  checkSameDesc(textDesc, binaryDesc);
+
+  //Saving what was loaded gives back the same file
+  binaryDesc.saveToBinaryFile(path2, false);
+  testAssert(Global::readFile(path) == Global::readFile(path2));
+
+  std::remove(path.c_str());
+  std::remove(path2.c_str());
+}
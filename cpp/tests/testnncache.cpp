@@ -0,0 +1,592 @@
+#include "../tests/tests.h"
+
+#include <fstream>
+
+#include "../neuralnet/nndiskcache.h"
+#include "../neuralnet/nneval.h"
+#include "../neuralnet/nnsharedcache.h"
+#include "../neuralnet/nntunecache.h"
+
+using namespace std;
+
+static shared_ptr<NNOutput> makeCacheTestOutput(Hash128 nnHash) {
+  shared_ptr<NNOutput> output = NNOutputPool::makeShared();
+  output->nnHash = nnHash;
+  //Something checkable that depends on the hash
+  output->whiteWinProb = (float)(nnHash.hash1 % 1000) / 1000.0f;
+  output->whiteLossProb = 1.0f - output->whiteWinProb;
+  output->whiteNoResultProb = 0.0f;
+  output->whiteScoreMean = 0.0f;
+  output->whiteScoreMeanSq = 0.0f;
+  output->nnXLen = 9;
+  output->nnYLen = 9;
+  std::fill(output->policyProbs, output->policyProbs + NNPos::MAX_NN_POLICY_SIZE, -1.0f);
+  output->policyProbs[NNPos::xyToPos(4,4,9)] = 0.75f;
+  output->policyProbs[NNPos::locToPos(Board::PASS_LOC,9,9,9)] = 0.25f;
+  return output;
+}
+
+static bool cacheHas(NNCacheTable& table, Hash128 nnHash) {
+  shared_ptr<NNOutput> buf;
+  bool found = table.get(nnHash,buf);
+  testAssert(found == (buf != nullptr));
+  if(found)
+    testAssert(buf->nnHash == nnHash);
+  return found;
+}
+
+void Tests::runNNCacheTableTests() {
+  cout << "Running nn cache table tests" << endl;
+
+  for(int compress = 0; compress <= 1; compress++) {
+    //Lots of sets, nothing should collide
+    {
+      NNCacheTable table(10, 4, compress == 1, 0);
+      for(uint64_t i = 0; i<100; i++)
+        table.set(makeCacheTestOutput(Hash128(i * 0x9E3779B97F4A7C15ULL, i+1)), 9, 9, 0);
+      for(uint64_t i = 0; i<100; i++) {
+        Hash128 nnHash(i * 0x9E3779B97F4A7C15ULL, i+1);
+        shared_ptr<NNOutput> buf;
+        testAssert(table.get(nnHash,buf));
+        testAssert(buf->whiteWinProb == makeCacheTestOutput(nnHash)->whiteWinProb);
+        testAssert(buf->policyProbs[NNPos::xyToPos(4,4,9)] == 0.75f);
+        testAssert(buf->policyProbs[NNPos::xyToPos(3,4,9)] < 0);
+        testAssert(!cacheHas(table, Hash128(i * 0x9E3779B97F4A7C15ULL, i+1000)));
+      }
+      testAssert(table.getNumInserts() == 100);
+      testAssert(table.getNumLookups() == 200);
+      testAssert(table.getNumHits() == 100);
+      testAssert(table.getNumEvictions() == 0);
+
+      table.clear();
+      testAssert(!cacheHas(table, Hash128(0,1)));
+      table.clearStats();
+      testAssert(table.getNumLookups() == 0);
+    }
+  }
+
+  //A single set, all of whose ways are usable, and which evicts the entry with the fewest recent hits
+  {
+    NNCacheTable table(2, 0, false, 0);
+    int deep = 10;
+    for(uint64_t i = 0; i<NNCacheTable::NUM_WAYS; i++)
+      table.set(makeCacheTestOutput(Hash128(0, i+1)), 9, 9, deep);
+    for(uint64_t i = 0; i<NNCacheTable::NUM_WAYS; i++)
+      testAssert(cacheHas(table, Hash128(0, i+1)));
+    //Hit all but the last one a few more times
+    for(int rep = 0; rep<3; rep++) {
+      for(uint64_t i = 0; i+1<NNCacheTable::NUM_WAYS; i++)
+        testAssert(cacheHas(table, Hash128(0, i+1)));
+    }
+    table.set(makeCacheTestOutput(Hash128(0, 100)), 9, 9, deep);
+    testAssert(table.getNumEvictions() == 1);
+    testAssert(cacheHas(table, Hash128(0, 100)));
+    testAssert(!cacheHas(table, Hash128(0, NNCacheTable::NUM_WAYS)));
+    for(uint64_t i = 0; i+1<NNCacheTable::NUM_WAYS; i++)
+      testAssert(cacheHas(table, Hash128(0, i+1)));
+
+    //Replacing the same position doesn't evict anything
+    table.set(makeCacheTestOutput(Hash128(0, 100)), 9, 9, deep);
+    testAssert(table.getNumEvictions() == 1);
+  }
+
+  //Entries near the root are kept over deeper ones with as many hits
+  {
+    NNCacheTable table(2, 0, false, 0);
+    table.set(makeCacheTestOutput(Hash128(0, 1)), 9, 9, 0);
+    for(uint64_t i = 1; i<NNCacheTable::NUM_WAYS; i++)
+      table.set(makeCacheTestOutput(Hash128(0, i+1)), 9, 9, 10);
+    for(uint64_t i = 0; i<NNCacheTable::NUM_WAYS; i++)
+      testAssert(cacheHas(table, Hash128(0, i+1)));
+    for(uint64_t i = 0; i<NNCacheTable::NUM_WAYS; i++)
+      table.set(makeCacheTestOutput(Hash128(0, i+100)), 9, 9, 10);
+    testAssert(cacheHas(table, Hash128(0, 1)));
+    for(uint64_t i = 1; i<NNCacheTable::NUM_WAYS; i++)
+      testAssert(!cacheHas(table, Hash128(0, i+1)));
+  }
+
+  //Concurrent lookups and inserts of a small set of positions in a small table, so that entries get replaced
+  //while others are still reading them
+  {
+    NNCacheTable table(4, 2, false, 0);
+    const int numThreads = 4;
+    const int numOpsPerThread = 20000;
+    vector<std::thread> threads;
+    std::atomic<int64_t> numFound(0);
+    for(int t = 0; t<numThreads; t++) {
+      threads.push_back(std::thread([&,t]() {
+        Rand rand("nn cache table tests " + Global::intToString(t));
+        shared_ptr<NNOutput> buf;
+        int64_t found = 0;
+        for(int i = 0; i<numOpsPerThread; i++) {
+          Hash128 nnHash(rand.nextUInt(8), rand.nextUInt(64) + 1);
+          if(table.get(nnHash,buf)) {
+            testAssert(buf->nnHash == nnHash);
+            testAssert(buf->whiteWinProb == (float)(nnHash.hash1 % 1000) / 1000.0f);
+            found++;
+          }
+          else
+            table.set(makeCacheTestOutput(nnHash), 9, 9, (int)rand.nextUInt(8));
+        }
+        numFound.fetch_add(found);
+      }));
+    }
+    for(int t = 0; t<numThreads; t++)
+      threads[t].join();
+    testAssert(table.getNumLookups() == (uint64_t)numThreads * numOpsPerThread);
+    testAssert(table.getNumHits() == (uint64_t)numFound.load());
+    testAssert(table.getNumInserts() == table.getNumLookups() - table.getNumHits());
+    testAssert(table.getNumEvictions() > 0);
+  }
+}
+
+void Tests::runNNDiskCacheTests() {
+  cout << "Running nn disk cache tests" << endl;
+
+  const string path = "nndiskcachetest.bin.tmp";
+  std::remove(path.c_str());
+  const int64_t maxBytes = NNDiskCache::MIN_BYTES;
+  const Hash128 salt(123, 456);
+
+  auto checkHas = [](NNDiskCache& cache, Hash128 nnHash, bool expectOwnerMap) {
+    shared_ptr<NNOutput> buf;
+    bool found = cache.get(nnHash,expectOwnerMap,buf);
+    testAssert(found == (buf != nullptr));
+    if(!found)
+      return false;
+    testAssert(buf->nnHash == nnHash);
+    testAssert(buf->whiteWinProb == makeCacheTestOutput(nnHash)->whiteWinProb);
+    testAssert(buf->policyProbs[NNPos::xyToPos(4,4,9)] == 0.75f);
+    testAssert(buf->policyProbs[NNPos::xyToPos(3,4,9)] < 0);
+    testAssert((buf->whiteOwnerMap != NULL) == expectOwnerMap);
+    return true;
+  };
+
+  //Entries are found again, including by another instance that can only read, and after reopening
+  {
+    NNDiskCache cache(path, maxBytes, false, salt, 0, NULL);
+    testAssert(cache.isWritable());
+    for(uint64_t i = 0; i<100; i++)
+      cache.set(*makeCacheTestOutput(Hash128(i * 0x9E3779B97F4A7C15ULL, i+1)), 9, 9);
+    shared_ptr<NNOutput> withOwnerMap = makeCacheTestOutput(Hash128(7777, 8888));
+    withOwnerMap->whiteOwnerMap = NNOutputPool::allocOwnerMap();
+    std::fill(withOwnerMap->whiteOwnerMap, withOwnerMap->whiteOwnerMap + 81, 1.0f);
+    cache.set(*withOwnerMap, 9, 9);
+    testAssert(cache.getNumInserts() == 101);
+    testAssert(cache.getNumEntries() == 101);
+
+    for(uint64_t i = 0; i<100; i++) {
+      testAssert(checkHas(cache, Hash128(i * 0x9E3779B97F4A7C15ULL, i+1), false));
+      testAssert(!checkHas(cache, Hash128(i * 0x9E3779B97F4A7C15ULL, i+1000), false));
+    }
+    testAssert(checkHas(cache, Hash128(7777, 8888), true));
+    //Asking without an owner map still finds the one with
+    shared_ptr<NNOutput> buf;
+    testAssert(cache.get(Hash128(7777, 8888),false,buf));
+    testAssert(buf->whiteOwnerMap != NULL && buf->whiteOwnerMap[0] == 1.0f);
+
+    NNDiskCache reader(path, maxBytes, false, salt, 0, NULL);
+    testAssert(!reader.isWritable());
+    testAssert(reader.getNumEntries() == 101);
+    testAssert(checkHas(reader, Hash128(0, 1), false));
+    //Sees new entries right away, and can't add its own
+    cache.set(*makeCacheTestOutput(Hash128(5555, 5555)), 9, 9);
+    testAssert(checkHas(reader, Hash128(5555, 5555), false));
+    reader.set(*makeCacheTestOutput(Hash128(6666, 6666)), 9, 9);
+    testAssert(!checkHas(cache, Hash128(6666, 6666), false));
+  }
+  {
+    NNDiskCache cache(path, maxBytes, true, salt, 0, NULL);
+    testAssert(!cache.isWritable());
+    testAssert(cache.getNumEntries() == 102);
+    for(uint64_t i = 0; i<100; i++)
+      testAssert(checkHas(cache, Hash128(i * 0x9E3779B97F4A7C15ULL, i+1), false));
+    testAssert(cache.getNumLookups() == 100 && cache.getNumHits() == 100);
+
+    //Different models don't see each other's entries
+    NNDiskCache otherModel(path, maxBytes, true, Hash128(123, 457), 0, NULL);
+    testAssert(!checkHas(otherModel, Hash128(0, 1), false));
+  }
+
+  //A damaged record is simply not found
+  {
+    //The first record starts right after the header and index, and its payload after its own 32 byte header
+    std::fstream out(path, std::ios::in | std::ios::out | std::ios::binary);
+    out.seekp(64 + (maxBytes / 512) * 24 + 32 + 20);
+    out.put((char)0x55);
+    out.close();
+    NNDiskCache cache(path, maxBytes, true, salt, 0, NULL);
+    testAssert(!checkHas(cache, Hash128(0, 1), false));
+    testAssert(checkHas(cache, Hash128(0x9E3779B97F4A7C15ULL, 2), false));
+  }
+
+  auto getFileSize = [&]() {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    return (int64_t)in.tellg();
+  };
+
+  //Opening with a different size keeps an existing file and its entries as they are
+  {
+    NNDiskCache cache(path, maxBytes * 2, false, salt, 0, NULL);
+    testAssert(cache.isWritable());
+    testAssert(cache.getNumEntries() == 102);
+    testAssert(checkHas(cache, Hash128(0x9E3779B97F4A7C15ULL, 2), false));
+    testAssert(checkHas(cache, Hash128(5555, 5555), false));
+    cache.set(*makeCacheTestOutput(Hash128(4444, 4444)), 9, 9);
+    testAssert(checkHas(cache, Hash128(4444, 4444), false));
+  }
+  testAssert(getFileSize() == maxBytes);
+
+  //A file that isn't a valid cache is resized and started over, and once full no more entries are added
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "not a cache";
+    out.close();
+    NNDiskCache cache(path, maxBytes * 2, false, salt, 0, NULL);
+    testAssert(cache.getNumEntries() == 0);
+    testAssert(!checkHas(cache, Hash128(0x9E3779B97F4A7C15ULL, 2), false));
+    uint64_t i = 0;
+    while(cache.getNumInsertsDropped() < 100) {
+      cache.set(*makeCacheTestOutput(Hash128(i * 0x9E3779B97F4A7C15ULL, i+1)), 9, 9);
+      i++;
+    }
+    testAssert(cache.getNumEntries() > 1000);
+    testAssert(cache.getNumEntries() == cache.getNumInserts());
+    testAssert(checkHas(cache, Hash128(0, 1), false));
+  }
+  testAssert(getFileSize() == maxBytes * 2);
+
+  std::remove(path.c_str());
+
+  bool threw = false;
+  try {
+    NNDiskCache cache(path, maxBytes, true, salt, 0, NULL);
+  }
+  catch(const StringError&) {
+    threw = true;
+  }
+  testAssert(threw);
+}
+
+void Tests::runNNSharedCacheTests() {
+  cout << "Running nn shared cache tests" << endl;
+
+  //Unique per process, in case several run the tests at once
+  Rand nameRand;
+  const string name = "katago-nnsharedcache-test-" + Global::uint64ToString(nameRand.nextUInt64());
+  SharedMemory::remove(name);
+  const int64_t maxBytes = NNSharedCache::MIN_BYTES;
+  const Hash128 salt(123, 456);
+
+  auto checkHas = [](NNSharedCache& cache, Hash128 nnHash) {
+    shared_ptr<NNOutput> buf;
+    bool found = cache.get(nnHash,buf);
+    testAssert(found == (buf != nullptr));
+    if(!found)
+      return false;
+    testAssert(buf->nnHash == nnHash);
+    testAssert(buf->whiteWinProb == makeCacheTestOutput(nnHash)->whiteWinProb);
+    testAssert(buf->policyProbs[NNPos::xyToPos(4,4,9)] == 0.75f);
+    testAssert(buf->policyProbs[NNPos::xyToPos(3,4,9)] < 0);
+    return true;
+  };
+
+  {
+    //Two instances on the same region, as if in two processes
+    NNSharedCache cache(name, maxBytes, salt, 0, NULL);
+    NNSharedCache other(name, maxBytes, salt, 0, NULL);
+    for(uint64_t i = 0; i<100; i++)
+      cache.set(*makeCacheTestOutput(Hash128(i * 0x9E3779B97F4A7C15ULL, i+1)), 9, 9);
+    testAssert(cache.getNumInserts() == 100);
+    for(uint64_t i = 0; i<100; i++) {
+      testAssert(checkHas(other, Hash128(i * 0x9E3779B97F4A7C15ULL, i+1)));
+      testAssert(!checkHas(other, Hash128(i * 0x9E3779B97F4A7C15ULL, i+1000)));
+    }
+    testAssert(other.getNumLookups() == 200 && other.getNumHits() == 100);
+
+    //Setting the same position again does nothing, unless it adds an owner map
+    other.set(*makeCacheTestOutput(Hash128(0, 1)), 9, 9);
+    testAssert(other.getNumInserts() == 0);
+    shared_ptr<NNOutput> withOwnerMap = makeCacheTestOutput(Hash128(0, 1));
+    withOwnerMap->whiteOwnerMap = NNOutputPool::allocOwnerMap();
+    std::fill(withOwnerMap->whiteOwnerMap, withOwnerMap->whiteOwnerMap + 81, -1.0f);
+    other.set(*withOwnerMap, 9, 9);
+    testAssert(other.getNumInserts() == 1);
+    shared_ptr<NNOutput> buf;
+    testAssert(cache.get(Hash128(0, 1),buf));
+    testAssert(buf->whiteOwnerMap != NULL && buf->whiteOwnerMap[80] == -1.0f);
+
+    //A different model doesn't see these, and replaces them before its own entries
+    NNSharedCache otherModel(name, maxBytes, Hash128(123, 457), 0, NULL);
+    testAssert(!checkHas(otherModel, Hash128(0, 1)));
+    for(uint64_t i = 0; i<NNSharedCache::NUM_WAYS; i++)
+      otherModel.set(*makeCacheTestOutput(Hash128(0, i+1000)), 9, 9);
+    for(uint64_t i = 0; i<NNSharedCache::NUM_WAYS; i++)
+      testAssert(checkHas(otherModel, Hash128(0, i+1000)));
+    testAssert(!checkHas(cache, Hash128(0, 1)));
+
+    //Mismatched sizes are refused
+    bool threw = false;
+    try {
+      NNSharedCache wrongSize(name, maxBytes * 2, salt, 0, NULL);
+    }
+    catch(const StringError&) {
+      threw = true;
+    }
+    testAssert(threw);
+  }
+
+  //Once the last user is gone, the region and its entries are still there until removed
+  {
+    NNSharedCache cache(name, maxBytes, salt, 0, NULL);
+    testAssert(checkHas(cache, Hash128(0x9E3779B97F4A7C15ULL, 2)));
+  }
+  testAssert(SharedMemory::remove(name));
+  {
+    NNSharedCache cache(name, maxBytes, salt, 0, NULL);
+    testAssert(!checkHas(cache, Hash128(0x9E3779B97F4A7C15ULL, 2)));
+  }
+  testAssert(SharedMemory::remove(name));
+
+  //A slot left mid-write by a writer that died is skipped at first, then taken over once it stays that way
+  {
+    NNSharedCache cache(name, maxBytes, salt, 0, NULL);
+    {
+      //The sequence number of the first slot of set 0, just past the header
+      SharedMemory raw(name, (size_t)maxBytes, true);
+      ((std::atomic<uint64_t>*)(raw.data + 64))->store(7);
+    }
+    cache.set(*makeCacheTestOutput(Hash128(0, 1)), 9, 9);
+    testAssert(cache.getNumInserts() == 0 && cache.getNumContentions() == 1);
+    testAssert(!checkHas(cache, Hash128(0, 1)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(NNSharedCache::STALLED_WRITE_MS + 100));
+    cache.set(*makeCacheTestOutput(Hash128(0, 1)), 9, 9);
+    testAssert(cache.getNumInserts() == 1 && cache.getNumTakeovers() == 1);
+    testAssert(checkHas(cache, Hash128(0, 1)));
+
+    //If the writer was only stopped and resumes writing its own entry over that, the slot is never returned mixed
+    {
+      SharedMemory raw(name, (size_t)maxBytes, true);
+      ((std::atomic<uint64_t>*)(raw.data + 64))[9].fetch_xor(0x10);
+    }
+    testAssert(!checkHas(cache, Hash128(0, 1)));
+  }
+  testAssert(SharedMemory::remove(name));
+
+  //Regions that must already exist are only opened, at exactly the size they were created with
+  {
+    string otherName = name + "-mustexist";
+    bool threw = false;
+    try {
+      SharedMemory missing(otherName, 4096, true);
+    }
+    catch(const StringError&) {
+      threw = true;
+    }
+    testAssert(threw);
+
+    SharedMemory created(otherName, 4096, false);
+    created.data[17] = 5;
+    {
+      SharedMemory opened(otherName, 4096, true);
+      testAssert(opened.data[17] == 5);
+    }
+    threw = false;
+    try {
+      SharedMemory wrongSize(otherName, 8192, true);
+    }
+    catch(const StringError&) {
+      threw = true;
+    }
+    testAssert(threw);
+    testAssert(SharedMemory::remove(otherName));
+
+    //Many opening a new region at once all get it at the right size, only one of them creating it
+    vector<std::thread> threads;
+    for(int t = 0; t<8; t++) {
+      threads.push_back(std::thread([&]() {
+        SharedMemory racing(otherName, 4096, false);
+        testAssert(racing.size == 4096);
+        racing.data[4095] = 1;
+      }));
+    }
+    for(std::thread& thread: threads)
+      thread.join();
+    testAssert(SharedMemory::remove(otherName));
+  }
+
+  //Concurrent lookups and inserts through several instances of a small region, so that slots get overwritten
+  //while others are reading them
+  {
+    const int numThreads = 4;
+    const int numOpsPerThread = 20000;
+    vector<NNSharedCache*> caches;
+    for(int t = 0; t<numThreads; t++)
+      caches.push_back(new NNSharedCache(name, maxBytes, salt, 0, NULL));
+    vector<std::thread> threads;
+    for(int t = 0; t<numThreads; t++) {
+      threads.push_back(std::thread([&,t]() {
+        Rand rand("nn shared cache tests " + Global::intToString(t));
+        shared_ptr<NNOutput> buf;
+        for(int i = 0; i<numOpsPerThread; i++) {
+          //Few enough sets that they fill up and get replaced
+          Hash128 nnHash(rand.nextUInt(4), rand.nextUInt(64) + 1);
+          if(caches[t]->get(nnHash,buf)) {
+            testAssert(buf->nnHash == nnHash);
+            testAssert(buf->whiteWinProb == (float)(nnHash.hash1 % 1000) / 1000.0f);
+          }
+          else
+            caches[t]->set(*makeCacheTestOutput(nnHash), 9, 9);
+        }
+      }));
+    }
+    uint64_t numHits = 0;
+    for(int t = 0; t<numThreads; t++) {
+      threads[t].join();
+      numHits += caches[t]->getNumHits();
+      delete caches[t];
+    }
+    testAssert(numHits > 0);
+  }
+  SharedMemory::remove(name);
+}
+
+void Tests::runNNInFlightTableTests() {
+  cout << "Running nn in-flight table tests" << endl;
+
+  //Later joins for the same position wait on the first, and get its result once it finishes
+  {
+    NNInFlightTable table;
+    Hash128 nnHash(5, 6);
+    bool isOwner;
+    shared_ptr<NNInFlightTable::Eval> owned = table.join(nnHash, false, false, isOwner);
+    testAssert(isOwner);
+    shared_ptr<NNInFlightTable::Eval> other = table.join(Hash128(5, 7), false, false, isOwner);
+    testAssert(isOwner);
+
+    const int numWaiters = 4;
+    vector<shared_ptr<NNInFlightTable::Eval>> joined;
+    for(int i = 0; i<numWaiters; i++) {
+      joined.push_back(table.join(nnHash, false, false, isOwner));
+      testAssert(!isOwner);
+      testAssert(joined[i] == owned);
+    }
+    testAssert(table.getNumCoalesced() == numWaiters);
+
+    vector<shared_ptr<NNOutput>> results(numWaiters);
+    vector<std::thread> threads;
+    for(int i = 0; i<numWaiters; i++)
+      threads.push_back(std::thread([&,i]() { results[i] = table.wait(*joined[i]); }));
+    shared_ptr<NNOutput> result = makeCacheTestOutput(nnHash);
+    table.finish(owned, result);
+    for(int i = 0; i<numWaiters; i++) {
+      threads[i].join();
+      testAssert(results[i] == result);
+    }
+
+    //Once finished, the next join evaluates afresh
+    shared_ptr<NNInFlightTable::Eval> again = table.join(nnHash, false, false, isOwner);
+    testAssert(isOwner);
+    testAssert(again != owned);
+    table.finish(again, result);
+    table.finish(other, nullptr);
+
+    table.clearStats();
+    testAssert(table.getNumCoalesced() == 0);
+  }
+
+  //Only evaluations that include an owner map are shared with joins that need one
+  {
+    NNInFlightTable table;
+    Hash128 nnHash(5, 6);
+    bool isOwner;
+    shared_ptr<NNInFlightTable::Eval> withoutOwnerMap = table.join(nnHash, false, false, isOwner);
+    testAssert(isOwner);
+    shared_ptr<NNInFlightTable::Eval> withOwnerMap = table.join(nnHash, true, false, isOwner);
+    testAssert(isOwner);
+    testAssert(table.join(nnHash, false, false, isOwner) == withoutOwnerMap && !isOwner);
+    //Finishing the one not in the table leaves the other there
+    table.finish(withOwnerMap, nullptr);
+    testAssert(table.join(nnHash, false, false, isOwner) == withoutOwnerMap && !isOwner);
+    table.finish(withoutOwnerMap, nullptr);
+
+    withOwnerMap = table.join(nnHash, true, false, isOwner);
+    testAssert(isOwner);
+    testAssert(table.join(nnHash, false, false, isOwner) == withOwnerMap && !isOwner);
+    testAssert(table.join(nnHash, true, false, isOwner) == withOwnerMap && !isOwner);
+
+    //Failures are passed on as nullptr
+    table.finish(withOwnerMap, nullptr);
+    testAssert(table.wait(*withOwnerMap) == nullptr);
+  }
+
+  //Synchronous joins never wait on asynchronous evaluations, which might be their own, but asynchronous ones may
+  //wait on anything, and get pushed onto their completion queues once it's done
+  {
+    NNInFlightTable table;
+    Hash128 nnHash(5, 6);
+    bool isOwner;
+    shared_ptr<NNInFlightTable::Eval> async = table.join(nnHash, false, true, isOwner);
+    testAssert(isOwner);
+    shared_ptr<NNInFlightTable::Eval> sync = table.join(nnHash, false, false, isOwner);
+    testAssert(isOwner && sync != async);
+    table.finish(sync, nullptr);
+    testAssert(table.join(nnHash, false, true, isOwner) == async && !isOwner);
+
+    NNCompletionQueue completionQueue;
+    NNResultBuf waiterBuf;
+    waiterBuf.completionQueue = &completionQueue;
+    testAssert(table.addAsyncWaiter(*async, &waiterBuf));
+    testAssert(completionQueue.size() == 0);
+    shared_ptr<NNOutput> result = makeCacheTestOutput(nnHash);
+    table.finish(async, result);
+    NNResultBuf* popped;
+    testAssert(completionQueue.tryPop(popped));
+    testAssert(popped == &waiterBuf && waiterBuf.hasResult && waiterBuf.result == result);
+    testAssert(!table.addAsyncWaiter(*async, &waiterBuf));
+  }
+}
+
+void Tests::runNNTuneCacheTests() {
+  cout << "Running nn tune cache tests" << endl;
+
+  const string path = "nntunecachetest.txt.tmp";
+  std::remove(path.c_str());
+
+  //Results are found again after reopening, with the last one set for a key winning
+  {
+    NNTuneCache cache(path, NULL);
+    string value;
+    testAssert(!cache.get("cpu avx2 Some Cpu conv 3x3 batch 1", value));
+    cache.set("cpu avx2 Some Cpu conv 3x3 batch 1", "winograd");
+    cache.set("cpu avx2 Some Cpu conv 3x3 batch 8", "im2col");
+    cache.set("cpu avx2 Some Cpu conv 3x3 batch 1", "direct");
+    testAssert(cache.get("cpu avx2 Some Cpu conv 3x3 batch 1", value) && value == "direct");
+  }
+  {
+    NNTuneCache cache(path, NULL);
+    string value;
+    testAssert(cache.get("cpu avx2 Some Cpu conv 3x3 batch 1", value) && value == "direct");
+    testAssert(cache.get("cpu avx2 Some Cpu conv 3x3 batch 8", value) && value == "im2col");
+    testAssert(!cache.get("cpu avx2 Some Cpu conv 3x3", value));
+  }
+
+  //A line cut short by a process dying while appending only spoils that line and the one run onto it
+  {
+    ofstream out(path, ios::app);
+    out << "winograd cpu avx2 Some Cpu conv 5x5 ba";
+    out.close();
+    NNTuneCache cache(path, NULL);
+    cache.set("cpu avx2 Some Cpu conv 5x5 batch 2", "im2col");
+    cache.set("cpu avx2 Some Cpu conv 5x5 batch 4", "direct");
+  }
+  {
+    NNTuneCache cache(path, NULL);
+    string value;
+    testAssert(cache.get("cpu avx2 Some Cpu conv 3x3 batch 8", value) && value == "im2col");
+    testAssert(!cache.get("cpu avx2 Some Cpu conv 5x5 batch 2", value));
+    testAssert(cache.get("cpu avx2 Some Cpu conv 5x5 batch 4", value) && value == "direct");
+  }
+
+  std::remove(path.c_str());
+}
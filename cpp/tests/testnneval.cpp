@@ -0,0 +1,666 @@
+#include "../tests/tests.h"
+
+#include <fstream>
+
+#include "../core/timer.h"
+#include "../neuralnet/nneval.h"
+#include "../neuralnet/nnremote.h"
+#include "../neuralnet/nnservergroup.h"
+#include "../neuralnet/nnsynthetic.h"
+
+using namespace std;
+
+//An evaluator that needs no model, returning random outputs
+static NNEvaluator* makeNNLessEval(Logger& logger, int nnCacheSizePowerOfTwo, int minBatchFill = 1, double maxBatchWaitMs = 0.0) {
+  vector<int> gpuIdxs = {0};
+  NNEvaluator::Options options;
+  options.minBatchFill = minBatchFill;
+  options.maxBatchWaitMs = maxBatchWaitMs;
+  NNEvaluator* nnEval = new NNEvaluator(
+    "nneval-test",
+    "/dev/null",
+    gpuIdxs,
+    &logger,
+    0, //modelFileIdx
+    8, //maxBatchSize
+    64, //maxConcurrentEvals
+    NNPos::MAX_BOARD_LEN,
+    NNPos::MAX_BOARD_LEN,
+    false, //requireExactNNLen
+    true, //inputsUseNHWC
+    nnCacheSizePowerOfTwo,
+    4, //nnMutexPoolSizePowerOfTwo
+    true, //debugSkipNeuralNet
+    false, //alwaysIncludeOwnerMap
+    1.0f, //nnPolicyTemperature
+    options
+  );
+  return nnEval;
+}
+
+//An evaluator that encodes rows as for a real net, but has them run by the nn server at nnServerSocket, or by a
+//synthetic backend if syntheticNumDevices > 0, or that replays the recording at replayFile
+static NNEvaluator* makeModelFreeEval(
+  Logger& logger, int nnXLen, int nnYLen, const string& nnServerSocket,
+  int syntheticNumDevices, double syntheticBatchLatencyMs, double syntheticRowLatencyMs,
+  const string& recordFile = "", const string& replayFile = "", int replayMissPolicy = NNReplay::MISS_FAIL
+) {
+  vector<int> gpuIdxs = {0};
+  NNEvaluator::Options options;
+  options.nnServerSocket = nnServerSocket;
+  options.syntheticNumDevices = syntheticNumDevices;
+  options.syntheticBatchLatencyMs = syntheticBatchLatencyMs;
+  options.syntheticRowLatencyMs = syntheticRowLatencyMs;
+  options.recordFile = recordFile;
+  options.replayFile = replayFile;
+  options.replayMissPolicy = replayMissPolicy;
+  NNEvaluator* nnEval = new NNEvaluator(
+    "nneval-model-free-test",
+    "",
+    gpuIdxs,
+    &logger,
+    0, //modelFileIdx
+    4, //maxBatchSize
+    64, //maxConcurrentEvals
+    nnXLen,
+    nnYLen,
+    false, //requireExactNNLen
+    true, //inputsUseNHWC
+    -1, //nnCacheSizePowerOfTwo
+    4, //nnMutexPoolSizePowerOfTwo
+    false, //debugSkipNeuralNet
+    false, //alwaysIncludeOwnerMap
+    1.0f, //nnPolicyTemperature
+    options
+  );
+  return nnEval;
+}
+
+static NNEvaluator* startNNLessEval(Logger& logger, int nnCacheSizePowerOfTwo) {
+  NNEvaluator* nnEval = makeNNLessEval(logger, nnCacheSizePowerOfTwo);
+  vector<int> gpuIdxByServerThread = {0};
+  nnEval->spawnServerThreads(1, false, "nneval-test", 0, logger, gpuIdxByServerThread, false, false, false);
+  return nnEval;
+}
+
+static void checkPostprocessed(const NNOutput& output, const Board& board) {
+  double policySum = 0.0;
+  for(int y = 0; y<board.y_size; y++) {
+    for(int x = 0; x<board.x_size; x++) {
+      Loc loc = Location::getLoc(x,y,board.x_size);
+      float prob = output.policyProbs[NNPos::locToPos(loc,board.x_size,output.nnXLen,output.nnYLen)];
+      if(board.colors[loc] != C_EMPTY)
+        testAssert(prob == -1.0f);
+      else {
+        testAssert(prob >= 0.0f);
+        policySum += prob;
+      }
+    }
+  }
+  policySum += output.policyProbs[NNPos::locToPos(Board::PASS_LOC,board.x_size,output.nnXLen,output.nnYLen)];
+  testAssert(std::fabs(policySum - 1.0) < 1e-4);
+  testAssert(std::fabs(output.whiteWinProb + output.whiteLossProb + output.whiteNoResultProb - 1.0) < 1e-4);
+}
+
+void Tests::runNNEvaluatorAsyncTests() {
+  cout << "Running nn evaluator async tests" << endl;
+  NeuralNet::globalInitialize();
+
+  Logger logger;
+  logger.setLogToStdout(false);
+
+  NNEvaluator* nnEval = startNNLessEval(logger, 10);
+  testAssert(nnEval->averageProcessedBatchSize() == 0.0);
+  Rules rules = Rules::getTrompTaylorish();
+
+  //Many evaluations in flight from one thread, each position different except for the last
+  const int numPositions = 20;
+  vector<Board> boards;
+  vector<BoardHistory> hists;
+  for(int i = 0; i<numPositions; i++) {
+    Board board(9,9);
+    board.playMoveAssumeLegal(Location::getLoc(i % 9, i / 9, 9), P_BLACK);
+    boards.push_back(board);
+    hists.push_back(BoardHistory(board,P_WHITE,rules,0));
+  }
+  boards.push_back(boards[0]);
+  hists.push_back(hists[0]);
+
+  NNCompletionQueue completionQueue;
+  vector<NNResultBuf*> bufs;
+  for(int i = 0; i<boards.size(); i++) {
+    bufs.push_back(new NNResultBuf());
+    bool done = nnEval->evaluateAsync(boards[i], hists[i], P_WHITE, 0.0, *bufs[i], completionQueue, false, false);
+    testAssert(!done);
+  }
+  //The duplicate waits on the first, which can't be finished until we finish it below
+  testAssert(nnEval->numCoalescedEvals() == 1);
+
+  std::set<NNResultBuf*> finished;
+  for(int i = 0; i<boards.size(); i++) {
+    NNResultBuf* buf = completionQueue.waitPop();
+    testAssert(finished.count(buf) == 0);
+    finished.insert(buf);
+    testAssert(nnEval->finishAsync(*buf, &logger));
+    testAssert(buf->hasResult && buf->result != nullptr);
+  }
+  testAssert(completionQueue.size() == 0);
+  for(int i = 0; i<boards.size(); i++)
+    checkPostprocessed(*(bufs[i]->result), boards[i]);
+  testAssert(bufs[numPositions]->result == bufs[0]->result);
+
+  //Now everything is cached, so results come back immediately, asynchronously or not
+  for(int i = 0; i<numPositions; i++) {
+    NNResultBuf buf;
+    testAssert(nnEval->evaluateAsync(boards[i], hists[i], P_WHITE, 0.0, buf, completionQueue, false, false));
+    testAssert(buf.result == bufs[i]->result);
+    nnEval->evaluate(boards[i], hists[i], P_WHITE, 0.0, buf, &logger, false, false);
+    testAssert(buf.result == bufs[i]->result);
+  }
+  testAssert(completionQueue.size() == 0);
+
+  //Asking for an owner map that the cached result lacks evaluates again, keeping the policy and value
+  {
+    NNResultBuf buf;
+    testAssert(!nnEval->evaluateAsync(boards[1], hists[1], P_WHITE, 0.0, buf, completionQueue, false, true));
+    testAssert(completionQueue.waitPop() == &buf);
+    testAssert(nnEval->finishAsync(buf, &logger));
+    testAssert(buf.result->whiteOwnerMap != NULL);
+    testAssert(buf.result->whiteWinProb == bufs[1]->result->whiteWinProb);
+    checkPostprocessed(*(buf.result), boards[1]);
+  }
+
+  for(int i = 0; i<bufs.size(); i++)
+    delete bufs[i];
+  delete nnEval;
+}
+
+void Tests::runNNEvaluatorPriorityTests() {
+  cout << "Running nn evaluator priority tests" << endl;
+  NeuralNet::globalInitialize();
+
+  Logger logger;
+  logger.setLogToStdout(false);
+
+  NNEvaluator* nnEval = startNNLessEval(logger, -1);
+  Rules rules = Rules::getTrompTaylorish();
+
+  //A mix of normal and high priority evaluations in flight at once, all of which should come back
+  const int numPositions = 40;
+  vector<Board> boards;
+  vector<BoardHistory> hists;
+  for(int i = 0; i<numPositions; i++) {
+    Board board(9,9);
+    board.playMoveAssumeLegal(Location::getLoc(i % 9, (i / 9) % 9, 9), P_BLACK);
+    boards.push_back(board);
+    hists.push_back(BoardHistory(board,P_WHITE,rules,0));
+  }
+
+  NNCompletionQueue completionQueue;
+  vector<NNResultBuf*> bufs;
+  int numHighPriority = 0;
+  for(int i = 0; i<numPositions; i++) {
+    bufs.push_back(new NNResultBuf());
+    bufs[i]->highPriority = i % 3 == 0;
+    if(bufs[i]->highPriority)
+      numHighPriority++;
+    bool done = nnEval->evaluateAsync(boards[i], hists[i], P_WHITE, 0.0, *bufs[i], completionQueue, true, false);
+    testAssert(!done);
+  }
+  for(int i = 0; i<numPositions; i++) {
+    NNResultBuf* buf = completionQueue.waitPop();
+    testAssert(nnEval->finishAsync(*buf, &logger));
+    testAssert(buf->hasResult && buf->result != nullptr);
+  }
+  for(int i = 0; i<numPositions; i++)
+    checkPostprocessed(*(bufs[i]->result), boards[i]);
+  testAssert(nnEval->numHighPriorityRowsProcessed() == numHighPriority);
+
+  //Synchronous high priority evaluations work too, including more of them at once than the high priority queue holds
+  {
+    const int numThreads = 24;
+    vector<std::thread> threads;
+    for(int t = 0; t<numThreads; t++) {
+      threads.push_back(std::thread([&,t]() {
+        NNResultBuf buf;
+        buf.highPriority = true;
+        for(int i = 0; i<10; i++) {
+          int idx = (t + i * numThreads) % numPositions;
+          Board board = boards[idx];
+          nnEval->evaluate(board, hists[idx], P_WHITE, 0.0, buf, &logger, true, false);
+          testAssert(buf.result != nullptr);
+        }
+      }));
+    }
+    for(int t = 0; t<numThreads; t++)
+      threads[t].join();
+  }
+  testAssert(nnEval->numHighPriorityRowsProcessed() == numHighPriority + 24 * 10);
+
+  for(int i = 0; i<bufs.size(); i++)
+    delete bufs[i];
+  delete nnEval;
+}
+
+void Tests::runNNServerGroupTests() {
+  cout << "Running nn server group tests" << endl;
+  NeuralNet::globalInitialize();
+
+  Logger logger;
+  logger.setLogToStdout(false);
+
+  Rules rules = Rules::getTrompTaylorish();
+  vector<Board> boards;
+  vector<BoardHistory> hists;
+  for(int i = 0; i<30; i++) {
+    Board board(9,9);
+    board.playMoveAssumeLegal(Location::getLoc(i % 9, (i / 9) % 9, 9), P_BLACK);
+    boards.push_back(board);
+    hists.push_back(BoardHistory(board,P_WHITE,rules,0));
+  }
+
+  //Evaluates every position from several threads at once on each evaluator, some of it high priority
+  auto evaluateAll = [&](const vector<NNEvaluator*>& nnEvals) {
+    vector<std::thread> threads;
+    for(int t = 0; t<12; t++) {
+      threads.push_back(std::thread([&,t]() {
+        NNEvaluator* nnEval = nnEvals[t % nnEvals.size()];
+        NNResultBuf buf;
+        buf.highPriority = t % 4 == 0;
+        for(int i = 0; i<boards.size(); i++) {
+          Board board = boards[i];
+          nnEval->evaluate(board, hists[i], P_WHITE, 0.0, buf, &logger, true, false);
+          testAssert(buf.result != nullptr);
+          checkPostprocessed(*buf.result, board);
+        }
+      }));
+    }
+    for(int t = 0; t<threads.size(); t++)
+      threads[t].join();
+  };
+
+  vector<int> gpuIdxByServerThread = {0,0};
+  NNServerGroup* group = new NNServerGroup(gpuIdxByServerThread, 0.0, logger);
+  testAssert(group->getNumServerThreads() == 2);
+
+  NNEvaluator* nnEvalA = makeNNLessEval(logger, -1);
+  NNEvaluator* nnEvalB = makeNNLessEval(logger, -1);
+  nnEvalA->joinServerGroup(*group, false, "a", 0, false, false, false);
+  nnEvalB->joinServerGroup(*group, false, "b", 0, false, false, false);
+  evaluateAll({nnEvalA, nnEvalB});
+  testAssert(group->numBatches() > 0);
+  testAssert(nnEvalA->numHighPriorityRowsProcessed() == 3 * boards.size());
+  testAssert(nnEvalB->numHighPriorityRowsProcessed() == 0);
+
+  //Evaluators can leave and join while the group keeps serving the others
+  delete nnEvalA;
+  evaluateAll({nnEvalB});
+  NNEvaluator* nnEvalC = makeNNLessEval(logger, 10);
+  nnEvalC->joinServerGroup(*group, false, "c", 0, false, false, false);
+  evaluateAll({nnEvalB, nnEvalC});
+
+  //Holding back short batches for a while doesn't lose any rows
+  delete nnEvalB;
+  delete nnEvalC;
+  delete group;
+  group = new NNServerGroup(gpuIdxByServerThread, 1.0, logger);
+  nnEvalA = makeNNLessEval(logger, -1, 8, 1.0);
+  nnEvalB = makeNNLessEval(logger, -1, 8, 1.0);
+  nnEvalA->joinServerGroup(*group, false, "a", 0, false, false, false);
+  nnEvalB->joinServerGroup(*group, false, "b", 0, false, false, false);
+  evaluateAll({nnEvalA, nnEvalB});
+
+  delete nnEvalA;
+  delete nnEvalB;
+  delete group;
+}
+
+void Tests::runNNRemoteTests() {
+  cout << "Running nn remote tests" << endl;
+  NeuralNet::globalInitialize();
+
+  Logger logger;
+  logger.setLogToStdout(false);
+
+  Rules rules = Rules::getTrompTaylorish();
+  vector<Board> boards;
+  vector<BoardHistory> hists;
+  for(int i = 0; i<20; i++) {
+    Board board(9,9);
+    board.playMoveAssumeLegal(Location::getLoc(i % 9, (i / 9) % 9, 9), P_BLACK);
+    boards.push_back(board);
+    hists.push_back(BoardHistory(board,P_WHITE,rules,0));
+  }
+
+  Rand rand;
+  string socketPath = "/tmp/katago-nnremote-test-" + Global::uint64ToHexString(rand.nextUInt64()) + ".sock";
+  vector<int> gpuIdxByServerThread = {0,0};
+  //A server with no model, random outputs as for debugSkipNeuralNet
+  NNRemoteServer* server = new NNRemoteServer(
+    socketPath, "", logger, 16, NNPos::MAX_BOARD_LEN, NNPos::MAX_BOARD_LEN, false, true, true,
+    1, 0.0, gpuIdxByServerThread, false, "nnremote-test", 0, false, false, false, ""
+  );
+
+  //Only one server per socket
+  {
+    bool threw = false;
+    try {
+      NNRemoteServer other(
+        socketPath, "", logger, 16, NNPos::MAX_BOARD_LEN, NNPos::MAX_BOARD_LEN, false, true, true,
+        1, 0.0, gpuIdxByServerThread, false, "nnremote-test", 0, false, false, false, ""
+      );
+    }
+    catch(const StringError&) {
+      threw = true;
+    }
+    testAssert(threw);
+  }
+  //Clients have to agree with the server on the size of the rows
+  {
+    bool threw = false;
+    try {
+      NNEvaluator* nnEval = makeModelFreeEval(logger, 9, 9, socketPath, 0, 0.0, 0.0);
+      delete nnEval;
+    }
+    catch(const StringError&) {
+      threw = true;
+    }
+    testAssert(threw);
+  }
+
+  //Several evaluators, as if in different processes, each evaluating from several threads
+  NNEvaluator* nnEvalA = makeModelFreeEval(logger, NNPos::MAX_BOARD_LEN, NNPos::MAX_BOARD_LEN, socketPath, 0, 0.0, 0.0);
+  NNEvaluator* nnEvalB = makeModelFreeEval(logger, NNPos::MAX_BOARD_LEN, NNPos::MAX_BOARD_LEN, socketPath, 0, 0.0, 0.0);
+  testAssert(nnEvalA->usesNNServer());
+  vector<int> clientGpuIdxByServerThread = {0,0};
+  nnEvalA->spawnServerThreads(2, false, "a", 0, logger, clientGpuIdxByServerThread, false, false, false);
+  nnEvalB->spawnServerThreads(2, false, "b", 0, logger, clientGpuIdxByServerThread, false, false, false);
+
+  int numThreads = 8;
+  vector<std::thread> threads;
+  for(int t = 0; t<numThreads; t++) {
+    threads.push_back(std::thread([&,t]() {
+      NNEvaluator* nnEval = t % 2 == 0 ? nnEvalA : nnEvalB;
+      bool includeOwnerMap = t % 4 < 2;
+      NNResultBuf buf;
+      for(int i = 0; i<boards.size(); i++) {
+        Board board = boards[i];
+        nnEval->evaluate(board, hists[i], P_WHITE, 0.0, buf, &logger, true, includeOwnerMap);
+        testAssert(buf.result != nullptr);
+        checkPostprocessed(*buf.result, board);
+        testAssert((buf.result->whiteOwnerMap != NULL) == includeOwnerMap);
+      }
+    }));
+  }
+  for(int t = 0; t<threads.size(); t++)
+    threads[t].join();
+
+  testAssert(nnEvalA->numRowsProcessed() + nnEvalB->numRowsProcessed() == numThreads * boards.size());
+  testAssert(server->numRowsProcessed() == numThreads * boards.size());
+  testAssert(server->numBatchesProcessed() > 0);
+
+  //The server shuts down even with clients still connected
+  delete server;
+  delete nnEvalA;
+  delete nnEvalB;
+}
+
+void Tests::runNNSyntheticBackendTests() {
+  cout << "Running nn synthetic backend tests" << endl;
+  NeuralNet::globalInitialize();
+
+  Logger logger;
+  logger.setLogToStdout(false);
+
+  //Outputs depend only on the row
+  {
+    int nnXLen = 9;
+    int nnYLen = 9;
+    int rowSpatialLen = 5 * nnXLen * nnYLen;
+    int rowGlobalLen = 3;
+    vector<float> spatial(3 * rowSpatialLen);
+    vector<float> global(3 * rowGlobalLen);
+    for(int i = 0; i<rowSpatialLen; i++) {
+      spatial[i] = (float)(i % 7);
+      spatial[rowSpatialLen + i] = (float)(i % 7);
+      spatial[2 * rowSpatialLen + i] = (float)(i % 5);
+    }
+    vector<shared_ptr<NNOutput>> outputs;
+    vector<NNOutput*> outputBuf;
+    for(int row = 0; row<3; row++) {
+      outputs.push_back(make_shared<NNOutput>());
+      outputs[row]->whiteOwnerMap = row == 0 ? NNOutputPool::allocOwnerMap() : NULL;
+      outputBuf.push_back(outputs[row].get());
+    }
+    NNSyntheticBackend backend(1, 0.0, 0.0, nnXLen, nnYLen);
+    backend.getOutput(spatial.data(), rowSpatialLen, global.data(), rowGlobalLen, 3, outputBuf);
+    testAssert(outputs[0]->whiteWinProb == outputs[1]->whiteWinProb);
+    testAssert(outputs[0]->policyProbs[10] == outputs[1]->policyProbs[10]);
+    testAssert(outputs[0]->whiteWinProb != outputs[2]->whiteWinProb);
+    testAssert(outputs[0]->whiteOwnerMap != NULL);
+    testAssert(backend.numBatches() == 1);
+  }
+
+  //Batches take at least their latency, and wait for a device
+  {
+    NNSyntheticBackend backend(1, 10.0, 1.0, 9, 9);
+    int rowSpatialLen = 81;
+    int rowGlobalLen = 1;
+    ClockTimer timer;
+    vector<std::thread> threads;
+    for(int t = 0; t<3; t++) {
+      threads.push_back(std::thread([&]() {
+        vector<float> spatial(2 * rowSpatialLen);
+        vector<float> global(2 * rowGlobalLen);
+        vector<shared_ptr<NNOutput>> outputs;
+        vector<NNOutput*> outputBuf;
+        for(int row = 0; row<2; row++) {
+          outputs.push_back(make_shared<NNOutput>());
+          outputs[row]->whiteOwnerMap = NULL;
+          outputBuf.push_back(outputs[row].get());
+        }
+        backend.getOutput(spatial.data(), rowSpatialLen, global.data(), rowGlobalLen, 2, outputBuf);
+      }));
+    }
+    for(int t = 0; t<threads.size(); t++)
+      threads[t].join();
+    testAssert(timer.getSeconds() >= 0.036);
+    testAssert(backend.numBatches() == 3);
+    testAssert(backend.totalBusyMs() >= 36.0);
+    testAssert(backend.totalDeviceWaitMs() >= 12.0);
+  }
+
+  //Evaluators using it give the same evaluation to the same position, regardless of how many devices
+  {
+    NNEvaluator* nnEvalA = makeModelFreeEval(logger, 9, 9, "", 1, 0.5, 0.01);
+    NNEvaluator* nnEvalB = makeModelFreeEval(logger, 9, 9, "", 2, 0.0, 0.0);
+    vector<int> gpuIdxByServerThread = {0,0};
+    nnEvalA->spawnServerThreads(2, false, "a", 0, logger, gpuIdxByServerThread, false, false, false);
+    nnEvalB->spawnServerThreads(2, false, "b", 0, logger, gpuIdxByServerThread, false, false, false);
+
+    Rules rules = Rules::getTrompTaylorish();
+    for(int i = 0; i<10; i++) {
+      Board board(9,9);
+      board.playMoveAssumeLegal(Location::getLoc(i % 9, (i / 9) % 9, 9), P_BLACK);
+      BoardHistory hist(board,P_WHITE,rules,0);
+      NNResultBuf bufA;
+      NNResultBuf bufB;
+      nnEvalA->evaluate(board, hist, P_WHITE, 0.0, bufA, &logger, true, true);
+      nnEvalB->evaluate(board, hist, P_WHITE, 0.0, bufB, &logger, true, true);
+      checkPostprocessed(*bufA.result, board);
+      testAssert(bufA.result->whiteWinProb == bufB.result->whiteWinProb);
+      testAssert(bufA.result->whiteScoreMean == bufB.result->whiteScoreMean);
+      for(int pos = 0; pos<NNPos::getPolicySize(9,9); pos++)
+        testAssert(bufA.result->policyProbs[pos] == bufB.result->policyProbs[pos]);
+      testAssert(bufA.result->whiteOwnerMap != NULL);
+    }
+    testAssert(nnEvalA->numRowsProcessed() == 10);
+    delete nnEvalA;
+    delete nnEvalB;
+  }
+}
+
+void Tests::runNNRecordingTests() {
+  cout << "Running nn recording tests" << endl;
+  NeuralNet::globalInitialize();
+
+  Logger logger;
+  logger.setLogToStdout(false);
+
+  string recordFile = "/tmp/katago-nnrecording-test-" + Global::uint64ToHexString(Rand().nextUInt64()) + ".bin";
+  Rules rules = Rules::getTrompTaylorish();
+  const int numPositions = 10;
+  auto makeBoard = [](int i) {
+    Board board(9,9);
+    board.playMoveAssumeLegal(Location::getLoc(i % 9, (i / 9) % 9, 9), P_BLACK);
+    return board;
+  };
+
+  //Record the evaluations of a synthetic net, one of them twice and one of them without ownership
+  vector<shared_ptr<NNOutput>> recorded;
+  {
+    NNEvaluator* nnEval = makeModelFreeEval(logger, 9, 9, "", 1, 0.0, 0.0, recordFile, "");
+    vector<int> gpuIdxByServerThread = {0};
+    nnEval->spawnServerThreads(1, false, "record", 0, logger, gpuIdxByServerThread, false, false, false);
+    for(int i = 0; i<numPositions; i++) {
+      Board board = makeBoard(i);
+      BoardHistory hist(board,P_WHITE,rules,0);
+      NNResultBuf buf;
+      nnEval->evaluate(board, hist, P_WHITE, 0.0, buf, &logger, true, i != 0);
+      recorded.push_back(buf.result);
+    }
+    {
+      Board board = makeBoard(3);
+      BoardHistory hist(board,P_WHITE,rules,0);
+      NNResultBuf buf;
+      nnEval->evaluate(board, hist, P_WHITE, 0.0, buf, &logger, true, true);
+    }
+    testAssert(nnEval->isRecording());
+    testAssert(nnEval->numRecordedEvals() == numPositions);
+    delete nnEval;
+  }
+
+  //Replaying gives the same evaluations, up to fp16 rounding, without running anything
+  {
+    NNEvaluator* nnEval = makeModelFreeEval(logger, 9, 9, "", 0, 0.0, 0.0, "", recordFile, NNReplay::MISS_FAIL);
+    vector<int> gpuIdxByServerThread = {0};
+    nnEval->spawnServerThreads(1, false, "replay", 0, logger, gpuIdxByServerThread, false, false, false);
+    for(int i = 0; i<numPositions; i++) {
+      Board board = makeBoard(i);
+      BoardHistory hist(board,P_WHITE,rules,0);
+      NNResultBuf buf;
+      nnEval->evaluate(board, hist, P_WHITE, 0.0, buf, &logger, true, false);
+      testAssert(std::fabs(buf.result->whiteWinProb - recorded[i]->whiteWinProb) < 1e-3);
+      testAssert(std::fabs(buf.result->whiteScoreMean - recorded[i]->whiteScoreMean) < 1e-2);
+      for(int pos = 0; pos<NNPos::getPolicySize(9,9); pos++)
+        testAssert(std::fabs(buf.result->policyProbs[pos] - recorded[i]->policyProbs[pos]) < 1e-3);
+    }
+    testAssert(nnEval->numReplayLookups() == numPositions);
+    testAssert(nnEval->numReplayHits() == numPositions);
+    testAssert(nnEval->numRowsProcessed() == 0);
+
+    //Ownership was recorded for all but the first
+    {
+      Board board = makeBoard(1);
+      BoardHistory hist(board,P_WHITE,rules,0);
+      NNResultBuf buf;
+      nnEval->evaluate(board, hist, P_WHITE, 0.0, buf, &logger, true, true);
+      testAssert(buf.result->whiteOwnerMap != NULL);
+      testAssert(std::fabs(buf.result->whiteOwnerMap[5] - recorded[1]->whiteOwnerMap[5]) < 1e-2);
+    }
+    bool threw = false;
+    try {
+      Board board = makeBoard(0);
+      BoardHistory hist(board,P_WHITE,rules,0);
+      NNResultBuf buf;
+      nnEval->evaluate(board, hist, P_WHITE, 0.0, buf, &logger, true, true);
+    }
+    catch(const StringError&) {
+      threw = true;
+    }
+    testAssert(threw);
+
+    //As are positions never seen
+    threw = false;
+    try {
+      Board board(9,9);
+      BoardHistory hist(board,P_BLACK,rules,0);
+      NNResultBuf buf;
+      nnEval->evaluate(board, hist, P_BLACK, 0.0, buf, &logger, true, false);
+    }
+    catch(const StringError&) {
+      threw = true;
+    }
+    testAssert(threw);
+    delete nnEval;
+  }
+
+  //Or else are uniform
+  {
+    NNEvaluator* nnEval = makeModelFreeEval(logger, 9, 9, "", 0, 0.0, 0.0, "", recordFile, NNReplay::MISS_UNIFORM);
+    vector<int> gpuIdxByServerThread = {0};
+    nnEval->spawnServerThreads(1, false, "replay", 0, logger, gpuIdxByServerThread, false, false, false);
+    Board board(9,9);
+    board.playMoveAssumeLegal(Location::getLoc(4,4,9), P_BLACK);
+    board.playMoveAssumeLegal(Location::getLoc(3,3,9), P_WHITE);
+    BoardHistory hist(board,P_BLACK,rules,0);
+    NNResultBuf buf;
+    nnEval->evaluate(board, hist, P_BLACK, 0.0, buf, &logger, true, true);
+    checkPostprocessed(*buf.result, board);
+    testAssert(buf.result->policyProbs[NNPos::locToPos(Location::getLoc(0,0,9),9,9,9)] == 1.0f / 80.0f);
+    testAssert(buf.result->whiteWinProb == 0.5f);
+    testAssert(buf.result->whiteOwnerMap != NULL && buf.result->whiteOwnerMap[0] == 0.0f);
+    testAssert(nnEval->numReplayHits() == 0);
+
+    Board recordedBoard = makeBoard(0);
+    BoardHistory recordedHist(recordedBoard,P_WHITE,rules,0);
+    nnEval->evaluate(recordedBoard, recordedHist, P_WHITE, 0.0, buf, &logger, true, true);
+    testAssert(std::fabs(buf.result->whiteWinProb - recorded[0]->whiteWinProb) < 1e-3);
+    testAssert(buf.result->whiteOwnerMap != NULL && buf.result->whiteOwnerMap[0] == 0.0f);
+    testAssert(nnEval->numReplayHits() == 1);
+    delete nnEval;
+  }
+
+  //Recordings are only for the board size they were made at
+  {
+    bool threw = false;
+    try {
+      NNEvaluator* nnEval = makeModelFreeEval(logger, 19, 19, "", 0, 0.0, 0.0, "", recordFile, NNReplay::MISS_FAIL);
+      delete nnEval;
+    }
+    catch(const StringError&) {
+      threw = true;
+    }
+    testAssert(threw);
+  }
+
+  //A file cut short partway through a record, or ending in garbage, replays the records before that
+  {
+    string data;
+    {
+      ifstream in(recordFile, ios::binary);
+      data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    string damagedFile = recordFile + ".damaged";
+    auto replayDamaged = [&](const string& contents) {
+      ofstream out(damagedFile, ios::binary | ios::trunc);
+      out.write(contents.data(), contents.size());
+      out.close();
+      NNReplay replay(damagedFile, &logger);
+      return replay.getNumEntries();
+    };
+    size_t numEntries = replayDamaged(data);
+    testAssert(numEntries == (size_t)numPositions);
+    testAssert(replayDamaged(data.substr(0, data.size() - 5)) == numEntries - 1);
+    testAssert(replayDamaged(data + string(2, '\x07')) == numEntries);
+    //A length that fits but a payload that isn't a valid output
+    uint32_t garbageBytes = 20;
+    testAssert(replayDamaged(data + string((const char*)&garbageBytes, sizeof(garbageBytes)) + string(garbageBytes, '\xff')) == numEntries);
+    //A length past the end of the file
+    garbageBytes = 1000000;
+    testAssert(replayDamaged(data + string((const char*)&garbageBytes, sizeof(garbageBytes)) + string(10, '\0')) == numEntries);
+    std::remove(damagedFile.c_str());
+  }
+
+  std::remove(recordFile.c_str());
+}
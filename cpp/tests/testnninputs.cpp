@@ -643,3 +643,299 @@ xxx..xx
 
   }
 }
+
+void Tests::runCompactNNOutputTests() {
+  cout << "Running compact nn output tests" << endl;
+
+  //Half precision conversions
+  {
+    testAssert(CompactNNOutput::halfToFloat(CompactNNOutput::floatToHalf(0.0f)) == 0.0f);
+    testAssert(CompactNNOutput::halfToFloat(CompactNNOutput::floatToHalf(1.0f)) == 1.0f);
+    testAssert(CompactNNOutput::halfToFloat(CompactNNOutput::floatToHalf(-1.0f)) == -1.0f);
+    testAssert(CompactNNOutput::halfToFloat(CompactNNOutput::floatToHalf(0.375f)) == 0.375f);
+    testAssert(CompactNNOutput::halfToFloat(CompactNNOutput::floatToHalf(65504.0f)) == 65504.0f);
+    testAssert(std::isinf(CompactNNOutput::halfToFloat(CompactNNOutput::floatToHalf(1e6f))));
+    testAssert(std::isnan(CompactNNOutput::halfToFloat(CompactNNOutput::floatToHalf(std::numeric_limits<float>::quiet_NaN()))));
+    //Smallest subnormal, and a value that rounds to it
+    float tiny = (float)std::ldexp(1.0, -24);
+    testAssert(CompactNNOutput::halfToFloat(CompactNNOutput::floatToHalf(tiny)) == tiny);
+    testAssert(CompactNNOutput::halfToFloat(CompactNNOutput::floatToHalf(tiny * 1.3f)) == tiny);
+    //Ties round to even
+    testAssert(CompactNNOutput::floatToHalf(1.0f + (float)std::ldexp(1.0, -11)) == CompactNNOutput::floatToHalf(1.0f));
+
+    Rand rand("compact nn output tests half");
+    for(int i = 0; i<10000; i++) {
+      float f = (float)rand.nextDouble();
+      float g = CompactNNOutput::halfToFloat(CompactNNOutput::floatToHalf(f));
+      testAssert(std::fabs(f - g) <= std::max(std::fabs(f) * (float)std::ldexp(1.0, -11), (float)std::ldexp(1.0, -25)));
+    }
+  }
+
+  auto makeOutput = [](Rand& rand, int nnXLen, int nnYLen, int boardXSize, int boardYSize) {
+    NNOutput output;
+    output.nnHash = Hash128(rand.nextUInt64(), rand.nextUInt64());
+    output.whiteWinProb = 0.6f;
+    output.whiteLossProb = 0.3f;
+    output.whiteNoResultProb = 0.1f;
+    output.whiteScoreMean = 3.7f;
+    output.whiteScoreMeanSq = 51.3f;
+    output.nnXLen = nnXLen;
+    output.nnYLen = nnYLen;
+    std::fill(output.policyProbs, output.policyProbs + NNPos::MAX_NN_POLICY_SIZE, -1.0f);
+    output.whiteOwnerMap = NNOutputPool::allocOwnerMap();
+    std::fill(output.whiteOwnerMap, output.whiteOwnerMap + nnXLen * nnYLen, 0.0f);
+    double sum = 0.0;
+    for(int y = 0; y<boardYSize; y++) {
+      for(int x = 0; x<boardXSize; x++) {
+        int pos = NNPos::xyToPos(x,y,nnXLen);
+        output.whiteOwnerMap[pos] = (float)(rand.nextDouble() * 2.0 - 1.0);
+        if(rand.nextBool(0.8)) {
+          output.policyProbs[pos] = (float)(rand.nextDouble() * rand.nextDouble() * rand.nextDouble());
+          sum += output.policyProbs[pos];
+        }
+      }
+    }
+    int passPos = NNPos::locToPos(Board::PASS_LOC,boardXSize,nnXLen,nnYLen);
+    output.policyProbs[passPos] = 0.01f;
+    sum += output.policyProbs[passPos];
+    for(int pos = 0; pos<NNPos::MAX_NN_POLICY_SIZE; pos++) {
+      if(output.policyProbs[pos] >= 0)
+        output.policyProbs[pos] = (float)(output.policyProbs[pos] / sum);
+    }
+    return output;
+  };
+
+  auto checkValues = [](const NNOutput& a, const NNOutput& b) {
+    testAssert(a.nnHash == b.nnHash);
+    testAssert(a.whiteWinProb == b.whiteWinProb);
+    testAssert(a.whiteLossProb == b.whiteLossProb);
+    testAssert(a.whiteNoResultProb == b.whiteNoResultProb);
+    testAssert(a.whiteScoreMean == b.whiteScoreMean);
+    testAssert(a.whiteScoreMeanSq == b.whiteScoreMeanSq);
+    testAssert(a.nnXLen == b.nnXLen);
+    testAssert(a.nnYLen == b.nnYLen);
+  };
+
+  //Dense fp16 policy, on a board smaller than the net's buffers
+  {
+    Rand rand("compact nn output tests dense");
+    int nnXLen = 19;
+    int nnYLen = 19;
+    NNOutput output = makeOutput(rand,nnXLen,nnYLen,9,9);
+    CompactNNOutput compact(output,9,9,0);
+    testAssert(compact.hasOwnerMap());
+    testAssert(compact.getNumBytes() * 8 < sizeof(NNOutput) + sizeof(float) * nnXLen * nnYLen);
+
+    NNOutput result;
+    compact.decompress(result);
+    checkValues(output,result);
+    for(int pos = 0; pos<NNPos::MAX_NN_POLICY_SIZE; pos++) {
+      if(output.policyProbs[pos] < 0)
+        testAssert(result.policyProbs[pos] < 0);
+      else
+        testAssert(std::fabs(output.policyProbs[pos] - result.policyProbs[pos]) <= output.policyProbs[pos] * 1e-3 + 1e-7);
+    }
+    testAssert(result.whiteOwnerMap != NULL);
+    for(int pos = 0; pos<nnXLen*nnYLen; pos++)
+      testAssert(std::fabs(output.whiteOwnerMap[pos] - result.whiteOwnerMap[pos]) <= 0.5f / 127.0f + 1e-6f);
+
+    //Decompressing again into the same output, and without an owner map
+    output.nnHash = Hash128(1,2);
+    NNOutputPool::freeOwnerMap(output.whiteOwnerMap);
+    output.whiteOwnerMap = NULL;
+    CompactNNOutput compact2(output,9,9,0);
+    testAssert(!compact2.hasOwnerMap());
+    compact2.decompress(result);
+    checkValues(output,result);
+    testAssert(result.whiteOwnerMap == NULL);
+  }
+
+  //Sparse top moves on a full size board
+  {
+    Rand rand("compact nn output tests topk");
+    int nnXLen = 19;
+    int nnYLen = 19;
+    int topK = 8;
+    NNOutput output = makeOutput(rand,nnXLen,nnYLen,19,19);
+    CompactNNOutput dense(output,19,19,0);
+    CompactNNOutput compact(output,19,19,topK);
+    testAssert(dense.getNumBytes() * 2 < sizeof(NNOutput) + sizeof(float) * nnXLen * nnYLen);
+    testAssert(compact.getNumBytes() * 4 < sizeof(NNOutput) + sizeof(float) * nnXLen * nnYLen);
+
+    vector<float> sorted;
+    for(int pos = 0; pos<NNPos::MAX_NN_POLICY_SIZE; pos++) {
+      if(output.policyProbs[pos] >= 0)
+        sorted.push_back(output.policyProbs[pos]);
+    }
+    std::sort(sorted.begin(), sorted.end(), std::greater<float>());
+    float threshold = sorted[topK-1];
+
+    shared_ptr<NNOutput> result = compact.decompress();
+    checkValues(output,*result);
+    double sum = 0.0;
+    float remainder = -1.0f;
+    for(int pos = 0; pos<NNPos::MAX_NN_POLICY_SIZE; pos++) {
+      if(output.policyProbs[pos] < 0) {
+        testAssert(result->policyProbs[pos] < 0);
+        continue;
+      }
+      sum += result->policyProbs[pos];
+      if(output.policyProbs[pos] >= threshold)
+        testAssert(std::fabs(output.policyProbs[pos] - result->policyProbs[pos]) <= output.policyProbs[pos] * 1e-3);
+      else {
+        if(remainder < 0)
+          remainder = result->policyProbs[pos];
+        testAssert(result->policyProbs[pos] == remainder);
+        testAssert(remainder < threshold);
+      }
+    }
+    testAssert(std::fabs(sum - 1.0) < 1e-4);
+  }
+}
+
+void Tests::runNNSymmetryTests() {
+  cout << "Running nn symmetry tests" << endl;
+
+  //Playing out the same game in every orientation should give the same canonical hash throughout
+  auto runGames = [](int xSize, int ySize, const Rules& rules, int encorePhase, const string& seed) {
+    Rand rand("nn symmetry tests " + seed);
+    for(int game = 0; game<20; game++) {
+      vector<Board> boards;
+      vector<BoardHistory> hists;
+      vector<int> symmetries;
+      for(int s = 0; s<NNSymmetry::NUM_SYMMETRIES; s++) {
+        if(!NNSymmetry::isValid(s,xSize,ySize))
+          continue;
+        Board board(xSize,ySize);
+        boards.push_back(board);
+        hists.push_back(BoardHistory(board,P_BLACK,rules,encorePhase));
+        symmetries.push_back(s);
+      }
+      testAssert(symmetries.size() == (xSize == ySize ? 8 : 4));
+
+      Player pla = P_BLACK;
+      for(int turn = 0; turn<xSize*ySize; turn++) {
+        //Pick a random legal move in the original orientation
+        Loc loc = Board::NULL_LOC;
+        for(int tries = 0; tries<50; tries++) {
+          Loc candidate = Location::getLoc((int)rand.nextUInt(xSize),(int)rand.nextUInt(ySize),xSize);
+          if(hists[0].isLegal(boards[0],candidate,pla)) {
+            loc = candidate;
+            break;
+          }
+        }
+        if(loc == Board::NULL_LOC)
+          break;
+        int x = Location::getX(loc,xSize);
+        int y = Location::getY(loc,xSize);
+        for(size_t i = 0; i<symmetries.size(); i++) {
+          int symX;
+          int symY;
+          NNSymmetry::getSymXY(x,y,xSize,ySize,symmetries[i],symX,symY);
+          Loc symLoc = Location::getLoc(symX,symY,xSize);
+          testAssert(hists[i].isLegal(boards[i],symLoc,pla));
+          hists[i].makeBoardMoveAssumeLegal(boards[i],symLoc,pla,NULL);
+        }
+        pla = getOpp(pla);
+
+        Hash128 canonicalHash;
+        for(size_t i = 0; i<symmetries.size(); i++) {
+          Hash128 nnHash = NNInputs::getHashV5(boards[i],hists[i],pla,0.5);
+          int symmetry;
+          Hash128 hash = NNSymmetry::getCanonicalHash(nnHash,boards[i],hists[i],symmetry);
+          testAssert(NNSymmetry::isValid(symmetry,xSize,ySize));
+          if(i == 0) {
+            canonicalHash = hash;
+            testAssert(hash == nnHash || hash < nnHash);
+            //The hash of the position under the chosen symmetry really is the canonical one
+            for(size_t j = 0; j<symmetries.size(); j++) {
+              if(symmetries[j] == symmetry)
+                testAssert(NNInputs::getHashV5(boards[j],hists[j],pla,0.5) == hash);
+            }
+          }
+          else
+            testAssert(hash == canonicalHash);
+        }
+
+        //And it still distinguishes different positions
+        Board other = boards[0];
+        BoardHistory otherHist = hists[0];
+        int symmetry;
+        Hash128 otherHash;
+        if(otherHist.isLegal(other,Board::PASS_LOC,pla)) {
+          otherHist.makeBoardMoveAssumeLegal(other,Board::PASS_LOC,pla,NULL);
+          otherHash = NNSymmetry::getCanonicalHash(NNInputs::getHashV5(other,otherHist,getOpp(pla),0.5),other,otherHist,symmetry);
+          testAssert(otherHash != canonicalHash);
+        }
+      }
+    }
+  };
+  runGames(9,9,Rules::getTrompTaylorish(),0,"a");
+  runGames(7,5,Rules::getTrompTaylorish(),0,"b");
+  runGames(6,6,Rules::getSimpleTerritory(),1,"c");
+  runGames(5,4,Rules::getSimpleTerritory(),2,"d");
+
+  //Transforming an output there and back gives it back exactly
+  {
+    Rand rand("nn symmetry tests outputs");
+    int nnXLen = 9;
+    int nnYLen = 9;
+    int sizes[3][2] = {{9,9},{7,7},{9,5}};
+    for(int i = 0; i<3; i++) {
+      int boardXSize = sizes[i][0];
+      int boardYSize = sizes[i][1];
+      NNOutput output;
+      output.nnHash = Hash128(rand.nextUInt64(), rand.nextUInt64());
+      output.whiteWinProb = 0.6f;
+      output.whiteLossProb = 0.3f;
+      output.whiteNoResultProb = 0.1f;
+      output.whiteScoreMean = 3.7f;
+      output.whiteScoreMeanSq = 51.3f;
+      output.nnXLen = nnXLen;
+      output.nnYLen = nnYLen;
+      std::fill(output.policyProbs, output.policyProbs + NNPos::MAX_NN_POLICY_SIZE, -1.0f);
+      output.whiteOwnerMap = NNOutputPool::allocOwnerMap();
+      std::fill(output.whiteOwnerMap, output.whiteOwnerMap + nnXLen * nnYLen, 0.0f);
+      for(int y = 0; y<boardYSize; y++) {
+        for(int x = 0; x<boardXSize; x++) {
+          int pos = NNPos::xyToPos(x,y,nnXLen);
+          output.whiteOwnerMap[pos] = (float)(rand.nextDouble() * 2.0 - 1.0);
+          output.policyProbs[pos] = rand.nextBool(0.8) ? (float)rand.nextDouble() : -1.0f;
+        }
+      }
+      output.policyProbs[NNPos::locToPos(Board::PASS_LOC,boardXSize,nnXLen,nnYLen)] = 0.01f;
+
+      for(int s = 0; s<NNSymmetry::NUM_SYMMETRIES; s++) {
+        if(!NNSymmetry::isValid(s,boardXSize,boardYSize))
+          continue;
+        NNOutput transformed;
+        transformed.whiteOwnerMap = NULL;
+        NNSymmetry::transformOutput(output,transformed,boardXSize,boardYSize,s,false);
+        //A corner point goes to the corresponding corner
+        int symX;
+        int symY;
+        NNSymmetry::getSymXY(0,0,boardXSize,boardYSize,s,symX,symY);
+        testAssert(transformed.policyProbs[NNPos::xyToPos(symX,symY,nnXLen)] == output.policyProbs[NNPos::xyToPos(0,0,nnXLen)]);
+        testAssert(transformed.whiteOwnerMap[NNPos::xyToPos(symX,symY,nnXLen)] == output.whiteOwnerMap[NNPos::xyToPos(0,0,nnXLen)]);
+
+        NNOutput back;
+        back.whiteOwnerMap = NULL;
+        NNSymmetry::transformOutput(transformed,back,boardXSize,boardYSize,s,true);
+        testAssert(back.nnHash == output.nnHash);
+        testAssert(back.whiteWinProb == output.whiteWinProb);
+        testAssert(back.whiteScoreMeanSq == output.whiteScoreMeanSq);
+        for(int pos = 0; pos<NNPos::MAX_NN_POLICY_SIZE; pos++)
+          testAssert(back.policyProbs[pos] == output.policyProbs[pos]);
+        for(int pos = 0; pos<nnXLen*nnYLen; pos++)
+          testAssert(back.whiteOwnerMap[pos] == output.whiteOwnerMap[pos]);
+
+        //Outputs without owner maps stay that way
+        NNOutput noOwnerMap(output);
+        NNOutputPool::freeOwnerMap(noOwnerMap.whiteOwnerMap);
+        noOwnerMap.whiteOwnerMap = NULL;
+        NNSymmetry::transformOutput(noOwnerMap,back,boardXSize,boardYSize,s,true);
+        testAssert(back.whiteOwnerMap == NULL);
+      }
+    }
+  }
+}
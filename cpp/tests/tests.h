@@ -31,6 +31,8 @@ namespace Tests {
 
   //testnninputs.cpp
   void runNNInputsV3V4Tests();
+  void runCompactNNOutputTests();
+  void runNNSymmetryTests();
 
   //testsearch.cpp
   void runNNLessSearchTests();
@@ -47,6 +49,26 @@ namespace Tests {
 
   //testnn.cpp
   void runNNLayerTests();
+  void runNNModelBinaryTests();
+
+  //testbatchqueue.cpp
+  void runLockFreeBatchQueueTests();
+  void runBatchQueueBenchmark(int numConsumers, int batchSize, int computeMicros, double seconds);
+
+  //testnncache.cpp
+  void runNNCacheTableTests();
+  void runNNInFlightTableTests();
+  void runNNDiskCacheTests();
+  void runNNSharedCacheTests();
+  void runNNTuneCacheTests();
+
+  //testnneval.cpp
+  void runNNEvaluatorAsyncTests();
+  void runNNEvaluatorPriorityTests();
+  void runNNServerGroupTests();
+  void runNNRemoteTests();
+  void runNNSyntheticBackendTests();
+  void runNNRecordingTests();
 }
 
 namespace TestCommon {
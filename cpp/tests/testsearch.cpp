@@ -136,7 +136,8 @@ static NNEvaluator* startNNEval(
     nnMutexPoolSizePowerOfTwo,
     debugSkipNeuralNet,
     alwaysIncludeOwnerMap,
-    nnPolicyTemperature
+    nnPolicyTemperature,
+    NNEvaluator::Options()
   );
   (void)inputsUseNHWC;
 
@@ -155,6 +156,7 @@ static NNEvaluator* startNNEval(
     logger,
     gpuIdxByServerThread,
     useFP16,
+    false,
     cudaUseNHWC
   );
 
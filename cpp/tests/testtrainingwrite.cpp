@@ -41,7 +41,8 @@ static NNEvaluator* startNNEval(
     nnMutexPoolSizePowerOfTwo,
     debugSkipNeuralNet,
     alwaysIncludeOwnerMap,
-    nnPolicyTemperature
+    nnPolicyTemperature,
+    NNEvaluator::Options()
   );
   (void)inputsUseNHWC;
 
@@ -56,6 +57,7 @@ static NNEvaluator* startNNEval(
     logger,
     gpuIdxByServerThread,
     useFP16,
+    false,
     cudaUseNHWC
   );
 